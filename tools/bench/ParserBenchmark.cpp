@@ -0,0 +1,576 @@
+// Throughput benchmark for AnsiParser::Parse feeding a TerminalBuffer.
+//
+//     ./wrt_parser_benchmark [--iterations N] [--scale F] [--chunk BYTES] [--filter NAME]
+//
+// Each workload is a synthetic stream shaped like a common kind of terminal output. It is fed in
+// chunks the size of a typical PTY read, and the best of N passes is reported as MB/s and ns/byte.
+// "B/line" is what the scrollback spends per history line, index included, and "ratio" how much
+// its cold chunks compress. "dec us" is the mean time to decompress a chunk while reading the
+// whole history back from newest to oldest, the way scrolling up would.
+//
+// The last columns look at the final screen: "B/cell" is what the snapshot spends per cell with
+// text and style spans kept apart (one Cell per position is 8 bytes), and "plan ns" / "cell ns"
+// the time to list the style runs a renderer draws, from the spans and by comparing every cell.
+// "full us" is a capture that rebuilds every snapshot row, "snap us" the mean capture after one
+// more line of output, which only rebuilds the rows that changed.
+//
+// "resize us" is narrowing the screen by a quarter, which rewraps the screen but not the history,
+// and "rewrap ns" what rewrapping the history afterwards costs per line, done in the background.
+//
+// The search table runs after the workloads (or alone with --filter search) over a history of
+// SEARCH_LINES build log lines, times --scale, with the index finished: "first ms" is the time to the first match, "total ms"
+// to the end of the search, and "skipped" the blocks ruled out without being read. The "typing"
+// row is the mean per keystroke while a query is typed one character at a time.
+//
+// The print table (after the workloads, or alone with --filter print) parses every workload twice:
+// "per-char" writes each printable character on its own, the way PrintChar did before runs of them
+// went to PrintString, and "runs" is the normal path.
+//
+// Last, a stream of SGR, cursor and erase sequences is parsed once to warm up and then again while
+// a global operator new counts allocations. In steady state a sequence must not allocate; the
+// benchmark fails if one does.
+#include "AnsiParser.h"
+#include "ScreenSnapshot.h"
+#include "ScrollbackSearch.h"
+#include "TerminalBuffer.h"
+#include "TerminalWorker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace winrt::win_retro_term::Core;
+
+namespace
+{
+    std::atomic<uint64_t> g_allocations{ 0 };
+}
+
+// Every allocation in the process is counted, so the sequence check sees any heap traffic
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size != 0 ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+namespace
+{
+    const int SCREEN_ROWS = 50;
+    const int SCREEN_COLS = 160;
+    const size_t BASE_WORKLOAD_BYTES = 8 * 1024 * 1024;
+
+    struct Workload {
+        const char* name;
+        const char* description;
+        std::string data;
+    };
+
+    // Appends 'unit' produced by 'generate' until the stream reaches 'targetBytes'
+    template <typename Generator>
+    std::string Repeat(size_t targetBytes, Generator generate)
+    {
+        std::string data;
+        data.reserve(targetBytes + 4096);
+        for (size_t i = 0; data.size() < targetBytes; ++i) {
+            generate(data, i);
+        }
+        return data;
+    }
+
+    std::vector<Workload> BuildWorkloads(double scale)
+    {
+        size_t target = std::max<size_t>(4096, static_cast<size_t>(BASE_WORKLOAD_BYTES * scale));
+        std::vector<Workload> workloads;
+        char line[256];
+
+        workloads.push_back({ "plain", "ASCII log lines, no escapes", Repeat(target, [&](std::string& out, size_t i) {
+            std::snprintf(line, sizeof(line), "2024-05-01 12:%02zu:%02zu INFO worker[%zu] processed request id=%zu in %zu ms\r\n",
+                (i / 60) % 60, i % 60, i % 16, i * 7919, i % 250);
+            out += line;
+        }) });
+
+        workloads.push_back({ "ls-color", "short lines with 16/256-color SGR", Repeat(target, [&](std::string& out, size_t i) {
+            switch (i % 3) {
+            case 0: out += "\x1b[01;34mdirectory_name\x1b[0m\r\n"; break;
+            case 1: out += "\x1b[01;32mexec.sh\x1b[0m  \x1b[00mfile.txt\x1b[0m\r\n"; break;
+            default: out += "\x1b[38;5;208mfoo.c\x1b[0m\r\n"; break;
+            }
+        }) });
+
+        workloads.push_back({ "htop", "cursor-addressed full-screen redraws", Repeat(target, [&](std::string& out, size_t i) {
+            int row = static_cast<int>(i % SCREEN_ROWS) + 1;
+            std::snprintf(line, sizeof(line), "\x1b[%d;1H\x1b[30;42m%6zu \x1b[0m\x1b[1;36mproc%03d\x1b[m  %4.1f %4.1f /usr/bin/thing --flag\x1b[K",
+                row, i * 7 % 99991, row, (i % 1000) / 10.0, (i % 333) / 10.0);
+            out += line;
+        }) });
+
+        workloads.push_back({ "truecolor", "24-bit SGR on every character", Repeat(target, [&](std::string& out, size_t i) {
+            for (int c = 0; c < 80; ++c) {
+                std::snprintf(line, sizeof(line), "\x1b[38;2;%d;%d;%dm%c", (c * 3 + static_cast<int>(i)) & 0xFF, (c * 5) & 0xFF, (255 - c) & 0xFF, 'a' + c % 26);
+                out += line;
+            }
+            out += "\x1b[0m\r\n";
+        }) });
+
+        workloads.push_back({ "unicode", "UTF-8 box drawing and CJK text", Repeat(target, [&](std::string& out, size_t i) {
+            out += (i % 2 == 0)
+                ? "\xe2\x94\x82 \xe4\xb8\xad\xe6\x96\x87\xe6\xb5\x8b\xe8\xaf\x95 \xe2\x94\x82 caf\xc3\xa9 na\xc3\xaf" "ve \xe2\x94\x82 \xce\xb1\xce\xb2\xce\xb3 \xe2\x94\x82\r\n"
+                : "\xe2\x94\x9c\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\xbc\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\xa4\r\n";
+        }) });
+
+        workloads.push_back({ "mixed", "mixed scripts: Latin, CJK, combining marks, emoji ZWJ sequences, flags", Repeat(target, [&](std::string& out, size_t i) {
+            switch (i % 4) {
+            case 0: out += "build ok \xe6\x9e\x84\xe5\xbb\xba\xe6\x88\x90\xe5\x8a\x9f \xef\xbc\x88\xef\xbc\x93\xef\xbc\x89 in 42 ms\r\n"; break;
+            case 1: out += "Cafe\xcc\x81 s\xcc\x8c" "e\xcc\x81" "ance, \xe1\x84\x92\xe1\x85\xa1\xe1\x86\xab \xed\x95\x9c\xea\xb5\xad\xec\x96\xb4 r\xc3\xa9sum\xc3\xa9\r\n"; break;
+            case 2: out += "deploy \xf0\x9f\x9a\x80 by \xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x92\xbb and \xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd \xe2\x9c\x94\xef\xb8\x8f done\r\n"; break;
+            default: out += "regions \xf0\x9f\x87\xaf\xf0\x9f\x87\xb5 \xf0\x9f\x87\xa9\xf0\x9f\x87\xaa \xf0\x9f\x87\xba\xf0\x9f\x87\xb8 latency p99 12.5 ms\r\n"; break;
+            }
+        }) });
+
+        workloads.push_back({ "hyperlinks", "OSC 8 links and OSC 0 titles", Repeat(target, [&](std::string& out, size_t i) {
+            if (i % 64 == 0) {
+                std::snprintf(line, sizeof(line), "\x1b]0;build step %zu\x07", i / 64);
+                out += line;
+            }
+            std::snprintf(line, sizeof(line), "\x1b]8;;file:///home/user/src/module%zu/file%zu.cpp\x1b\\file%zu.cpp\x1b]8;;\x1b\\\r\n", i % 32, i % 512, i % 512);
+            out += line;
+        }) });
+
+        workloads.push_back({ "clear", "clear loop: erase the screen, then a few lines", Repeat(target, [&](std::string& out, size_t i) {
+            std::snprintf(line, sizeof(line), "\x1b[H\x1b[2J$ make\r\nbuilding target %zu\r\ndone\r\n", i);
+            out += line;
+        }) });
+
+        workloads.push_back({ "watch", "watch-style refresh: header, a short table, erase below", Repeat(target, [&](std::string& out, size_t i) {
+            std::snprintf(line, sizeof(line), "\x1b[H\x1b[KEvery 2.0s: uptime\r\n\r\n\x1b[K load %zu.%02zu\r\n\x1b[K users %zu\x1b[J", i % 8, i % 100, i % 5);
+            out += line;
+        }) });
+
+        workloads.push_back({ "altscreen", "pager entering and leaving the alternate screen", Repeat(target, [&](std::string& out, size_t i) {
+            std::snprintf(line, sizeof(line), "\x1b[?1049h\x1b[H\x1b[7m page %zu \x1b[m\x1b[2;1Hsome text\x1b[?1049l$ less file%zu\r\n", i, i % 100);
+            out += line;
+        }) });
+
+        return workloads;
+    }
+
+    struct Result {
+        double bestSeconds = 0;
+        double meanSeconds = 0;
+        uint64_t checksum = 0;
+        double historyBytesPerLine = 0;
+        double compressionRatio = 1;
+        double decompressMicroseconds = 0;
+        double snapshotBytesPerCell = 0;
+        double spanPlanNanoseconds = 0;
+        double cellPlanNanoseconds = 0;
+        double fullCaptureMicroseconds = 0;
+        double captureMicroseconds = 0;
+        double resizeMicroseconds = 0;
+        double rewrapNanosecondsPerLine = 0;
+        double rewrapPeakMemory = 0;        // History RAM at its highest during the rewrap, over what it was before
+    };
+
+    const int PLAN_PASSES = 200;
+
+    void PlanFromSpans(const ScreenSnapshot& snapshot, std::vector<StyleSpan>& runs)
+    {
+        runs.clear();
+        for (int r = 0; r < snapshot.rows; ++r) {
+            std::span<const StyleSpan> spans = snapshot.Spans(r);
+            runs.insert(runs.end(), spans.begin(), spans.end());
+        }
+    }
+
+    void PlanFromCells(const std::vector<Cell>& cells, int rows, int cols, std::vector<StyleSpan>& runs)
+    {
+        runs.clear();
+        for (int r = 0; r < rows; ++r) {
+            const Cell* row = cells.data() + static_cast<size_t>(r) * cols;
+            runs.push_back({ 1, row[0].style });
+            for (int c = 1; c < cols; ++c) {
+                if (row[c].style == runs.back().style) {
+                    ++runs.back().length;
+                }
+                else {
+                    runs.push_back({ 1, row[c].style });
+                }
+            }
+        }
+    }
+
+    // Nanoseconds per call of 'plan', averaged over PLAN_PASSES
+    template <typename Plan>
+    double TimePlan(Plan plan)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < PLAN_PASSES; ++pass) {
+            plan();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / PLAN_PASSES;
+    }
+
+    void MeasurePlans(const ScreenSnapshot& snapshot, Result& result)
+    {
+        size_t cellCount = static_cast<size_t>(snapshot.rows) * snapshot.cols;
+        size_t bytes = 0;
+        for (int r = 0; r < snapshot.rows; ++r) {
+            bytes += snapshot.cols * sizeof(char32_t) + snapshot.Spans(r).size() * sizeof(StyleSpan);
+        }
+        result.snapshotBytesPerCell = static_cast<double>(bytes) / cellCount;
+
+        // The same screen as one Cell per position
+        std::vector<Cell> cells(cellCount);
+        for (int r = 0; r < snapshot.rows; ++r) {
+            size_t column = static_cast<size_t>(r) * snapshot.cols;
+            const char32_t* text = snapshot.Text(r);
+            for (const StyleSpan& span : snapshot.Spans(r)) {
+                for (uint32_t i = 0; i < span.length; ++i, ++column, ++text) {
+                    cells[column] = { *text, span.style };
+                }
+            }
+        }
+
+        std::vector<StyleSpan> runs;
+        result.spanPlanNanoseconds = TimePlan([&] { PlanFromSpans(snapshot, runs); });
+        size_t spanRuns = runs.size();
+        result.cellPlanNanoseconds = TimePlan([&] { PlanFromCells(cells, snapshot.rows, snapshot.cols, runs); });
+        if (runs.size() != spanRuns) {
+            std::fprintf(stderr, "wrt_parser_benchmark: %zu runs from spans but %zu from cells\n", spanRuns, runs.size());
+        }
+    }
+
+    // Captures the way the worker does, into the oldest of three snapshots, after a line of output each
+    void MeasureCaptures(TerminalBuffer& buffer, AnsiParser& parser, Result& result)
+    {
+        ScreenSnapshot snapshots[3];
+        static const char line[] = "\x1b[32mok\x1b[m one more line of output\r\n";
+        double total = 0;
+        for (int pass = 0; pass < PLAN_PASSES; ++pass) {
+            parser.Parse(line, sizeof(line) - 1);
+            auto start = std::chrono::steady_clock::now();
+            buffer.CaptureSnapshot(snapshots[pass % 3]);
+            total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        result.captureMicroseconds = total / PLAN_PASSES;
+    }
+
+    // Leaves the buffer narrower than SCREEN_COLS
+    void MeasureResize(TerminalBuffer& buffer, Result& result)
+    {
+        auto start = std::chrono::steady_clock::now();
+        buffer.Resize(SCREEN_ROWS, SCREEN_COLS * 3 / 4);
+        auto resized = std::chrono::steady_clock::now();
+        result.resizeMicroseconds = std::chrono::duration<double, std::micro>(resized - start).count();
+
+        size_t lines = buffer.GetScrollback().LineCount();
+        size_t memory = buffer.HistoryMemoryUsage();
+        size_t peak = memory;
+        while (buffer.ContinueHistoryReflow(TerminalWorker::HISTORY_REFLOW_LINES)) {
+            peak = std::max(peak, buffer.HistoryMemoryUsage());
+        }
+        double rewrap = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - resized).count();
+        result.rewrapNanosecondsPerLine = lines != 0 ? rewrap / lines : 0;
+        result.rewrapPeakMemory = memory != 0 ? static_cast<double>(peak) / memory : 1;
+    }
+
+    const size_t SEARCH_LINES = 1000000;
+
+    struct SearchTiming {
+        double firstMilliseconds = 0;
+        double totalMilliseconds = 0;
+        SearchProgress progress;
+    };
+
+    SearchTiming TimeSearch(ScrollbackSearch& search, const std::vector<std::shared_ptr<const SearchBlock>>& blocks, std::u32string_view query)
+    {
+        SearchTiming timing;
+        std::vector<SearchMatch> matches;
+        auto start = std::chrono::steady_clock::now();
+        search.Start(blocks, 0, query, false);
+        while (search.TakeMatches(matches) == 0 && !search.Progress().done) {
+            std::this_thread::yield(); // The pool may have no core to itself
+        }
+        timing.firstMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        search.Wait();
+        timing.totalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        timing.progress = search.Progress();
+        return timing;
+    }
+
+    void PrintSearch(const char* name, const SearchTiming& timing)
+    {
+        std::printf("%-24s %10.2f %10.2f %10zu %10zu %10zu\n", name, timing.firstMilliseconds, timing.totalMilliseconds,
+            timing.progress.matches, timing.progress.blocksSkipped, timing.progress.blocks);
+    }
+
+    // A build log: compile lines, a warning every 50 lines, and one linker error early on
+    void RunSearch(double scale)
+    {
+        size_t lineCount = std::max<size_t>(10000, static_cast<size_t>(SEARCH_LINES * scale));
+        Scrollback history(SIZE_MAX, 0);
+        StyleTable styles;
+        std::vector<char32_t> text;
+        char line[256];
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lineCount; ++i) {
+            if (i == lineCount / 20) {
+                std::snprintf(line, sizeof(line), "src/module03/linker_glue.cpp:88: error: undefined reference to `frobnicate_widget(int)'");
+            }
+            else if (i % 50 == 0) {
+                std::snprintf(line, sizeof(line), "src/module%02zu/source_file_%05zu.cpp:%zu:%zu: warning: unused variable 'tmp_%zu' [-Wunused-variable]",
+                    i % 37, i % 9973, i % 400, i % 80, i);
+            }
+            else {
+                std::snprintf(line, sizeof(line), "[%3zu%%] Building CXX object src/module%02zu/CMakeFiles/mod%02zu.dir/source_file_%05zu.cpp.o",
+                    i * 100 / lineCount, i % 37, i % 37, i % 9973);
+            }
+            text.assign(line, line + std::strlen(line));
+            StyleSpan span = { static_cast<uint32_t>(text.size()), StyleTable::DEFAULT_STYLE };
+            history.PushLine(text, { &span, 1 }, styles);
+        }
+        auto pushed = std::chrono::steady_clock::now();
+        double pushNanoseconds = std::chrono::duration<double, std::nano>(pushed - start).count() / lineCount;
+        while (history.FinishSearchIndex(TerminalWorker::SEARCH_INDEX_BLOCKS)) {
+        }
+        double finishNanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - pushed).count() / lineCount;
+
+        std::vector<std::shared_ptr<const SearchBlock>> blocks;
+        history.CollectSearchBlocks(blocks);
+        std::printf("\nsearch: %zu lines, %.0f ns/line to push, %.0f ns/line to finish the index, index %.1f B/line, %u threads\n", lineCount,
+            pushNanoseconds, finishNanoseconds, static_cast<double>(history.SearchIndexMemoryUsage()) / lineCount, std::max(1u, std::thread::hardware_concurrency()));
+        std::printf("%-24s %10s %10s %10s %10s %10s\n", "query", "first ms", "total ms", "matches", "skipped", "blocks");
+
+        ScrollbackSearch search;
+        PrintSearch("rare, old", TimeSearch(search, blocks, U"frobnicate_widget"));
+        PrintSearch("frequent", TimeSearch(search, blocks, U"warning: unused"));
+        PrintSearch("absent", TimeSearch(search, blocks, U"segmentation fault"));
+
+        std::u32string_view typed = U"undefined reference";
+        SearchTiming typing;
+        search.Start({}, 0, U"", false);
+        for (size_t length = 1; length <= typed.size(); ++length) {
+            SearchTiming keystroke = TimeSearch(search, blocks, typed.substr(0, length));
+            typing.firstMilliseconds += keystroke.firstMilliseconds / typed.size();
+            typing.totalMilliseconds += keystroke.totalMilliseconds / typed.size();
+            typing.progress = keystroke.progress;
+        }
+        PrintSearch("typing, per key", typing);
+    }
+
+    // Hands every character of a printable run to the buffer on its own
+    class PerCharacterBuffer : public TerminalBuffer {
+    public:
+        using TerminalBuffer::TerminalBuffer;
+
+        void PrintString(std::span<const char32_t> text) override
+        {
+            for (size_t i = 0; i < text.size(); ++i) {
+                TerminalBuffer::PrintString(text.subspan(i, 1));
+            }
+        }
+    };
+
+    // Best MB/s of 'iterations' passes, each into a new 'Buffer'
+    template <typename Buffer>
+    double BestThroughput(const Workload& workload, int iterations, size_t chunkSize, uint64_t& checksum)
+    {
+        double bestSeconds = 0;
+        for (int iteration = 0; iteration < iterations; ++iteration) {
+            Buffer buffer(SCREEN_ROWS, SCREEN_COLS);
+            AnsiParser parser(buffer);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < workload.data.size(); offset += chunkSize) {
+                parser.Parse(workload.data.data() + offset, std::min(chunkSize, workload.data.size() - offset));
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (iteration == 0 || seconds < bestSeconds) {
+                bestSeconds = seconds;
+            }
+            checksum = 0;
+            for (int r = 0; r < buffer.GetRows(); ++r) {
+                for (char32_t ch : buffer.GetRowText(r)) {
+                    checksum = checksum * 31 + static_cast<uint64_t>(ch);
+                }
+            }
+        }
+        return static_cast<double>(workload.data.size()) / bestSeconds / 1e6;
+    }
+
+    void RunPrintComparison(const std::vector<Workload>& workloads, int iterations, size_t chunkSize)
+    {
+        std::printf("\n%-12s %14s %10s %8s\n", "print", "per-char MB/s", "runs MB/s", "speedup");
+        for (const Workload& workload : workloads) {
+            uint64_t perCharacterChecksum = 0;
+            uint64_t runsChecksum = 0;
+            double perCharacter = BestThroughput<PerCharacterBuffer>(workload, iterations, chunkSize, perCharacterChecksum);
+            double runs = BestThroughput<TerminalBuffer>(workload, iterations, chunkSize, runsChecksum);
+            if (perCharacterChecksum != runsChecksum) {
+                std::fprintf(stderr, "wrt_parser_benchmark: %s prints differently one character at a time\n", workload.name);
+            }
+            std::printf("%-12s %14.1f %10.1f %7.2fx\n", workload.name, perCharacter, runs, runs / perCharacter);
+        }
+    }
+
+    const int ALLOCATION_PASSES = 100;
+
+    // Allocations per pass over SGR (legacy and colon forms), CUP, EL/ED and DECSET sequences once
+    // everything they touch has been warmed up. None of them scrolls, which would add history.
+    bool CheckSequenceAllocations()
+    {
+        std::string stream;
+        char sequence[128];
+        for (int i = 0; i < 64; ++i) {
+            std::snprintf(sequence, sizeof(sequence), "\x1b[%d;%dH\x1b[1;4:3;38:2::%d:%d:%d;48;5;%dmcell\x1b[0m\x1b[K\x1b[?25l\x1b[?7h\x1b[m\x1b[2;5r\x1b[r",
+                1 + i % SCREEN_ROWS, 1 + i % 40, i * 3 & 0xFF, i * 5 & 0xFF, i * 7 & 0xFF, i);
+            stream += sequence;
+        }
+        stream += "\x1b[H\x1b[2J\x1b[?25h";
+        size_t sequences = static_cast<size_t>(std::count(stream.begin(), stream.end(), '\x1b'));
+
+        TerminalBuffer buffer(SCREEN_ROWS, SCREEN_COLS);
+        AnsiParser parser(buffer);
+        parser.Parse(stream.data(), stream.size());
+        uint64_t before = g_allocations.load(std::memory_order_relaxed);
+        for (int pass = 0; pass < ALLOCATION_PASSES; ++pass) {
+            parser.Parse(stream.data(), stream.size());
+        }
+        uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - before;
+        std::printf("\nallocations: %llu in %zu sequences after warming up\n", static_cast<unsigned long long>(allocations), sequences * ALLOCATION_PASSES);
+        if (allocations != 0) {
+            std::fprintf(stderr, "wrt_parser_benchmark: parsing sequences allocated in steady state\n");
+            return false;
+        }
+        return true;
+    }
+
+    Result Run(const Workload& workload, int iterations, size_t chunkSize)
+    {
+        Result result;
+        double total = 0;
+        for (int iteration = 0; iteration < iterations; ++iteration) {
+            TerminalBuffer buffer(SCREEN_ROWS, SCREEN_COLS);
+            AnsiParser parser(buffer);
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < workload.data.size(); offset += chunkSize) {
+                parser.Parse(workload.data.data() + offset, std::min(chunkSize, workload.data.size() - offset));
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            total += seconds;
+            if (iteration == 0 || seconds < result.bestSeconds) {
+                result.bestSeconds = seconds;
+            }
+
+            // Keeps the work observable so nothing gets optimized away, and doubles as a sanity value.
+            // The first capture of a buffer builds every row.
+            ScreenSnapshot snapshot;
+            auto captureStart = std::chrono::steady_clock::now();
+            buffer.CaptureSnapshot(snapshot);
+            result.fullCaptureMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - captureStart).count();
+            for (int r = 0; r < snapshot.rows; ++r) {
+                for (int c = 0; c < snapshot.cols; ++c) {
+                    result.checksum = result.checksum * 31 + static_cast<uint64_t>(snapshot.Text(r)[c]);
+                }
+            }
+            MeasurePlans(snapshot, result);
+            const Scrollback& history = buffer.GetScrollback();
+            if (history.LineCount() != 0) {
+                result.historyBytesPerLine = static_cast<double>(history.MemoryUsage()) / history.LineCount();
+            }
+            std::vector<char32_t> line(SCREEN_COLS);
+            std::vector<StyleSpan> spans;
+            StyleTable styles;
+            for (size_t i = history.LineCount(); i-- > 0;) {
+                spans.clear();
+                history.ReadLine(i, line, spans, styles);
+                result.checksum = result.checksum * 31 + static_cast<uint64_t>(line[0]);
+            }
+            Scrollback::CompressionStats stats = history.GetCompressionStats();
+            result.compressionRatio = stats.Ratio();
+            result.decompressMicroseconds = stats.AverageDecompressMicroseconds();
+            MeasureCaptures(buffer, parser, result);
+            MeasureResize(buffer, result);
+        }
+        result.meanSeconds = total / iterations;
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 5;
+    double scale = 1.0;
+    size_t chunkSize = 16 * 1024;
+    std::string filter;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--scale" && i + 1 < argc) {
+            scale = std::atof(argv[++i]);
+        }
+        else if (arg == "--chunk" && i + 1 < argc) {
+            chunkSize = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [--iterations N] [--scale F] [--chunk BYTES] [--filter NAME]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::printf("%-12s %10s %10s %10s %10s %8s %6s %7s %7s %8s %8s %8s %8s %9s %9s %8s  %s\n", "workload", "MiB", "MB/s", "ns/byte", "mean MB/s", "B/line", "ratio",
+        "dec us", "B/cell", "plan ns", "cell ns", "full us", "snap us", "resize us", "rewrap ns", "rewrap x", "description");
+    std::vector<Workload> workloads = BuildWorkloads(scale);
+    for (const Workload& workload : workloads) {
+        if (!filter.empty() && workload.name != filter) {
+            continue;
+        }
+        Result result = Run(workload, iterations, chunkSize);
+        double bytes = static_cast<double>(workload.data.size());
+        std::printf("%-12s %10.2f %10.1f %10.3f %10.1f %8.1f %6.1f %7.1f %7.2f %8.0f %8.0f %8.1f %8.2f %9.1f %9.1f %8.2f  %s [%016llx]\n", workload.name, bytes / (1024 * 1024),
+            bytes / result.bestSeconds / 1e6, result.bestSeconds * 1e9 / bytes, bytes / result.meanSeconds / 1e6,
+            result.historyBytesPerLine, result.compressionRatio, result.decompressMicroseconds,
+            result.snapshotBytesPerCell, result.spanPlanNanoseconds, result.cellPlanNanoseconds,
+            result.fullCaptureMicroseconds, result.captureMicroseconds, result.resizeMicroseconds, result.rewrapNanosecondsPerLine,
+            result.rewrapPeakMemory, workload.description, static_cast<unsigned long long>(result.checksum));
+    }
+    if (filter.empty() || filter == "print") {
+        RunPrintComparison(workloads, iterations, chunkSize);
+    }
+    if (filter.empty() || filter == "search") {
+        RunSearch(scale);
+    }
+    if (filter.empty() || filter == "alloc") {
+        return CheckSequenceAllocations() ? 0 : 1;
+    }
+    return 0;
+}
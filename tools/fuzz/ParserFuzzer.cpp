@@ -0,0 +1,652 @@
+// Fuzz harness for AnsiParser::Parse feeding a TerminalBuffer.
+//
+// With Clang and -DWRT_LIBFUZZER=ON this is a regular libFuzzer target:
+//     ./wrt_parser_fuzzer corpus_dir/
+// Otherwise it is built with a small driver (WRT_FUZZ_STANDALONE) that replays the files or
+// directories given on the command line, or with no inputs generates VT-shaped data from a fixed seed:
+//     ./wrt_parser_fuzzer crash-1234         replay one input
+//     ./wrt_parser_fuzzer --runs 100000      generated inputs only
+//
+// The first bytes of every input pick the screen size, how the stream is split across Parse
+// calls and the OSC/DCS string limit, so chunk boundaries and resizes get explored as well.
+// Resized inputs go back to their first size three quarters in, and the history is rewrapped a few
+// lines per Parse call, so output keeps arriving while it is. The others are narrowed and widened
+// straight back halfway through, which has to give the same screen. At the end the history and screen
+// are searched, once and then narrowed, and the matches compared with a brute-force scan.
+//
+// The input also goes through the LZ4 codec on its own. When the header asks for a large history,
+// the scrollback gets room for more than HOT_CHUNKS chunks, and a separate history is filled with
+// the screen's rows and slices of the input until chunks get compressed, then read back line by line.
+#include "AnsiParser.h"
+#include "Lz4.h"
+#include "ScreenSnapshot.h"
+#include "ScrollbackSearch.h"
+#include "TerminalBuffer.h"
+#include "UnicodeWidth.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace winrt::win_retro_term::Core;
+
+namespace
+{
+    const size_t HEADER_BYTES = 4;
+
+    void Check(bool condition, const char* what)
+    {
+        if (!condition) {
+            std::fprintf(stderr, "wrt_parser_fuzzer: invariant failed: %s\n", what);
+            std::abort();
+        }
+    }
+
+    // Style runs cover the row exactly, are never empty and refer to known styles
+    void CheckSpans(std::span<const StyleSpan> spans, int cols, size_t styleCount)
+    {
+        size_t covered = 0;
+        for (const StyleSpan& span : spans) {
+            Check(span.length != 0, "no empty style spans");
+            Check(span.style < styleCount, "style id in the table");
+            covered += span.length;
+        }
+        Check(covered == static_cast<size_t>(cols), "style spans cover the row");
+    }
+
+    // Every wide character is followed by its spacer and every spacer follows one; cluster cells refer to the row's list
+    void CheckCells(std::span<const char32_t> text, std::span<const std::u32string> clusters)
+    {
+        bool expectSpacer = false;
+        for (char32_t ch : text) {
+            if (ch == WIDE_SPACER) {
+                Check(expectSpacer, "spacer follows a wide character");
+                expectSpacer = false;
+                continue;
+            }
+            Check(!expectSpacer, "wide character followed by its spacer");
+            if (IsClusterCell(ch)) {
+                Check(ch - CLUSTER_CELL < clusters.size(), "cluster cell in the row's list");
+                const std::u32string& cluster = clusters[ch - CLUSTER_CELL];
+                Check(cluster.size() >= 2 && cluster.size() <= MAX_CLUSTER_LENGTH, "cluster length");
+                ch = cluster[0];
+            }
+            expectSpacer = ch >= FIRST_NON_NARROW && CellWidth(ClassifyCodePoint(ch)) == 2;
+        }
+        Check(!expectSpacer, "wide character followed by its spacer");
+    }
+
+    // Captures into the oldest of three snapshots while the other two stay held, like the exchange does
+    void CheckBuffer(TerminalBuffer& buffer, ScreenSnapshot (&snapshots)[3], size_t& next)
+    {
+        ScreenSnapshot& snapshot = snapshots[next];
+        const ScreenSnapshot& previous = snapshots[(next + 2) % 3];
+        next = (next + 1) % 3;
+
+        // Column may sit one past the last cell while a wrap is pending
+        Check(buffer.GetCursorRow() >= 0 && buffer.GetCursorRow() < buffer.GetRows(), "cursor row in range");
+        Check(buffer.GetCursorCol() >= 0 && buffer.GetCursorCol() <= buffer.GetCols(), "cursor column in range");
+
+        buffer.CaptureSnapshot(snapshot);
+        Check(snapshot.viewportOffset >= 0 && static_cast<size_t>(snapshot.viewportOffset) <= snapshot.scrollbackLines, "viewport inside history");
+        Check(snapshot.rows == buffer.GetRows() && snapshot.cols == buffer.GetCols(), "snapshot size");
+        Check(snapshot.lines.size() == static_cast<size_t>(snapshot.rows), "snapshot row count");
+        Check(snapshot.epoch > previous.epoch, "snapshot epochs increase");
+        Check(snapshot.scrollbackLines == buffer.HistoryLineCount(), "snapshot history line count");
+        for (int r = 0; r < snapshot.rows; ++r) {
+            Check(snapshot.lines[r]->text.size() == static_cast<size_t>(snapshot.cols), "snapshot row width");
+            Check(snapshot.lines[r]->epoch <= snapshot.epoch, "snapshot rows built up to its capture");
+            CheckSpans(snapshot.Spans(r), snapshot.cols, snapshot.styles.size());
+            CheckSpans(buffer.GetRowSpans(r), buffer.GetCols(), buffer.GetStyles().Size());
+            CheckCells(buffer.GetRowText(r), buffer.GetRowClusters(r));
+            CheckCells(snapshot.lines[r]->text, snapshot.lines[r]->clusters);
+            if (r >= snapshot.viewportOffset) {
+                std::span<const char32_t> text = buffer.GetRowText(r - snapshot.viewportOffset);
+                std::span<const StyleSpan> spans = buffer.GetRowSpans(r - snapshot.viewportOffset);
+                Check(std::equal(text.begin(), text.end(), snapshot.Text(r), snapshot.Text(r) + snapshot.cols), "snapshot text matches the screen");
+                Check(std::ranges::equal(spans, snapshot.Spans(r)), "snapshot styles match the screen");
+                Check(std::ranges::equal(buffer.GetRowClusters(r - snapshot.viewportOffset), snapshot.lines[r]->clusters), "snapshot clusters match the screen");
+            }
+            else {
+                // Spliced from two histories while a reflow runs
+                std::vector<char32_t> text(static_cast<size_t>(snapshot.cols));
+                std::vector<StyleSpan> spans;
+                StyleTable styles;
+                std::vector<std::u32string> clusters;
+                buffer.ReadHistoryLine(snapshot.scrollbackLines - snapshot.viewportOffset + r, text, spans, styles, &clusters);
+                Check(std::equal(text.begin(), text.end(), snapshot.Text(r)), "snapshot text matches history");
+                Check(clusters == snapshot.lines[r]->clusters, "snapshot clusters match history");
+            }
+        }
+        // Rows still held by an older snapshot are never rewritten
+        for (int r = 0; r < previous.rows; ++r) {
+            Check(previous.lines[r]->epoch <= previous.epoch, "held snapshot rows untouched");
+        }
+    }
+
+    // The screen as of the previous ConsumeDamage; snapshots follow the same screen with their own cursor
+    struct ShadowScreen {
+        int rows = 0;
+        int cols = 0;
+        std::vector<std::vector<char32_t>> text;
+        std::vector<std::vector<StyleSpan>> spans;
+        int cursorRow = -1;
+        int cursorCol = -1;
+    };
+
+    // Rows the damage doesn't report must be the shadow's rows moved by the scroll delta
+    void CheckDamage(TerminalBuffer& buffer, ScreenDamage& damage, ShadowScreen& shadow)
+    {
+        buffer.ConsumeDamage(damage);
+        int rows = buffer.GetRows();
+        Check(damage.scrollDelta >= -rows && damage.scrollDelta <= rows, "scroll delta within a screenful");
+
+        std::vector<bool> reported(rows, false);
+        int previousLast = -1;
+        for (const ScreenDamage::RowRange& range : damage.rows) {
+            Check(range.first > previousLast && range.first <= range.last && range.last < rows, "damage ranges ascending and in range");
+            previousLast = range.last;
+            for (int r = range.first; r <= range.last; ++r) {
+                reported[r] = true;
+            }
+        }
+
+        bool sameSize = shadow.rows == rows && shadow.cols == buffer.GetCols();
+        Check(sameSize || damage.full, "a resize is full damage");
+        if (!damage.full) {
+            for (int r = 0; r < rows; ++r) {
+                if (reported[r]) continue;
+                int source = r + damage.scrollDelta;
+                Check(source >= 0 && source < rows, "unreported rows come from the old screen");
+                std::span<const char32_t> text = buffer.GetRowText(r);
+                std::span<const StyleSpan> spans = buffer.GetRowSpans(r);
+                Check(std::equal(text.begin(), text.end(), shadow.text[source].begin(), shadow.text[source].end()), "unreported row text unchanged");
+                Check(std::equal(spans.begin(), spans.end(), shadow.spans[source].begin(), shadow.spans[source].end()), "unreported row styles unchanged");
+            }
+            if (!damage.cursorChanged) {
+                Check(buffer.GetCursorRow() == shadow.cursorRow && buffer.GetCursorCol() == shadow.cursorCol, "cursor moves are reported");
+            }
+        }
+
+        shadow.rows = rows;
+        shadow.cols = buffer.GetCols();
+        shadow.text.resize(rows);
+        shadow.spans.resize(rows);
+        for (int r = 0; r < rows; ++r) {
+            shadow.text[r].assign(buffer.GetRowText(r).begin(), buffer.GetRowText(r).end());
+            shadow.spans[r].assign(buffer.GetRowSpans(r).begin(), buffer.GetRowSpans(r).end());
+        }
+        shadow.cursorRow = buffer.GetCursorRow();
+        shadow.cursorCol = buffer.GetCursorCol();
+    }
+
+    // The input survives a round trip, repeated so there are matches to find, and decoding it as a
+    // block, which it mostly isn't, fails or succeeds without going out of bounds
+    void CheckLz4(const uint8_t* data, size_t size)
+    {
+        if (size == 0) {
+            return;
+        }
+        std::vector<uint8_t> source(data, data + size);
+        source.insert(source.end(), data, data + size);
+        source.insert(source.end(), data, data + size / 2);
+        std::vector<uint8_t> compressed(Lz4::CompressBound(source.size()));
+        size_t stored = Lz4::Compress(source.data(), source.size(), compressed.data(), compressed.size());
+        Check(stored != 0, "LZ4 output fits CompressBound");
+        std::vector<uint8_t> decompressed(source.size());
+        Check(Lz4::Decompress(compressed.data(), stored, decompressed.data(), decompressed.size()), "LZ4 decodes its own output");
+        Check(decompressed == source, "LZ4 round trip");
+        Check(!Lz4::Decompress(compressed.data(), stored, decompressed.data(), decompressed.size() - 1), "LZ4 rejects a short destination");
+
+        std::vector<uint8_t> garbage(size * 4 + 64);
+        Lz4::Decompress(data, size, garbage.data(), garbage.size());
+    }
+
+    struct HistoryLine {
+        std::vector<char32_t> text;         // Cluster cells all CLUSTER_CELL, they are numbered per row
+        std::vector<std::pair<uint32_t, TextStyle>> runs;      // Equal neighbouring styles merged
+        std::vector<std::u32string> clusters;   // In the order of their cells
+        bool wrapped;
+
+        bool operator==(const HistoryLine&) const = default;
+    };
+
+    HistoryLine ExpandLine(std::span<const char32_t> text, std::span<const StyleSpan> spans, const StyleTable& styles,
+        std::span<const std::u32string> clusters, bool wrapped)
+    {
+        HistoryLine line{ { text.begin(), text.end() }, {}, {}, wrapped };
+        for (const StyleSpan& span : spans) {
+            const TextStyle& style = styles.Get(span.style);
+            if (!line.runs.empty() && line.runs.back().second == style) {
+                line.runs.back().first += span.length;
+            }
+            else {
+                line.runs.emplace_back(span.length, style);
+            }
+        }
+        for (size_t c = 0; c < text.size(); ++c) {
+            if (IsClusterCell(text[c])) {
+                line.text[c] = CLUSTER_CELL;
+                line.clusters.push_back(text[c] - CLUSTER_CELL < clusters.size() ? clusters[text[c] - CLUSTER_CELL] : std::u32string());
+            }
+        }
+        return line;
+    }
+
+    // Lines of a history with more than HOT_CHUNKS chunks in RAM, so the older ones are compressed,
+    // read back exactly as they went in: text, style of every cell, clusters and the wrap flag
+    void CheckCompressedHistory(const TerminalBuffer& buffer, const uint8_t* data, size_t size)
+    {
+        const size_t SLICE_CELLS = 1000;
+        const size_t MAX_LINES = 20000;
+        Scrollback history(Scrollback::CHUNK_BYTES * (Scrollback::HOT_CHUNKS + 4), 0);
+        const StyleTable& styles = buffer.GetStyles();
+        std::vector<HistoryLine> pushed;
+        std::vector<char32_t> slice(SLICE_CELLS);
+        while (history.GetCompressionStats().compressedBytes == 0 && pushed.size() < MAX_LINES) {
+            size_t i = pushed.size();
+            if (i % 4 == 0) {
+                int r = static_cast<int>(i / 4 % static_cast<size_t>(buffer.GetRows()));
+                history.PushLine(buffer.GetRowText(r), buffer.GetRowSpans(r), styles, buffer.GetRowClusters(r), buffer.IsRowWrapped(r));
+                pushed.push_back(ExpandLine(buffer.GetRowText(r), buffer.GetRowSpans(r), styles, buffer.GetRowClusters(r), buffer.IsRowWrapped(r)));
+                continue;
+            }
+            // Bytes of the input as Latin-1 cells, half of them in a style taken from the input too
+            for (size_t c = 0; c < SLICE_CELLS; ++c) {
+                slice[c] = size != 0 ? data[(i * 37 + c) % size] : U'x';
+            }
+            uint32_t style = size != 0 ? data[i % size] % static_cast<uint32_t>(styles.Size()) : StyleTable::DEFAULT_STYLE;
+            StyleSpan spans[2] = { { SLICE_CELLS / 2, style }, { SLICE_CELLS - SLICE_CELLS / 2, StyleTable::DEFAULT_STYLE } };
+            history.PushLine(slice, spans, styles, {}, i % 3 == 0);
+            pushed.push_back(ExpandLine(slice, spans, styles, {}, i % 3 == 0));
+        }
+        Check(history.GetCompressionStats().compressedBytes != 0, "history compresses aged chunks");
+        Check(history.LineCount() == pushed.size(), "history under its limits keeps every line");
+
+        std::vector<char32_t> text;
+        std::vector<StyleSpan> spans;
+        StyleTable readStyles;
+        std::vector<std::u32string> clusters;
+        for (size_t line = 0; line < pushed.size(); ++line) {
+            const HistoryLine& expected = pushed[line];
+            text.resize(expected.text.size());
+            spans.clear();
+            clusters.clear();
+            history.ReadLine(line, text, spans, readStyles, &clusters);
+            Check(ExpandLine(text, spans, readStyles, clusters, history.IsWrapped(line)) == expected, "history line reads back as pushed");
+        }
+        Check(history.GetCompressionStats().decompressions != 0, "compressed chunks are read back");
+    }
+
+    // Narrowing the screen and widening it straight back gives the same rows and cursor: what the narrow width
+    // pushed into history is taken back. Only checked when nothing can get lost on the way, so with nothing
+    // after the cursor, the cursor on the last row unless history is empty, and the lines involved still in RAM.
+    void CheckResizeRoundTrip(TerminalBuffer& buffer, int narrowCols)
+    {
+        int rows = buffer.GetRows();
+        int cols = buffer.GetCols();
+        int cursorY = buffer.GetCursorRow();
+        int cursorX = buffer.GetCursorCol();
+        const Scrollback& history = buffer.GetScrollback();
+        if (buffer.IsAlternateScreenActive() || narrowCols >= cols || (cursorY != rows - 1 && history.LineCount() != 0)) {
+            return;
+        }
+        if (narrowCols < 2 || buffer.IsRowWrapped(rows - 1)) {
+            return; // Too narrow for a wide character, which is replaced, or a wrap flag the last row can't keep
+        }
+        if (cursorX == 0 && cursorY > 0 && buffer.IsRowWrapped(cursorY - 1)) {
+            return; // Wrapped onto a row of its own, which at another width may be the end of the one before
+        }
+        for (int r = cursorY; r < rows; ++r) {
+            std::span<const char32_t> text = buffer.GetRowText(r);
+            if (std::any_of(text.begin() + (r == cursorY ? std::min(cursorX, cols) : 0), text.end(), [](char32_t ch) { return ch != U' '; })) {
+                return;
+            }
+        }
+        // History lines that wrap into the top row come back with it
+        size_t joined = 0;
+        while (joined < history.LineCount() && history.IsWrapped(history.LineCount() - 1 - joined)) {
+            ++joined;
+        }
+        for (int r = 0; r < rows; ++r) {
+            // A line that wrapped onto a row and was erased there ends before it, taking one row fewer
+            std::span<const char32_t> text = buffer.GetRowText(r);
+            bool continues = r > 0 ? buffer.IsRowWrapped(r - 1) : joined != 0;
+            if (continues && !buffer.IsRowWrapped(r) && std::all_of(text.begin(), text.end(), [](char32_t ch) { return ch == U' '; })) {
+                return;
+            }
+            // A blank that ends up in the last column before a wide character is taken for the gap one leaves
+            std::span<const char32_t> next = r + 1 < rows && buffer.IsRowWrapped(r) ? buffer.GetRowText(r + 1) : std::span<const char32_t>();
+            for (int c = 0; c < cols; ++c) {
+                char32_t after = c + 2 < cols ? text[c + 2] : next.size() > static_cast<size_t>(c + 2 - cols) ? next[c + 2 - cols] : U' ';
+                if (text[c] == U' ' && after == WIDE_SPACER) {
+                    return;
+                }
+            }
+        }
+
+        const StyleTable& styles = buffer.GetStyles();
+        std::vector<HistoryLine> before;
+        for (int r = 0; r < rows; ++r) {
+            before.push_back(ExpandLine(buffer.GetRowText(r), buffer.GetRowSpans(r), styles, buffer.GetRowClusters(r), buffer.IsRowWrapped(r)));
+        }
+        uint64_t lines = history.TotalLines();
+        buffer.Resize(rows, narrowCols);
+        if (history.RetractableLines() < history.TotalLines() - lines + joined) {
+            buffer.Resize(rows, cols);
+            return;
+        }
+        buffer.Resize(rows, cols);
+
+        Check(buffer.GetCursorRow() == cursorY && buffer.GetCursorCol() == cursorX, "cursor comes back after narrowing and widening");
+        for (int r = 0; r < rows; ++r) {
+            Check(ExpandLine(buffer.GetRowText(r), buffer.GetRowSpans(r), styles, buffer.GetRowClusters(r), buffer.IsRowWrapped(r)) == before[r],
+                "rows come back after narrowing and widening");
+        }
+    }
+
+    // A cell as a search compares it: a cluster by its first code point, ASCII letters in lower case
+    char32_t SearchCell(char32_t ch, std::span<const std::u32string> clusters)
+    {
+        if (IsClusterCell(ch) && ch - CLUSTER_CELL < clusters.size()) {
+            ch = clusters[ch - CLUSTER_CELL][0];
+        }
+        return ch >= U'A' && ch <= U'Z' ? ch | 0x20 : ch;
+    }
+
+    // History and screen searched for each query, the second narrowing the first, find every place a
+    // brute-force scan of the same rows does and nothing else, halfway through a history reflow too. The queries can't overlap themselves,
+    // so counting every occurrence agrees with the search's left-to-right scan.
+    void CheckSearch(TerminalBuffer& buffer)
+    {
+        static ScrollbackSearch search(1);
+        while (buffer.ContinueSearchIndexing(64)) {
+        }
+        std::vector<std::shared_ptr<const SearchBlock>> blocks;
+        uint64_t firstLine = 0;
+        buffer.CollectSearchBlocks(blocks, firstLine);
+
+        // Rows from 'firstLine' on, with trailing blanks dropped as they were indexed
+        std::vector<std::u32string> rows;
+        std::vector<bool> wrapped;
+        std::vector<char32_t> text;
+        std::vector<StyleSpan> spans;
+        StyleTable styles;
+        std::vector<std::u32string> clusters;
+        for (size_t line = 0; line < buffer.HistoryLineCount(); ++line) {
+            text.resize(buffer.HistoryLineLength(line));
+            spans.clear();
+            clusters.clear();
+            buffer.ReadHistoryLine(line, text, spans, styles, &clusters);
+            std::u32string& row = rows.emplace_back();
+            for (char32_t ch : text) {
+                row += SearchCell(ch, clusters);
+            }
+            wrapped.push_back(buffer.IsHistoryWrapped(line));
+        }
+        for (int r = 0; r < buffer.GetRows(); ++r) {
+            std::span<const char32_t> cells = buffer.GetRowText(r);
+            bool rowWrapped = buffer.IsRowWrapped(r);
+            size_t length = cells.size();
+            while (!rowWrapped && length > 0 && cells[length - 1] == U' ') {
+                --length;
+            }
+            std::u32string& row = rows.emplace_back();
+            for (char32_t ch : cells.first(length)) {
+                row += SearchCell(ch, buffer.GetRowClusters(r));
+            }
+            wrapped.push_back(rowWrapped);
+        }
+
+        // A match never runs from one block into the next, the screen being a block of its own
+        std::vector<uint64_t> blockStarts;
+        for (const std::shared_ptr<const SearchBlock>& block : blocks) {
+            blockStarts.push_back(block->firstLine);
+        }
+        auto goesOn = [&](size_t row) {
+            return wrapped[row] && row + 1 < rows.size() && !std::binary_search(blockStarts.begin(), blockStarts.end(), firstLine + row + 1);
+        };
+
+        for (std::u32string_view query : { std::u32string_view(U"e"), std::u32string_view(U"e ") }) {
+            search.Start(blocks, firstLine, query, false);
+            search.Wait();
+            std::vector<SearchMatch> matches;
+            search.TakeMatches(matches);
+            SearchProgress progress = search.Progress();
+            Check(progress.done, "search finishes");
+
+            size_t expected = 0;
+            std::u32string line;
+            for (size_t r = 0; r < rows.size(); ++r) {
+                line += rows[r];
+                if (goesOn(r)) {
+                    continue;
+                }
+                for (size_t at = line.find(query); at != std::u32string::npos; at = line.find(query, at + query.size())) {
+                    ++expected;
+                }
+                line.clear();
+            }
+            Check(progress.matches == expected, "search finds what a brute-force scan does");
+            Check(matches.size() == std::min(expected, ScrollbackSearch::MAX_MATCHES), "search keeps the matches it counts");
+
+            std::sort(matches.begin(), matches.end(), [](const SearchMatch& a, const SearchMatch& b) {
+                return a.line != b.line ? a.line < b.line : a.column < b.column;
+            });
+            for (size_t m = 0; m < matches.size(); ++m) {
+                const SearchMatch& match = matches[m];
+                Check(match.line >= firstLine && match.line - firstLine < rows.size(), "search match line in range");
+                Check(m == 0 || match.line != matches[m - 1].line || match.column != matches[m - 1].column, "search matches are distinct");
+                size_t r = static_cast<size_t>(match.line - firstLine);
+                Check(match.column >= 0 && static_cast<size_t>(match.column) < rows[r].size(), "search match column in range");
+                Check(match.length == static_cast<int>(query.size()), "search match length in cells");
+                std::u32string found = rows[r].substr(static_cast<size_t>(match.column));
+                while (found.size() < query.size() && goesOn(r)) {
+                    found += rows[++r];
+                }
+                Check(found.compare(0, query.size(), query) == 0, "search match holds the query");
+            }
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size < HEADER_BYTES) {
+        return 0;
+    }
+
+    int rows = 1 + data[0] % 64;
+    bool largeHistory = (data[0] & 0xC0) == 0xC0;          // Past HOT_CHUNKS, so chunks get compressed
+    int cols = 1 + data[1] % 160;
+    size_t chunkSize = 1 + data[2];                         // 1..256 bytes per Parse call
+    size_t stringLimit = AnsiParser::MIN_STRING_LIMIT << (data[3] & 0x07);
+    bool resizeHalfway = (data[3] & 0x08) != 0;         // And back at three quarters
+    int viewportLines = (data[3] >> 4) * 3;             // Scrolled back this far for the whole run
+    data += HEADER_BYTES;
+    size -= HEADER_BYTES;
+    CheckLz4(data, size);
+
+    TerminalBuffer buffer(rows, cols);
+    AnsiParser parser(buffer);
+    parser.SetStringLimit(stringLimit);
+    ScreenSnapshot snapshots[3];
+    size_t nextSnapshot = 0;
+    ScreenDamage damage;
+    ShadowScreen shadow;
+    // Small enough that long inputs spill chunks, wrap the spill ring and drop history
+    buffer.SetScrollbackLimit(Scrollback::CHUNK_BYTES * (largeHistory ? Scrollback::HOT_CHUNKS + 4 : 2));
+    buffer.SetScrollbackSpillLimit(Scrollback::CHUNK_BYTES * 3);
+    buffer.ScrollViewport(viewportLines);
+
+    const char* text = reinterpret_cast<const char*>(data);
+    for (size_t offset = 0; offset < size; offset += chunkSize) {
+        size_t length = size - offset < chunkSize ? size - offset : chunkSize;
+        parser.Parse(text + offset, length);
+        CheckDamage(buffer, damage, shadow);
+        CheckBuffer(buffer, snapshots, nextSnapshot);
+        if (viewportLines != 0) {
+            buffer.ScrollViewport(viewportLines);
+        }
+
+        if (buffer.HistoryReflowPending()) {
+            buffer.ContinueHistoryReflow(3);
+            CheckBuffer(buffer, snapshots, nextSnapshot);
+        }
+
+        bool halfway = offset < size / 2 && offset + length >= size / 2;
+        bool threeQuarters = offset < size * 3 / 4 && offset + length >= size * 3 / 4;
+        if (!resizeHalfway && halfway) {
+            CheckResizeRoundTrip(buffer, 1 + cols / 3);
+            CheckBuffer(buffer, snapshots, nextSnapshot);
+            CheckDamage(buffer, damage, shadow);
+        }
+        if (resizeHalfway && (halfway || threeQuarters)) {
+            if (halfway) {
+                buffer.Resize(1 + (rows * 7 + cols) % 64, 1 + (cols * 5 + rows) % 160);
+            }
+            else {
+                buffer.Resize(rows, cols);
+            }
+            CheckBuffer(buffer, snapshots, nextSnapshot);
+            CheckDamage(buffer, damage, shadow);
+            if (buffer.HistoryReflowPending()) {
+                CheckSearch(buffer);
+            }
+        }
+    }
+    while (buffer.ContinueHistoryReflow(64)) {
+    }
+    Check(!buffer.HistoryReflowPending(), "history reflow finishes");
+    CheckBuffer(buffer, snapshots, nextSnapshot);
+    CheckSearch(buffer);
+    if (largeHistory) {
+        CheckCompressedHistory(buffer, data, size);
+    }
+    return 0;
+}
+
+#if defined(WRT_FUZZ_STANDALONE)
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Fragments that steer generated input into the interesting parser states
+    const char* const FRAGMENTS[] = {
+        "\x1b[", "\x1b]", "\x1bP", "\x1b_", "\x1b^", "\x1bX", "\x1b\\", "\x1b(0", "\x1b(B", "\x1b)0",
+        "\x1b[?", "\x1b[>", "\x1b[?1049h", "\x1b[?1049l", "\x1b[?47h", "\x1b[?47l", "\x1b[?1047h", "\x1b[?1047l", "\x1b[?1048h", "\x1b[?1048l",
+        "\x1b" "7", "\x1b" "8", "\x1b[s", "\x1b[u", "\x1b[?25l", "\x1b[?7l", "\x1b[?7h", "\x1b[?6h",
+        "\x1b[2;5r", "\x1b[r", "\x1bM", "\x1b" "D", "\x1b[3L", "\x1b[3M", "\x1b[4@", "\x1b[4P", "\x1b[2S", "\x1b[2T",
+        "\x1b[38;2;", "\x1b[48;5;", "\x1b[38:2::", "\x1b[58:5:", "\x1b[59m", "\x1b[4:3m", "\x1b[0m", "\x1b[H", "\x1b[2J", "\x1b[3J", "\x1b[K",
+        "\x1b]0;", "\x1b]4;1;rgb:ff/00/00", "\x1b]8;id=x;http://a", "\x1b]8;;", "\x1b]52;c;aGVsbG8=",
+        "\x1b]10;#fff", "\x1bP$q", "\x1bP1;2|", "\x07", "\x18", "\x1a", "\x7f",
+        ";", ":", "0", "1", "9", "65535", "4294967296", "m", "H", "J", "K", "A", "h", "l", "r", "@", "P",
+        "\r\n", "\t", "\b", "\x0e", "\x0f", "\xc3\xa9", "\xe2\x94\x80", "\xf0\x9f\x98\x80", "\xe4\xb8\xad",
+        "\xcc\x81", "\xe2\x80\x8d", "\xef\xb8\x8f", "\xf0\x9f\x8f\xbd", "\xf0\x9f\x91\xa9", "\xf0\x9f\x87\xba", "\xe2\x9d\xa4",
+        "\xef\xbc\xa1\xef\xbc\xa2", "\xe1\x84\x80\xe1\x85\xa1", "\xc3", "\xe2\x94", "\xff", "\x9b", "\x90", "hello world ",
+    };
+
+    std::string GenerateInput(std::mt19937& rng)
+    {
+        std::string input;
+        for (size_t i = 0; i < HEADER_BYTES; ++i) {
+            input.push_back(static_cast<char>(rng()));
+        }
+
+        size_t pieces = rng() % 96;
+        for (size_t i = 0; i < pieces; ++i) {
+            uint32_t choice = rng() % 8;
+            if (choice == 0) {
+                // Raw bytes
+                size_t count = 1 + rng() % 16;
+                for (size_t k = 0; k < count; ++k) {
+                    input.push_back(static_cast<char>(rng()));
+                }
+            }
+            else if (choice == 1) {
+                // Long run, to cross the string limit or wrap many lines
+                input.append(1 + rng() % 1024, static_cast<char>('A' + rng() % 26));
+            }
+            else {
+                input += FRAGMENTS[rng() % std::size(FRAGMENTS)];
+            }
+        }
+        return input;
+    }
+
+    bool RunFile(const std::filesystem::path& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::fprintf(stderr, "wrt_parser_fuzzer: can't read %s\n", path.string().c_str());
+            return false;
+        }
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long runs = 10000;
+    unsigned long seed = 1;
+    std::vector<std::filesystem::path> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) {
+            runs = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else {
+            inputs.emplace_back(arg);
+        }
+    }
+
+    if (!inputs.empty()) {
+        size_t replayed = 0;
+        for (const auto& input : inputs) {
+            if (std::filesystem::is_directory(input)) {
+                for (const auto& entry : std::filesystem::recursive_directory_iterator(input)) {
+                    if (entry.is_regular_file()) {
+                        replayed += RunFile(entry.path()) ? 1 : 0;
+                    }
+                }
+            }
+            else if (!RunFile(input)) {
+                return 1;
+            }
+            else {
+                ++replayed;
+            }
+        }
+        std::printf("Replayed %zu inputs\n", replayed);
+        return 0;
+    }
+
+    std::mt19937 rng(static_cast<uint32_t>(seed));
+    size_t totalBytes = 0;
+    for (unsigned long run = 0; run < runs; ++run) {
+        std::string input = GenerateInput(rng);
+        totalBytes += input.size();
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    }
+    std::printf("Ran %lu generated inputs (%zu bytes, seed %lu)\n", runs, totalBytes, seed);
+    return 0;
+}
+
+#endif
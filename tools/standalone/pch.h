@@ -0,0 +1,4 @@
+#pragma once
+
+// Core sources include the app's precompiled header first. Outside the Windows build there is
+// nothing to precompile: every Core file includes the standard headers it uses.
@@ -1,433 +1,818 @@
 #include "pch.h"
 #include "AnsiParser.h"
-#include <Windows.h>
+#include "Simd.h"
+#include "Trace.h"
+#include <algorithm>
+#include <array>
+#include <bit>
 
 namespace winrt::win_retro_term::Core
 {
+    namespace
+    {
+        // Character classes used as the column index of the transition table.
+        // Only code points below 0x80 are classified individually.
+        enum CharClass : uint8_t {
+            CC_C0,              // 00-06, 08-17, 19, 1C-1F
+            CC_BEL,             // 07, also terminates OSC strings
+            CC_CAN_SUB,         // 18, 1A
+            CC_ESC,             // 1B
+            CC_INTERMEDIATE,    // 20-2F
+            CC_DIGIT,           // 30-39
+            CC_COLON,           // 3A
+            CC_SEMICOLON,       // 3B
+            CC_PRIVATE,         // 3C-3F
+            CC_FINAL,           // 40-7E other than the introducers below
+            CC_DCS,             // 'P'
+            CC_SOS_PM_APC,      // 'X', '^', '_'
+            CC_CSI,             // '['
+            CC_OSC,             // ']'
+            CC_DEL,             // 7F
+            CC_NON_ASCII,       // 80 and up
+            CC_COUNT
+        };
+
+        constexpr std::array<CharClass, 0x80> BuildCharClassTable()
+        {
+            std::array<CharClass, 0x80> table{};
+            for (size_t ch = 0; ch < 0x80; ++ch) {
+                if (ch < 0x20) table[ch] = CC_C0;
+                else if (ch < 0x30) table[ch] = CC_INTERMEDIATE;
+                else if (ch < 0x3A) table[ch] = CC_DIGIT;
+                else if (ch < 0x3C) table[ch] = ch == 0x3A ? CC_COLON : CC_SEMICOLON;
+                else if (ch < 0x40) table[ch] = CC_PRIVATE;
+                else if (ch < 0x7F) table[ch] = CC_FINAL;
+                else table[ch] = CC_DEL;
+            }
+            table[0x07] = CC_BEL;
+            table[0x18] = CC_CAN_SUB;
+            table[0x1A] = CC_CAN_SUB;
+            table[0x1B] = CC_ESC;
+            table['P'] = CC_DCS;
+            table['X'] = CC_SOS_PM_APC;
+            table['^'] = CC_SOS_PM_APC;
+            table['_'] = CC_SOS_PM_APC;
+            table['['] = CC_CSI;
+            table[']'] = CC_OSC;
+            return table;
+        }
+
+        using TransitionTable = std::array<std::array<uint8_t, CC_COUNT>, static_cast<size_t>(ParserState::COUNT)>;
+
+        // Table entries pack the action in the low nibble and the next state in the high nibble
+        constexpr uint8_t PackTransition(ParserAction action, ParserState next)
+        {
+            return static_cast<uint8_t>(static_cast<uint8_t>(action) | (static_cast<uint8_t>(next) << 4));
+        }
+
+        constexpr TransitionTable BuildTransitionTable()
+        {
+            using S = ParserState;
+            using A = ParserAction;
+
+            TransitionTable table{};
+            for (size_t index = 0; index < table.size(); ++index) {
+                const S state = static_cast<S>(index);
+                auto on = [&](std::initializer_list<CharClass> classes, A action, S next) {
+                    for (CharClass cc : classes) table[index][cc] = PackTransition(action, next);
+                };
+                auto stay = [&](std::initializer_list<CharClass> classes, A action) { on(classes, action, state); };
+
+                // Colons separate sub-parameters (ITU T.416 / ECMA-48 5th edition) instead of forcing CSI_IGNORE
+                const std::initializer_list<CharClass> params = { CC_DIGIT, CC_COLON, CC_SEMICOLON };
+                const std::initializer_list<CharClass> parameterBytes = { CC_DIGIT, CC_COLON, CC_SEMICOLON, CC_PRIVATE };
+                const std::initializer_list<CharClass> finals = { CC_FINAL, CC_DCS, CC_SOS_PM_APC, CC_CSI, CC_OSC };
+
+                // By default C0 controls execute in place and everything else is ignored
+                for (size_t cc = 0; cc < CC_COUNT; ++cc) table[index][cc] = PackTransition(A::NONE, state);
+                stay({ CC_C0, CC_BEL }, A::EXECUTE);
+
+                switch (state) {
+                case S::GROUND:
+                    stay({ CC_INTERMEDIATE, CC_DEL, CC_NON_ASCII }, A::PRINT);
+                    stay(parameterBytes, A::PRINT);
+                    stay(finals, A::PRINT);
+                    break;
+                case S::ESCAPE:
+                    on({ CC_INTERMEDIATE }, A::COLLECT, S::ESCAPE_INTERMEDIATE);
+                    on(parameterBytes, A::ESC_DISPATCH, S::GROUND);
+                    on({ CC_FINAL }, A::ESC_DISPATCH, S::GROUND);
+                    on({ CC_CSI }, A::NONE, S::CSI_ENTRY);
+                    on({ CC_DCS }, A::NONE, S::DCS_ENTRY);
+                    on({ CC_OSC }, A::NONE, S::OSC_STRING);
+                    on({ CC_SOS_PM_APC }, A::NONE, S::SOS_PM_APC_STRING);
+                    on({ CC_NON_ASCII }, A::NONE, S::GROUND);
+                    break;
+                case S::ESCAPE_INTERMEDIATE:
+                    stay({ CC_INTERMEDIATE }, A::COLLECT);
+                    on(parameterBytes, A::ESC_DISPATCH, S::GROUND);
+                    on(finals, A::ESC_DISPATCH, S::GROUND);
+                    on({ CC_NON_ASCII }, A::NONE, S::GROUND);
+                    break;
+                case S::CSI_ENTRY:
+                    on({ CC_INTERMEDIATE }, A::COLLECT, S::CSI_INTERMEDIATE);
+                    on(params, A::PARAM, S::CSI_PARAM);
+                    on({ CC_PRIVATE }, A::COLLECT, S::CSI_PARAM);
+                    on(finals, A::CSI_DISPATCH, S::GROUND);
+                    on({ CC_NON_ASCII }, A::NONE, S::GROUND);
+                    break;
+                case S::CSI_PARAM:
+                    stay(params, A::PARAM);
+                    on({ CC_PRIVATE }, A::NONE, S::CSI_IGNORE);
+                    on({ CC_INTERMEDIATE }, A::COLLECT, S::CSI_INTERMEDIATE);
+                    on(finals, A::CSI_DISPATCH, S::GROUND);
+                    on({ CC_NON_ASCII }, A::NONE, S::GROUND);
+                    break;
+                case S::CSI_INTERMEDIATE:
+                    stay({ CC_INTERMEDIATE }, A::COLLECT);
+                    on(parameterBytes, A::NONE, S::CSI_IGNORE);
+                    on(finals, A::CSI_DISPATCH, S::GROUND);
+                    on({ CC_NON_ASCII }, A::NONE, S::GROUND);
+                    break;
+                case S::CSI_IGNORE:
+                    on(finals, A::NONE, S::GROUND);
+                    on({ CC_NON_ASCII }, A::NONE, S::GROUND);
+                    break;
+                case S::DCS_ENTRY:
+                    stay({ CC_C0, CC_BEL }, A::NONE);
+                    on({ CC_INTERMEDIATE }, A::COLLECT, S::DCS_INTERMEDIATE);
+                    on(params, A::PARAM, S::DCS_PARAM);
+                    on({ CC_PRIVATE }, A::COLLECT, S::DCS_PARAM);
+                    on(finals, A::NONE, S::DCS_PASSTHROUGH);
+                    on({ CC_NON_ASCII }, A::NONE, S::DCS_IGNORE);
+                    break;
+                case S::DCS_PARAM:
+                    stay({ CC_C0, CC_BEL }, A::NONE);
+                    stay(params, A::PARAM);
+                    on({ CC_PRIVATE }, A::NONE, S::DCS_IGNORE);
+                    on({ CC_INTERMEDIATE }, A::COLLECT, S::DCS_INTERMEDIATE);
+                    on(finals, A::NONE, S::DCS_PASSTHROUGH);
+                    on({ CC_NON_ASCII }, A::NONE, S::DCS_IGNORE);
+                    break;
+                case S::DCS_INTERMEDIATE:
+                    stay({ CC_C0, CC_BEL }, A::NONE);
+                    stay({ CC_INTERMEDIATE }, A::COLLECT);
+                    on(parameterBytes, A::NONE, S::DCS_IGNORE);
+                    on(finals, A::NONE, S::DCS_PASSTHROUGH);
+                    on({ CC_NON_ASCII }, A::NONE, S::DCS_IGNORE);
+                    break;
+                case S::DCS_PASSTHROUGH:
+                    stay({ CC_C0, CC_BEL, CC_INTERMEDIATE, CC_NON_ASCII }, A::PUT);
+                    stay(parameterBytes, A::PUT);
+                    stay(finals, A::PUT);
+                    break;
+                case S::DCS_IGNORE:
+                case S::SOS_PM_APC_STRING:
+                    stay({ CC_C0, CC_BEL }, A::NONE);
+                    break;
+                case S::OSC_STRING:
+                    stay({ CC_C0 }, A::NONE);
+                    on({ CC_BEL }, A::NONE, S::GROUND); // xterm accepts BEL as well as ST
+                    stay({ CC_INTERMEDIATE, CC_DEL, CC_NON_ASCII }, A::OSC_PUT);
+                    stay(parameterBytes, A::OSC_PUT);
+                    stay(finals, A::OSC_PUT);
+                    break;
+                default:
+                    break;
+                }
+
+                // "Anywhere" transitions
+                on({ CC_CAN_SUB }, A::EXECUTE, S::GROUND);
+                on({ CC_ESC }, A::NONE, S::ESCAPE);
+            }
+            return table;
+        }
+
+        constexpr std::array<CharClass, 0x80> charClassTable = BuildCharClassTable();
+        constexpr TransitionTable transitionTable = BuildTransitionTable();
+
+        // Returns how many code points from the start of 'text' are printable in GROUND state
+        // (anything from 0x20 up, C0 controls end the run). Scans 8 code points per step.
+        size_t FindPrintableRunLength(const char32_t* text, size_t length)
+        {
+            size_t i = 0;
+#if defined(WRT_SIMD_SSE2)
+            // Code points never exceed 0x10FFFF, so a signed compare is safe
+            const __m128i firstPrintable = _mm_set1_epi32(0x20);
+            for (; i + 8 <= length; i += 8) {
+                const __m128i* block = reinterpret_cast<const __m128i*>(text + i);
+                __m128i lo = _mm_cmplt_epi32(_mm_loadu_si128(block), firstPrintable);
+                __m128i hi = _mm_cmplt_epi32(_mm_loadu_si128(block + 1), firstPrintable);
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi32(lo, hi)));
+                if (mask != 0) {
+                    return i + (std::countr_zero(mask) / 2);
+                }
+            }
+#elif defined(WRT_SIMD_NEON)
+            const uint32x4_t firstPrintable = vdupq_n_u32(0x20);
+            const uint32_t* units = reinterpret_cast<const uint32_t*>(text);
+            for (; i + 8 <= length; i += 8) {
+                uint32x4_t lo = vcltq_u32(vld1q_u32(units + i), firstPrintable);
+                uint32x4_t hi = vcltq_u32(vld1q_u32(units + i + 4), firstPrintable);
+                if (vmaxvq_u32(vorrq_u32(lo, hi)) != 0) {
+                    break; // Scalar tail finds the exact position
+                }
+            }
+#endif
+            while (i < length && text[i] >= 0x20) {
+                ++i;
+            }
+            return i;
+        }
+
+        // Splits off the next ';'-separated field of an OSC payload
+        std::string_view NextOscField(std::string_view& payload)
+        {
+            size_t end = payload.find(';');
+            std::string_view field = payload.substr(0, end);
+            payload.remove_prefix(end == std::string_view::npos ? payload.size() : end + 1);
+            return field;
+        }
+
+        bool ParseOscNumber(std::string_view text, int& value)
+        {
+            if (text.empty() || text.size() > 5) return false;
+            value = 0;
+            for (char ch : text) {
+                if (ch < '0' || ch > '9') return false;
+                value = value * 10 + (ch - '0');
+            }
+            return true;
+        }
+
+        int HexDigitValue(char ch)
+        {
+            if (ch >= '0' && ch <= '9') return ch - '0';
+            if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+            if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+            return -1;
+        }
+
+        // Parses 1-4 hex digits and scales them to 0-255, as XParseColor does
+        bool ParseScaledHex(std::string_view digits, uint32_t& component)
+        {
+            if (digits.empty() || digits.size() > 4) return false;
+            uint32_t value = 0;
+            for (char ch : digits) {
+                int digit = HexDigitValue(ch);
+                if (digit < 0) return false;
+                value = (value << 4) | static_cast<uint32_t>(digit);
+            }
+            uint32_t max = (1u << (4 * digits.size())) - 1;
+            component = (value * 255 + max / 2) / max;
+            return true;
+        }
+
+        // X11 color specs as used by xterm: "rgb:r/g/b" with 1-4 hex digits per component,
+        // or "#rgb" with 1-4 digits per component where the digits are the high bits.
+        // Named colors are not supported.
+        bool ParseColorSpec(std::string_view spec, uint32_t& rgb)
+        {
+            uint32_t components[3] = {};
+            if (spec.starts_with("rgb:")) {
+                spec.remove_prefix(4);
+                for (int i = 0; i < 3; ++i) {
+                    size_t end = i < 2 ? spec.find('/') : spec.size();
+                    if (end == std::string_view::npos || !ParseScaledHex(spec.substr(0, end), components[i])) return false;
+                    spec.remove_prefix(i < 2 ? end + 1 : end);
+                }
+            }
+            else if (spec.starts_with('#') && (spec.size() - 1) % 3 == 0 && spec.size() > 1 && spec.size() <= 13) {
+                size_t digits = (spec.size() - 1) / 3;
+                for (int i = 0; i < 3; ++i) {
+                    uint32_t value = 0;
+                    for (size_t d = 0; d < digits; ++d) {
+                        int digit = HexDigitValue(spec[1 + i * digits + d]);
+                        if (digit < 0) return false;
+                        value = (value << 4) | static_cast<uint32_t>(digit);
+                    }
+                    // Keep the top 8 bits; a single digit is its own high nibble
+                    components[i] = digits == 1 ? value << 4 : value >> (4 * (digits - 2));
+                }
+            }
+            else {
+                return false;
+            }
+            rgb = (components[0] << 16) | (components[1] << 8) | components[2];
+            return true;
+        }
+    }
+
     AnsiParser::AnsiParser(ITerminalActions& actions) : m_terminalActions(actions), m_currentState(ParserState::GROUND)
     {
         ClearSequenceState();
+        m_stringBuffer.reserve(m_stringLimit);
     }
 
     void AnsiParser::ClearSequenceState()
     {
-        m_params.clear();
-        m_intermediates.clear();
+        m_params.Clear();
+        m_privateMarker = 0;
+        m_intermediateCount = 0;
     }
 
-    void AnsiParser::ParamDigit(wchar_t digit) {
-        if (m_params.empty()) {
-            m_params.push_back(0);
+    void AnsiParser::CollectIntermediate(char32_t ch) {
+        if (ch >= U'<' && ch <= U'?') {
+            // The table only collects these directly after the introducer
+            m_privateMarker = static_cast<char>(ch);
+            return;
         }
-        int currentParamIndex = static_cast<int>(m_params.size() - 1);
-        long long val = m_params[currentParamIndex];
-        val = val * 10 + (digit - L'0');
-
-        // Clamp to avoid overflow, typical terminal int range
-        if (val > std::numeric_limits<int>::max()) {
-            val = std::numeric_limits<int>::max();
+        if (m_intermediateCount < MAX_INTERMEDIATES) {
+            m_intermediates[m_intermediateCount] = static_cast<char>(ch);
         }
-        m_params[currentParamIndex] = static_cast<int>(val);
-    }
-
-    void AnsiParser::ParamSeparator() {
-        if (m_params.size() < MAX_PARAMS) {
-            if (m_params.empty()) {
-                m_params.push_back(0);
-            }
-            m_params.push_back(0);
+        if (m_intermediateCount <= MAX_INTERMEDIATES) {
+            ++m_intermediateCount;
         }
     }
 
-    void AnsiParser::CollectIntermediate(wchar_t ch) {
-        if (m_intermediates.length() < 16) {
-            m_intermediates += ch;
+    int32_t AnsiParser::PackedIntermediates() const {
+        char chars[1 + MAX_INTERMEDIATES];
+        size_t count = 0;
+        if (m_privateMarker != 0) {
+            chars[count++] = m_privateMarker;
         }
-    }
-
-    int AnsiParser::GetParam(size_t index, int defaultValue) const {
-        if (index < m_params.size()) {
-            if (m_params[index] == 0 && defaultValue != 0) {
-                return defaultValue;
-            }
-            return m_params[index];
+        for (size_t i = 0; i < m_intermediateCount && i < MAX_INTERMEDIATES; ++i) {
+            chars[count++] = m_intermediates[i];
         }
-        return defaultValue;
+        return Trace::PackChars(chars, count);
     }
 
-    void AnsiParser::DispatchCsi(wchar_t finalChar) {
-        OutputDebugString((L"AnsiParser: CSI Dispatch - Final: '" + std::wstring(1, finalChar) + L"'").c_str());
-        OutputDebugString(L" Params: {");
-        for (size_t i = 0; i < m_params.size(); ++i) {
-            OutputDebugString(std::to_wstring(m_params[i]).c_str());
-            if (i < m_params.size() - 1) OutputDebugString(L", ");
-        }
-        OutputDebugString(L"} Intermediates: '");
-        OutputDebugString(m_intermediates.c_str());
-        OutputDebugString(L"'\n");
+    void AnsiParser::DispatchCsi(char32_t finalChar) {
+        WRT_TRACE(TraceCategory::Parser, TraceLevel::Verbose, TraceEvent::CsiDispatch, static_cast<int32_t>(finalChar),
+            PackedIntermediates(), static_cast<int32_t>(m_params.size()), GetParam(0, 0));
 
-        if (!m_intermediates.empty() && m_intermediates != L"?" && m_intermediates != L"!") {
-            OutputDebugString((L"AnsiParser: CSI Dispatch with unhandled intermediates '" + m_intermediates + L"', ignoring for now.\n").c_str());
+        // Nothing handled below takes intermediates, and '?' is the only private marker understood
+        if (HasIntermediates() || (m_privateMarker != 0 && m_privateMarker != '?')) {
+            WRT_TRACE(TraceCategory::Parser, TraceLevel::Info, TraceEvent::CsiUnhandled, static_cast<int32_t>(finalChar), PackedIntermediates());
             return;
         }
 
+        const bool isPrivate = m_privateMarker == '?';
+        const VtParamsView params = m_params.View();
+
         switch (finalChar) {
         case L'A': // CUU - Cursor Up
-            if (m_intermediates.empty()) {
+            if (!isPrivate) {
                 m_terminalActions.CursorUp(GetParam(0, 1));
             }
             break;
         case L'B': // CUD - Cursor Down
-            if (m_intermediates.empty()) {
+            if (!isPrivate) {
                 m_terminalActions.CursorDown(GetParam(0, 1));
             }
             break;
         case L'C': // CUF - Cursor Forward
-            if (m_intermediates.empty()) {
+            if (!isPrivate) {
                 m_terminalActions.CursorForward(GetParam(0, 1));
             }
             break;
         case L'D': // CUB - Cursor Back
-            if (m_intermediates.empty()) {
+            if (!isPrivate) {
                 m_terminalActions.CursorBack(GetParam(0, 1));
             }
             break;
         case L'H': // CUP - Cursor Position
         case L'f': // HVP - Horizontal and Vertical Position (same as CUP)
-            if (m_intermediates.empty()) {
+            if (!isPrivate) {
                 m_terminalActions.CursorPosition(GetParam(0, 1), GetParam(1, 1));
             }
             break;
-        case L'J': // ED - Erase in Display
-            if (m_intermediates.empty() || m_intermediates == L"?") { // CSI ? J is DECSED
-                m_terminalActions.EraseInDisplay(GetParam(0, 0));
+        case L'J': // ED - Erase in Display (CSI ? J is DECSED)
+            m_terminalActions.EraseInDisplay(GetParam(0, 0));
+            break;
+        case L'K': // EL - Erase in Line (CSI ? K is DECSEL)
+            m_terminalActions.EraseInLine(GetParam(0, 0));
+            break;
+        case L'r': // DECSTBM - Set Top and Bottom Margins (CSI ? r is XTRESTORE)
+            if (!isPrivate) {
+                m_terminalActions.SetScrollingRegion(GetParam(0, 1), GetParam(1, 0));
             }
             break;
-        case L'K': // EL - Erase in Line
-            if (m_intermediates.empty() || m_intermediates == L"?") { // CSI ? K is DECSEL
-                m_terminalActions.EraseInLine(GetParam(0, 0));
+        case L'S': // SU - Scroll Up
+            if (!isPrivate) {
+                m_terminalActions.ScrollUp(GetParam(0, 1));
             }
             break;
-        case L'm': // SGR - Select Graphic Rendition
-            if (m_params.empty()) {
-                m_terminalActions.SetGraphicsRendition({ 0 });
+        case L'T': // SD - Scroll Down; with more than one parameter it is xterm's mouse highlight tracking
+            if (!isPrivate && params.size() <= 1) {
+                m_terminalActions.ScrollDown(GetParam(0, 1));
             }
-            else {
-                m_terminalActions.SetGraphicsRendition(m_params);
+            break;
+        case L'L': // IL - Insert Line
+            if (!isPrivate) {
+                m_terminalActions.InsertLines(GetParam(0, 1));
             }
             break;
-        case L'h': // DECSET - DEC Private Mode Set
-            if (m_intermediates == L"?") {
-                for (size_t i = 0; i < m_params.size(); ++i) {
-                    int mode = GetParam(i, -1);
-                    if (mode != -1) {
-                        m_terminalActions.SetDecPrivateMode(mode, true);
-                    }
-                }
+        case L'M': // DL - Delete Line
+            if (!isPrivate) {
+                m_terminalActions.DeleteLines(GetParam(0, 1));
+            }
+            break;
+        case L'@': // ICH - Insert Character
+            if (!isPrivate) {
+                m_terminalActions.InsertCharacters(GetParam(0, 1));
             }
             break;
+        case L'P': // DCH - Delete Character
+            if (!isPrivate) {
+                m_terminalActions.DeleteCharacters(GetParam(0, 1));
+            }
+            break;
+        case L'm': // SGR - Select Graphic Rendition, an empty list means reset
+            if (!isPrivate) {
+                m_terminalActions.SetGraphicsRendition(params);
+            }
+            break;
+        case L's': // SCOSC - Save Cursor; with parameters it would be DECSLRM, which needs left/right margins
+            if (!isPrivate && params.size() == 0) {
+                m_terminalActions.SaveCursor();
+            }
+            break;
+        case L'u': // SCORC - Restore Cursor (CSI ? u is a keyboard protocol query)
+            if (!isPrivate && params.size() == 0) {
+                m_terminalActions.RestoreCursor();
+            }
+            break;
+        case L'h': // DECSET - DEC Private Mode Set
         case L'l': // DECRST - DEC Private Mode Reset
-            if (m_intermediates == L"?") 
-            {
-                for (size_t i = 0; i < m_params.size(); ++i) 
-                {
-                    int mode = GetParam(i, -1);
-                    if (mode != -1) 
-                    {
-                        m_terminalActions.SetDecPrivateMode(mode, false);
+            if (isPrivate) {
+                for (size_t i = 0; i < params.size(); ++i) {
+                    if (params[i] != 0) {
+                        m_terminalActions.SetDecPrivateMode(params[i], finalChar == L'h');
                     }
                 }
             }
             break;
 
         default:
-            OutputDebugString((L"AnsiParser: Unhandled CSI final character: '" + std::wstring(1, finalChar) + L"' with intermediates '" + m_intermediates + L"'\n").c_str());
+            WRT_TRACE(TraceCategory::Parser, TraceLevel::Info, TraceEvent::CsiUnhandled, static_cast<int32_t>(finalChar), PackedIntermediates());
             break;
         }
     }
 
-    void AnsiParser::DispatchEscapeSequence(wchar_t finalChar) {
-        OutputDebugString((L"AnsiParser: ESC Dispatch - Intermediates: '" + m_intermediates + L"' Final: '" + std::wstring(1, finalChar) + L"'\n").c_str());
+    void AnsiParser::DispatchEscapeSequence(char32_t finalChar) {
+        WRT_TRACE(TraceCategory::Parser, TraceLevel::Verbose, TraceEvent::EscDispatch, static_cast<int32_t>(finalChar), PackedIntermediates());
 
-        if (m_intermediates.length() == 1) {
-            wchar_t intermediate = m_intermediates[0];
+        if (m_intermediateCount == 1) {
+            char intermediate = m_intermediates[0];
             uint8_t targetSet = 0xFF;
 
             switch (intermediate) {
-            case L'(': targetSet = 0; break; // G0
-            case L')': targetSet = 1; break; // G1
-            case L'-': targetSet = 1; break; // G1 (VT300)
-            case L'*': targetSet = 2; break; // G2
-            case L'.': targetSet = 2; break; // G2 (VT300)
-            case L'+': targetSet = 3; break; // G3
-            case L'/': targetSet = 3; break; // G3 (VT300)
+            case '(': targetSet = 0; break; // G0
+            case ')': targetSet = 1; break; // G1
+            case '-': targetSet = 1; break; // G1 (VT300)
+            case '*': targetSet = 2; break; // G2
+            case '.': targetSet = 2; break; // G2 (VT300)
+            case '+': targetSet = 3; break; // G3
+            case '/': targetSet = 3; break; // G3 (VT300)
             default:
                 // Unknown intermediate for SCS
                 break;
             }
 
             if (targetSet != 0xFF) {
-                m_terminalActions.DesignateCharSet(targetSet, finalChar);
+                m_terminalActions.DesignateCharSet(targetSet, static_cast<wchar_t>(finalChar));
                 return;
             }
         }
 
-        if (m_intermediates.empty()) {
+        if (!HasIntermediates()) {
             switch (finalChar) {
             case L'D': m_terminalActions.LineFeed(); break;                                     // IND - Index (move down one line)
             case L'E': m_terminalActions.CarriageReturn(); m_terminalActions.LineFeed(); break; // NEL - Next Line
-            case L'M': break;                                                                   // RI - Reverse Index (move up one line, scroll if at top)
+            case L'M': m_terminalActions.ReverseIndex(); break;                                 // RI - Reverse Index (move up one line, scroll if at top)
+            case L'7': m_terminalActions.SaveCursor(); break;                                   // DECSC - Save Cursor
+            case L'8': m_terminalActions.RestoreCursor(); break;                                // DECRC - Restore Cursor
             case L'=': m_terminalActions.SetDecPrivateMode(66, true); break;                    // DECKPAM - Keypad Application Mode
             case L'>': m_terminalActions.SetDecPrivateMode(66, false); break;                   // DECKPNM - Keypad Numeric Mode
+            case L'\\': break;                                                                  // ST - String Terminator, the string states already ended
             default:
-                OutputDebugString((L"AnsiParser: Unhandled simple ESC sequence: ESC " + std::wstring(1, finalChar) + L"\n").c_str());
+                WRT_TRACE(TraceCategory::Parser, TraceLevel::Info, TraceEvent::EscUnhandled, static_cast<int32_t>(finalChar));
                 break;
             }
         }
     }
 
-    void AnsiParser::Parse(const char* data, size_t length)
+    void AnsiParser::SetStringLimit(size_t limit)
     {
-        if (length == 0) return;
+        m_stringLimit = std::max(limit, MIN_STRING_LIMIT);
+        m_stringBuffer.clear();
+        m_stringBuffer.shrink_to_fit();
+        m_stringBuffer.reserve(m_stringLimit);
+    }
 
-        // Prepend any partial UTF-8 sequence from the previous call
-        std::vector<char> currentData;
-        if (!m_utf8PartialSequence.empty()) {
-            currentData.insert(currentData.end(), m_utf8PartialSequence.begin(), m_utf8PartialSequence.end());
-            m_utf8PartialSequence.clear();
+    bool AnsiParser::AppendToString(char32_t ch)
+    {
+        // Payloads are kept as UTF-8, the form hosts and URIs expect
+        char bytes[4];
+        size_t count = 0;
+        if (ch < 0x80) {
+            bytes[count++] = static_cast<char>(ch);
         }
-        currentData.insert(currentData.end(), data, data + length);
-
-        // Convert UTF-8 (common from ConPTY) to wide char (UTF-16)
-        if (currentData.empty()) return;
-
-        int wideCharCount = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, currentData.data(), static_cast<int>(currentData.size()), nullptr, 0);
-
-        std::wstring wideString;
-        if (wideCharCount > 0) {
-            wideString.resize(wideCharCount);
-            MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, currentData.data(), static_cast<int>(currentData.size()), &wideString[0], wideCharCount);
+        else if (ch < 0x800) {
+            bytes[count++] = static_cast<char>(0xC0 | (ch >> 6));
+            bytes[count++] = static_cast<char>(0x80 | (ch & 0x3F));
         }
-        else
-        {
-            DWORD error = GetLastError();
-            if (error == ERROR_NO_UNICODE_TRANSLATION)
-            {
-                size_t bytesToKeep = 0;
-                if (currentData.size() >= 1 && (static_cast<unsigned char>(currentData.back()) & 0xC0) == 0xC0) bytesToKeep = 1;
-                if (currentData.size() >= 2 && (static_cast<unsigned char>(currentData[currentData.size() - 2]) & 0xE0) == 0xE0 && (static_cast<unsigned char>(currentData.back()) & 0xC0) == 0x80) bytesToKeep = 2;
-                if (currentData.size() >= 3 && (static_cast<unsigned char>(currentData[currentData.size() - 3]) & 0xF0) == 0xF0 && (static_cast<unsigned char>(currentData[currentData.size() - 2]) & 0xC0) == 0x80 && (static_cast<unsigned char>(currentData.back()) & 0xC0) == 0x80) bytesToKeep = 3;
-
-                if (bytesToKeep > 0 && bytesToKeep < currentData.size())
-                {
-                    m_utf8PartialSequence.assign(currentData.end() - bytesToKeep, currentData.end());
-                    // Try converting the part before the partial sequence
-                    wideCharCount = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, currentData.data(), static_cast<int>(currentData.size() - bytesToKeep), nullptr, 0);
-                    if (wideCharCount > 0)
-                    {
-                        wideString.resize(wideCharCount);
-                        MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, currentData.data(), static_cast<int>(currentData.size() - bytesToKeep), &wideString[0], wideCharCount);
-                    }
-                    else
-                    {
-                        OutputDebugStringA("AnsiParser: Failed to convert to wide char or no complete chars.\n");
-                        return;
-                    }
-                }
-                else if (bytesToKeep == currentData.size())
-                {
-                    m_utf8PartialSequence.assign(currentData.begin(), currentData.end());
-                    return;
-                }
-                else
-                {
-                    OutputDebugStringA("AnsiParser: MultiByteToWideChar failed with ERROR_NO_UNICODE_TRANSLATION.\n");
-                    return;
-                }
-            }
-            else if (error != 0)
-            {
-                OutputDebugStringA("AnsiParser: MultiByteToWideChar failed.\n");
-                return;
-            }
+        else if (ch < 0x10000) {
+            bytes[count++] = static_cast<char>(0xE0 | (ch >> 12));
+            bytes[count++] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+            bytes[count++] = static_cast<char>(0x80 | (ch & 0x3F));
+        }
+        else {
+            bytes[count++] = static_cast<char>(0xF0 | (ch >> 18));
+            bytes[count++] = static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+            bytes[count++] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+            bytes[count++] = static_cast<char>(0x80 | (ch & 0x3F));
         }
 
-        for (wchar_t wc : wideString) {
-            ProcessChar(wc);
+        if (m_stringBuffer.size() + count > m_stringLimit) {
+            return false;
         }
+        m_stringBuffer.append(bytes, count);
+        return true;
     }
 
-    void AnsiParser::ProcessChar(wchar_t ch)
+    void AnsiParser::OscPut(char32_t ch)
     {
-        switch (m_currentState) {
-        case ParserState::GROUND:
-            if (ch >= 0x20 && ch <= 0x7F) {
-                m_terminalActions.PrintChar(ch);
-            }
-            else if (ch == L'\x1B') { // ESC
-                ClearSequenceState();
-                m_currentState = ParserState::ESCAPE;
-            }
-            else if (ch == L'\n') { // LF
-                m_terminalActions.LineFeed();
-            }
-            else if (ch == L'\r') { // CR
-                m_terminalActions.CarriageReturn();
-            }
-            else if (ch == L'\b') { // BS
-                m_terminalActions.Backspace();
-            }
-            else if (ch == L'\t') { // HT
-                m_terminalActions.HorizontalTab();
-            }
-            else if (ch == L'\x07') { // BEL
-                m_terminalActions.Bell();
+        if (m_stringOverflow) {
+            return;
+        }
+        if (!m_oscCommandDone) {
+            if (ch >= U'0' && ch <= U'9') {
+                m_oscCommand = std::min(m_oscCommand * 10 + static_cast<int>(ch - U'0'), 0xFFFF);
             }
-            else if ((ch >= 0x00 && ch <= 0x1A) || (ch >= 0x1C && ch <= 0x1F)) {
-                m_terminalActions.ExecuteControlFunction(ch);
+            else if (ch == U';') {
+                m_oscCommandDone = true;
             }
-            else if (ch >= 0x80) {
-                // This is a simplification. Proper C1 handling is more involved.
-                m_terminalActions.PrintChar(ch);
+            else {
+                m_stringOverflow = true; // Not a numeric command, ignore the whole string
             }
-            break;
+            return;
+        }
 
-        case ParserState::ESCAPE:
-            if (ch == L'[') // CSI
-            {
-                m_currentState = ParserState::CSI_ENTRY;
-            }
-            else if ((ch >= L'(' && ch <= L'+') || (ch >= L'-' && ch <= L'/')) // SCS Intermediate characters (for G0, G1, G2, G3 designation)
-            {
-                CollectIntermediate(ch);
-                m_currentState = ParserState::ESCAPE_INTERMEDIATE;
-            }
-            else if (ch == L'P') // DCS
-            {
-                m_currentState = ParserState::DCS_ENTRY;
-            }
-            else if (ch == L']') // OSC
-            {
-                m_currentState = ParserState::OSC_STRING;
-            }
-            else if (ch == L'X')
-            {
-                m_currentState = ParserState::OSC_STRING;
-            }
-            else if (ch == L'^')
-            {
-                m_currentState = ParserState::OSC_STRING;
-            }
-            else if (ch == L'_')
-            {
-                m_currentState = ParserState::OSC_STRING;
+        if (!AppendToString(ch)) {
+            if (m_oscCommand == 52) {
+                // Clipboard data is the one OSC payload that is routinely large: stream it
+                FlushClipboardChunk(false);
+                if (!m_stringOverflow) {
+                    AppendToString(ch);
+                }
             }
-            else if (ch >= 0x28 && ch <= 0x2F)
-            {
-                CollectIntermediate(ch);
-                m_currentState = ParserState::ESCAPE_INTERMEDIATE;
+            else {
+                m_stringOverflow = true;
             }
-            else if (ch >= 0x40 && ch <= 0x5F) 
-            {
-                DispatchEscapeSequence(ch);
-                m_currentState = ParserState::GROUND;
+        }
+    }
+
+    void AnsiParser::FlushClipboardChunk(bool last)
+    {
+        std::string_view data = m_stringBuffer;
+        if (!m_stringStreamed) {
+            // The first chunk starts with the selection field, e.g. "c;" or "pc;"
+            size_t separator = data.find(';');
+            if (separator == std::string_view::npos || separator > sizeof(m_clipboardSelection)) {
+                m_stringOverflow = true;
+                return;
             }
-            else
-            {
-                m_currentState = ParserState::GROUND;
+            std::copy_n(data.data(), separator, m_clipboardSelection);
+            m_clipboardSelectionLength = separator;
+            data.remove_prefix(separator + 1);
+            if (data == "?") {
+                return; // Clipboard queries are not answered, there is no reply channel to the PTY
             }
-            break;
+        }
 
-        case ParserState::ESCAPE_INTERMEDIATE:
-            if (ch >= 0x20 && ch <= 0x7E) {
-                DispatchEscapeSequence(ch);
-                m_currentState = ParserState::GROUND;
+        m_terminalActions.ClipboardWrite(std::string_view(m_clipboardSelection, m_clipboardSelectionLength), data, !m_stringStreamed, last);
+        m_stringStreamed = true;
+        m_stringBuffer.clear();
+    }
+
+    void AnsiParser::DispatchOsc()
+    {
+        if (m_stringOverflow) {
+            WRT_TRACE(TraceCategory::Parser, TraceLevel::Info, TraceEvent::OscUnhandled, m_oscCommand, static_cast<int32_t>(m_stringBuffer.size()));
+            return;
+        }
+        WRT_TRACE(TraceCategory::Parser, TraceLevel::Verbose, TraceEvent::OscDispatch, m_oscCommand, static_cast<int32_t>(m_stringBuffer.size()));
+
+        std::string_view payload = m_stringBuffer;
+        switch (m_oscCommand) {
+        case 0: // Icon name and window title
+        case 2: // Window title
+            m_terminalActions.SetWindowTitle(payload);
+            break;
+        case 1: // Icon name only, nothing to show it on
+            break;
+        case 4: { // Palette: 4;index;spec[;index;spec...]
+            while (!payload.empty()) {
+                std::string_view indexField = NextOscField(payload);
+                std::string_view specField = NextOscField(payload);
+                int index = 0;
+                uint32_t rgb = 0;
+                if (ParseOscNumber(indexField, index) && index <= 255 && ParseColorSpec(specField, rgb)) {
+                    m_terminalActions.SetPaletteColor(index, rgb);
+                }
             }
-            else if (ch == 0x1B) { // ESC (Abort)
-                m_currentState = ParserState::GROUND;
+            break;
+        }
+        case 10: // Default foreground, an extra field continues with 11
+        case 11: { // Default background
+            for (int command = m_oscCommand; !payload.empty() && command <= 11; ++command) {
+                uint32_t rgb = 0;
+                if (ParseColorSpec(NextOscField(payload), rgb)) {
+                    m_terminalActions.SetDefaultColor(command == 10, rgb);
+                }
             }
-            else {
-                // Unexpected character
-                m_currentState = ParserState::GROUND;
+            break;
+        }
+        case 8: { // Hyperlink: 8;key=value:key=value;uri
+            std::string_view params = NextOscField(payload);
+            std::string_view id;
+            while (!params.empty()) {
+                size_t end = params.find(':');
+                std::string_view param = params.substr(0, end);
+                if (param.starts_with("id=")) {
+                    id = param.substr(3);
+                }
+                params.remove_prefix(end == std::string_view::npos ? params.size() : end + 1);
             }
+            m_terminalActions.SetHyperlink(id, payload);
             break;
+        }
+        case 52: // Clipboard: 52;selection;base64
+            FlushClipboardChunk(true);
+            break;
+        default:
+            WRT_TRACE(TraceCategory::Parser, TraceLevel::Info, TraceEvent::OscUnhandled, m_oscCommand, static_cast<int32_t>(m_stringBuffer.size()));
+            break;
+        }
+    }
 
+    void AnsiParser::DcsPut(char32_t ch)
+    {
+        if (!AppendToString(ch)) {
+            m_terminalActions.DcsPut(m_stringBuffer);
+            m_stringBuffer.clear();
+            AppendToString(ch);
+        }
+    }
 
-        case ParserState::CSI_ENTRY:
-            if (ch >= L'0' && ch <= L'9') { // Parameter digit
-                ParamDigit(ch);
-                m_currentState = ParserState::CSI_PARAM;
-            }
-            else if (ch == L';') { // Parameter separator
-                ParamSeparator();
-                m_currentState = ParserState::CSI_PARAM;
-            }
-            else if (ch >= L'<' && ch <= L'?') { // Private parameter characters: < = > ?
-                CollectIntermediate(ch);
-                m_currentState = ParserState::CSI_INTERMEDIATE;
-            }
-            else if (ch >= 0x20 && ch <= 0x2F) { // Intermediate characters ! " # $ % & ' ( ) * + , - . /
-                CollectIntermediate(ch);
-                m_currentState = ParserState::CSI_INTERMEDIATE;
+    void AnsiParser::Parse(const char* data, size_t length)
+    {
+        // Decode straight into the fixed scratch buffer; a sequence split across reads stays in the decoder
+        while (length > 0) {
+            Utf8Decoder::Result decoded = m_utf8Decoder.Decode(data, length, m_decodeBuffer, DECODE_BUFFER_SIZE);
+            data += decoded.bytesConsumed;
+            length -= decoded.bytesConsumed;
+            ProcessText(m_decodeBuffer, decoded.codePointsWritten);
+        }
+    }
+
+    void AnsiParser::ProcessText(const char32_t* text, size_t count)
+    {
+        size_t i = 0;
+        while (i < count) {
+            if (m_currentState == ParserState::GROUND) {
+                // Hand whole runs of printable text to the buffer at once instead of one call per character
+                size_t run = FindPrintableRunLength(text + i, count - i);
+                if (run > 0) {
+                    m_terminalActions.PrintString({ text + i, run });
+                    i += run;
+                    continue;
+                }
             }
-            else if (ch >= 0x40 && ch <= 0x7E) { // Final character for CSI sequence
-                DispatchCsi(ch);
-                m_currentState = ParserState::GROUND;
+            ProcessChar(text[i++]);
+        }
+    }
+
+    void AnsiParser::ProcessChar(char32_t ch)
+    {
+        CharClass charClass = ch < 0x80 ? charClassTable[ch] : CC_NON_ASCII;
+        uint8_t entry = transitionTable[static_cast<size_t>(m_currentState)][charClass];
+        ParserAction action = static_cast<ParserAction>(entry & 0x0F);
+        ParserState nextState = static_cast<ParserState>(entry >> 4);
+
+        if (nextState == m_currentState) {
+            PerformAction(action, ch);
+            return;
+        }
+
+        // Exit action of the old state, then the transition action, then entry action of the new state
+        ExitState(m_currentState, ch);
+        PerformAction(action, ch);
+        m_currentState = nextState;
+        EnterState(nextState, ch);
+    }
+
+    void AnsiParser::PerformAction(ParserAction action, char32_t ch)
+    {
+        switch (action) {
+        case ParserAction::NONE:
+            break;
+        case ParserAction::PRINT:
+            m_terminalActions.PrintChar(ch);
+            break;
+        case ParserAction::EXECUTE:
+            ExecuteControl(ch);
+            break;
+        case ParserAction::COLLECT:
+            CollectIntermediate(ch);
+            break;
+        case ParserAction::PARAM:
+            if (ch == U';') {
+                m_params.NextParam();
             }
-            else if (ch == 0x1B) { // ESC within CSI (abort)
-                m_currentState = ParserState::GROUND;
+            else if (ch == U':') {
+                m_params.NextSubParam();
             }
             else {
-                // Unexpected char in CSI_ENTRY
-                m_currentState = ParserState::GROUND;
+                m_params.AddDigit(static_cast<int>(ch - U'0'));
             }
             break;
+        case ParserAction::ESC_DISPATCH:
+            DispatchEscapeSequence(ch);
+            break;
+        case ParserAction::CSI_DISPATCH:
+            DispatchCsi(ch);
+            break;
+        case ParserAction::PUT:
+            DcsPut(ch);
+            break;
+        case ParserAction::OSC_PUT:
+            OscPut(ch);
+            break;
+        }
+    }
 
-        case ParserState::CSI_PARAM:
-            if (ch >= L'0' && ch <= L'9') { // Parameter digit
-                ParamDigit(ch);
-            }
-            else if (ch == L';') { // Parameter separator
-                ParamSeparator();
-            }
-            else if (ch >= 0x20 && ch <= 0x2F) { // Intermediate characters
-                CollectIntermediate(ch);
-                m_currentState = ParserState::CSI_INTERMEDIATE;
-            }
-            else if (ch >= 0x40 && ch <= 0x7E) { // Final character
-                DispatchCsi(ch);
-                m_currentState = ParserState::GROUND;
-            }
-            else if (ch == 0x1B) { // ESC within CSI (abort)
-                m_currentState = ParserState::GROUND;
-            }
-            else {
-                // Unexpected char in CSI_PARAM
-                m_currentState = ParserState::GROUND;
-            }
+    void AnsiParser::EnterState(ParserState state, char32_t ch)
+    {
+        switch (state) {
+        case ParserState::ESCAPE:
+        case ParserState::CSI_ENTRY:
+        case ParserState::DCS_ENTRY:
+            ClearSequenceState();
+            break;
+        case ParserState::OSC_STRING: // osc_start
+            m_stringBuffer.clear();
+            m_oscCommand = 0;
+            m_oscCommandDone = false;
+            m_stringOverflow = false;
+            m_stringStreamed = false;
+            break;
+        case ParserState::DCS_PASSTHROUGH: // hook, 'ch' is the final character
+            m_stringBuffer.clear();
+            m_terminalActions.DcsHook(m_params.View(), std::string_view(m_intermediates, std::min<size_t>(m_intermediateCount, MAX_INTERMEDIATES)), ch);
             break;
+        default:
+            break;
+        }
+    }
 
-        case ParserState::CSI_INTERMEDIATE:
-            if (ch >= 0x20 && ch <= 0x2F) { // More intermediate characters
-                CollectIntermediate(ch);
-            }
-            else if (ch >= 0x40 && ch <= 0x7E) { // Final character
-                DispatchCsi(ch);
-                m_currentState = ParserState::GROUND;
-            }
-            else if (ch == 0x1B) { // ESC within CSI (abort)
-                m_currentState = ParserState::GROUND;
+    void AnsiParser::ExitState(ParserState state, char32_t ch)
+    {
+        // CAN and SUB cancel a string, anything else (BEL, ESC of an ST) terminates it
+        const bool aborted = ch == 0x18 || ch == 0x1A;
+        switch (state) {
+        case ParserState::OSC_STRING: // osc_end
+            if (!aborted) {
+                DispatchOsc();
             }
-            else {
-                m_currentState = ParserState::GROUND; // Or an IGNORE state
+            break;
+        case ParserState::DCS_PASSTHROUGH: // unhook
+            if (!m_stringBuffer.empty() && !aborted) {
+                m_terminalActions.DcsPut(m_stringBuffer);
             }
+            m_stringBuffer.clear();
+            m_terminalActions.DcsUnhook(aborted);
             break;
+        default:
+            break;
+        }
+    }
 
-            // Future states will be added here
+    void AnsiParser::ExecuteControl(char32_t control)
+    {
+        switch (control) {
+        case U'\n': // LF
+        case U'\v': // VT, treated as LF
+        case U'\f': // FF, treated as LF
+            m_terminalActions.LineFeed();
+            break;
+        case U'\r': // CR
+            m_terminalActions.CarriageReturn();
+            break;
+        case U'\b': // BS
+            m_terminalActions.Backspace();
+            break;
+        case U'\t': // HT
+            m_terminalActions.HorizontalTab();
+            break;
+        case U'\a': // BEL
+            m_terminalActions.Bell();
+            break;
         default:
-            OutputDebugStringA("AnsiParser: Reached unknown state, resetting to GROUND.\n");
-            m_currentState = ParserState::GROUND;
+            m_terminalActions.ExecuteControlFunction(static_cast<wchar_t>(control));
             break;
         }
     }
-}
\ No newline at end of file
+}
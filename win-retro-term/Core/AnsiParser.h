@@ -1,12 +1,16 @@
 #pragma once
 #include "ITerminalActions.h"
+#include "Utf8Decoder.h"
+#include "VtParams.h"
+#include <cstdint>
 #include <string>
-#include <vector>
-#include <limits>
+#include <string_view>
 
 namespace winrt::win_retro_term::Core 
 {
-    enum class ParserState {
+    // States of the DEC ANSI parser (vt100.net/emu/dec_ansi_parser).
+    // Values are packed into 4 bits of a transition table entry.
+    enum class ParserState : uint8_t {
         GROUND,
 
         ESCAPE,
@@ -15,38 +19,95 @@ namespace winrt::win_retro_term::Core
         CSI_ENTRY,
         CSI_PARAM,
         CSI_INTERMEDIATE,
+        CSI_IGNORE,
+
+        DCS_ENTRY,
+        DCS_PARAM,
+        DCS_INTERMEDIATE,
+        DCS_PASSTHROUGH,
+        DCS_IGNORE,
 
         OSC_STRING,
+        SOS_PM_APC_STRING,
+
+        COUNT
+    };
 
-        DCS_ENTRY
+    // Actions performed on a transition. Entry/exit actions (clear, hook, unhook,
+    // osc_start, osc_end) are tied to the states instead and run when the state changes.
+    enum class ParserAction : uint8_t {
+        NONE,       // Also covers 'ignore'
+        PRINT,
+        EXECUTE,
+        COLLECT,
+        PARAM,
+        ESC_DISPATCH,
+        CSI_DISPATCH,
+        PUT,
+        OSC_PUT
     };
 
     class AnsiParser {
     public:
+        static constexpr size_t DEFAULT_STRING_LIMIT = 64 * 1024;
+        static constexpr size_t MIN_STRING_LIMIT = 256;
+
         AnsiParser(ITerminalActions& actions);
 
         void Parse(const char* data, size_t length);
 
+        // Caps how much of an OSC or DCS payload is held at once. DCS and OSC 52 payloads are
+        // delivered in chunks of this size, any other OSC string that outgrows it is dropped.
+        void SetStringLimit(size_t limit);
+
     private:
-        void ProcessChar(wchar_t ch);
+        void ProcessText(const char32_t* text, size_t count);
+        void ProcessChar(char32_t ch);
+        void PerformAction(ParserAction action, char32_t ch);
+        void EnterState(ParserState state, char32_t ch);
+        void ExitState(ParserState state, char32_t ch);
+        void ExecuteControl(char32_t control);
         void ClearSequenceState();
 
-        void ParamDigit(wchar_t digit);
-        void ParamSeparator();
-        void CollectIntermediate(wchar_t ch);
-        int GetParam(size_t index, int defaultValue) const;
+        void CollectIntermediate(char32_t ch);
+        bool HasIntermediates() const { return m_intermediateCount != 0; }
+        int32_t PackedIntermediates() const;
+        int GetParam(size_t index, int defaultValue) const { return m_params.View().At(index, defaultValue); }
 
-        void DispatchCsi(wchar_t finalChar);
-        void DispatchEscapeSequence(wchar_t finalChar);
+        void DispatchCsi(char32_t finalChar);
+        void DispatchEscapeSequence(char32_t finalChar);
+
+        bool AppendToString(char32_t ch);
+        void OscPut(char32_t ch);
+        void DispatchOsc();
+        void FlushClipboardChunk(bool last);
+        void DcsPut(char32_t ch);
 
         ITerminalActions& m_terminalActions;
         ParserState m_currentState;
 
-        std::vector<char> m_utf8PartialSequence;
-        std::vector<int> m_params;
-        std::wstring m_intermediates;
+        Utf8Decoder m_utf8Decoder;
+
+        // Sequence state lives inline so dispatching a sequence never allocates
+        static constexpr size_t MAX_INTERMEDIATES = 2;
+        VtParams m_params;
+        char m_privateMarker = 0;                   // One of '<', '=', '>', '?' right after CSI/DCS, or 0
+        char m_intermediates[MAX_INTERMEDIATES] = {};
+        uint8_t m_intermediateCount = 0;            // Counts past MAX_INTERMEDIATES so overlong sequences can be rejected
+
+        // OSC/DCS payload as UTF-8, reserved once so it never reallocates while a string is collected
+        std::string m_stringBuffer;
+        size_t m_stringLimit = DEFAULT_STRING_LIMIT;
+        int m_oscCommand = 0;
+        bool m_oscCommandDone = false;              // The numeric command and its ';' have been read
+        bool m_stringOverflow = false;              // Payload outgrew the limit and will be dropped
+        bool m_stringStreamed = false;              // Some chunks were already delivered
+        char m_clipboardSelection[16] = {};         // OSC 52 selection field, kept across chunks
+        size_t m_clipboardSelectionLength = 0;
+
+        static const size_t DECODE_BUFFER_SIZE = 4096;
 
-        static const int MAX_PARAMS = 16;
+        char32_t m_decodeBuffer[DECODE_BUFFER_SIZE];
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "ByteRing.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        void Signal(std::atomic<uint32_t>& signal)
+        {
+            signal.fetch_add(1, std::memory_order_release);
+            signal.notify_all();
+        }
+    }
+
+    ByteRing::ByteRing(size_t capacity)
+        : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 64))), m_mask(m_capacity - 1), m_writeLimit(m_capacity)
+    {
+        m_storage = std::make_unique<char[]>(m_capacity);
+    }
+
+    std::span<char> ByteRing::PrepareWrite()
+    {
+        uint64_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+        uint64_t readIndex = m_readIndex.load(std::memory_order_acquire);
+        size_t offset = static_cast<size_t>(writeIndex) & m_mask;
+        size_t used = static_cast<size_t>(writeIndex - readIndex);
+        size_t limit = m_writeLimit.load(std::memory_order_relaxed);
+        size_t free = used < limit ? limit - used : 0;
+        return { m_storage.get() + offset, std::min(free, m_capacity - offset) };
+    }
+
+    void ByteRing::CommitWrite(size_t count)
+    {
+        m_writeIndex.store(m_writeIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        Signal(m_dataSignal);
+    }
+
+    size_t ByteRing::Write(const char* data, size_t length)
+    {
+        size_t written = 0;
+        // At most two pieces around the wrap point
+        for (int piece = 0; piece < 2 && written < length; ++piece) {
+            std::span<char> region = PrepareWrite();
+            size_t count = std::min(region.size(), length - written);
+            if (count == 0) {
+                break;
+            }
+            std::memcpy(region.data(), data + written, count);
+            written += count;
+            m_writeIndex.store(m_writeIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        }
+        if (written > 0) {
+            Signal(m_dataSignal);
+        }
+        return written;
+    }
+
+    bool ByteRing::WaitForSpace()
+    {
+        while (true) {
+            uint32_t epoch = m_spaceSignal.load(std::memory_order_acquire);
+            if (IsClosed()) {
+                return false;
+            }
+            if (Size() < m_writeLimit.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            m_spaceSignal.wait(epoch, std::memory_order_acquire);
+        }
+    }
+
+    std::span<const char> ByteRing::PeekRead() const
+    {
+        uint64_t readIndex = m_readIndex.load(std::memory_order_relaxed);
+        uint64_t writeIndex = m_writeIndex.load(std::memory_order_acquire);
+        size_t offset = static_cast<size_t>(readIndex) & m_mask;
+        size_t available = static_cast<size_t>(writeIndex - readIndex);
+        return { m_storage.get() + offset, std::min(available, m_capacity - offset) };
+    }
+
+    void ByteRing::CommitRead(size_t count)
+    {
+        m_readIndex.store(m_readIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        Signal(m_spaceSignal);
+    }
+
+    void ByteRing::SetWriteLimit(size_t limit)
+    {
+        m_writeLimit.store(std::clamp<size_t>(limit, 1, m_capacity), std::memory_order_relaxed);
+        Signal(m_spaceSignal);
+    }
+
+    void ByteRing::WakeConsumer()
+    {
+        Signal(m_dataSignal);
+    }
+
+    void ByteRing::Close()
+    {
+        m_closed.store(true, std::memory_order_release);
+        Signal(m_spaceSignal);
+        Signal(m_dataSignal);
+    }
+}
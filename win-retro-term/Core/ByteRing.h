@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+namespace winrt::win_retro_term::Core
+{
+    // Lock-free single-producer/single-consumer byte ring.
+    // The producer (PTY reader thread) reads straight into PrepareWrite() spans, the consumer
+    // (parser worker) parses straight out of PeekRead() spans, so bytes are never copied in between.
+    // Both sides can block on the ring's signals; Close() releases them for shutdown.
+    class ByteRing {
+    public:
+        explicit ByteRing(size_t capacity); // Rounded up to a power of two
+
+        ByteRing(const ByteRing&) = delete;
+        ByteRing& operator=(const ByteRing&) = delete;
+
+        // --- Producer ---
+        // The largest contiguous free region, empty when the ring is full
+        std::span<char> PrepareWrite();
+        // Publishes 'count' bytes written into the last PrepareWrite() span and wakes the consumer
+        void CommitWrite(size_t count);
+        // Copies as much of 'data' as fits and returns the number of bytes written
+        size_t Write(const char* data, size_t length);
+        // Blocks until there is free space. Returns false once the ring is closed.
+        bool WaitForSpace();
+
+        // --- Consumer ---
+        // The largest contiguous readable region, empty when the ring is empty.
+        // A wrapped region is returned in two steps.
+        std::span<const char> PeekRead() const;
+        void CommitRead(size_t count);     // Also skips bytes unread, up to Size()
+        // Read the epoch before checking for work, then wait on it: any commit or WakeConsumer()
+        // after the read makes WaitForData return immediately.
+        uint32_t ConsumerEpoch() const { return m_dataSignal.load(std::memory_order_acquire); }
+        void WaitForData(uint32_t epoch) const { m_dataSignal.wait(epoch, std::memory_order_acquire); }
+        void WakeConsumer();
+
+        // Caps how much the producer may queue, at most Capacity(). Lowering it applies backpressure
+        // earlier without reallocating; raising it wakes a producer waiting for space.
+        void SetWriteLimit(size_t limit);
+        size_t WriteLimit() const { return m_writeLimit.load(std::memory_order_relaxed); }
+
+        // Wakes both sides for good; the producer stops writing, the consumer may still drain
+        void Close();
+        bool IsClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+        // Bytes committed and consumed since construction. Any thread may read them to mark a point in the stream.
+        uint64_t WritePosition() const { return m_writeIndex.load(std::memory_order_acquire); }
+        uint64_t ReadPosition() const { return m_readIndex.load(std::memory_order_acquire); }
+
+        size_t Capacity() const { return m_capacity; }
+        size_t Size() const {
+            return static_cast<size_t>(m_writeIndex.load(std::memory_order_acquire) - m_readIndex.load(std::memory_order_acquire));
+        }
+
+    private:
+        std::unique_ptr<char[]> m_storage;
+        size_t m_capacity;
+        size_t m_mask;
+        std::atomic<bool> m_closed{ false };
+        std::atomic<size_t> m_writeLimit;
+
+        // Monotonic counters and wake signals, producer and consumer state on separate cache lines
+        alignas(64) std::atomic<uint64_t> m_writeIndex{ 0 };
+        std::atomic<uint32_t> m_dataSignal{ 0 };
+        alignas(64) std::atomic<uint64_t> m_readIndex{ 0 };
+        std::atomic<uint32_t> m_spaceSignal{ 0 };
+    };
+}
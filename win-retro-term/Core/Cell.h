@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace winrt::win_retro_term::Core
+{
+    enum class CellAttributesFlags : uint16_t {
+        None = 0,
+        Bold = 1 << 0,
+        Italic = 1 << 1,
+        Underline = 1 << 2,
+        Inverse = 1 << 3,
+        Concealed = 1 << 4,
+        Strikethrough = 1 << 5,
+        Dim = 1 << 6,
+        DoubleUnderline = 1 << 7,   // Set together with Underline
+        CurlyUnderline = 1 << 8     // Set together with Underline
+    };
+
+    inline CellAttributesFlags operator|(CellAttributesFlags a, CellAttributesFlags b) {
+        return static_cast<CellAttributesFlags>(static_cast<uint16_t>(a) | static_cast<uint16_t>(b));
+    }
+    inline CellAttributesFlags& operator|=(CellAttributesFlags& a, CellAttributesFlags b) {
+        a = a | b;
+        return a;
+    }
+    inline CellAttributesFlags operator&(CellAttributesFlags a, CellAttributesFlags b) {
+        return static_cast<CellAttributesFlags>(static_cast<uint16_t>(a) & static_cast<uint16_t>(b));
+    }
+    inline CellAttributesFlags operator~(CellAttributesFlags a) {
+        return static_cast<CellAttributesFlags>(~static_cast<uint16_t>(a));
+    }
+
+    // A color as the application set it: the default, one of the 256 palette entries or 24-bit RGB.
+    // Left unresolved so palette changes (OSC 4/10/11) recolor text that is already on screen.
+    struct TextColor {
+        static constexpr uint32_t KIND_MASK = 0xFF000000;
+        static constexpr uint32_t KIND_INDEXED = 1u << 24;
+        static constexpr uint32_t KIND_RGB = 2u << 24;
+
+        uint32_t bits = 0; // 0 is the default color
+
+        static constexpr TextColor Default() { return {}; }
+        static constexpr TextColor Indexed(uint8_t index) { return { KIND_INDEXED | index }; }
+        static constexpr TextColor Rgb(uint32_t rgb) { return { KIND_RGB | (rgb & 0xFFFFFF) }; }
+
+        constexpr bool IsDefault() const { return bits == 0; }
+        constexpr bool IsIndexed() const { return (bits & KIND_MASK) == KIND_INDEXED; }
+        constexpr bool IsRgb() const { return (bits & KIND_MASK) == KIND_RGB; }
+        constexpr uint8_t Index() const { return static_cast<uint8_t>(bits); }
+        constexpr uint32_t RgbValue() const { return bits & 0xFFFFFF; }
+
+        bool operator==(const TextColor&) const = default;
+    };
+
+    // Everything about how a cell is drawn except its character. Cells refer to one by id, see StyleTable.
+    struct TextStyle {
+        TextColor foreground;
+        TextColor background;
+        TextColor underlineColor;   // Default follows the foreground
+        CellAttributesFlags attributes = CellAttributesFlags::None;
+        uint16_t hyperlink = 0;     // OSC 8 link id, see TerminalBuffer::GetHyperlinkUri; 0 when not a link
+
+        bool operator==(const TextStyle&) const = default;
+    };
+
+    // Cell text values past the last code point, still within 21 bits so scrollback stores them like any other.
+    // A wide character takes its cell plus a WIDE_SPACER to the right; a grapheme cluster of more than one
+    // code point is kept in its row's cluster list (CellGrid::Clusters) and the cell holds CLUSTER_CELL + index.
+    constexpr char32_t WIDE_SPACER = 0x110000;
+    constexpr char32_t CLUSTER_CELL = 0x110001;
+    constexpr size_t MAX_CLUSTER_LENGTH = 32;     // Code points past this are dropped
+
+    constexpr bool IsClusterCell(char32_t ch) { return ch >= CLUSTER_CELL; }
+
+    struct Cell {
+        char32_t character = U' ';  // A code point or one of the values above, 21 bits
+        uint32_t style = 0;         // StyleTable id, 0 is the default style
+    };
+    static_assert(sizeof(Cell) == 8, "Screen rows are sized on 8-byte cells");
+
+    // 'length' consecutive cells in one style. Rows store their styles as a list of these, see CellGrid.
+    struct StyleSpan {
+        uint32_t length;
+        uint32_t style;             // StyleTable id
+
+        bool operator==(const StyleSpan&) const = default;
+    };
+}
@@ -0,0 +1,484 @@
+#include "pch.h"
+#include "CellGrid.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <utility>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        // Sets 'count' code points to spaces, four per vector store
+        void FillSpaces(char32_t* text, size_t count)
+        {
+            size_t i = 0;
+#if defined(WRT_SIMD_SSE2)
+            const __m128i spaces = _mm_set1_epi32(U' ');
+            for (; i + 16 <= count; i += 16) {
+                __m128i* out = reinterpret_cast<__m128i*>(text + i);
+                _mm_storeu_si128(out + 0, spaces);
+                _mm_storeu_si128(out + 1, spaces);
+                _mm_storeu_si128(out + 2, spaces);
+                _mm_storeu_si128(out + 3, spaces);
+            }
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(text + i), spaces);
+            }
+#elif defined(WRT_SIMD_NEON)
+            const uint32x4_t spaces = vdupq_n_u32(U' ');
+            for (; i + 16 <= count; i += 16) {
+                uint32_t* out = reinterpret_cast<uint32_t*>(text + i);
+                vst1q_u32(out + 0, spaces);
+                vst1q_u32(out + 4, spaces);
+                vst1q_u32(out + 8, spaces);
+                vst1q_u32(out + 12, spaces);
+            }
+            for (; i + 4 <= count; i += 4) {
+                vst1q_u32(reinterpret_cast<uint32_t*>(text + i), spaces);
+            }
+#endif
+            for (; i < count; ++i) {
+                text[i] = U' ';
+            }
+        }
+
+        // Appends a run, merged into the last one when the style is the same
+        void AppendSpan(std::vector<StyleSpan>& out, uint32_t length, uint32_t style)
+        {
+            if (length == 0) return;
+            if (!out.empty() && out.back().style == style) {
+                out.back().length += length;
+            }
+            else {
+                out.push_back({ length, style });
+            }
+        }
+
+        // Appends the part of 'spans' covering cells from..to (exclusive)
+        void AppendRange(std::vector<StyleSpan>& out, std::span<const StyleSpan> spans, uint32_t from, uint32_t to)
+        {
+            uint32_t position = 0;
+            for (const StyleSpan& span : spans) {
+                uint32_t end = position + span.length;
+                if (end > from && position < to) {
+                    AppendSpan(out, std::min(end, to) - std::max(position, from), span.style);
+                }
+                if (end >= to) break;
+                position = end;
+            }
+        }
+    }
+
+    size_t CellGrid::RowStride(int cols)
+    {
+        // Smallest multiple of 'unit' code points that spans whole cache lines
+        const size_t unit = ROW_ALIGNMENT / std::gcd(ROW_ALIGNMENT, sizeof(char32_t));
+        size_t count = static_cast<size_t>(std::max(cols, 1));
+        return (count + unit - 1) / unit * unit;
+    }
+
+    CellGrid::CellGrid(int rows, int cols, uint32_t style)
+    {
+        Allocate(rows, cols);
+        if (m_text) {
+            FillRows(0, m_rows - 1, style);
+        }
+    }
+
+    CellGrid::CellGrid(const CellGrid& other)
+    {
+        *this = other;
+    }
+
+    CellGrid::CellGrid(CellGrid&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    CellGrid& CellGrid::operator=(const CellGrid& other)
+    {
+        if (this == &other) return *this;
+
+        if (m_rows != other.m_rows || m_cols != other.m_cols) {
+            Release();
+            Allocate(other.m_rows, other.m_cols);
+        }
+        // The copy starts with its ring unrotated
+        m_head = 0;
+        for (int r = 0; r < m_rows; ++r) {
+            m_rowData[r].offset = static_cast<size_t>(r) * m_stride;
+            MarkChanged(m_rowData[r]);
+            m_rowData[r].blank = other.m_rowData[other.Slot(r)].blank;
+            if (!m_rowData[r].blank) {
+                std::memcpy(m_text + m_rowData[r].offset, other.Text(r), sizeof(char32_t) * m_cols);
+            }
+            std::span<const StyleSpan> spans = other.Spans(r);
+            m_rowData[r].spans.assign(spans.begin(), spans.end());
+            std::span<const std::u32string> clusters = other.Clusters(r);
+            m_rowData[r].clusters.assign(clusters.begin(), clusters.end());
+            m_rowData[r].wrapped = other.Wrapped(r);
+        }
+        return *this;
+    }
+
+    CellGrid& CellGrid::operator=(CellGrid&& other) noexcept
+    {
+        if (this == &other) return *this;
+
+        Release();
+        m_text = std::exchange(other.m_text, nullptr);
+        m_rows = std::exchange(other.m_rows, 0);
+        m_cols = std::exchange(other.m_cols, 0);
+        m_stride = std::exchange(other.m_stride, 0);
+        m_rowData = std::move(other.m_rowData);
+        m_head = std::exchange(other.m_head, 0);
+        m_changeCount = std::exchange(other.m_changeCount, 0);
+        m_scrolledLines = std::exchange(other.m_scrolledLines, 0);
+        other.m_rowData.clear();
+        return *this;
+    }
+
+    CellGrid::~CellGrid()
+    {
+        Release();
+    }
+
+    void CellGrid::Allocate(int rows, int cols)
+    {
+        if (rows <= 0 || cols <= 0) return;
+
+        m_rows = rows;
+        m_cols = cols;
+        m_stride = RowStride(cols);
+        m_text = static_cast<char32_t*>(::operator new(sizeof(char32_t) * m_stride * (rows + 1), std::align_val_t(ROW_ALIGNMENT)));
+        FillSpaces(m_text + m_stride * rows, m_stride);
+        m_rowData.resize(rows);
+        for (int r = 0; r < rows; ++r) {
+            m_rowData[r].offset = static_cast<size_t>(r) * m_stride;
+        }
+        m_head = 0;
+    }
+
+    void CellGrid::Release()
+    {
+        if (m_text) {
+            ::operator delete(m_text, std::align_val_t(ROW_ALIGNMENT));
+            m_text = nullptr;
+        }
+        m_rows = 0;
+        m_cols = 0;
+        m_stride = 0;
+        m_rowData.clear();
+        m_head = 0;
+    }
+
+    void CellGrid::Unshare(RowData& data)
+    {
+        FillSpaces(m_text + data.offset, static_cast<size_t>(m_cols));
+        data.blank = false;
+    }
+
+    uint32_t CellGrid::StyleAt(int row, int col) const
+    {
+        uint32_t position = 0;
+        for (const StyleSpan& span : Spans(row)) {
+            position += span.length;
+            if (static_cast<uint32_t>(col) < position) {
+                return span.style;
+            }
+        }
+        return 0;
+    }
+
+    void CellGrid::CommitSpans(int row)
+    {
+        MarkChanged(m_rowData[Slot(row)]);
+        m_rowData[Slot(row)].spans.swap(m_spanScratch);
+        m_spanScratch.clear();
+    }
+
+    void CellGrid::AppendToCell(int row, int col, char32_t ch)
+    {
+        char32_t* text = Text(row);
+        RowData& data = m_rowData[Slot(row)];
+        if (IsClusterCell(text[col])) {
+            std::u32string& cluster = data.clusters[text[col] - CLUSTER_CELL];
+            if (cluster.size() < MAX_CLUSTER_LENGTH) {
+                cluster.push_back(ch);
+            }
+            return;
+        }
+
+        // The cell taking the new entry isn't a cluster yet, so compacting leaves room below m_cols
+        if (data.clusters.size() >= static_cast<size_t>(m_cols)) {
+            CompactClusters(data);
+        }
+        data.clusters.push_back({ text[col], ch });
+        text[col] = CLUSTER_CELL + static_cast<char32_t>(data.clusters.size() - 1);
+    }
+
+    void CellGrid::CompactClusters(RowData& data)
+    {
+        char32_t* text = m_text + data.offset;
+        std::vector<std::u32string> kept;
+        for (int c = 0; c < m_cols; ++c) {
+            if (IsClusterCell(text[c])) {
+                kept.push_back(std::move(data.clusters[text[c] - CLUSTER_CELL]));
+                text[c] = CLUSTER_CELL + static_cast<char32_t>(kept.size() - 1);
+            }
+        }
+        data.clusters.swap(kept);
+    }
+
+    void CellGrid::SetRow(int row, std::span<const char32_t> text, std::span<const StyleSpan> spans,
+        std::span<const std::u32string> clusters, bool wrapped)
+    {
+        std::memcpy(Text(row), text.data(), sizeof(char32_t) * m_cols);
+        RowData& data = m_rowData[Slot(row)];
+        data.spans.assign(spans.begin(), spans.end());
+        data.clusters.assign(clusters.begin(), clusters.end());
+        data.wrapped = wrapped;
+    }
+
+    void CellGrid::SetStyle(int row, int col, int count, uint32_t style)
+    {
+        if (count <= 0) return;
+        uint32_t first = static_cast<uint32_t>(col);
+        uint32_t last = first + static_cast<uint32_t>(count);
+
+        // Printing usually lands inside one span, most often the blank tail of the row or a span that
+        // already has the style, which can be edited in place
+        RowData& data = m_rowData[Slot(row)];
+        MarkChanged(data);
+        std::vector<StyleSpan>& spans = data.spans;
+        uint32_t position = 0;
+        for (size_t i = 0; i < spans.size(); ++i) {
+            uint32_t end = position + spans[i].length;
+            if (first >= end) {
+                position = end;
+                continue;
+            }
+            if (last > end) break;
+            if (spans[i].style == style) return;
+
+            uint32_t before = first - position;
+            uint32_t after = end - last;
+            uint32_t length = last - first;
+            if (before == 0 && after != 0) {
+                spans[i].length -= length;
+                if (i > 0 && spans[i - 1].style == style) {
+                    spans[i - 1].length += length;
+                }
+                else {
+                    spans.insert(spans.begin() + i, { length, style });
+                }
+                return;
+            }
+            if (after == 0 && before != 0) {
+                spans[i].length -= length;
+                if (i + 1 < spans.size() && spans[i + 1].style == style) {
+                    spans[i + 1].length += length;
+                }
+                else {
+                    spans.insert(spans.begin() + i + 1, { length, style });
+                }
+                return;
+            }
+            if (before != 0) {
+                spans[i].length = before;
+                const StyleSpan split[2] = { { length, style }, { after, spans[i].style } };
+                spans.insert(spans.begin() + i + 1, std::begin(split), std::end(split));
+                return;
+            }
+            break; // The whole span, which may merge with both neighbours
+        }
+
+        AppendRange(m_spanScratch, spans, 0, first);
+        AppendSpan(m_spanScratch, last - first, style);
+        AppendRange(m_spanScratch, spans, last, static_cast<uint32_t>(m_cols));
+        CommitSpans(row);
+    }
+
+    void CellGrid::FillRows(int first, int last, uint32_t style)
+    {
+        for (int r = first; r <= last; ++r) {
+            RowData& data = m_rowData[Slot(r)];
+            MarkChanged(data);
+            data.blank = true;
+            data.wrapped = false;
+            data.clusters.clear();
+            data.spans.clear();
+            data.spans.push_back({ static_cast<uint32_t>(m_cols), style });
+        }
+    }
+
+    void CellGrid::FillCells(int row, int col, int count, uint32_t style)
+    {
+        if (count <= 0) return;
+        if (col == 0 && count >= m_cols) {
+            FillRows(row, row, style);
+            return;
+        }
+        if (!m_rowData[Slot(row)].blank) {
+            FillSpaces(Text(row) + col, static_cast<size_t>(count));
+        }
+        SetStyle(row, col, count, style);
+    }
+
+    void CellGrid::InsertCells(int row, int col, int count, uint32_t style)
+    {
+        if (count <= 0) return;
+        if (!m_rowData[Slot(row)].blank) {
+            char32_t* text = Text(row);
+            std::memmove(text + col + count, text + col, sizeof(char32_t) * (m_cols - col - count));
+            FillSpaces(text + col, static_cast<size_t>(count));
+        }
+
+        std::span<const StyleSpan> spans = Spans(row);
+        AppendRange(m_spanScratch, spans, 0, static_cast<uint32_t>(col));
+        AppendSpan(m_spanScratch, static_cast<uint32_t>(count), style);
+        AppendRange(m_spanScratch, spans, static_cast<uint32_t>(col), static_cast<uint32_t>(m_cols - count));
+        CommitSpans(row);
+    }
+
+    void CellGrid::DeleteCells(int row, int col, int count, uint32_t style)
+    {
+        if (count <= 0) return;
+        if (!m_rowData[Slot(row)].blank) {
+            char32_t* text = Text(row);
+            std::memmove(text + col, text + col + count, sizeof(char32_t) * (m_cols - col - count));
+            FillSpaces(text + m_cols - count, static_cast<size_t>(count));
+        }
+
+        std::span<const StyleSpan> spans = Spans(row);
+        AppendRange(m_spanScratch, spans, 0, static_cast<uint32_t>(col));
+        AppendRange(m_spanScratch, spans, static_cast<uint32_t>(col + count), static_cast<uint32_t>(m_cols));
+        AppendSpan(m_spanScratch, static_cast<uint32_t>(count), style);
+        CommitSpans(row);
+    }
+
+    void CellGrid::SwapRows(int a, int b)
+    {
+        std::swap(m_rowData[Slot(a)], m_rowData[Slot(b)]);
+    }
+
+    void CellGrid::ReverseRows(int first, int last)
+    {
+        while (first < last) {
+            SwapRows(first++, last--);
+        }
+    }
+
+    void CellGrid::ScrollRows(int top, int bottom, int count, uint32_t style)
+    {
+        int height = bottom - top + 1;
+        if (count == 0 || height <= 0) return;
+
+        int lines = count > 0 ? std::min(count, height) : (count < -height ? height : -count);
+        if (lines == height) {
+            FillRows(top, bottom, style); // Everything scrolls out
+            return;
+        }
+
+        if (top == 0 && bottom == m_rows - 1) {
+            // Whole screen: turn the ring, the rows that fall off are reused for the incoming ones
+            size_t rows = static_cast<size_t>(m_rows);
+            m_head = (m_head + (count > 0 ? static_cast<size_t>(lines) : rows - lines)) % rows;
+            m_scrolledLines += count > 0 ? lines : -lines;
+        }
+        else {
+            // Margins: rotate the rows of the region in place with three reversals. Only whole-screen
+            // scrolling is reported as a delta, so every row of the region counts as changed.
+            int split = count > 0 ? top + lines : bottom - lines + 1;
+            ReverseRows(top, split - 1);
+            ReverseRows(split, bottom);
+            ReverseRows(top, bottom);
+            for (int r = top; r <= bottom; ++r) {
+                MarkChanged(m_rowData[Slot(r)]);
+            }
+        }
+
+        if (count > 0) {
+            FillRows(bottom - lines + 1, bottom, style);
+        }
+        else {
+            FillRows(top, top + lines - 1, style);
+        }
+    }
+
+    void CellGrid::Resize(int rows, int cols, uint32_t style)
+    {
+        CellGrid resized(rows, cols, style);
+        int keepRows = std::min(rows, m_rows);
+        int keepCols = std::min(cols, m_cols);
+        for (int r = 0; r < keepRows; ++r) {
+            const RowData& data = m_rowData[Slot(r)];
+            if (!data.blank) {
+                char32_t* text = resized.Text(r);
+                std::memcpy(text, Text(r), sizeof(char32_t) * keepCols);
+                // A wide character losing its right half goes with it
+                if (keepCols < m_cols && Text(r)[keepCols] == WIDE_SPACER) {
+                    text[keepCols - 1] = U' ';
+                }
+                resized.m_rowData[r].clusters = data.clusters;
+            }
+
+            AppendRange(resized.m_spanScratch, Spans(r), 0, static_cast<uint32_t>(keepCols));
+            AppendSpan(resized.m_spanScratch, static_cast<uint32_t>(cols - keepCols), style);
+            resized.CommitSpans(r);
+        }
+        *this = std::move(resized);
+    }
+
+    void CellGrid::Swap(CellGrid& other) noexcept
+    {
+        std::swap(m_text, other.m_text);
+        std::swap(m_rows, other.m_rows);
+        std::swap(m_cols, other.m_cols);
+        std::swap(m_stride, other.m_stride);
+        m_rowData.swap(other.m_rowData);
+        std::swap(m_head, other.m_head);
+        std::swap(m_changeCount, other.m_changeCount);
+        std::swap(m_scrolledLines, other.m_scrolledLines);
+    }
+
+    void CellGrid::MarkStyles(std::vector<bool>& used) const
+    {
+        for (const RowData& row : m_rowData) {
+            for (const StyleSpan& span : row.spans) {
+                used[span.style] = true;
+            }
+        }
+    }
+
+    void CellGrid::RemapStyles(const std::vector<uint32_t>& remap)
+    {
+        for (RowData& row : m_rowData) {
+            for (StyleSpan& span : row.spans) {
+                span.style = remap[span.style];
+            }
+        }
+    }
+
+    void CellGrid::CollectDamage(uint64_t changeCount, int64_t scrolledLines, ScreenDamage& damage) const
+    {
+        // Past a screenful every row has come in, so the exact delta no longer matters
+        int64_t delta = m_scrolledLines - scrolledLines;
+        damage.scrollDelta = static_cast<int>(std::clamp<int64_t>(delta, -m_rows, m_rows));
+        damage.rows.clear();
+        for (int r = 0; r < m_rows; ++r) {
+            if (m_rowData[Slot(r)].change <= changeCount) continue;
+            if (!damage.rows.empty() && damage.rows.back().last == r - 1) {
+                damage.rows.back().last = r;
+            }
+            else {
+                damage.rows.push_back({ r, r });
+            }
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include "Cell.h"
+#include "ScreenDamage.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // Screen cells, split into text and styles. The code points live in one contiguous, cache-line
+    // aligned block; every row starts on a cache line (the row stride is padded to a multiple of 64 bytes)
+    // so fills and copies can use aligned vector stores.
+    //
+    // Styles are kept per row as a run-length list of StyleSpans covering exactly Cols() cells.
+    // Most rows have one to three of them, so erasing or restyling a range edits a few spans
+    // instead of every cell, and the renderer and scrollback take the runs as they are.
+    //
+    // Rows are reached through a ring: visible row r is m_rowData[(m_head + r) % rows]. Scrolling the
+    // whole screen only advances m_head, scrolling part of it swaps entries, and in both cases only
+    // the rows that come in are cleared.
+    //
+    // Clearing a whole row doesn't write its text: the row is flagged blank and reads go to one shared
+    // row of spaces past the last one, whatever the style (that is in the spans). The row's own storage
+    // is only filled when something first writes to it, so erasing the screen, scrolling in blank
+    // lines or growing the grid costs a span per row.
+    //
+    // Every row records the change count of the last write to it, and whole-screen scrolling adds up
+    // in a line counter. Both travel with the rows around the ring, so a consumer that remembers the two
+    // counters sees scrolling as a delta plus the rows that came in rather than as every row changing,
+    // and any number of consumers can follow the same grid.
+    //
+    // Grapheme clusters of more than one code point are rare, so each row keeps its own short list of them
+    // and the cell holds CLUSTER_CELL + index (see Cell.h). Overwritten clusters stay in the list until it
+    // reaches a row's worth of entries and is compacted; clearing the row drops the list.
+    class CellGrid {
+    public:
+        static constexpr size_t ROW_ALIGNMENT = 64;
+
+        CellGrid() = default;
+        CellGrid(int rows, int cols, uint32_t style);   // Blank cells in 'style'
+        CellGrid(const CellGrid& other);
+        CellGrid(CellGrid&& other) noexcept;
+        CellGrid& operator=(const CellGrid& other);
+        CellGrid& operator=(CellGrid&& other) noexcept;
+        ~CellGrid();
+
+        int Rows() const { return m_rows; }
+        int Cols() const { return m_cols; }
+        bool Empty() const { return m_text == nullptr; }
+
+        // Writable text, marks the row changed
+        char32_t* Text(int row) {
+            RowData& data = m_rowData[Slot(row)];
+            MarkChanged(data);
+            if (data.blank) {
+                Unshare(data);
+            }
+            return m_text + data.offset;
+        }
+        const char32_t* Text(int row) const {
+            const RowData& data = m_rowData[Slot(row)];
+            return data.blank ? BlankText() : m_text + data.offset;
+        }
+        std::span<const char32_t> TextSpan(int row) const { return { Text(row), static_cast<size_t>(m_cols) }; }
+        std::span<const StyleSpan> Spans(int row) const { return m_rowData[Slot(row)].spans; }
+        std::span<const std::u32string> Clusters(int row) const { return m_rowData[Slot(row)].clusters; }
+        std::u32string_view Cluster(int row, char32_t cell) const { return m_rowData[Slot(row)].clusters[cell - CLUSTER_CELL]; }
+
+        // Set when printing ran off the end of the row, so the line goes on in the next one. Not a write to the
+        // cells: it doesn't mark the row changed. Clearing the row clears it.
+        bool Wrapped(int row) const { return m_rowData[Slot(row)].wrapped; }
+        void SetWrapped(int row, bool wrapped) { m_rowData[Slot(row)].wrapped = wrapped; }
+
+        uint32_t StyleAt(int row, int col) const;
+        Cell At(int row, int col) const { return { Text(row)[col], StyleAt(row, col) }; }
+
+        // Adds 'ch' to the grapheme cluster in the cell, turning a single code point into a cluster
+        void AppendToCell(int row, int col, char32_t ch);
+
+        // Replaces the whole row: Cols() code points, spans covering them and the clusters they refer to
+        void SetRow(int row, std::span<const char32_t> text, std::span<const StyleSpan> spans,
+            std::span<const std::u32string> clusters, bool wrapped);
+
+        // Restyles 'count' cells from 'col', the text is left alone
+        void SetStyle(int row, int col, int count, uint32_t style);
+
+        // The fills, shifts and scrolls below bring in blanks: spaces in 'style'
+        void FillRows(int first, int last, uint32_t style);
+        void FillCells(int row, int col, int count, uint32_t style);
+        void InsertCells(int row, int col, int count, uint32_t style);     // Cells shifted past the right edge are lost
+        void DeleteCells(int row, int col, int count, uint32_t style);     // Blanks come in from the right edge
+
+        // Shifts rows top..bottom (inclusive) up by 'count', or down for a negative count
+        void ScrollRows(int top, int bottom, int count, uint32_t style);
+
+        // Keeps the top-left part that fits, the rest is blank. Rows end up in visible order and unwrapped.
+        void Resize(int rows, int cols, uint32_t style);
+
+        // Exchanges everything with 'other', change counters included, without touching any cells
+        void Swap(CellGrid& other) noexcept;
+
+        // Sets used[style] for every style a cell refers to
+        void MarkStyles(std::vector<bool>& used) const;
+        void RemapStyles(const std::vector<uint32_t>& remap);
+
+        uint64_t ChangeCount() const { return m_changeCount; }
+        int64_t ScrolledLines() const { return m_scrolledLines; }    // Up is positive
+
+        // Fills in the scroll delta and the rows written since the two counters had the given values
+        void CollectDamage(uint64_t changeCount, int64_t scrolledLines, ScreenDamage& damage) const;
+
+    private:
+        struct RowData {
+            size_t offset = 0;                  // Code point offset of the row in m_text
+            std::vector<StyleSpan> spans;
+            std::vector<std::u32string> clusters;   // Referenced from the text, may hold stale entries
+            uint64_t change = 0;                // m_changeCount after the last write
+            bool blank = false;                 // All spaces, read from BlankText(); the own storage is stale
+            bool wrapped = false;               // See Wrapped()
+        };
+
+        size_t Slot(int row) const {
+            size_t slot = m_head + static_cast<size_t>(row);
+            return slot >= static_cast<size_t>(m_rows) ? slot - m_rows : slot;
+        }
+        void MarkChanged(RowData& data) { data.change = ++m_changeCount; }
+        const char32_t* BlankText() const { return m_text + m_stride * m_rows; }
+        void Unshare(RowData& data);   // Fills the row's own storage so it can be written
+        void CompactClusters(RowData& data);
+        void SwapRows(int a, int b);
+        void ReverseRows(int first, int last);
+        void Allocate(int rows, int cols);
+        void Release();
+
+        // Rebuilds the spans of 'row' from m_spanScratch once it has been filled
+        void CommitSpans(int row);
+
+        static size_t RowStride(int cols);
+
+        char32_t* m_text = nullptr;         // m_rows rows, then the shared blank row
+        int m_rows = 0;
+        int m_cols = 0;
+        size_t m_stride = 0;                // Code points per block row, >= m_cols
+        std::vector<RowData> m_rowData;     // Indexed by ring slot
+        size_t m_head = 0;                  // Ring slot of visible row 0
+        uint64_t m_changeCount = 0;
+        int64_t m_scrolledLines = 0;
+        std::vector<StyleSpan> m_spanScratch;
+    };
+}
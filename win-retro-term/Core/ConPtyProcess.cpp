@@ -2,6 +2,7 @@
 #include "ConPtyProcess.h"
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 
 // Helper to convert HRESULT to a more usable error message
 std::string HResultToString(HRESULT hr) {
@@ -76,13 +77,13 @@ void ConPtyProcess::CloseAllHandles() {
     }
 }
 
-bool ConPtyProcess::Start(const std::wstring& commandLine, COORD size, DataReceivedCallback callback) {
+bool ConPtyProcess::Start(const std::wstring& commandLine, COORD size, winrt::win_retro_term::Core::ByteRing& outputRing) {
     if (m_running) {
         std::cerr << "ConPtyProcess already running." << std::endl;
         return false;
     }
 
-    m_onDataReceivedCallback = callback;
+    m_outputRing = &outputRing;
     HRESULT hr = S_OK;
 
     // 1. Create Pipes for PTY communication
@@ -196,28 +197,45 @@ bool ConPtyProcess::Start(const std::wstring& commandLine, COORD size, DataRecei
 }
 
 void ConPtyProcess::OutputThreadFunc() {
-    const DWORD BUFFER_SIZE = 4096;
-    std::vector<char> buffer(BUFFER_SIZE);
+    DWORD readSize = MIN_READ_SIZE;
     DWORD bytesRead = 0;
 
     while (m_running) {
+        // Read straight into the ring; while the consumer is behind, wait here instead of buffering more
+        if (!m_outputRing->WaitForSpace()) {
+            break; // Consumer is shutting down
+        }
+        std::span<char> region = m_outputRing->PrepareWrite();
+        DWORD request = static_cast<DWORD>(std::min<size_t>(region.size(), readSize));
+
         // ReadFile will block until data is available or an error occurs (e.g., pipe closed)
-        BOOL success = ReadFile(m_hInputPipeOurRead, buffer.data(), BUFFER_SIZE, &bytesRead, nullptr);
+        BOOL success = ReadFile(m_hInputPipeOurRead, region.data(), request, &bytesRead, nullptr);
 
         if (!success || bytesRead == 0) {
             // Error or pipe closed (client process likely exited)
-            // ERROR_BROKEN_PIPE is expected when the PTY client closes its end of the pipe.
+            // ERROR_BROKEN_PIPE is expected when the PTY client closes its end of the pipe,
+            // ERROR_OPERATION_ABORTED when Stop() cancels the read.
             DWORD error = GetLastError();
-            if (error != ERROR_BROKEN_PIPE && error != ERROR_SUCCESS /* ReadFile can return TRUE with bytesRead=0 on EOF */) {
+            if (error != ERROR_BROKEN_PIPE && error != ERROR_OPERATION_ABORTED && error != ERROR_SUCCESS /* ReadFile can return TRUE with bytesRead=0 on EOF */) {
                 std::cerr << "ReadFile failed in OutputThreadFunc: " << HResultToString(HRESULT_FROM_WIN32(error)) << std::endl;
             }
             m_running = false; // Signal to stop
             break;
         }
 
-        if (m_onDataReceivedCallback) {
-            m_onDataReceivedCallback(buffer.data(), bytesRead);
+        m_outputRing->CommitWrite(bytesRead);
+        m_readCount.fetch_add(1, std::memory_order_relaxed);
+        m_bytesRead.fetch_add(bytesRead, std::memory_order_relaxed);
+
+        // Grow while reads come back full, shrink again once output turns interactive. A read cut short
+        // by the ring (its end or the write limit) that still came back full says nothing either way.
+        if (bytesRead == request && request == readSize && readSize < MAX_READ_SIZE) {
+            readSize *= 2;
+        }
+        else if (bytesRead < request && bytesRead < readSize / 4 && readSize > MIN_READ_SIZE) {
+            readSize /= 2;
         }
+        m_readSize.store(readSize, std::memory_order_relaxed);
     }
     std::cout << "OutputThreadFunc exiting." << std::endl;
 
@@ -225,6 +243,14 @@ void ConPtyProcess::OutputThreadFunc() {
     // This can be useful for the UI to know the terminal session ended.
 }
 
+ConPtyProcess::ReadMetrics ConPtyProcess::GetReadMetrics() const {
+    ReadMetrics metrics;
+    metrics.reads = m_readCount.load(std::memory_order_relaxed);
+    metrics.bytes = m_bytesRead.load(std::memory_order_relaxed);
+    metrics.readSize = m_readSize.load(std::memory_order_relaxed);
+    return metrics;
+}
+
 bool ConPtyProcess::WriteInput(const std::string& data) {
     if (!m_running || m_hOutputPipeOurWrite == INVALID_HANDLE_VALUE || data.empty()) {
         return false;
@@ -275,8 +301,13 @@ void ConPtyProcess::Stop() {
     }
 
 
-    // Wait for the output thread to finish
+    // Wait for the output thread to finish, cancelling the blocking ReadFile
+    // in case the client is still alive and not writing anything
     if (m_outputThread.joinable()) {
+        HANDLE outputThread = m_outputThread.native_handle();
+        while (WaitForSingleObject(outputThread, 50) == WAIT_TIMEOUT) {
+            CancelSynchronousIo(outputThread);
+        }
         m_outputThread.join();
     }
     std::cout << "Output thread joined." << std::endl;
@@ -3,19 +3,27 @@
 #include <Windows.h>
 #include <string>
 #include <vector>
-#include <functional>
 #include <thread>
 #include <atomic>
 #include <processthreadsapi.h>
 #include <consoleapi.h>
 
+#include "ByteRing.h"
+
 namespace winrt::win_retro_term::Core { class ConPtyProcess; }
 
 class ConPtyProcess {
 public:
-    // Callback function type for when data is received from the PTY
-    // Parameters: buffer pointer, buffer size
-    using DataReceivedCallback = std::function<void(const char*, size_t)>;
+    // Bounds for the adaptive read size: small reads keep interactive output snappy,
+    // large ones cut the number of syscalls and consumer wake-ups during floods
+    static constexpr DWORD MIN_READ_SIZE = 4 * 1024;
+    static constexpr DWORD MAX_READ_SIZE = 128 * 1024;
+
+    struct ReadMetrics {
+        uint64_t reads = 0;
+        uint64_t bytes = 0;
+        DWORD readSize = MIN_READ_SIZE; // Current request size
+    };
 
     ConPtyProcess();
     ~ConPtyProcess();
@@ -23,8 +31,9 @@ public:
     // Starts the PTY and the specified command line process
     // commandLine: e.g., L"cmd.exe" or L"powershell.exe"
     // size: Initial dimensions of the PTY
-    // callback: Function to call when data is received from the PTY
-    bool Start(const std::wstring& commandLine, COORD size, DataReceivedCallback callback);
+    // outputRing: PTY output is read directly into this ring, which must outlive the process.
+    //             Its consumer is woken on every commit; the reader waits while the ring is full.
+    bool Start(const std::wstring& commandLine, COORD size, winrt::win_retro_term::Core::ByteRing& outputRing);
 
     // Writes data to the PTY's input.
     bool WriteInput(const std::string& data);
@@ -37,6 +46,8 @@ public:
 
     bool IsRunning() const { return m_running; }
 
+    ReadMetrics GetReadMetrics() const;
+
 private:
     void OutputThreadFunc();
     void CloseAllHandles();
@@ -54,5 +65,9 @@ private:
     std::thread m_outputThread;
     std::atomic<bool> m_running = false;
 
-    DataReceivedCallback m_onDataReceivedCallback;
+    winrt::win_retro_term::Core::ByteRing* m_outputRing = nullptr;
+
+    std::atomic<uint64_t> m_readCount = 0;
+    std::atomic<uint64_t> m_bytesRead = 0;
+    std::atomic<DWORD> m_readSize = MIN_READ_SIZE;
 };
\ No newline at end of file
@@ -1,4 +1,8 @@
 #pragma once
+#include "VtParams.h"
+#include <cstdint>
+#include <span>
+#include <string_view>
 
 namespace winrt::win_retro_term::Core 
 {
@@ -7,7 +11,11 @@ namespace winrt::win_retro_term::Core
         virtual ~ITerminalActions() = default;
 
         // Called for printable characters when in GROUND state
-        virtual void PrintChar(wchar_t ch) = 0;
+        virtual void PrintChar(char32_t ch) = 0;
+
+        // Called with the longest run of printable characters found in GROUND state,
+        // so the whole run can be written into the row in one pass
+        virtual void PrintString(std::span<const char32_t> text) = 0;
 
         // Called for C0 control characters (other than ones with specific handlers like LF, CR, BS, HT)
         // or C1 control characters if 7-bit mapping is used (e.g. ESC Fe)
@@ -25,16 +33,44 @@ namespace winrt::win_retro_term::Core
         virtual void CursorForward(int count) = 0;      // CUF: CSI Pn C
         virtual void CursorBack(int count) = 0;         // CUB: CSI Pn D
         virtual void CursorPosition(int row, int col) = 0; // CUP: CSI Pn ; Pn H (or f)
+        virtual void ReverseIndex() = 0;                // RI:  ESC M, scrolls down at the top margin
+        virtual void SaveCursor() = 0;                  // DECSC: ESC 7, also SCOSC: CSI s
+        virtual void RestoreCursor() = 0;               // DECRC: ESC 8, also SCORC: CSI u
 
         virtual void EraseInDisplay(int mode) = 0;      // ED:  CSI Ps J
         virtual void EraseInLine(int mode) = 0;         // EL:  CSI Ps K
 
-        virtual void SetGraphicsRendition(const std::vector<int>& params) = 0; // SGR
+        // Scrolling margins and the operations that shift lines or characters.
+        // Rows are 1-based like the sequences, a bottom of 0 means the last row.
+        virtual void SetScrollingRegion(int top, int bottom) = 0; // DECSTBM: CSI Pt ; Pb r
+        virtual void ScrollUp(int count) = 0;           // SU:  CSI Pn S
+        virtual void ScrollDown(int count) = 0;         // SD:  CSI Pn T
+        virtual void InsertLines(int count) = 0;        // IL:  CSI Pn L
+        virtual void DeleteLines(int count) = 0;        // DL:  CSI Pn M
+        virtual void InsertCharacters(int count) = 0;   // ICH: CSI Pn @
+        virtual void DeleteCharacters(int count) = 0;   // DCH: CSI Pn P
+
+        virtual void SetGraphicsRendition(VtParamsView params) = 0; // SGR: CSI Pm m, sub-parameters included
 
         virtual void DesignateCharSet(uint8_t targetSet, wchar_t charSet) = 0;
         virtual void InvokeCharSet(uint8_t gSetToInvokeIntoGL) = 0;
 
         virtual void SetDecPrivateMode(int mode, bool enabled) = 0;
+
+        // OSC strings. Text is UTF-8 and points into parser storage, so it is only valid during the call.
+        virtual void SetWindowTitle(std::string_view title) = 0;                // OSC 0 / 2
+        virtual void SetPaletteColor(int index, uint32_t rgb) = 0;              // OSC 4, rgb is 0xRRGGBB
+        virtual void SetDefaultColor(bool foreground, uint32_t rgb) = 0;        // OSC 10 / 11
+        virtual void SetHyperlink(std::string_view id, std::string_view uri) = 0; // OSC 8, an empty uri ends the link
+
+        // OSC 52: base64 payloads larger than the parser's string limit arrive in several chunks,
+        // 'first' starts a new write and 'last' completes it. A cancelled string never sends 'last'.
+        virtual void ClipboardWrite(std::string_view selection, std::string_view base64, bool first, bool last) = 0;
+
+        // DCS: hook with the sequence's parameters, then the payload in chunks, then unhook
+        virtual void DcsHook(VtParamsView params, std::string_view intermediates, char32_t finalChar) = 0;
+        virtual void DcsPut(std::string_view data) = 0;
+        virtual void DcsUnhook(bool aborted) = 0;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "LineRewrapper.h"
+#include "StyleTable.h"
+#include <algorithm>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        // Appends a run, merged into the last one when the style is the same
+        void AppendSpan(std::vector<StyleSpan>& out, uint32_t length, uint32_t style)
+        {
+            if (length == 0) return;
+            if (!out.empty() && out.back().style == style) {
+                out.back().length += length;
+            }
+            else {
+                out.push_back({ length, style });
+            }
+        }
+    }
+
+    LineRewrapper::LineRewrapper(int cols, uint32_t blankStyle) : m_cols(std::max(cols, 1)), m_blankStyle(blankStyle)
+    {
+    }
+
+    void LineRewrapper::AddRow(std::span<const char32_t> text, std::span<const StyleSpan> spans, std::span<const std::u32string> clusters,
+        bool wrapped, int cursorCol)
+    {
+        // A row that goes on with a wide character most likely left its last column blank because the character
+        // didn't fit there, not as part of the text
+        if (!m_text.empty() && text.size() >= 2 && text[1] == WIDE_SPACER && m_text.back() == U' ' && m_styles.back() == StyleTable::DEFAULT_STYLE) {
+            m_text.pop_back();
+            m_styles.pop_back();
+        }
+        if (cursorCol >= 0) {
+            m_cursorOffset = m_text.size() + static_cast<size_t>(cursorCol);
+            m_cursorWrapped = cursorCol == 0 && !m_text.empty();
+        }
+
+        // Clusters are renumbered into the line's own list
+        for (char32_t ch : text) {
+            if (IsClusterCell(ch)) {
+                m_clusters.emplace_back(clusters[ch - CLUSTER_CELL]);
+                ch = CLUSTER_CELL + static_cast<char32_t>(m_clusters.size() - 1);
+            }
+            m_text.push_back(ch);
+        }
+        for (const StyleSpan& span : spans) {
+            m_styles.insert(m_styles.end(), span.length, span.style);
+        }
+        m_styles.resize(m_text.size(), StyleTable::DEFAULT_STYLE);
+
+        if (!wrapped) {
+            EmitLine(false);
+        }
+    }
+
+    void LineRewrapper::Finish()
+    {
+        if (!m_text.empty() || m_cursorOffset != NO_CURSOR) {
+            EmitLine(true);
+        }
+    }
+
+    LineRewrapper::Row& LineRewrapper::NextRow()
+    {
+        if (m_rowCount == m_rows.size()) {
+            m_rows.emplace_back();
+        }
+        Row& row = m_rows[m_rowCount++];
+        row.text.assign(static_cast<size_t>(m_cols), U' ');
+        row.spans.clear();
+        row.clusters.clear();
+        row.wrapped = false;
+        return row;
+    }
+
+    void LineRewrapper::EndRow(Row& row, int used)
+    {
+        AppendSpan(row.spans, static_cast<uint32_t>(m_cols - used), m_blankStyle);
+    }
+
+    void LineRewrapper::EmitLine(bool open)
+    {
+        // An open line keeps its blanks, they come before whatever continues it. So does the part before the cursor.
+        size_t length = m_text.size();
+        if (!open) {
+            while (length > 0 && m_text[length - 1] == U' ' && m_styles[length - 1] == StyleTable::DEFAULT_STYLE) {
+                --length;
+            }
+        }
+        if (m_cursorOffset != NO_CURSOR) {
+            length = std::max(length, std::min(m_cursorOffset, m_text.size()));
+        }
+
+        Row* row = &NextRow();
+        int col = 0;
+        for (size_t i = 0; i < length; ++i) {
+            char32_t ch = m_text[i];
+            if (ch == WIDE_SPACER) {
+                if (i == m_cursorOffset) {
+                    // On the right half of the wide character before it
+                    m_cursorRow = static_cast<int>(m_rowCount - 1);
+                    m_cursorCol = std::max(col - 1, 0);
+                }
+                continue;
+            }
+
+            int width = i + 1 < m_text.size() && m_text[i + 1] == WIDE_SPACER ? 2 : 1;
+            if (width > m_cols) {
+                ch = 0xFFFD;
+                width = 1;
+            }
+            if (col + width > m_cols) {
+                // A wide character that doesn't fit in the last column leaves it blank
+                EndRow(*row, col);
+                row->wrapped = true;
+                row = &NextRow();
+                col = 0;
+            }
+            if (i == m_cursorOffset) {
+                m_cursorRow = static_cast<int>(m_rowCount - 1);
+                m_cursorCol = col;
+            }
+
+            if (IsClusterCell(ch)) {
+                row->clusters.push_back(std::move(m_clusters[ch - CLUSTER_CELL]));
+                ch = CLUSTER_CELL + static_cast<char32_t>(row->clusters.size() - 1);
+            }
+            row->text[col] = ch;
+            if (width == 2) {
+                row->text[col + 1] = WIDE_SPACER;
+            }
+            AppendSpan(row->spans, static_cast<uint32_t>(width), m_styles[i]);
+            col += width;
+        }
+        if (m_cursorOffset != NO_CURSOR && m_cursorOffset >= length) {
+            // Past the end of the line, or on the last column with a wrap pending. A cursor that had already
+            // wrapped stays at the start of a row of its own.
+            if (col == m_cols && m_cursorWrapped) {
+                EndRow(*row, col);
+                row->wrapped = true;
+                row = &NextRow();
+                col = 0;
+            }
+            m_cursorRow = static_cast<int>(m_rowCount - 1);
+            m_cursorCol = col;
+        }
+        EndRow(*row, col);
+        row->wrapped = open;
+
+        m_text.clear();
+        m_styles.clear();
+        m_clusters.clear();
+        m_cursorOffset = NO_CURSOR;
+    }
+
+    bool LineRewrapper::IsBlank(size_t row) const
+    {
+        const Row& data = m_rows[row];
+        return !data.wrapped && std::all_of(data.text.begin(), data.text.end(), [](char32_t ch) { return ch == U' '; });
+    }
+
+    void LineRewrapper::ClearRows()
+    {
+        m_rowCount = 0;
+        m_cursorRow = -1;
+        m_cursorCol = -1;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "Cell.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // Rewraps rows to another width. Rows go in one at a time with their soft-wrap flag: a row that
+    // wrapped continues on the next one, and together they make a logical line, which comes out
+    // rewrapped to Cols() once its last row is in. Wide characters never straddle two rows, one that
+    // would start in the last column moves down and leaves a blank behind.
+    //
+    // Trailing blanks (spaces in the default style) of a logical line are dropped, so narrowing and
+    // widening again gives back the same rows.
+    class LineRewrapper {
+    public:
+        struct Row {
+            std::vector<char32_t> text;             // Cols() code points
+            std::vector<StyleSpan> spans;           // Covering exactly Cols() cells
+            std::vector<std::u32string> clusters;   // Referenced from 'text', see Cell.h
+            bool wrapped = false;                   // Continues on the next row
+        };
+
+        // Cells past the end of a logical line are blanks in 'blankStyle'
+        LineRewrapper(int cols, uint32_t blankStyle);
+
+        int Cols() const { return m_cols; }
+
+        // 'spans' cover 'text', whatever its length. 'cursorCol' is the cursor column when it is on this row,
+        // up to text.size() for a pending wrap, and -1 otherwise.
+        void AddRow(std::span<const char32_t> text, std::span<const StyleSpan> spans, std::span<const std::u32string> clusters,
+            bool wrapped, int cursorCol = -1);
+
+        // Puts out a logical line left open by a last row that wrapped, still flagged as wrapping
+        void Finish();
+
+        size_t RowCount() const { return m_rowCount; }
+        const Row& GetRow(size_t row) const { return m_rows[row]; }
+        bool IsBlank(size_t row) const;
+
+        // Drops the rows put out so far, keeping their storage and the line still being collected
+        void ClearRows();
+
+        // Where the cursor went, -1 until its logical line is out. The column is Cols() for a pending wrap.
+        int CursorRow() const { return m_cursorRow; }
+        int CursorCol() const { return m_cursorCol; }
+
+    private:
+        static constexpr size_t NO_CURSOR = SIZE_MAX;
+
+        void EmitLine(bool open);
+        Row& NextRow();
+        void EndRow(Row& row, int used);
+
+        int m_cols;
+        uint32_t m_blankStyle;
+
+        // The logical line being collected, one style per cell
+        std::vector<char32_t> m_text;
+        std::vector<uint32_t> m_styles;
+        std::vector<std::u32string> m_clusters;
+        size_t m_cursorOffset = NO_CURSOR;
+        bool m_cursorWrapped = false;   // At the start of a row the line wrapped onto
+
+        std::vector<Row> m_rows;        // The first m_rowCount are in use
+        size_t m_rowCount = 0;
+        int m_cursorRow = -1;
+        int m_cursorCol = -1;
+    };
+}
@@ -0,0 +1,167 @@
+#include "pch.h"
+#include "Lz4.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace winrt::win_retro_term::Core::Lz4
+{
+    namespace
+    {
+        // Format rules: matches are at least 4 bytes, the last 5 bytes are always literals and
+        // the last match starts at least 12 bytes before the end
+        const size_t MIN_MATCH = 4;
+        const size_t LAST_LITERALS = 5;
+        const size_t MATCH_START_LIMIT = 12;
+        const size_t MAX_OFFSET = 65535;
+        const int HASH_BITS = 12;
+
+        uint32_t Read32(const uint8_t* p)
+        {
+            uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        uint32_t Hash(uint32_t sequence)
+        {
+            return (sequence * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        // Lengths of 15 and up continue in extra bytes of 255 each, ending with one below 255
+        uint8_t* WriteLength(uint8_t* out, size_t length)
+        {
+            for (; length >= 255; length -= 255) {
+                *out++ = 255;
+            }
+            *out++ = static_cast<uint8_t>(length);
+            return out;
+        }
+
+        bool ReadLength(const uint8_t*& in, const uint8_t* end, size_t& length)
+        {
+            uint8_t byte;
+            do {
+                if (in == end) return false;
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+            return true;
+        }
+
+        // Emits one sequence; a match length of 0 means the final literals-only sequence
+        uint8_t* WriteSequence(uint8_t* out, uint8_t* outEnd, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength)
+        {
+            size_t worst = 1 + literalCount / 255 + 1 + literalCount + 2 + matchLength / 255 + 1;
+            if (static_cast<size_t>(outEnd - out) < worst) {
+                return nullptr;
+            }
+
+            uint8_t* token = out++;
+            *token = static_cast<uint8_t>(std::min<size_t>(literalCount, 15) << 4);
+            if (literalCount >= 15) out = WriteLength(out, literalCount - 15);
+            if (literalCount != 0) std::memcpy(out, literals, literalCount);
+            out += literalCount;
+
+            if (matchLength != 0) {
+                *out++ = static_cast<uint8_t>(offset);
+                *out++ = static_cast<uint8_t>(offset >> 8);
+                size_t extra = matchLength - MIN_MATCH;
+                *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+                if (extra >= 15) out = WriteLength(out, extra - 15);
+            }
+            return out;
+        }
+    }
+
+    size_t Compress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity)
+    {
+        // Positions are stored plus one so 0 marks an empty slot
+        thread_local std::vector<uint32_t> table;
+        table.assign(size_t{ 1 } << HASH_BITS, 0);
+
+        const uint8_t* end = source + size;
+        const uint8_t* anchor = source;
+        uint8_t* out = destination;
+        uint8_t* outEnd = destination + capacity;
+
+        if (size > MATCH_START_LIMIT) {
+            const uint8_t* matchStartLimit = end - MATCH_START_LIMIT;
+            const uint8_t* matchEndLimit = end - LAST_LITERALS;
+            const uint8_t* in = source;
+            while (in < matchStartLimit) {
+                uint32_t sequence = Read32(in);
+                uint32_t& slot = table[Hash(sequence)];
+                const uint8_t* candidate = slot != 0 ? source + slot - 1 : nullptr;
+                slot = static_cast<uint32_t>(in - source) + 1;
+
+                if (!candidate || static_cast<size_t>(in - candidate) > MAX_OFFSET || Read32(candidate) != sequence) {
+                    // Step further the longer nothing matched, so incompressible data goes by quickly
+                    in += 1 + ((in - anchor) >> 6);
+                    continue;
+                }
+
+                while (in > anchor && candidate > source && in[-1] == candidate[-1]) {
+                    --in;
+                    --candidate;
+                }
+                const uint8_t* matchEnd = in + MIN_MATCH;
+                const uint8_t* candidateEnd = candidate + MIN_MATCH;
+                while (matchEnd < matchEndLimit && *matchEnd == *candidateEnd) {
+                    ++matchEnd;
+                    ++candidateEnd;
+                }
+
+                out = WriteSequence(out, outEnd, anchor, static_cast<size_t>(in - anchor), static_cast<size_t>(in - candidate),
+                    static_cast<size_t>(matchEnd - in));
+                if (!out) return 0;
+                in = matchEnd;
+                anchor = in;
+            }
+        }
+
+        out = WriteSequence(out, outEnd, anchor, static_cast<size_t>(end - anchor), 0, 0);
+        return out ? static_cast<size_t>(out - destination) : 0;
+    }
+
+    bool Decompress(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size)
+    {
+        const uint8_t* in = source;
+        const uint8_t* inEnd = source + sourceSize;
+        uint8_t* out = destination;
+        uint8_t* outEnd = destination + size;
+
+        while (in < inEnd) {
+            uint8_t token = *in++;
+
+            size_t literalCount = token >> 4;
+            if (literalCount == 15 && !ReadLength(in, inEnd, literalCount)) return false;
+            if (literalCount > static_cast<size_t>(inEnd - in) || literalCount > static_cast<size_t>(outEnd - out)) return false;
+            if (literalCount != 0) std::memcpy(out, in, literalCount);
+            in += literalCount;
+            out += literalCount;
+            if (in == inEnd) break; // The last sequence has no match
+
+            if (inEnd - in < 2) return false;
+            size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+            in += 2;
+            if (offset == 0 || offset > static_cast<size_t>(out - destination)) return false;
+
+            size_t matchLength = token & 0x0F;
+            if (matchLength == 15 && !ReadLength(in, inEnd, matchLength)) return false;
+            matchLength += MIN_MATCH;
+            if (matchLength > static_cast<size_t>(outEnd - out)) return false;
+
+            const uint8_t* match = out - offset;
+            if (offset >= matchLength) {
+                std::memcpy(out, match, matchLength);
+            }
+            else {
+                // Overlapping copy repeats the last 'offset' bytes, which has to go byte by byte
+                for (size_t i = 0; i < matchLength; ++i) out[i] = match[i];
+            }
+            out += matchLength;
+        }
+        return out == outEnd;
+    }
+}
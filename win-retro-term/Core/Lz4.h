@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace winrt::win_retro_term::Core::Lz4
+{
+    // Compressor and decompressor for the LZ4 block format, used for cold scrollback chunks.
+    // Greedy matching over a single hash table: much faster than it is thorough, which suits
+    // repetitive terminal text where even short matches pay off.
+
+    // Worst-case compressed size of 'size' input bytes
+    constexpr size_t CompressBound(size_t size) { return size + size / 255 + 16; }
+
+    // Returns the compressed size, or 0 if it would not fit in 'capacity'
+    size_t Compress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity);
+
+    // Decodes a whole block into exactly 'size' bytes. Returns false on malformed input
+    // instead of reading or writing out of bounds.
+    bool Decompress(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size);
+}
@@ -0,0 +1,214 @@
+#include "pch.h"
+#include "Platform.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#include <winioctl.h>
+#else
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace winrt::win_retro_term::Core::Platform
+{
+    void Beep()
+    {
+#if defined(_WIN32)
+        MessageBeep(MB_OK);
+#endif
+        // Elsewhere Core only runs headless (fuzzing, benchmarks), where a bell has nowhere to go
+    }
+
+    SpillFile::~SpillFile()
+    {
+        Close();
+    }
+
+#if defined(_WIN32)
+
+    bool SpillFile::Open()
+    {
+        if (IsOpen()) return true;
+
+        wchar_t directory[MAX_PATH + 1];
+        wchar_t path[MAX_PATH + 1];
+        DWORD length = GetTempPathW(MAX_PATH + 1, directory);
+        if (length == 0 || length > MAX_PATH || GetTempFileNameW(directory, L"wrt", 0, path) == 0) {
+            return false;
+        }
+
+        HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            DeleteFileW(path);
+            return false;
+        }
+        // Sparse, so Discard can give space back; without it the file just keeps its size
+        DWORD returned = 0;
+        DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+        m_file = file;
+        m_size = 0;
+        return true;
+    }
+
+    bool SpillFile::IsOpen() const
+    {
+        return m_file != nullptr;
+    }
+
+    void SpillFile::Close()
+    {
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+            m_mappingSize = 0;
+        }
+        if (m_file) {
+            CloseHandle(m_file); // FILE_FLAG_DELETE_ON_CLOSE removes it
+            m_file = nullptr;
+        }
+        m_size = 0;
+    }
+
+    bool SpillFile::Write(uint64_t offset, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD written = 0;
+            DWORD request = static_cast<DWORD>(size < 0x40000000 ? size : 0x40000000);
+            if (!WriteFile(m_file, bytes, request, &written, &overlapped) || written == 0) {
+                return false;
+            }
+            bytes += written;
+            offset += written;
+            size -= written;
+        }
+        if (offset > m_size) m_size = offset;
+        return true;
+    }
+
+    void SpillFile::Truncate()
+    {
+        // Windows won't shrink a file that still has views, the caller unmaps them first
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+            m_mappingSize = 0;
+        }
+        LARGE_INTEGER zero = {};
+        if (SetFilePointerEx(m_file, zero, nullptr, FILE_BEGIN)) {
+            SetEndOfFile(m_file);
+        }
+        m_size = 0;
+    }
+
+    void SpillFile::Discard(uint64_t offset, size_t size)
+    {
+        FILE_ZERO_DATA_INFORMATION range = {};
+        range.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+        range.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + size);
+        DWORD returned = 0;
+        DeviceIoControl(m_file, FSCTL_SET_ZERO_DATA, &range, sizeof(range), nullptr, 0, &returned, nullptr);
+    }
+
+    const uint8_t* SpillFile::Map(uint64_t offset, size_t size)
+    {
+        if (size == 0 || offset + size > m_size) return nullptr;
+
+        // A mapping object can't grow, so it is recreated once the file has outgrown it
+        if (!m_mapping || offset + size > m_mappingSize) {
+            if (m_mapping) CloseHandle(m_mapping);
+            m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            m_mappingSize = m_mapping ? m_size : 0;
+            if (!m_mapping) return nullptr;
+        }
+        void* view = MapViewOfFile(m_mapping, FILE_MAP_READ, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), size);
+        return static_cast<const uint8_t*>(view);
+    }
+
+    void SpillFile::Unmap(const uint8_t* view, size_t)
+    {
+        if (view) UnmapViewOfFile(view);
+    }
+
+#else
+
+    bool SpillFile::Open()
+    {
+        if (IsOpen()) return true;
+
+        const char* directory = std::getenv("TMPDIR");
+        std::string path = std::string(directory && *directory ? directory : "/tmp") + "/wrt-scrollback-XXXXXX";
+        int fd = mkstemp(path.data());
+        if (fd < 0) return false;
+        unlink(path.c_str()); // The open descriptor keeps the data, the name is gone right away
+        m_fd = fd;
+        m_size = 0;
+        return true;
+    }
+
+    bool SpillFile::IsOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    void SpillFile::Close()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+        m_size = 0;
+    }
+
+    bool SpillFile::Write(uint64_t offset, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            ssize_t written = pwrite(m_fd, bytes, size, static_cast<off_t>(offset));
+            if (written <= 0) return false;
+            bytes += written;
+            offset += written;
+            size -= written;
+        }
+        if (offset > m_size) m_size = offset;
+        return true;
+    }
+
+    void SpillFile::Truncate()
+    {
+        if (ftruncate(m_fd, 0) == 0) {
+            m_size = 0;
+        }
+    }
+
+    void SpillFile::Discard(uint64_t offset, size_t size)
+    {
+#if defined(FALLOC_FL_PUNCH_HOLE)
+        fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(size));
+#else
+        (void)offset;
+        (void)size;
+#endif
+    }
+
+    const uint8_t* SpillFile::Map(uint64_t offset, size_t size)
+    {
+        if (size == 0 || offset + size > m_size) return nullptr;
+        void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, static_cast<off_t>(offset));
+        return view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+    }
+
+    void SpillFile::Unmap(const uint8_t* view, size_t size)
+    {
+        if (view) munmap(const_cast<uint8_t*>(view), size);
+    }
+
+#endif
+}
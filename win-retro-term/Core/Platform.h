@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace winrt::win_retro_term::Core::Platform
+{
+    // The few OS services the parser and buffer need, so Core builds without <Windows.h>
+    // on other platforms (see the CMake project at the repository root).
+
+    // Audible bell for BEL
+    void Beep();
+
+    // Anonymous temporary file that is written with positioned writes and read back through
+    // read-only mapped views. It lives in the temp directory and is deleted when closed
+    // (or, outside Windows, as soon as it is created), so nothing is left behind after a crash.
+    // View offsets must be multiples of MAP_ALIGNMENT.
+    class SpillFile {
+    public:
+        static constexpr size_t MAP_ALIGNMENT = 64 * 1024; // Windows allocation granularity, a page multiple elsewhere
+
+        SpillFile() = default;
+        SpillFile(const SpillFile&) = delete;
+        SpillFile& operator=(const SpillFile&) = delete;
+        ~SpillFile();
+
+        bool Open();
+        bool IsOpen() const;
+        void Close();
+
+        // Exchanges the open files, views stay valid
+        void Swap(SpillFile& other) noexcept {
+#if defined(_WIN32)
+            std::swap(m_file, other.m_file);
+            std::swap(m_mapping, other.m_mapping);
+            std::swap(m_mappingSize, other.m_mappingSize);
+#else
+            std::swap(m_fd, other.m_fd);
+#endif
+            std::swap(m_size, other.m_size);
+        }
+
+        bool Write(uint64_t offset, const void* data, size_t size);
+        void Truncate();
+        // Gives the disk space of a range no longer needed back, where the file system can. It reads as zeros after.
+        void Discard(uint64_t offset, size_t size);
+
+        // nullptr on failure; the view stays valid until unmapped, even across later writes
+        const uint8_t* Map(uint64_t offset, size_t size);
+        void Unmap(const uint8_t* view, size_t size);
+
+    private:
+#if defined(_WIN32)
+        void* m_file = nullptr;         // HANDLE, INVALID_HANDLE_VALUE is stored as nullptr
+        void* m_mapping = nullptr;
+        uint64_t m_mappingSize = 0;     // File size the mapping object was created with
+#else
+        int m_fd = -1;
+#endif
+        uint64_t m_size = 0;
+    };
+}
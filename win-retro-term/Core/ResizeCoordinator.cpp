@@ -0,0 +1,40 @@
+#include "pch.h"
+#include "ResizeCoordinator.h"
+
+namespace winrt::win_retro_term::Core
+{
+    void ResizeCoordinator::Commit(GridSize size)
+    {
+        m_committed = size;
+        m_pending = false;
+    }
+
+    void ResizeCoordinator::Request(GridSize size, Clock::time_point now)
+    {
+        if (size == m_committed) {
+            m_pending = false; // Dragged back to where it was
+            return;
+        }
+        if (!m_pending) {
+            m_pending = true;
+            m_firstChange = now;
+            m_lastChange = now;
+        }
+        else if (size != m_requested) {
+            m_lastChange = now; // Layout passes that keep the same grid size don't hold it back
+        }
+        m_requested = size;
+    }
+
+    std::optional<GridSize> ResizeCoordinator::Poll(Clock::time_point now)
+    {
+        if (!m_pending) {
+            return std::nullopt;
+        }
+        if (now - m_lastChange < SETTLE_DELAY && now - m_firstChange < MAX_LATENCY) {
+            return std::nullopt;
+        }
+        Commit(m_requested);
+        return m_committed;
+    }
+}
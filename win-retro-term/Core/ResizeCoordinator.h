@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <optional>
+
+namespace winrt::win_retro_term::Core
+{
+    struct GridSize {
+        int rows = 0;
+        int cols = 0;
+
+        bool operator==(const GridSize&) const = default;
+    };
+
+    // Paces grid and PTY resizes while a window edge is dragged. Layout reports a new size every frame
+    // of the drag, but each one committed costs a reflow on the worker and a full repaint from ConPTY,
+    // so a size is only committed once it has settled: no other size for SETTLE_DELAY (trailing edge),
+    // or MAX_LATENCY after the first uncommitted change, so a drag that never pauses still reflows a
+    // few times a second. Until then the renderer draws the committed grid into the new viewport.
+    //
+    // UI thread only. The caller passes the time in and polls once per frame.
+    class ResizeCoordinator {
+    public:
+        using Clock = std::chrono::steady_clock;
+        static constexpr std::chrono::milliseconds SETTLE_DELAY{ 50 };
+        static constexpr std::chrono::milliseconds MAX_LATENCY{ 200 };
+
+        explicit ResizeCoordinator(GridSize committed = {}) : m_committed(committed) {}
+
+        // Takes 'size' as committed right away, dropping anything pending
+        void Commit(GridSize size);
+
+        // A size from layout, committed by a later Poll unless another one replaces it first
+        void Request(GridSize size, Clock::time_point now);
+
+        // The size due to be committed, if any; it becomes the committed size
+        std::optional<GridSize> Poll(Clock::time_point now);
+
+        bool Pending() const { return m_pending; }
+        GridSize Committed() const { return m_committed; }
+
+    private:
+        GridSize m_committed;
+        GridSize m_requested;
+        bool m_pending = false;
+        Clock::time_point m_firstChange;    // Since the committed size
+        Clock::time_point m_lastChange;
+    };
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // What changed on the live screen since a consumer last looked, so renderers and other consumers
+    // (accessibility, mirroring) can update incrementally instead of rescanning.
+    struct ScreenDamage {
+        struct RowRange {
+            int first;
+            int last;       // Inclusive
+        };
+
+        // Whole-screen scrolling first: row r now shows what row r + scrollDelta showed before
+        // (negative when the screen scrolled down). The rows it brought in are in 'rows'.
+        int scrollDelta = 0;
+        std::vector<RowRange> rows;     // Rows whose cells changed, in their current positions, ascending
+
+        bool full = false;              // Size, screen or style ids changed: 'rows' covers everything, scrollDelta is 0
+        bool cursorChanged = false;     // Position or visibility
+        bool modesChanged = false;      // Input modes, autowrap, origin mode, alternate screen
+        bool viewportChanged = false;   // Scrolled into or within history
+
+        bool Empty() const {
+            return scrollDelta == 0 && rows.empty() && !full && !cursorChanged && !modesChanged && !viewportChanged;
+        }
+    };
+
+    // Where one consumer left off. Every consumer keeps its own and passes it to TerminalBuffer::CollectDamage.
+    struct DamageCursor {
+        uint64_t screenId = 0;          // 0 never matches, so the first collect is full damage
+        uint64_t changeCount = 0;
+        int64_t scrolledLines = 0;
+        int cursorRow = -1;
+        int cursorCol = -1;
+        bool cursorVisible = false;
+        uint32_t modes = 0;
+        int viewportOffset = 0;
+    };
+}
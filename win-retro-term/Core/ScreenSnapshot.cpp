@@ -0,0 +1,21 @@
+#include "pch.h"
+#include "ScreenSnapshot.h"
+
+namespace winrt::win_retro_term::Core
+{
+    void SnapshotExchange::Publish()
+    {
+        // acq_rel: releases the snapshot just written, acquires the buffer the reader gave back
+        uint8_t previous = m_middle.exchange(static_cast<uint8_t>(m_backIndex | FRESH_BIT), std::memory_order_acq_rel);
+        m_backIndex = previous & INDEX_MASK;
+    }
+
+    const ScreenSnapshot& SnapshotExchange::Acquire()
+    {
+        if (m_middle.load(std::memory_order_relaxed) & FRESH_BIT) {
+            uint8_t previous = m_middle.exchange(m_frontIndex, std::memory_order_acq_rel);
+            m_frontIndex = previous & INDEX_MASK;
+        }
+        return m_buffers[m_frontIndex];
+    }
+}
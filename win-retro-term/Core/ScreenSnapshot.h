@@ -0,0 +1,88 @@
+#pragma once
+#include "TerminalBuffer.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // One row of a snapshot, never modified once a snapshot holds it. Rows that didn't change between
+    // publishes are the same object in both snapshots, so comparing pointers or epochs finds what changed.
+    struct SnapshotRow {
+        uint64_t epoch = 0;                 // Snapshot epoch the row was built in
+        std::vector<char32_t> text;         // cols code points
+        std::vector<StyleSpan> spans;       // Covering exactly cols cells
+        std::vector<std::u32string> clusters;   // Indexed by cluster cells, see Cell.h
+    };
+
+    // Everything the UI thread needs to draw a frame and encode input, filled in from TerminalBuffer
+    // by the parser worker. Rows are shared handles, so publishing only rebuilds the rows that changed.
+    struct ScreenSnapshot {
+        int rows = 0;
+        int cols = 0;
+        std::vector<std::shared_ptr<const SnapshotRow>> lines;     // 'rows' entries, top to bottom
+        uint64_t epoch = 0;                 // Incremented by every capture
+
+        // Copy of the StyleTable the cells' style ids index into, extended in place until the table is compacted
+        std::vector<TextStyle> styles;
+        uint64_t styleGeneration = 0;
+
+        int cursorRow = 0;
+        int cursorCol = 0;
+        bool cursorVisible = true;
+
+        // Lines the view is scrolled back into history (0 shows the live screen), and how many there are
+        int viewportOffset = 0;
+        size_t scrollbackLines = 0;
+
+        bool applicationCursorKeysMode = false;
+        bool applicationKeypadMode = false;
+
+        // Flood control state at publish time, shown as a backlog indicator
+        bool flooding = false;
+        size_t backlogBytes = 0;
+
+        // Host state from OSC strings; strings are only re-copied when their generation changes
+        std::string title;
+        uint64_t titleGeneration = 0;
+        ColorPalette palette = DEFAULT_PALETTE;
+        uint64_t paletteGeneration = 0;
+        std::string clipboardText;      // Latest OSC 52 write, as UTF-8
+        uint64_t clipboardGeneration = 0;
+
+        uint64_t sequence = 0; // Incremented on every publish, 0 means nothing was published yet
+
+        const char32_t* Text(int row) const { return lines[row]->text.data(); }
+        std::span<const StyleSpan> Spans(int row) const { return lines[row]->spans; }
+        std::u32string_view Cluster(int row, char32_t cell) const { return lines[row]->clusters[cell - CLUSTER_CELL]; }
+        const TextStyle& Style(const StyleSpan& span) const { return styles[span.style]; }
+    };
+
+    // Lock-free triple buffer handing snapshots from one writer thread to one reader thread.
+    // The writer always has a back buffer to fill and the reader always holds a complete front buffer,
+    // the third one sits in the middle; both sides only ever swap indices, so neither waits on the other.
+    class SnapshotExchange {
+    public:
+        // Writer side
+        ScreenSnapshot& BackBuffer() { return m_buffers[m_backIndex]; }
+        void Publish();
+
+        // Reader side: picks up the latest published snapshot, if any, and returns the current front buffer.
+        // The reference stays valid until the next call.
+        const ScreenSnapshot& Acquire();
+        const ScreenSnapshot& FrontBuffer() const { return m_buffers[m_frontIndex]; }
+
+    private:
+        static constexpr uint8_t INDEX_MASK = 0x03;
+        static constexpr uint8_t FRESH_BIT = 0x04; // Set in m_middle when it holds a snapshot the reader hasn't seen
+
+        ScreenSnapshot m_buffers[3];
+        uint8_t m_backIndex = 0;                    // Writer only
+        uint8_t m_frontIndex = 1;                   // Reader only
+        std::atomic<uint8_t> m_middle{ 2 };
+    };
+}
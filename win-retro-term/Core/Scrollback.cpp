@@ -0,0 +1,581 @@
+#include "pch.h"
+#include "Scrollback.h"
+#include "Lz4.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        // Never a UTF-8 lead byte, stands for the WIDE_SPACER that follows every wide character
+        constexpr uint8_t SPACER_BYTE = 0xF8;
+
+        // Code points are encoded as-is, a lone surrogate gets the 3-byte form
+        size_t EncodeUnit(uint32_t unit, uint8_t* out)
+        {
+            if (unit < 0x80) {
+                out[0] = static_cast<uint8_t>(unit);
+                return 1;
+            }
+            if (unit < 0x800) {
+                out[0] = static_cast<uint8_t>(0xC0 | (unit >> 6));
+                out[1] = static_cast<uint8_t>(0x80 | (unit & 0x3F));
+                return 2;
+            }
+            if (unit < 0x10000) {
+                out[0] = static_cast<uint8_t>(0xE0 | (unit >> 12));
+                out[1] = static_cast<uint8_t>(0x80 | ((unit >> 6) & 0x3F));
+                out[2] = static_cast<uint8_t>(0x80 | (unit & 0x3F));
+                return 3;
+            }
+            if (unit == WIDE_SPACER) {
+                out[0] = SPACER_BYTE;
+                return 1;
+            }
+            out[0] = static_cast<uint8_t>(0xF0 | (unit >> 18));
+            out[1] = static_cast<uint8_t>(0x80 | ((unit >> 12) & 0x3F));
+            out[2] = static_cast<uint8_t>(0x80 | ((unit >> 6) & 0x3F));
+            out[3] = static_cast<uint8_t>(0x80 | (unit & 0x3F));
+            return 4;
+        }
+
+        // Only ever reads what EncodeUnit wrote, so no validation is needed
+        uint32_t DecodeUnit(const uint8_t*& in)
+        {
+            uint8_t lead = *in++;
+            if (lead < 0x80) {
+                return lead;
+            }
+            if (lead < 0xE0) {
+                return ((lead & 0x1Fu) << 6) | (*in++ & 0x3Fu);
+            }
+            if (lead < 0xF0) {
+                uint32_t unit = ((lead & 0x0Fu) << 12) | ((in[0] & 0x3Fu) << 6) | (in[1] & 0x3Fu);
+                in += 2;
+                return unit;
+            }
+            if (lead == SPACER_BYTE) {
+                return WIDE_SPACER;
+            }
+            uint32_t unit = ((lead & 0x07u) << 18) | ((in[0] & 0x3Fu) << 12) | ((in[1] & 0x3Fu) << 6) | (in[2] & 0x3Fu);
+            in += 3;
+            return unit;
+        }
+    }
+
+    Scrollback::Scrollback(size_t memoryLimit, uint64_t spillLimit) : m_memoryLimit(memoryLimit), m_spillLimit(spillLimit)
+    {
+    }
+
+    Scrollback::~Scrollback()
+    {
+        DropOldest(m_chunks.size()); // Unmaps the views before the file goes away
+    }
+
+    void Scrollback::SetMemoryLimit(size_t bytes)
+    {
+        m_memoryLimit = bytes;
+        Evict();
+    }
+
+    void Scrollback::SetSpillLimit(uint64_t bytes)
+    {
+        m_spillLimit = bytes;
+
+        // Chunks stored past the new end of the ring go, with everything older than them
+        size_t drop = 0;
+        for (size_t i = 0; i < m_spilledChunks; ++i) {
+            if (m_chunks[i].fileOffset + m_chunks[i].stored > m_spillLimit) {
+                drop = i + 1;
+            }
+        }
+        DropOldest(drop);
+        Evict();
+    }
+
+    void Scrollback::Clear()
+    {
+        DropOldest(m_chunks.size());
+        if (m_file.IsOpen()) {
+            m_file.Truncate();
+        }
+        m_firstChunk = 0;
+        m_writeOffset = 0;
+        m_spillFailed = false;
+        m_totalLines = 0;
+        m_index.Clear();
+    }
+
+    void Scrollback::Swap(Scrollback& other) noexcept
+    {
+        std::swap(m_memoryLimit, other.m_memoryLimit);
+        std::swap(m_spillLimit, other.m_spillLimit);
+        m_chunks.swap(other.m_chunks);
+        std::swap(m_firstChunk, other.m_firstChunk);
+        std::swap(m_chunkBytes, other.m_chunkBytes);
+        std::swap(m_spilledChunks, other.m_spilledChunks);
+        std::swap(m_spilledBytes, other.m_spilledBytes);
+        std::swap(m_writeOffset, other.m_writeOffset);
+        std::swap(m_spillFailed, other.m_spillFailed);
+        m_lines.swap(other.m_lines);
+        std::swap(m_totalLines, other.m_totalLines);
+        m_index.Swap(other.m_index);
+        m_file.Swap(other.m_file);
+        m_mappedChunks.swap(other.m_mappedChunks);
+        m_cache.swap(other.m_cache);
+        std::swap(m_cacheClock, other.m_cacheClock);
+        std::swap(m_stats, other.m_stats);
+    }
+
+    void Scrollback::PushLine(std::span<const char32_t> text, std::span<const StyleSpan> spans, const StyleTable& styles,
+        std::span<const std::u32string> clusters, bool wrapped)
+    {
+        // Trailing blanks are spaces in the default style, the last spans are checked from the end
+        size_t count = text.size();
+        size_t spanEnd = text.size();
+        for (size_t s = spans.size(); s-- > 0 && count == spanEnd && !wrapped;) {
+            size_t spanStart = spanEnd - spans[s].length;
+            if (spans[s].style == StyleTable::DEFAULT_STYLE) {
+                while (count > spanStart && text[count - 1] == U' ') {
+                    --count;
+                }
+            }
+            spanEnd = spanStart;
+        }
+        count = std::min<size_t>(count, UINT16_MAX);
+
+        // Style runs, and whether every character fits in a byte
+        m_runScratch.clear();
+        size_t position = 0;
+        for (const StyleSpan& span : spans) {
+            if (position >= count) break;
+            const TextStyle& style = styles.Get(span.style);
+            uint16_t length = static_cast<uint16_t>(std::min<size_t>(span.length, count - position));
+            m_runScratch.push_back({ length, style.attributes, style.hyperlink, 0, style.foreground, style.background, style.underlineColor });
+            position += length;
+        }
+        bool narrow = std::all_of(text.begin(), text.begin() + count, [](char32_t ch) { return static_cast<uint32_t>(ch) < 0x100; });
+
+        m_textScratch.resize(count * 4);
+        m_clusterScratch.clear();
+        uint16_t clusterCount = 0;
+        size_t textBytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t unit = static_cast<uint32_t>(text[i]);
+            if (narrow) {
+                m_textScratch[textBytes++] = static_cast<uint8_t>(unit);
+                continue;
+            }
+            if (IsClusterCell(text[i])) {
+                // Only the clusters still on the line are kept, renumbered in order
+                const std::u32string& cluster = clusters[unit - CLUSTER_CELL];
+                size_t at = m_clusterScratch.size();
+                m_clusterScratch.resize(at + 1 + cluster.size() * 4);
+                m_clusterScratch[at] = static_cast<uint8_t>(cluster.size());
+                size_t end = at + 1;
+                for (char32_t ch : cluster) {
+                    end += EncodeUnit(static_cast<uint32_t>(ch), m_clusterScratch.data() + end);
+                }
+                m_clusterScratch.resize(end);
+                unit = CLUSTER_CELL + clusterCount++;
+            }
+            textBytes += EncodeUnit(unit, m_textScratch.data() + textBytes);
+        }
+        size_t clusterBytes = clusterCount != 0 ? 2 + m_clusterScratch.size() : 0;
+
+        uint8_t flags = static_cast<uint8_t>((narrow ? 0 : LINE_UTF8) | (clusterCount != 0 ? LINE_CLUSTERS : 0) | (wrapped ? LINE_WRAPPED : 0));
+        LineHeader header = { static_cast<uint32_t>(textBytes), static_cast<uint16_t>(count),
+            static_cast<uint16_t>(m_runScratch.size()), flags };
+        size_t runBytes = m_runScratch.size() * sizeof(PackedRun);
+        uint8_t* record = Allocate(HEADER_BYTES + runBytes + textBytes + clusterBytes);
+
+        std::memcpy(record, &header.textBytes, 4);
+        std::memcpy(record + 4, &header.cellCount, 2);
+        std::memcpy(record + 6, &header.runCount, 2);
+        record[8] = header.flags;
+        if (runBytes != 0) {
+            std::memcpy(record + HEADER_BYTES, m_runScratch.data(), runBytes);
+        }
+        if (textBytes != 0) {
+            std::memcpy(record + HEADER_BYTES + runBytes, m_textScratch.data(), textBytes);
+        }
+        if (clusterBytes != 0) {
+            uint8_t* out = record + HEADER_BYTES + runBytes + textBytes;
+            std::memcpy(out, &clusterCount, 2);
+            std::memcpy(out + 2, m_clusterScratch.data(), m_clusterScratch.size());
+        }
+        m_index.AddRow(text.first(count), clusters, wrapped);
+        ++m_totalLines;
+        Evict();
+    }
+
+    size_t Scrollback::RetractableLines() const
+    {
+        size_t raw = m_chunks.size();
+        while (raw > m_spilledChunks && !m_chunks[raw - 1].compressed) {
+            --raw;
+        }
+        uint32_t sequence = m_firstChunk + static_cast<uint32_t>(raw);
+        auto first = std::partition_point(m_lines.begin(), m_lines.end(), [sequence](const LineRef& ref) { return ref.chunk < sequence; });
+        return static_cast<size_t>(m_lines.end() - first);
+    }
+
+    void Scrollback::DropNewest(size_t lines)
+    {
+        lines = std::min(lines, RetractableLines());
+        if (lines == 0) return;
+
+        // Chunks after the first dropped line's go, and that one is cut back to where the line began
+        LineRef first = m_lines[m_lines.size() - lines];
+        while (m_firstChunk + m_chunks.size() - 1 > first.chunk) {
+            m_chunkBytes -= m_chunks.back().capacity;
+            m_chunks.pop_back();
+        }
+        m_chunks.back().used = first.offset;
+        if (first.offset == 0) {
+            m_chunkBytes -= m_chunks.back().capacity;
+            m_chunks.pop_back();
+        }
+
+        m_lines.resize(m_lines.size() - lines);
+        m_totalLines -= lines;
+        m_index.DropFrom(m_totalLines);
+    }
+
+    void Scrollback::DropBefore(uint64_t line)
+    {
+        if (m_lines.empty()) return;
+        uint64_t first = m_totalLines - m_lines.size();
+        size_t keep = static_cast<size_t>(std::min<uint64_t>(line > first ? line - first : 0, m_lines.size() - 1));
+        size_t chunks = m_lines[keep].chunk - m_firstChunk;
+
+        // A ring write would only reuse the space once it wraps around
+        for (size_t i = 0; i < std::min(chunks, m_spilledChunks); ++i) {
+            m_file.Discard(m_chunks[i].fileOffset, m_chunks[i].stored);
+        }
+        DropOldest(chunks);
+    }
+
+    uint8_t* Scrollback::Allocate(size_t bytes)
+    {
+        if (m_chunks.empty() || m_chunks.back().capacity - m_chunks.back().used < bytes) {
+            // Very wide lines get a chunk of their own
+            Chunk chunk;
+            chunk.capacity = std::max(CHUNK_BYTES, bytes);
+            chunk.data = std::make_unique<uint8_t[]>(chunk.capacity);
+            m_chunkBytes += chunk.capacity;
+            m_chunks.push_back(std::move(chunk));
+            CompressAged();
+        }
+
+        Chunk& chunk = m_chunks.back();
+        uint32_t sequence = m_firstChunk + static_cast<uint32_t>(m_chunks.size() - 1);
+        m_lines.push_back({ sequence, static_cast<uint32_t>(chunk.used) });
+        uint8_t* record = chunk.data.get() + chunk.used;
+        chunk.used += bytes;
+        return record;
+    }
+
+    void Scrollback::CompressAged()
+    {
+        // Each new chunk pushes exactly one chunk out of the hot tail
+        if (m_chunks.size() <= HOT_CHUNKS + 1) return;
+        Chunk& chunk = m_chunks[m_chunks.size() - 1 - HOT_CHUNKS];
+        if (!chunk.data || chunk.compressed) return;
+
+        m_compressScratch.resize(Lz4::CompressBound(chunk.used));
+        size_t size = Lz4::Compress(chunk.data.get(), chunk.used, m_compressScratch.data(), m_compressScratch.size());
+        if (size == 0 || size > chunk.used - chunk.used / 8) {
+            return; // Not worth a decompression on every read
+        }
+
+        auto compressed = std::make_unique<uint8_t[]>(size);
+        std::memcpy(compressed.get(), m_compressScratch.data(), size);
+        m_chunkBytes -= chunk.capacity;
+        m_chunkBytes += size;
+        chunk.data = std::move(compressed);
+        chunk.stored = size;
+        chunk.compressed = true;
+        m_stats.rawBytes += chunk.used;
+        m_stats.compressedBytes += size;
+    }
+
+    void Scrollback::Evict()
+    {
+        // The chunk being filled always stays resident, so the newest lines survive even a tiny limit
+        while (MemoryUsage() > m_memoryLimit && m_chunks.size() - m_spilledChunks > 1) {
+            if (!SpillOldestResident()) {
+                // Lines must go oldest first, so whatever is on disk goes along with it
+                DropOldest(m_spilledChunks + 1);
+            }
+        }
+    }
+
+    bool Scrollback::SpillOldestResident()
+    {
+        Chunk& chunk = m_chunks[m_spilledChunks];
+        size_t bytes = chunk.compressed ? chunk.stored : chunk.used;
+        if (m_spillFailed || bytes > m_spillLimit) {
+            return false;
+        }
+        if (!m_file.IsOpen() && !m_file.Open()) {
+            m_spillFailed = true;
+            return false;
+        }
+
+        // Append, wrapping to the start of the file when the ring's end is reached. Spilled chunks
+        // that overlap the target range are dropped together with everything older than them.
+        if (m_writeOffset + bytes > m_spillLimit) {
+            m_writeOffset = 0;
+        }
+        uint64_t start = m_writeOffset;
+        uint64_t end = start + bytes;
+        size_t drop = 0;
+        for (size_t i = 0; i < m_spilledChunks; ++i) {
+            const Chunk& spilled = m_chunks[i];
+            if (spilled.fileOffset < end && spilled.fileOffset + spilled.stored > start) {
+                drop = i + 1;
+            }
+        }
+        DropOldest(drop); // Leaves 'chunk' in place, a deque keeps references to the elements it doesn't erase
+
+        if (!m_file.Write(start, chunk.data.get(), bytes)) {
+            m_spillFailed = true;
+            return false;
+        }
+        m_chunkBytes -= chunk.compressed ? chunk.stored : chunk.capacity;
+        chunk.data.reset();
+        chunk.stored = bytes;
+        chunk.fileOffset = start;
+        m_spilledBytes += bytes;
+        ++m_spilledChunks;
+        m_writeOffset = end;
+        return true;
+    }
+
+    void Scrollback::DropOldest(size_t chunks)
+    {
+        for (size_t i = 0; i < chunks && !m_chunks.empty(); ++i) {
+            while (!m_lines.empty() && m_lines.front().chunk == m_firstChunk) {
+                m_lines.pop_front();
+            }
+
+            Chunk& chunk = m_chunks.front();
+            if (chunk.view) {
+                UnmapView(chunk);
+                std::erase(m_mappedChunks, m_firstChunk);
+            }
+            if (chunk.compressed) {
+                m_stats.rawBytes -= chunk.used;
+                m_stats.compressedBytes -= chunk.stored;
+                for (CacheEntry& entry : m_cache) {
+                    if (entry.chunk == m_firstChunk) entry.lastUse = 0;
+                }
+            }
+            if (chunk.data) {
+                m_chunkBytes -= chunk.compressed ? chunk.stored : chunk.capacity;
+            }
+            else {
+                m_spilledBytes -= chunk.stored;
+                --m_spilledChunks;
+            }
+            m_chunks.pop_front();
+            ++m_firstChunk;
+        }
+        m_index.DropBefore(m_totalLines - m_lines.size());
+    }
+
+    void Scrollback::UnmapView(const Chunk& chunk) const
+    {
+        // Views start on a mapping boundary, 'view' points at the chunk inside it
+        size_t lead = static_cast<size_t>(chunk.fileOffset % Platform::SpillFile::MAP_ALIGNMENT);
+        m_file.Unmap(chunk.view - lead, lead + chunk.stored);
+        chunk.view = nullptr;
+    }
+
+    const uint8_t* Scrollback::StoredData(uint32_t sequence) const
+    {
+        const Chunk& chunk = m_chunks[sequence - m_firstChunk];
+        if (chunk.data) {
+            return chunk.data.get();
+        }
+        if (chunk.view) {
+            return chunk.view;
+        }
+
+        // Fault the chunk in, unmapping the one mapped longest ago once too many are
+        size_t lead = static_cast<size_t>(chunk.fileOffset % Platform::SpillFile::MAP_ALIGNMENT);
+        const uint8_t* view = m_file.Map(chunk.fileOffset - lead, lead + chunk.stored);
+        if (!view) {
+            return nullptr;
+        }
+        chunk.view = view + lead;
+        m_mappedChunks.push_back(sequence);
+        if (m_mappedChunks.size() > MAX_MAPPED_CHUNKS) {
+            UnmapView(m_chunks[m_mappedChunks.front() - m_firstChunk]);
+            m_mappedChunks.pop_front();
+        }
+        return chunk.view;
+    }
+
+    const uint8_t* Scrollback::ChunkData(uint32_t sequence) const
+    {
+        const Chunk& chunk = m_chunks[sequence - m_firstChunk];
+        if (!chunk.compressed) {
+            return StoredData(sequence);
+        }
+
+        for (CacheEntry& entry : m_cache) {
+            if (entry.lastUse != 0 && entry.chunk == sequence) {
+                entry.lastUse = ++m_cacheClock;
+                ++m_stats.cacheHits;
+                return entry.bytes.data();
+            }
+        }
+
+        // Miss: decompress into a free entry, or over the least recently used one
+        CacheEntry* entry = nullptr;
+        if (m_cache.size() < DECOMPRESSED_CACHE_CHUNKS) {
+            entry = &m_cache.emplace_back();
+        }
+        else {
+            entry = &*std::min_element(m_cache.begin(), m_cache.end(),
+                [](const CacheEntry& a, const CacheEntry& b) { return a.lastUse < b.lastUse; });
+        }
+        entry->lastUse = 0;
+
+        const uint8_t* stored = StoredData(sequence);
+        if (!stored) {
+            return nullptr;
+        }
+        auto start = std::chrono::steady_clock::now();
+        entry->bytes.resize(chunk.used);
+        if (!Lz4::Decompress(stored, chunk.stored, entry->bytes.data(), chunk.used)) {
+            return nullptr;
+        }
+        m_stats.decompressNanoseconds += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        ++m_stats.decompressions;
+
+        entry->chunk = sequence;
+        entry->lastUse = ++m_cacheClock;
+        return entry->bytes.data();
+    }
+
+    const uint8_t* Scrollback::LineData(size_t line, LineHeader& header) const
+    {
+        const LineRef& ref = m_lines[line];
+        const uint8_t* data = ChunkData(ref.chunk);
+        if (!data) {
+            return nullptr;
+        }
+        const uint8_t* record = data + ref.offset;
+        std::memcpy(&header.textBytes, record, 4);
+        std::memcpy(&header.cellCount, record + 4, 2);
+        std::memcpy(&header.runCount, record + 6, 2);
+        header.flags = record[8];
+        return record + HEADER_BYTES;
+    }
+
+    void Scrollback::ReadClusters(const uint8_t* packed, std::span<char32_t> text, std::vector<std::u32string>* clusters)
+    {
+        uint16_t count;
+        std::memcpy(&count, packed, 2);
+        packed += 2;
+
+        if (clusters) {
+            size_t base = clusters->size();
+            clusters->reserve(base + count);
+            for (uint16_t c = 0; c < count; ++c) {
+                std::u32string& cluster = clusters->emplace_back(*packed++, U'\0');
+                for (char32_t& ch : cluster) {
+                    ch = DecodeUnit(packed);
+                }
+            }
+            for (char32_t& ch : text) {
+                if (IsClusterCell(ch)) {
+                    ch += static_cast<char32_t>(base);
+                }
+            }
+            return;
+        }
+
+        // Without a list to append to, cluster cells fall back to their first code point
+        std::vector<char32_t> first(count);
+        for (uint16_t c = 0; c < count; ++c) {
+            uint8_t length = *packed++;
+            first[c] = DecodeUnit(packed);
+            for (uint8_t i = 1; i < length; ++i) {
+                DecodeUnit(packed);
+            }
+        }
+        for (char32_t& ch : text) {
+            if (IsClusterCell(ch)) {
+                ch = first[ch - CLUSTER_CELL];
+            }
+        }
+    }
+
+    size_t Scrollback::LineLength(size_t line) const
+    {
+        LineHeader header;
+        return LineData(line, header) ? header.cellCount : 0;
+    }
+
+    bool Scrollback::IsWrapped(size_t line) const
+    {
+        LineHeader header;
+        return LineData(line, header) && (header.flags & LINE_WRAPPED) != 0;
+    }
+
+    void Scrollback::ReadLine(size_t line, std::span<char32_t> text, std::vector<StyleSpan>& spans, StyleTable& styles,
+        std::vector<std::u32string>* clusters) const
+    {
+        LineHeader header;
+        const uint8_t* runs = LineData(line, header);
+        size_t column = 0;
+        if (runs) {
+            const uint8_t* packed = runs + header.runCount * sizeof(PackedRun);
+            bool utf8 = (header.flags & LINE_UTF8) != 0;
+
+            for (uint16_t r = 0; r < header.runCount && column < text.size(); ++r) {
+                PackedRun run;
+                std::memcpy(&run, runs + r * sizeof(PackedRun), sizeof(PackedRun));
+
+                TextStyle style;
+                style.foreground = run.foreground;
+                style.background = run.background;
+                style.underlineColor = run.underlineColor;
+                style.attributes = run.attributes;
+                style.hyperlink = run.hyperlink;
+                size_t length = std::min<size_t>(run.length, text.size() - column);
+                spans.push_back({ static_cast<uint32_t>(length), styles.Intern(style) });
+                for (size_t i = 0; i < length; ++i) {
+                    text[column++] = utf8 ? DecodeUnit(packed) : *packed++;
+                }
+            }
+
+            // A wide character cut off by a narrower 'text' loses its left half too
+            if (utf8 && column == text.size() && column < header.cellCount && DecodeUnit(packed) == WIDE_SPACER) {
+                text[column - 1] = U' ';
+            }
+            if ((header.flags & LINE_CLUSTERS) != 0) {
+                ReadClusters(runs + header.runCount * sizeof(PackedRun) + header.textBytes, text.first(column), clusters);
+            }
+        }
+        // Otherwise the chunk couldn't be mapped or decompressed, and the line reads as blank
+
+        if (column < text.size()) {
+            std::fill(text.begin() + column, text.end(), U' ');
+            if (!spans.empty() && spans.back().style == StyleTable::DEFAULT_STYLE && column != 0) {
+                spans.back().length += static_cast<uint32_t>(text.size() - column);
+            }
+            else {
+                spans.push_back({ static_cast<uint32_t>(text.size() - column), StyleTable::DEFAULT_STYLE });
+            }
+        }
+    }
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include "Cell.h"
+#include "Platform.h"
+#include "SearchIndex.h"
+#include "StyleTable.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // History of lines that scrolled off the top of the screen, capped in bytes rather than lines.
+    //
+    // Lines are packed into 64 KiB chunks with trailing blanks trimmed: the text as one byte per cell
+    // when every character fits (ASCII and Latin-1), UTF-8 otherwise, and the attributes as runs of
+    // equally styled cells instead of one copy per cell. Runs hold the style itself rather than a
+    // StyleTable id, so history outlives style compaction. A line index gives O(1) access to any line.
+    // Wide-character spacers take one byte, and a line's grapheme clusters follow its text.
+    //
+    // Chunks older than the newest HOT_CHUNKS are LZ4 compressed (kept raw if that doesn't save
+    // anything), and reading a line in one decompresses the whole chunk into a small LRU cache,
+    // so scrolling or searching through neighbouring lines pays for it once.
+    //
+    // Only the index and the newest chunks (the hot tail, up to the memory limit) stay in RAM.
+    // Older chunks spill to a temporary session file used as a ring log up to the spill limit,
+    // and are mapped back in on demand when a line in them is read; a few views are kept mapped.
+    // Past both limits whole chunks are dropped from the oldest end. The file is deleted with
+    // the Scrollback, and truncated by Clear.
+    //
+    // The text of every line also goes to a SearchIndex, numbered like TotalLines. It has a memory
+    // limit of its own, outside MemoryLimit(), so spilled history is only searchable as far back as it reaches.
+    // Its blocks are finished by FinishSearchIndex, left to the owner's idle time.
+    class Scrollback {
+    public:
+        static constexpr size_t DEFAULT_MEMORY_LIMIT = 64 * 1024 * 1024;
+        static constexpr uint64_t DEFAULT_SPILL_LIMIT = 1024ull * 1024 * 1024;
+        static constexpr size_t CHUNK_BYTES = 64 * 1024;
+        static constexpr size_t HOT_CHUNKS = 4;                 // Newest chunks left uncompressed
+        static constexpr size_t DECOMPRESSED_CACHE_CHUNKS = 8;
+        static constexpr size_t MAX_MAPPED_CHUNKS = 64;
+
+        struct CompressionStats {
+            uint64_t rawBytes = 0;              // Held chunks that are compressed, before and after
+            uint64_t compressedBytes = 0;
+            uint64_t decompressions = 0;
+            uint64_t decompressNanoseconds = 0;
+            uint64_t cacheHits = 0;
+
+            double Ratio() const { return compressedBytes != 0 ? static_cast<double>(rawBytes) / compressedBytes : 1.0; }
+            double AverageDecompressMicroseconds() const { return decompressions != 0 ? decompressNanoseconds / 1000.0 / decompressions : 0.0; }
+        };
+
+        explicit Scrollback(size_t memoryLimit = DEFAULT_MEMORY_LIMIT, uint64_t spillLimit = DEFAULT_SPILL_LIMIT);
+        ~Scrollback();
+
+        void SetMemoryLimit(size_t bytes);
+        size_t MemoryLimit() const { return m_memoryLimit; }
+        // RAM held: resident chunks and the line index, mapped views and the decompressed cache not included
+        size_t MemoryUsage() const { return m_chunkBytes + m_lines.size() * sizeof(LineRef); }
+
+        // 0 disables spilling, history is then dropped at the memory limit
+        void SetSpillLimit(uint64_t bytes);
+        uint64_t SpillLimit() const { return m_spillLimit; }
+        uint64_t SpilledBytes() const { return m_spilledBytes; }
+
+        CompressionStats GetCompressionStats() const { return m_stats; }
+
+        // Line 0 is the oldest line still held
+        size_t LineCount() const { return m_lines.size(); }
+        // Lines pushed since construction or Clear, including evicted ones
+        uint64_t TotalLines() const { return m_totalLines; }
+
+        // 'styles' resolves the ids in 'spans', which cover the whole of 'text', and 'clusters' the cluster cells in it
+        // A 'wrapped' line goes on in the next one (see CellGrid::Wrapped) and keeps its trailing blanks.
+        void PushLine(std::span<const char32_t> text, std::span<const StyleSpan> spans, const StyleTable& styles,
+            std::span<const std::u32string> clusters = {}, bool wrapped = false);
+
+        // Number of cells stored for 'line', trailing blanks excluded unless it wrapped
+        size_t LineLength(size_t line) const;
+        bool IsWrapped(size_t line) const;
+
+        // Unpacks 'line' into 'text' and appends spans covering it to 'spans', interning the styles into 'styles'.
+        // Cells past the stored length, or past the stored width, are blanks in the default style.
+        // Cluster cells refer to entries appended to 'clusters', or hold the cluster's first code point without it.
+        void ReadLine(size_t line, std::span<char32_t> text, std::vector<StyleSpan>& spans, StyleTable& styles,
+            std::vector<std::u32string>* clusters = nullptr) const;
+
+        // How many of the newest lines DropNewest can take back: those in chunks still held raw in RAM
+        size_t RetractableLines() const;
+        // Takes the newest 'lines' off the end again, up to RetractableLines(), with their search index rows.
+        // TotalLines goes back by as many, so the next line pushed is numbered like the first one dropped.
+        void DropNewest(size_t lines);
+        // Drops the chunks that only hold lines before 'line', counted like TotalLines, and gives their file space back.
+        // The newest chunk stays.
+        void DropBefore(uint64_t line);
+
+        void Clear();
+
+        // Exchanges the whole history, limits and spill file included
+        void Swap(Scrollback& other) noexcept;
+
+        // Appends the search index's blocks, see SearchIndex::Collect
+        void CollectSearchBlocks(std::vector<std::shared_ptr<const SearchBlock>>& blocks) const { m_index.Collect(blocks); }
+        // See SearchIndex::FinishBlocks
+        bool FinishSearchIndex(size_t blocks) { return m_index.FinishBlocks(blocks); }
+        size_t SearchIndexMemoryUsage() const { return m_index.MemoryUsage(); }
+
+    private:
+        // One style run: 'length' cells sharing the same style
+        struct PackedRun {
+            uint16_t length;
+            CellAttributesFlags attributes;
+            uint16_t hyperlink;
+            uint16_t reserved;
+            TextColor foreground;
+            TextColor background;
+            TextColor underlineColor;
+        };
+        static_assert(sizeof(PackedRun) == 20, "Runs are stored back to back without padding");
+
+        struct LineHeader {
+            uint32_t textBytes;
+            uint16_t cellCount;
+            uint16_t runCount;
+            uint8_t flags;
+        };
+        static constexpr uint8_t LINE_UTF8 = 0x01; // Text is UTF-8, otherwise one byte per cell
+        static constexpr uint8_t LINE_CLUSTERS = 0x02; // The text is followed by a 2-byte count and that many clusters, each a length byte and UTF-8
+        static constexpr uint8_t LINE_WRAPPED = 0x04;
+        static constexpr size_t HEADER_BYTES = 9;   // LineHeader without padding
+
+        // Resident chunks own 'data', raw or compressed. Spilled ones live at 'fileOffset' and have a 'view' while mapped.
+        struct Chunk {
+            std::unique_ptr<uint8_t[]> data;
+            size_t capacity = 0;        // Raw size
+            size_t used = 0;            // Raw bytes filled
+            size_t stored = 0;          // Bytes kept once compressed or spilled
+            bool compressed = false;
+            uint64_t fileOffset = 0;
+            mutable const uint8_t* view = nullptr;
+        };
+
+        struct LineRef {
+            uint32_t chunk;     // Chunk sequence number, see m_firstChunk
+            uint32_t offset;
+        };
+
+        struct CacheEntry {
+            uint32_t chunk = 0;
+            uint64_t lastUse = 0;       // 0 when the entry is free
+            std::vector<uint8_t> bytes;
+        };
+
+        const uint8_t* LineData(size_t line, LineHeader& header) const;
+        static void ReadClusters(const uint8_t* packed, std::span<char32_t> text, std::vector<std::u32string>* clusters);
+        const uint8_t* ChunkData(uint32_t sequence) const;     // Raw bytes, decompressed if needed
+        const uint8_t* StoredData(uint32_t sequence) const;    // Bytes as kept, mapped if spilled
+        void UnmapView(const Chunk& chunk) const;
+        uint8_t* Allocate(size_t bytes);
+        void CompressAged();
+        void Evict();
+        bool SpillOldestResident();
+        void DropOldest(size_t chunks);
+
+        size_t m_memoryLimit;
+        uint64_t m_spillLimit;
+        std::deque<Chunk> m_chunks;     // The first m_spilledChunks are on disk, the rest resident
+        uint32_t m_firstChunk = 0;      // Sequence number of m_chunks.front()
+        size_t m_chunkBytes = 0;        // Resident only
+        size_t m_spilledChunks = 0;
+        uint64_t m_spilledBytes = 0;
+        uint64_t m_writeOffset = 0;     // Where the next chunk goes in the file ring
+        bool m_spillFailed = false;     // The file couldn't be created or written, history is dropped instead
+        std::deque<LineRef> m_lines;
+        uint64_t m_totalLines = 0;
+        SearchIndex m_index;
+
+        // Reading a line maps and decompresses its chunk, so these change in const methods
+        mutable Platform::SpillFile m_file;
+        mutable std::deque<uint32_t> m_mappedChunks;    // Sequence numbers, oldest mapping first
+        mutable std::vector<CacheEntry> m_cache;
+        mutable uint64_t m_cacheClock = 0;
+        mutable CompressionStats m_stats;
+
+        // Reused while packing a line so pushing doesn't allocate once the chunk exists
+        std::vector<PackedRun> m_runScratch;
+        std::vector<uint8_t> m_textScratch;
+        std::vector<uint8_t> m_clusterScratch;
+        std::vector<uint8_t> m_compressScratch;
+    };
+}
@@ -0,0 +1,344 @@
+#include "pch.h"
+#include "ScrollbackSearch.h"
+#include "Lz4.h"
+#include "Simd.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <unordered_map>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        constexpr size_t NOT_FOUND = SIZE_MAX;
+
+        bool IsAsciiLetter(uint8_t byte)
+        {
+            return static_cast<uint8_t>((byte | 0x20) - 'a') < 26;
+        }
+
+        bool Contains(const std::vector<uint8_t>& haystack, const std::vector<uint8_t>& needle)
+        {
+            return std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end()) != haystack.end();
+        }
+
+        // A byte of the text matches a needle byte when (byte | fold) == needle, see ScrollbackSearch::m_fold
+        bool MatchesAt(const uint8_t* text, const uint8_t* needle, const uint8_t* fold, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i) {
+                if ((text[i] | fold[i]) != needle[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Offset of the first match in 'text', or NOT_FOUND. Candidates are the positions where the needle's
+        // first and last byte both match, found 16 at a time, and only those are compared in full.
+        size_t FindNeedle(const uint8_t* text, size_t length, const uint8_t* needle, const uint8_t* fold, size_t size)
+        {
+            if (size == 0 || size > length) {
+                return NOT_FOUND;
+            }
+            size_t last = size - 1;
+            size_t i = 0;
+#if defined(WRT_SIMD_SSE2)
+            const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+            const __m128i firstFold = _mm_set1_epi8(static_cast<char>(fold[0]));
+            const __m128i lastByte = _mm_set1_epi8(static_cast<char>(needle[last]));
+            const __m128i lastFold = _mm_set1_epi8(static_cast<char>(fold[last]));
+            for (; i + last + 16 <= length; i += 16) {
+                __m128i heads = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)), firstFold);
+                __m128i tails = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + last)), lastFold);
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(heads, first), _mm_cmpeq_epi8(tails, lastByte))));
+                for (; mask != 0; mask &= mask - 1) {
+                    size_t at = i + std::countr_zero(mask);
+                    if (MatchesAt(text + at, needle, fold, size)) {
+                        return at;
+                    }
+                }
+            }
+#elif defined(WRT_SIMD_NEON)
+            const uint8x16_t first = vdupq_n_u8(needle[0]);
+            const uint8x16_t firstFold = vdupq_n_u8(fold[0]);
+            const uint8x16_t lastByte = vdupq_n_u8(needle[last]);
+            const uint8x16_t lastFold = vdupq_n_u8(fold[last]);
+            for (; i + last + 16 <= length; i += 16) {
+                uint8x16_t heads = vorrq_u8(vld1q_u8(text + i), firstFold);
+                uint8x16_t tails = vorrq_u8(vld1q_u8(text + i + last), lastFold);
+                uint8x16_t hits = vandq_u8(vceqq_u8(heads, first), vceqq_u8(tails, lastByte));
+                // Four bits per byte, there is no movemask
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+                for (; mask != 0; mask &= ~(0xFull << (std::countr_zero(mask) & ~3))) {
+                    size_t at = i + std::countr_zero(mask) / 4;
+                    if (MatchesAt(text + at, needle, fold, size)) {
+                        return at;
+                    }
+                }
+            }
+#endif
+            for (; i + size <= length; ++i) {
+                if ((text[i] | fold[0]) == needle[0] && MatchesAt(text + i, needle, fold, size)) {
+                    return i;
+                }
+            }
+            return NOT_FOUND;
+        }
+    }
+
+    ScrollbackSearch::ScrollbackSearch(unsigned threads)
+        : m_threadCount(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+    {
+    }
+
+    ScrollbackSearch::~ScrollbackSearch()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+            m_cancel.store(true, std::memory_order_relaxed);
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void ScrollbackSearch::Start(std::vector<std::shared_ptr<const SearchBlock>> blocks, uint64_t firstLine, std::u32string_view query, bool matchCase)
+    {
+        std::vector<uint8_t> needle;
+        SearchIndex::EncodeQuery(query, needle);
+        std::vector<uint8_t> fold(needle.size(), 0);
+        if (!matchCase) {
+            for (size_t i = 0; i < needle.size(); ++i) {
+                if (IsAsciiLetter(needle[i])) {
+                    needle[i] |= 0x20;
+                    fold[i] = 0x20;
+                }
+            }
+        }
+
+        {
+            std::unique_lock lock(m_mutex);
+            m_cancel.store(true, std::memory_order_relaxed);
+            m_idle.wait(lock, [this] { return m_active == 0; });
+
+            // Lines that can match the new query matched the old one if it contains it, under the same or a looser case rule
+            bool narrowing = false;
+            if (!needle.empty() && !m_needle.empty() && (matchCase || !m_matchCase)) {
+                std::vector<uint8_t> folded = needle;
+                if (!m_matchCase) {
+                    for (uint8_t& byte : folded) {
+                        if (IsAsciiLetter(byte)) byte |= 0x20;
+                    }
+                }
+                narrowing = Contains(folded, m_needle);
+            }
+
+            std::vector<BlockScan> previous = std::move(m_scans);
+            std::unordered_map<const SearchBlock*, BlockScan*> previousScans;
+            if (narrowing) {
+                for (BlockScan& scan : previous) {
+                    if (scan.scanned) previousScans.emplace(scan.block.get(), &scan);
+                }
+            }
+            m_scans.clear();
+            if (!needle.empty()) {
+                m_scans.reserve(blocks.size());
+                for (std::shared_ptr<const SearchBlock>& block : blocks) {
+                    BlockScan& scan = m_scans.emplace_back();
+                    auto found = previousScans.find(block.get());
+                    if (found != previousScans.end()) {
+                        scan.narrowed = true;
+                        scan.lines = std::move(found->second->lines);
+                    }
+                    scan.block = std::move(block);
+                }
+            }
+
+            m_firstLine = firstLine;
+            m_needle = std::move(needle);
+            m_fold = std::move(fold);
+            m_matchCase = matchCase;
+            m_needleCells = static_cast<int>(std::count_if(m_needle.begin(), m_needle.end(), [](uint8_t byte) { return (byte & 0xC0) != 0x80; }));
+            m_trigrams.clear();
+            for (size_t i = 2; i < m_needle.size(); ++i) {
+                m_trigrams.push_back(SearchBlock::TrigramBit(m_needle[i - 2], m_needle[i - 1], m_needle[i]));
+            }
+
+            {
+                std::lock_guard matchLock(m_matchMutex);
+                m_matches.clear();
+                m_matchCount.store(0, std::memory_order_relaxed);
+            }
+            m_next.store(0, std::memory_order_relaxed);
+            m_done.store(0, std::memory_order_relaxed);
+            m_skipped.store(0, std::memory_order_relaxed);
+            m_total.store(m_scans.size(), std::memory_order_relaxed);
+            m_cancel.store(false, std::memory_order_relaxed);
+            if (m_scans.empty()) {
+                return;
+            }
+            ++m_generation;
+        }
+
+        if (m_threads.empty()) {
+            for (unsigned i = 0; i < m_threadCount; ++i) {
+                m_threads.emplace_back(&ScrollbackSearch::ThreadFunc, this);
+            }
+        }
+        m_wake.notify_all();
+    }
+
+    void ScrollbackSearch::Cancel()
+    {
+        std::unique_lock lock(m_mutex);
+        m_cancel.store(true, std::memory_order_relaxed);
+        m_idle.wait(lock, [this] { return m_active == 0; });
+    }
+
+    size_t ScrollbackSearch::TakeMatches(std::vector<SearchMatch>& out)
+    {
+        std::lock_guard lock(m_matchMutex);
+        size_t count = m_matches.size();
+        out.insert(out.end(), m_matches.begin(), m_matches.end());
+        m_matches.clear();
+        return count;
+    }
+
+    SearchProgress ScrollbackSearch::Progress() const
+    {
+        SearchProgress progress;
+        progress.blocks = m_total.load(std::memory_order_relaxed);
+        progress.blocksDone = m_done.load(std::memory_order_acquire);
+        progress.blocksSkipped = m_skipped.load(std::memory_order_relaxed);
+        progress.matches = m_matchCount.load(std::memory_order_relaxed);
+        progress.done = progress.blocksDone >= progress.blocks || m_cancel.load(std::memory_order_relaxed);
+        return progress;
+    }
+
+    void ScrollbackSearch::Wait()
+    {
+        std::unique_lock lock(m_mutex);
+        m_idle.wait(lock, [this] {
+            return m_done.load(std::memory_order_acquire) >= m_total.load(std::memory_order_relaxed) || (m_cancel.load(std::memory_order_relaxed) && m_active == 0);
+        });
+    }
+
+    void ScrollbackSearch::ThreadFunc()
+    {
+        // Decompressed text and the matches of one block, reused from block to block
+        std::vector<uint8_t> text;
+        std::vector<SearchMatch> found;
+        uint64_t seen = 0;
+
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+            if (m_stopping) {
+                return;
+            }
+            seen = m_generation;
+            ++m_active;
+            lock.unlock();
+            RunSearch(text, found);
+            lock.lock();
+            if (--m_active == 0) {
+                m_idle.notify_all();
+            }
+        }
+    }
+
+    void ScrollbackSearch::RunSearch(std::vector<uint8_t>& text, std::vector<SearchMatch>& found)
+    {
+        size_t count = m_scans.size();
+        while (!m_cancel.load(std::memory_order_relaxed)) {
+            size_t next = m_next.fetch_add(1, std::memory_order_relaxed);
+            if (next >= count) {
+                break;
+            }
+
+            found.clear();
+            ScanBlock(m_scans[count - 1 - next], text, found);
+            if (!found.empty()) {
+                std::lock_guard lock(m_matchMutex);
+                size_t kept = m_matchCount.fetch_add(found.size(), std::memory_order_relaxed);
+                if (kept < MAX_MATCHES) {
+                    m_matches.insert(m_matches.end(), found.begin(), found.begin() + std::min(found.size(), MAX_MATCHES - kept));
+                }
+            }
+            if (m_done.fetch_add(1, std::memory_order_acq_rel) + 1 == count) {
+                std::lock_guard lock(m_mutex);
+                m_idle.notify_all();
+            }
+        }
+    }
+
+    void ScrollbackSearch::ScanBlock(BlockScan& scan, std::vector<uint8_t>& text, std::vector<SearchMatch>& found)
+    {
+        const SearchBlock& block = *scan.block;
+        std::vector<std::pair<uint32_t, uint32_t>> candidates;
+        if (scan.narrowed) {
+            candidates.swap(scan.lines);
+        }
+        scan.lines.clear();
+        scan.scanned = true;
+
+        if ((scan.narrowed && candidates.empty()) || !block.MayContain(m_trigrams)) {
+            m_skipped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        const uint8_t* data = block.bytes.data();
+        if (block.compressed) {
+            text.resize(block.textBytes);
+            if (!Lz4::Decompress(block.bytes.data(), block.bytes.size(), text.data(), block.textBytes)) {
+                return;
+            }
+            data = text.data();
+        }
+
+        if (scan.narrowed) {
+            for (const auto& [begin, end] : candidates) {
+                ScanRange(block, data, begin, end, scan, found);
+            }
+        }
+        else {
+            ScanRange(block, data, 0, block.textBytes, scan, found);
+        }
+    }
+
+    void ScrollbackSearch::ScanRange(const SearchBlock& block, const uint8_t* text, uint32_t begin, uint32_t end,
+        BlockScan& scan, std::vector<SearchMatch>& found) const
+    {
+        for (uint32_t position = begin; position < end;) {
+            size_t at = FindNeedle(text + position, end - position, m_needle.data(), m_fold.data(), m_needle.size());
+            if (at == NOT_FOUND) {
+                break;
+            }
+            uint32_t offset = position + static_cast<uint32_t>(at);
+            position = offset + static_cast<uint32_t>(m_needle.size());
+
+            // The logical line goes to the list a narrowing search starts from
+            if (scan.lines.empty() || scan.lines.back().second <= offset) {
+                uint32_t lineStart = offset;
+                while (lineStart > 0 && text[lineStart - 1] != '\n') {
+                    --lineStart;
+                }
+                const void* newline = std::memchr(text + offset, '\n', block.textBytes - offset);
+                uint32_t lineEnd = newline ? static_cast<uint32_t>(static_cast<const uint8_t*>(newline) - text) : block.textBytes;
+                scan.lines.emplace_back(lineStart, lineEnd);
+            }
+
+            size_t row = block.RowAt(offset);
+            uint64_t line = block.firstLine + row;
+            if (line < m_firstLine) {
+                continue;
+            }
+            const uint8_t* rowText = text + block.rowStarts[row];
+            int column = static_cast<int>(std::count_if(rowText, text + offset, [](uint8_t byte) { return (byte & 0xC0) != 0x80; }));
+            found.push_back({ line, column, m_needleCells });
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "SearchIndex.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    struct SearchMatch {
+        uint64_t line;      // Numbered like the SearchBlock rows: history as Scrollback::TotalLines, then the screen
+        int column;         // In cells
+        int length;         // In cells, running on into the following rows if the line wrapped
+    };
+
+    struct SearchProgress {
+        size_t blocks = 0;
+        size_t blocksDone = 0;
+        size_t blocksSkipped = 0;   // Done without reading their text, ruled out by their filter or by narrowing
+        size_t matches = 0;         // Found so far, including any past MAX_MATCHES
+        bool done = true;
+    };
+
+    // Finds a string in SearchBlocks on a pool of threads, one block at a time and newest block first,
+    // so matches near the bottom come in first. Each block is checked against the query's trigrams
+    // before its text is decompressed, and the text is scanned 16 bytes at a time for the first and
+    // last byte of the query together; only positions where both are there get compared in full.
+    //
+    // Narrowing: when a query contains the one before it (typing on), a block the previous search
+    // finished is only rescanned in the lines that matched, and skipped if there were none.
+    //
+    // Start and Cancel come from one thread; TakeMatches, Progress and Wait may come from any.
+    class ScrollbackSearch {
+    public:
+        static constexpr size_t MAX_MATCHES = 65536;    // Matches past this many are counted but not kept
+
+        explicit ScrollbackSearch(unsigned threads = 0);    // 0: one per hardware thread
+        ~ScrollbackSearch();
+
+        ScrollbackSearch(const ScrollbackSearch&) = delete;
+        ScrollbackSearch& operator=(const ScrollbackSearch&) = delete;
+
+        // Searches 'blocks' (oldest first) for 'query', stopping the search before. Matches on rows before
+        // 'firstLine' aren't reported. An empty query finds nothing. ASCII letters match either case unless 'matchCase'.
+        void Start(std::vector<std::shared_ptr<const SearchBlock>> blocks, uint64_t firstLine, std::u32string_view query, bool matchCase);
+        void Cancel();
+
+        // Moves the matches found since the last call to the end of 'out', returns how many
+        size_t TakeMatches(std::vector<SearchMatch>& out);
+        SearchProgress Progress() const;
+        // Blocks until the current search is finished or cancelled
+        void Wait();
+
+    private:
+        struct BlockScan {
+            std::shared_ptr<const SearchBlock> block;
+            bool scanned = false;       // By the current search, which left the matching lines in 'lines'
+            bool narrowed = false;      // Only 'lines' are scanned, they matched the previous query
+            std::vector<std::pair<uint32_t, uint32_t>> lines;   // Byte ranges of logical lines
+        };
+
+        void ThreadFunc();
+        void RunSearch(std::vector<uint8_t>& text, std::vector<SearchMatch>& found);
+        void ScanBlock(BlockScan& scan, std::vector<uint8_t>& text, std::vector<SearchMatch>& found);
+        void ScanRange(const SearchBlock& block, const uint8_t* text, uint32_t begin, uint32_t end,
+            BlockScan& scan, std::vector<SearchMatch>& found) const;
+
+        unsigned m_threadCount;
+        std::vector<std::thread> m_threads;     // Started with the first search
+
+        // The current search. Only Start writes it, while no pool thread is in RunSearch.
+        std::vector<BlockScan> m_scans;
+        uint64_t m_firstLine = 0;
+        std::vector<uint8_t> m_needle;      // Letters in lower case when !m_matchCase
+        std::vector<uint8_t> m_fold;        // 0x20 for each needle byte that matches either case
+        std::vector<uint32_t> m_trigrams;
+        int m_needleCells = 0;
+        bool m_matchCase = false;
+
+        std::atomic<size_t> m_next{ 0 };        // Scans handed out
+        std::atomic<size_t> m_total{ 0 };
+        std::atomic<size_t> m_done{ 0 };
+        std::atomic<size_t> m_skipped{ 0 };
+        std::atomic<size_t> m_matchCount{ 0 };
+        std::atomic<bool> m_cancel{ false };
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wake;         // A new search or stopping
+        std::condition_variable m_idle;         // A pool thread left RunSearch
+        uint64_t m_generation = 0;
+        unsigned m_active = 0;                  // Pool threads in RunSearch
+        bool m_stopping = false;
+
+        mutable std::mutex m_matchMutex;
+        std::vector<SearchMatch> m_matches;
+    };
+}
@@ -0,0 +1,383 @@
+#include "pch.h"
+#include "SearchIndex.h"
+#include "Cell.h"
+#include "Lz4.h"
+#include "Simd.h"
+#include "UnicodeWidth.h"
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        size_t EncodeUtf8(uint32_t unit, uint8_t* out)
+        {
+            if (unit < 0x80) {
+                out[0] = static_cast<uint8_t>(unit);
+                return 1;
+            }
+            if (unit < 0x800) {
+                out[0] = static_cast<uint8_t>(0xC0 | (unit >> 6));
+                out[1] = static_cast<uint8_t>(0x80 | (unit & 0x3F));
+                return 2;
+            }
+            if (unit < 0x10000) {
+                out[0] = static_cast<uint8_t>(0xE0 | (unit >> 12));
+                out[1] = static_cast<uint8_t>(0x80 | ((unit >> 6) & 0x3F));
+                out[2] = static_cast<uint8_t>(0x80 | (unit & 0x3F));
+                return 3;
+            }
+            out[0] = static_cast<uint8_t>(0xF0 | (unit >> 18));
+            out[1] = static_cast<uint8_t>(0x80 | ((unit >> 12) & 0x3F));
+            out[2] = static_cast<uint8_t>(0x80 | ((unit >> 6) & 0x3F));
+            out[3] = static_cast<uint8_t>(0x80 | (unit & 0x3F));
+            return 4;
+        }
+
+        // Narrows code points to bytes while they are ASCII. Returns how many were copied, 16 per step.
+        size_t NarrowAsciiRun(const char32_t* text, size_t length, uint8_t* out)
+        {
+            size_t i = 0;
+#if defined(WRT_SIMD_SSE2)
+            const __m128i high = _mm_set1_epi32(~0x7F);
+            for (; i + 16 <= length; i += 16) {
+                const __m128i* units = reinterpret_cast<const __m128i*>(text + i);
+                __m128i a = _mm_loadu_si128(units);
+                __m128i b = _mm_loadu_si128(units + 1);
+                __m128i c = _mm_loadu_si128(units + 2);
+                __m128i d = _mm_loadu_si128(units + 3);
+                __m128i any = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high);
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) != 0xFFFF) {
+                    break;
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+            }
+#elif defined(WRT_SIMD_NEON)
+            const uint32_t* units = reinterpret_cast<const uint32_t*>(text);
+            for (; i + 16 <= length; i += 16) {
+                uint32x4_t a = vld1q_u32(units + i);
+                uint32x4_t b = vld1q_u32(units + i + 4);
+                uint32x4_t c = vld1q_u32(units + i + 8);
+                uint32x4_t d = vld1q_u32(units + i + 12);
+                if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80) {
+                    break;
+                }
+                uint16x8_t lo = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+                uint16x8_t hi = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+                vst1q_u8(out + i, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+            }
+#endif
+            while (i < length && text[i] < 0x80) {
+                out[i] = static_cast<uint8_t>(text[i]);
+                ++i;
+            }
+            return i;
+        }
+
+        uint32_t FoldAscii(uint8_t byte)
+        {
+            return static_cast<uint32_t>(byte - 'A') < 26 ? byte | 0x20u : byte;
+        }
+
+        // Three folded bytes, the first in the high bits
+        uint32_t HashTrigram(uint32_t key)
+        {
+            return (key * 0x9E3779B1u) >> (32 - std::countr_zero(SearchBlock::FILTER_BITS));
+        }
+
+        size_t BlockBytes(const SearchBlock& block)
+        {
+            return sizeof(SearchBlock) + block.bytes.capacity() + block.rowStarts.capacity() * sizeof(uint32_t) + block.filter.capacity() * sizeof(uint64_t);
+        }
+    }
+
+    size_t SearchBlock::RowAt(uint32_t offset) const
+    {
+        return static_cast<size_t>(std::upper_bound(rowStarts.begin(), rowStarts.end(), offset) - rowStarts.begin()) - 1;
+    }
+
+    uint32_t SearchBlock::TrigramBit(uint8_t a, uint8_t b, uint8_t c)
+    {
+        return HashTrigram((FoldAscii(a) << 16) | (FoldAscii(b) << 8) | FoldAscii(c));
+    }
+
+    bool SearchBlock::MayContain(std::span<const uint32_t> bits) const
+    {
+        if (filter.empty()) {
+            return true;
+        }
+        return std::all_of(bits.begin(), bits.end(), [this](uint32_t bit) { return (filter[bit / 64] >> (bit % 64)) & 1; });
+    }
+
+    SearchIndex::SearchIndex(uint64_t firstLine, size_t memoryLimit) : m_nextLine(firstLine), m_memoryLimit(memoryLimit)
+    {
+        m_open.firstLine = firstLine;
+    }
+
+    void SearchIndex::AddRow(std::span<const char32_t> text, std::span<const std::u32string> clusters, bool wrapped)
+    {
+        if (m_open.textBytes >= BLOCK_BYTES && (!m_openContinues || m_open.textBytes >= MAX_BLOCK_BYTES)) {
+            Seal();
+        }
+        m_openCopy.reset();
+
+        // Room for ASCII first, most rows are
+        size_t at = m_open.bytes.size();
+        m_open.rowStarts.push_back(static_cast<uint32_t>(at));
+        m_open.bytes.resize(at + text.size() + 1);
+        size_t ascii = NarrowAsciiRun(text.data(), text.size(), m_open.bytes.data() + at);
+        uint8_t* out = m_open.bytes.data() + at + ascii;
+        if (ascii < text.size()) {
+            m_open.bytes.resize(at + ascii + (text.size() - ascii) * 4 + 1);
+            out = m_open.bytes.data() + at + ascii;
+            for (char32_t ch : text.subspan(ascii)) {
+                if (ch < 0x80) {
+                    *out++ = static_cast<uint8_t>(ch);
+                    continue;
+                }
+                if (ch == WIDE_SPACER) {
+                    *out++ = SearchBlock::SPACER_BYTE;
+                    continue;
+                }
+                if (IsClusterCell(ch)) {
+                    size_t index = ch - CLUSTER_CELL;
+                    ch = index < clusters.size() && !clusters[index].empty() ? clusters[index][0] : U' ';
+                }
+                out += EncodeUtf8(static_cast<uint32_t>(ch), out);
+            }
+        }
+        if (!wrapped) {
+            *out++ = '\n';
+        }
+        m_open.bytes.resize(static_cast<size_t>(out - m_open.bytes.data()));
+        m_open.textBytes = static_cast<uint32_t>(m_open.bytes.size());
+        m_openContinues = wrapped;
+        ++m_nextLine;
+    }
+
+    void SearchIndex::Seal()
+    {
+        auto block = std::make_shared<SearchBlock>();
+        block->firstLine = m_open.firstLine;
+        block->rowStarts = std::move(m_open.rowStarts);
+        block->textBytes = m_open.textBytes;
+        block->bytes = std::move(m_open.bytes);
+        m_sealedBytes += BlockBytes(*block);
+        m_blocks.push_back(std::move(block));
+        ++m_unfinished;
+
+        m_open.rowStarts.clear();
+        m_open.bytes.clear();
+        m_open.bytes.reserve(BLOCK_BYTES + BLOCK_BYTES / 8);
+        m_open.textBytes = 0;
+        m_open.firstLine = m_nextLine;
+        Trim();
+    }
+
+    bool SearchIndex::FinishBlocks(size_t count)
+    {
+        for (; count > 0 && m_unfinished > 0; --count, --m_unfinished) {
+            std::shared_ptr<const SearchBlock>& slot = m_blocks[m_blocks.size() - m_unfinished];
+            const SearchBlock& raw = *slot;
+            auto block = std::make_shared<SearchBlock>();
+            block->firstLine = raw.firstLine;
+            block->rowStarts.assign(raw.rowStarts.begin(), raw.rowStarts.end());
+            block->textBytes = raw.textBytes;
+
+            // Trigrams never take in the '\n' between logical lines, a search doesn't look across it
+            block->filter.resize(SearchBlock::FILTER_BITS / 64);
+            uint32_t key = 0;
+            size_t run = 0;
+            for (uint8_t byte : raw.bytes) {
+                if (byte == '\n') {
+                    run = 0;
+                    continue;
+                }
+                key = (key << 8) | FoldAscii(byte);
+                if (++run >= 3) {
+                    uint32_t bit = HashTrigram(key & 0xFFFFFF);
+                    block->filter[bit / 64] |= 1ull << (bit % 64);
+                }
+            }
+
+            m_compressScratch.resize(Lz4::CompressBound(raw.bytes.size()));
+            size_t size = Lz4::Compress(raw.bytes.data(), raw.bytes.size(), m_compressScratch.data(), m_compressScratch.size());
+            if (size != 0 && size <= raw.bytes.size() - raw.bytes.size() / 8) {
+                block->bytes.assign(m_compressScratch.begin(), m_compressScratch.begin() + size);
+                block->compressed = true;
+            }
+            else {
+                block->bytes.assign(raw.bytes.begin(), raw.bytes.end());
+            }
+
+            // Searches still running keep the raw block alive until they are done with it
+            m_sealedBytes -= BlockBytes(raw);
+            m_sealedBytes += BlockBytes(*block);
+            slot = std::move(block);
+        }
+        return m_unfinished > 0;
+    }
+
+    void SearchIndex::Trim()
+    {
+        // Finished blocks take a fraction of the room, so a flood that outruns FinishBlocks doesn't cost the older rows
+        while (m_sealedBytes > m_memoryLimit && !m_blocks.empty()) {
+            if (m_unfinished > 0) {
+                FinishBlocks(1);
+                continue;
+            }
+            PopFront();
+        }
+    }
+
+    void SearchIndex::SetMemoryLimit(size_t bytes)
+    {
+        m_memoryLimit = bytes;
+        Trim();
+    }
+
+    void SearchIndex::DropBefore(uint64_t line)
+    {
+        while (!m_blocks.empty() && m_blocks.front()->firstLine + m_blocks.front()->RowCount() <= line) {
+            PopFront();
+        }
+    }
+
+    void SearchIndex::DropFrom(uint64_t line)
+    {
+        if (line >= m_nextLine) return;
+        m_openCopy.reset();
+
+        // The newest sealed block becomes the open one again while the line is in it or before it.
+        // Searches still running keep their own reference to it.
+        while (line < m_open.firstLine && !m_blocks.empty()) {
+            const SearchBlock& block = *m_blocks.back();
+            m_open.firstLine = block.firstLine;
+            m_open.rowStarts.assign(block.rowStarts.begin(), block.rowStarts.end());
+            m_open.textBytes = block.textBytes;
+            if (block.compressed) {
+                m_open.bytes.resize(block.textBytes);
+                if (!Lz4::Decompress(block.bytes.data(), block.bytes.size(), m_open.bytes.data(), block.textBytes)) {
+                    m_open.rowStarts.clear();
+                    m_open.bytes.clear();
+                    m_open.textBytes = 0;
+                }
+            }
+            else {
+                m_open.bytes.assign(block.bytes.begin(), block.bytes.end());
+            }
+            m_sealedBytes -= BlockBytes(block);
+            m_blocks.pop_back();
+            if (m_unfinished > 0) {
+                --m_unfinished; // They are the newest
+            }
+        }
+
+        size_t keep = line > m_open.firstLine ? static_cast<size_t>(line - m_open.firstLine) : 0;
+        if (keep < m_open.rowStarts.size()) {
+            m_open.bytes.resize(m_open.rowStarts[keep]);
+            m_open.rowStarts.resize(keep);
+        }
+        if (m_open.rowStarts.empty()) {
+            m_open.bytes.clear();
+            m_open.firstLine = line;
+        }
+        m_open.textBytes = static_cast<uint32_t>(m_open.bytes.size());
+        m_openContinues = !m_open.bytes.empty() && m_open.bytes.back() != '\n';
+        m_nextLine = line;
+    }
+
+    void SearchIndex::PopFront()
+    {
+        m_sealedBytes -= BlockBytes(*m_blocks.front());
+        m_blocks.pop_front();
+        m_unfinished = std::min(m_unfinished, m_blocks.size());
+    }
+
+    void SearchIndex::Clear(uint64_t firstLine)
+    {
+        m_blocks.clear();
+        m_sealedBytes = 0;
+        m_unfinished = 0;
+        m_open.rowStarts.clear();
+        m_open.bytes.clear();
+        m_open.textBytes = 0;
+        m_open.firstLine = firstLine;
+        m_openContinues = false;
+        m_openCopy.reset();
+        m_nextLine = firstLine;
+    }
+
+    void SearchIndex::Swap(SearchIndex& other) noexcept
+    {
+        m_blocks.swap(other.m_blocks);
+        std::swap(m_open, other.m_open);
+        std::swap(m_openContinues, other.m_openContinues);
+        m_openCopy.swap(other.m_openCopy);
+        std::swap(m_nextLine, other.m_nextLine);
+        std::swap(m_memoryLimit, other.m_memoryLimit);
+        std::swap(m_sealedBytes, other.m_sealedBytes);
+        std::swap(m_unfinished, other.m_unfinished);
+    }
+
+    void SearchIndex::Collect(std::vector<std::shared_ptr<const SearchBlock>>& blocks) const
+    {
+        blocks.insert(blocks.end(), m_blocks.begin(), m_blocks.end());
+        if (m_open.rowStarts.empty()) {
+            return;
+        }
+        if (!m_openCopy) {
+            m_openCopy = std::make_shared<const SearchBlock>(m_open);
+        }
+        blocks.push_back(m_openCopy);
+    }
+
+    std::shared_ptr<const SearchBlock> SearchIndex::Renumbered(const SearchBlock& block, uint64_t from, uint64_t number)
+    {
+        if (block.firstLine + block.RowCount() <= from) {
+            return nullptr;
+        }
+        auto copy = std::make_shared<SearchBlock>(block);
+        if (from <= block.firstLine) {
+            copy->firstLine = block.firstLine - from + number;
+            return copy;
+        }
+
+        if (block.compressed) {
+            copy->bytes.resize(block.textBytes);
+            if (!Lz4::Decompress(block.bytes.data(), block.bytes.size(), copy->bytes.data(), block.textBytes)) {
+                return nullptr;
+            }
+            copy->compressed = false;
+        }
+        size_t skip = static_cast<size_t>(from - block.firstLine);
+        uint32_t start = copy->rowStarts[skip];
+        copy->bytes.erase(copy->bytes.begin(), copy->bytes.begin() + start);
+        copy->rowStarts.erase(copy->rowStarts.begin(), copy->rowStarts.begin() + skip);
+        for (uint32_t& rowStart : copy->rowStarts) {
+            rowStart -= start;
+        }
+        copy->textBytes = static_cast<uint32_t>(copy->bytes.size());
+        copy->firstLine = number;
+        return copy;
+    }
+
+    void SearchIndex::EncodeQuery(std::u32string_view query, std::vector<uint8_t>& out)
+    {
+        out.clear();
+        for (char32_t ch : query) {
+            // Rows only keep a cluster's first code point, the ones that join it are left out here too
+            int width = ch < FIRST_NON_NARROW ? 1 : CellWidth(ClassifyCodePoint(ch));
+            if (width == 0) {
+                continue;
+            }
+            uint8_t units[4];
+            out.insert(out.end(), units, units + EncodeUtf8(static_cast<uint32_t>(ch), units));
+            if (width == 2) {
+                out.push_back(SearchBlock::SPACER_BYTE);
+            }
+        }
+    }
+}
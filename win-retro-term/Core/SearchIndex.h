@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // The text of consecutive rows, packed for searching. A row is UTF-8 with a SPACER_BYTE after
+    // every wide character, so byte offsets map back to cells, and a grapheme cluster shows as its
+    // first code point. The rows of a logical line follow each other directly and a '\n' ends the
+    // line, so a match can run on into the rows a line wrapped onto but never into the next line.
+    struct SearchBlock {
+        static constexpr size_t FILTER_BITS = 16384;
+        static constexpr uint8_t SPACER_BYTE = 0xF8;    // Never in UTF-8
+
+        uint64_t firstLine = 0;             // Number of the first row
+        std::vector<uint32_t> rowStarts;    // Where each row's text starts
+        uint32_t textBytes = 0;
+        std::vector<uint8_t> bytes;         // The text, LZ4 compressed when 'compressed'
+        bool compressed = false;
+
+        // Every trigram of the text, ASCII letters folded to lower case, hashed to one bit: FILTER_BITS / 64 words
+        // once the block is finished, empty before
+        std::vector<uint64_t> filter;
+
+        size_t RowCount() const { return rowStarts.size(); }
+        size_t RowAt(uint32_t offset) const;    // The row holding the byte at 'offset'
+
+        static uint32_t TrigramBit(uint8_t a, uint8_t b, uint8_t c);
+        // False only if the text can't contain all the trigrams 'bits' stand for
+        bool MayContain(std::span<const uint32_t> bits) const;
+    };
+
+    // Packs rows into SearchBlocks as they come, numbering them on from 'firstLine'. A block is sealed
+    // once it holds BLOCK_BYTES of text and its last logical line has ended, and never changes after
+    // that, so searches on other threads share it without copying or locking. Building the trigram
+    // filter and compressing the text is left to FinishBlocks, which replaces sealed blocks with finished
+    // ones when the owner has time; until then they are searched raw. Past the memory limit the sealed
+    // blocks are finished on the spot, then the oldest are dropped and their rows can no longer be found.
+    class SearchIndex {
+    public:
+        static constexpr size_t BLOCK_BYTES = 64 * 1024;
+        static constexpr size_t MAX_BLOCK_BYTES = 4 * BLOCK_BYTES;     // Sealed even inside a very long logical line
+        static constexpr size_t DEFAULT_MEMORY_LIMIT = 32 * 1024 * 1024;
+
+        explicit SearchIndex(uint64_t firstLine = 0, size_t memoryLimit = DEFAULT_MEMORY_LIMIT);
+
+        // 'clusters' resolves the cluster cells in 'text'. A 'wrapped' row goes on in the next one.
+        void AddRow(std::span<const char32_t> text, std::span<const std::u32string> clusters, bool wrapped);
+
+        // Finishes up to 'count' sealed blocks, oldest first. False once none is left.
+        bool FinishBlocks(size_t count);
+        bool Unfinished() const { return m_unfinished != 0; }
+
+        // Drops the blocks that only hold rows before 'line'
+        void DropBefore(uint64_t line);
+        // Drops the rows from 'line' on, reopening the sealed blocks they were in
+        void DropFrom(uint64_t line);
+        void Clear(uint64_t firstLine = 0);
+        void Swap(SearchIndex& other) noexcept;
+
+        void SetMemoryLimit(size_t bytes);
+        size_t MemoryUsage() const { return m_sealedBytes + m_open.bytes.capacity() + m_open.rowStarts.capacity() * sizeof(uint32_t); }
+
+        uint64_t FirstLine() const { return m_blocks.empty() ? m_open.firstLine : m_blocks.front()->firstLine; }
+        uint64_t NextLine() const { return m_nextLine; }
+
+        // Appends every block, oldest first. The block still being filled goes in as a copy, made once per change.
+        void Collect(std::vector<std::shared_ptr<const SearchBlock>>& blocks) const;
+        // A copy of 'block' from row 'from' on, which has to begin a logical line, numbered so that 'from' is 'number'.
+        // nullptr if it has no rows from there. Cut text is kept raw, the filter still holds for it.
+        static std::shared_ptr<const SearchBlock> Renumbered(const SearchBlock& block, uint64_t from, uint64_t number);
+
+        // 'query' encoded the way rows are: what a search looks for in the text
+        static void EncodeQuery(std::u32string_view query, std::vector<uint8_t>& out);
+
+    private:
+        void Seal();
+        void Trim();
+        void PopFront();
+
+        std::deque<std::shared_ptr<const SearchBlock>> m_blocks;
+        size_t m_unfinished = 0;            // The newest blocks, sealed but not finished
+        SearchBlock m_open;
+        bool m_openContinues = false;       // The last row added wrapped
+        mutable std::shared_ptr<const SearchBlock> m_openCopy;     // Dropped when m_open changes
+        uint64_t m_nextLine;
+        size_t m_memoryLimit;
+        size_t m_sealedBytes = 0;
+        std::vector<uint8_t> m_compressScratch;
+    };
+}
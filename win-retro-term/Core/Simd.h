@@ -0,0 +1,11 @@
+#pragma once
+
+// Selects the vector instruction set used by the Core hot loops.
+// x86/x64 always have SSE2, ARM64 always has NEON; anything else uses the scalar paths.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define WRT_SIMD_SSE2 1
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define WRT_SIMD_NEON 1
+#endif
@@ -0,0 +1,49 @@
+#include "pch.h"
+#include "StyleTable.h"
+
+namespace winrt::win_retro_term::Core
+{
+    size_t StyleTable::StyleHash::operator()(const TextStyle& style) const
+    {
+        uint64_t hash = style.foreground.bits;
+        hash = hash * 0x9E3779B97F4A7C15ull ^ style.background.bits;
+        hash = hash * 0x9E3779B97F4A7C15ull ^ style.underlineColor.bits;
+        hash = hash * 0x9E3779B97F4A7C15ull ^ (static_cast<uint64_t>(style.attributes) << 16 | style.hyperlink);
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+
+    StyleTable::StyleTable()
+    {
+        m_styles.push_back(TextStyle{});
+        m_ids.emplace(TextStyle{}, DEFAULT_STYLE);
+    }
+
+    uint32_t StyleTable::Intern(const TextStyle& style)
+    {
+        auto [entry, inserted] = m_ids.try_emplace(style, static_cast<uint32_t>(m_styles.size()));
+        if (inserted) {
+            m_styles.push_back(style);
+        }
+        return entry->second;
+    }
+
+    std::vector<uint32_t> StyleTable::Compact(const std::vector<bool>& used)
+    {
+        std::vector<uint32_t> remap(m_styles.size(), DEFAULT_STYLE);
+        std::vector<TextStyle> kept;
+        kept.push_back(m_styles[DEFAULT_STYLE]);
+        m_ids.clear();
+        m_ids.emplace(m_styles[DEFAULT_STYLE], DEFAULT_STYLE);
+
+        for (size_t id = 1; id < m_styles.size(); ++id) {
+            if (id < used.size() && used[id]) {
+                remap[id] = static_cast<uint32_t>(kept.size());
+                m_ids.emplace(m_styles[id], remap[id]);
+                kept.push_back(m_styles[id]);
+            }
+        }
+        m_styles = std::move(kept);
+        ++m_generation;
+        return remap;
+    }
+}
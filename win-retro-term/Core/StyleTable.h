@@ -0,0 +1,43 @@
+#pragma once
+#include "Cell.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    // Deduplicated styles for the cells of one terminal. Interning a style that is already known
+    // returns its id, so a run of cells costs 4 bytes of style whatever colors it uses.
+    //
+    // Ids are handed out densely and never reused on their own; the owner calls Compact once the
+    // table has grown, passing the ids still referenced, and renumbers its cells with the result.
+    // Generation() changes whenever that happens, so copies of the table know to start over.
+    class StyleTable {
+    public:
+        static constexpr uint32_t DEFAULT_STYLE = 0;
+
+        StyleTable();
+
+        uint32_t Intern(const TextStyle& style);
+
+        const TextStyle& Get(uint32_t id) const { return m_styles[id]; }
+        std::span<const TextStyle> Styles() const { return m_styles; }
+        size_t Size() const { return m_styles.size(); }
+        uint64_t Generation() const { return m_generation; }
+
+        // Keeps the styles flagged in 'used' plus the default one, and returns old id -> new id
+        // (ids that were dropped map to the default style)
+        std::vector<uint32_t> Compact(const std::vector<bool>& used);
+
+    private:
+        struct StyleHash {
+            size_t operator()(const TextStyle& style) const;
+        };
+
+        std::vector<TextStyle> m_styles;
+        std::unordered_map<TextStyle, uint32_t, StyleHash> m_ids;
+        uint64_t m_generation = 0;
+    };
+}
@@ -1,50 +1,139 @@
 #include "pch.h"
 #include "TerminalBuffer.h"
+#include "Platform.h"
+#include "ScreenSnapshot.h"
+#include "Simd.h"
+#include "Trace.h"
+#include "UnicodeWidth.h"
+#include <bit>
+#include <cstring>
+#include <iterator>
 #include <stdexcept>
 
 namespace winrt::win_retro_term::Core 
 {
-    const std::map<wchar_t, wchar_t> decSpecialGraphicsMap = {
-        {L'`', L'\u25C6'}, // Diamond
-        {L'a', L'\u2592'}, // Checker board (stipple)
-        {L'b', L'\u2409'}, // HT symbol
-        {L'c', L'\u240C'}, // FF symbol
-        {L'd', L'\u240D'}, // CR symbol
-        {L'e', L'\u240A'}, // LF symbol
-        {L'f', L'\u00B0'}, // Degree Symbol
-        {L'g', L'\u00B1'}, // Plus/Minus Symbol
-        {L'h', L'\u2424'}, // NL symbol
-        {L'i', L'\u240B'}, // VT symbol
-        {L'j', L'\u2518'}, // Lower Right Corner
-        {L'k', L'\u2510'}, // Upper Right Corner
-        {L'l', L'\u250C'}, // Upper Left Corner
-        {L'm', L'\u2514'}, // Lower Left Corner
-        {L'n', L'\u253C'}, // Crossing Lines (plus)
-        {L'o', L'\u23BA'}, // Scan Line 1 (horizontal line - top)
-        {L'p', L'\u23BB'}, // Scan Line 3
-        {L'q', L'\u2500'}, // Scan Line 5 (horizontal line - middle)
-        {L'r', L'\u23BC'}, // Scan Line 7
-        {L's', L'\u23BD'}, // Scan Line 9 (horizontal line - bottom)
-        {L't', L'\u251C'}, // Left Tee
-        {L'u', L'\u2524'}, // Right Tee
-        {L'v', L'\u2534'}, // Bottom Tee
-        {L'w', L'\u252C'}, // Top Tee
-        {L'x', L'\u2502'}, // Vertical Line
-        {L'y', L'\u2264'}, // Less Than Or Equal To
-        {L'z', L'\u2265'}, // Greater Than Or Equal To
-        {L'{', L'\u03C0'}, // Pi
-        {L'|', L'\u2260'}, // Not Equal To
-        {L'}', L'\u00A3'}, // UK Pound Sterling
-        {L'~', L'\u00B7'}  // Centered Dot (bullet)
+    namespace
+    {
+        // Snapshots only gain and drop rows on the worker thread, so a row nothing else holds can be
+        // rewritten in place; one that a snapshot still holds is left alone and replaced
+        SnapshotRow& WritableRow(std::shared_ptr<SnapshotRow>& row, uint64_t epoch)
+        {
+            if (!row || row.use_count() > 1) {
+                row = std::make_shared<SnapshotRow>();
+            }
+            row->epoch = epoch;
+            return *row;
+        }
+
+        // Length of the leading run of code points below FIRST_NON_NARROW, four compares per vector
+        size_t LowRunLength(std::span<const char32_t> text)
+        {
+            size_t i = 0;
+#if defined(WRT_SIMD_SSE2)
+            // Code points fit in 21 bits, so the signed compare is fine
+            const __m128i limit = _mm_set1_epi32(static_cast<int>(FIRST_NON_NARROW));
+            for (; i + 4 <= text.size(); i += 4) {
+                __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+                int narrow = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(chars, limit)));
+                if (narrow != 0xF) {
+                    return i + std::countr_one(static_cast<unsigned>(narrow));
+                }
+            }
+#elif defined(WRT_SIMD_NEON)
+            const uint32x4_t limit = vdupq_n_u32(FIRST_NON_NARROW);
+            for (; i + 4 <= text.size(); i += 4) {
+                uint32x4_t chars = vld1q_u32(reinterpret_cast<const uint32_t*>(text.data() + i));
+                if (vminvq_u32(vcltq_u32(chars, limit)) == 0) break;
+            }
+#endif
+            while (i < text.size() && text[i] < FIRST_NON_NARROW) {
+                ++i;
+            }
+            return i;
+        }
+
+        // Length of the leading run of code points that take one cell each and never join a cluster, and the
+        // class of the one that ends it. Only the ones past the vector scan need a table lookup.
+        size_t NarrowRunLength(std::span<const char32_t> text, CodePointClass& next)
+        {
+            size_t i = 0;
+            while (true) {
+                i += LowRunLength(text.subspan(i));
+                if (i == text.size()) {
+                    return i;
+                }
+                next = ClassifyCodePoint(text[i]);
+                if (next != CodePointClass::Narrow) {
+                    return i;
+                }
+                ++i;
+            }
+        }
+
+        constexpr ColorPalette BuildDefaultPalette()
+        {
+            ColorPalette palette = {
+                0x000000, 0xA80000, 0x00A800, 0xA8A800, 0x0000A8, 0xA800A8, 0x00A8A8, 0xD1D1D1, // Normal
+                0x545454, 0xFF3333, 0x33FF33, 0xFFFF33, 0x3333FF, 0xFF33FF, 0x33FFFF, 0xFFFFFF, // Bright
+            };
+
+            // xterm's 6x6x6 color cube and 24-step gray ramp
+            const uint32_t levels[6] = { 0x00, 0x5F, 0x87, 0xAF, 0xD7, 0xFF };
+            for (size_t i = 0; i < 216; ++i) {
+                palette[16 + i] = levels[i / 36] << 16 | levels[i / 6 % 6] << 8 | levels[i % 6];
+            }
+            for (size_t i = 0; i < 24; ++i) {
+                uint32_t gray = static_cast<uint32_t>(8 + i * 10);
+                palette[232 + i] = gray << 16 | gray << 8 | gray;
+            }
+
+            palette[PALETTE_DEFAULT_FOREGROUND] = 0xD1D1D1; // Light gray
+            palette[PALETTE_DEFAULT_BACKGROUND] = 0x050514; // Dark blue
+            return palette;
+        }
+    }
+
+    const ColorPalette DEFAULT_PALETTE = BuildDefaultPalette();
+
+    // DEC Special Graphics replacements for '_' (0x5F) through '~' (0x7E)
+    const wchar_t DEC_SPECIAL_GRAPHICS_FIRST = L'_';
+    const wchar_t decSpecialGraphicsTable[] = {
+        L' ',      // _ Blank
+        L'\u25C6', // ` Diamond
+        L'\u2592', // a Checker board (stipple)
+        L'\u2409', // b HT symbol
+        L'\u240C', // c FF symbol
+        L'\u240D', // d CR symbol
+        L'\u240A', // e LF symbol
+        L'\u00B0', // f Degree Symbol
+        L'\u00B1', // g Plus/Minus Symbol
+        L'\u2424', // h NL symbol
+        L'\u240B', // i VT symbol
+        L'\u2518', // j Lower Right Corner
+        L'\u2510', // k Upper Right Corner
+        L'\u250C', // l Upper Left Corner
+        L'\u2514', // m Lower Left Corner
+        L'\u253C', // n Crossing Lines (plus)
+        L'\u23BA', // o Scan Line 1 (horizontal line - top)
+        L'\u23BB', // p Scan Line 3
+        L'\u2500', // q Scan Line 5 (horizontal line - middle)
+        L'\u23BC', // r Scan Line 7
+        L'\u23BD', // s Scan Line 9 (horizontal line - bottom)
+        L'\u251C', // t Left Tee
+        L'\u2524', // u Right Tee
+        L'\u2534', // v Bottom Tee
+        L'\u252C', // w Top Tee
+        L'\u2502', // x Vertical Line
+        L'\u2264', // y Less Than Or Equal To
+        L'\u2265', // z Greater Than Or Equal To
+        L'\u03C0', // { Pi
+        L'\u2260', // | Not Equal To
+        L'\u00A3', // } UK Pound Sterling
+        L'\u00B7'  // ~ Centered Dot (bullet)
     };
 
     TerminalBuffer::TerminalBuffer(int rows, int cols) : m_rows(rows), m_cols(cols), m_cursorX(0), m_cursorY(0)
     {
-        m_defaultAttributes.foregroundColor = AnsiColor::Foreground;
-        m_defaultAttributes.backgroundColor = AnsiColor::Background;
-        m_defaultAttributes.attributes = CellAttributesFlags::None;
-        m_currentAttributes = m_defaultAttributes;
-
         m_charsets[0] = CHARSET_US_ASCII;
         m_charsets[1] = CHARSET_US_ASCII;
         m_charsets[2] = CHARSET_US_ASCII;
@@ -56,94 +145,550 @@ namespace winrt::win_retro_term::Core
     }
 
     void TerminalBuffer::InitBuffer() {
-        m_screenBuffer.assign(m_rows, std::vector<Cell>(m_cols));
-        
-        Cell defaultCell;
-        defaultCell.foregroundColor = m_defaultAttributes.foregroundColor;
-        defaultCell.backgroundColor = m_defaultAttributes.backgroundColor;
-        defaultCell.attributes = m_defaultAttributes.attributes;
+        m_screen = CellGrid(m_rows, m_cols, BlankStyle());
+        m_scrollTop = 0;
+        m_scrollBottom = m_rows - 1;
+    }
 
-        for (int r = 0; r < m_rows; ++r) {
-            for (int c = 0; c < m_cols; ++c) {
-                m_screenBuffer[r][c] = defaultCell;
+    uint32_t TerminalBuffer::ModeBits() const {
+        return (m_applicationCursorKeysMode ? 0x01u : 0) | (m_applicationKeypadMode ? 0x02u : 0) | (m_autoWrapMode ? 0x04u : 0) |
+            (m_originMode ? 0x08u : 0) | (m_isAlternateScreenActive ? 0x10u : 0);
+    }
+
+    void TerminalBuffer::CollectDamage(DamageCursor& cursor, ScreenDamage& damage) const {
+        damage.full = cursor.screenId != m_screenId;
+        if (damage.full) {
+            damage.scrollDelta = 0;
+            damage.rows.assign(1, { 0, m_rows - 1 });
+        }
+        else {
+            m_screen.CollectDamage(cursor.changeCount, cursor.scrolledLines, damage);
+        }
+
+        damage.cursorChanged = m_cursorY != cursor.cursorRow || m_cursorX != cursor.cursorCol || m_cursorVisible != cursor.cursorVisible;
+        damage.modesChanged = ModeBits() != cursor.modes;
+        damage.viewportChanged = m_viewportOffset != cursor.viewportOffset;
+
+        cursor.screenId = m_screenId;
+        cursor.changeCount = m_screen.ChangeCount();
+        cursor.scrolledLines = m_screen.ScrolledLines();
+        cursor.cursorRow = m_cursorY;
+        cursor.cursorCol = m_cursorX;
+        cursor.cursorVisible = m_cursorVisible;
+        cursor.modes = ModeBits();
+        cursor.viewportOffset = m_viewportOffset;
+    }
+
+    void TerminalBuffer::UpdateSnapshotRows() {
+        CollectDamage(m_snapshotCursor, m_snapshotDamage);
+        if (m_snapshotDamage.full) {
+            m_snapshotRows.assign(static_cast<size_t>(m_rows), nullptr);
+        }
+        else if (m_snapshotDamage.scrollDelta > 0) {
+            std::rotate(m_snapshotRows.begin(), m_snapshotRows.begin() + m_snapshotDamage.scrollDelta, m_snapshotRows.end());
+        }
+        else if (m_snapshotDamage.scrollDelta < 0) {
+            std::rotate(m_snapshotRows.begin(), m_snapshotRows.end() + m_snapshotDamage.scrollDelta, m_snapshotRows.end());
+        }
+
+        for (const ScreenDamage::RowRange& range : m_snapshotDamage.rows) {
+            for (int r = range.first; r <= range.last; ++r) {
+                SnapshotRow& row = WritableRow(m_snapshotRows[r], m_snapshotEpoch);
+                std::span<const char32_t> text = m_screen.TextSpan(r);
+                std::span<const StyleSpan> spans = m_screen.Spans(r);
+                row.text.assign(text.begin(), text.end());
+                row.spans.assign(spans.begin(), spans.end());
+                std::span<const std::u32string> clusters = m_screen.Clusters(r);
+                row.clusters.assign(clusters.begin(), clusters.end());
             }
         }
     }
 
-    void TerminalBuffer::Resize(int newRows, int newCols) {
-        // Naive resize: create a new buffer and copy what fits.
-        // More sophisticated resize would try to preserve scrollback and content.
-        std::vector<std::vector<Cell>> newBuffer(newRows, std::vector<Cell>(newCols));
-
-        for (int r = 0; r < std::min(m_rows, newRows); ++r) {
-            for (int c = 0; c < std::min(m_cols, newCols); ++c) {
-                if (r < m_screenBuffer.size() && c < m_screenBuffer[r].size()) {
-                    newBuffer[r][c] = m_screenBuffer[r][c];
-                }
+    void TerminalBuffer::UpdateHistoryRows(int count, size_t firstLine) {
+        // Style ids and the width change with the screen id, line numbers start over on a clear and
+        // don't hold still while a reflow splices two histories
+        if (m_historyRowsId != m_screenId || m_historyRowsClears != m_historyClears || m_historyReflow) {
+            m_historyRows.clear();
+            m_historyRowsId = m_screenId;
+            m_historyRowsClears = m_historyClears;
+        }
+
+        uint64_t first = m_scrollback.TotalLines() - m_scrollback.LineCount() + firstLine;
+        m_historyScratch.clear();
+        for (int i = 0; i < count; ++i) {
+            uint64_t line = first + i;
+            std::shared_ptr<SnapshotRow> row;
+            if (!m_historyRows.empty() && line >= m_historyRows.front().line && line - m_historyRows.front().line < m_historyRows.size()) {
+                row = std::move(m_historyRows[line - m_historyRows.front().line].row);
+            }
+            else {
+                SnapshotRow& written = WritableRow(row, m_snapshotEpoch);
+                written.text.resize(static_cast<size_t>(m_cols));
+                written.spans.clear();
+                written.clusters.clear();
+                ReadHistoryLine(firstLine + i, written.text, written.spans, m_styles, &written.clusters);
             }
+            m_historyScratch.push_back({ line, std::move(row) });
+        }
+        m_historyRows.swap(m_historyScratch);
+    }
+
+    void TerminalBuffer::CaptureSnapshot(ScreenSnapshot& snapshot) {
+        // This buffer's rows go first, so the ones no other snapshot holds can be rewritten in place
+        snapshot.lines.clear();
+        snapshot.epoch = ++m_snapshotEpoch;
+        snapshot.rows = m_rows;
+        snapshot.cols = m_cols;
+
+        // When scrolled back, the top 'offset' rows come from history and the screen moves down
+        size_t historyLines = HistoryLineCount();
+        int offset = static_cast<int>(std::min<size_t>(m_viewportOffset, historyLines));
+        int historyRows = std::min(offset, m_rows);
+        UpdateSnapshotRows();
+        UpdateHistoryRows(historyRows, historyLines - offset);
+        for (const HistoryRow& history : m_historyRows) {
+            snapshot.lines.push_back(history.row);
+        }
+        snapshot.lines.insert(snapshot.lines.end(), m_snapshotRows.begin(), m_snapshotRows.end() - historyRows);
+
+        snapshot.cursorRow = std::min(m_cursorY + offset, m_rows - 1);
+        snapshot.cursorCol = m_cursorX;
+        snapshot.cursorVisible = m_cursorVisible && m_cursorY + offset < m_rows;
+        snapshot.viewportOffset = offset;
+        snapshot.scrollbackLines = historyLines;
+        snapshot.applicationCursorKeysMode = m_applicationCursorKeysMode;
+        snapshot.applicationKeypadMode = m_applicationKeypadMode;
+
+        // Between compactions styles are only ever appended, so only the new ones are copied
+        if (snapshot.styleGeneration != m_styles.Generation() || snapshot.styles.size() > m_styles.Size()) {
+            snapshot.styles.clear();
+            snapshot.styleGeneration = m_styles.Generation();
+        }
+        std::span<const TextStyle> styles = m_styles.Styles();
+        snapshot.styles.insert(snapshot.styles.end(), styles.begin() + snapshot.styles.size(), styles.end());
+
+        if (snapshot.titleGeneration != m_titleGeneration) {
+            snapshot.title = m_title;
+            snapshot.titleGeneration = m_titleGeneration;
+        }
+        if (snapshot.paletteGeneration != m_paletteGeneration) {
+            snapshot.palette = m_palette;
+            snapshot.paletteGeneration = m_paletteGeneration;
+        }
+        if (snapshot.clipboardGeneration != m_clipboardGeneration) {
+            snapshot.clipboardText = m_clipboardText;
+            snapshot.clipboardGeneration = m_clipboardGeneration;
+        }
+    }
+
+    void TerminalBuffer::Resize(int newRows, int newCols) {
+        // The hidden screen has to follow too, or switching back would show rows of the old size.
+        // Full-screen programs redraw the alternate one anyway, so it is only cut to size.
+        CellGrid& main = m_isAlternateScreenActive ? m_hiddenScreen : m_screen;
+        CellGrid& alternate = m_isAlternateScreenActive ? m_screen : m_hiddenScreen;
+        bool widthChanged = newCols != m_cols;
+        if (m_historyReflow) {
+            // What is rewrapped stays, the line being collected is read again at the new size. Lines
+            // rewrapped at an earlier width get another pass once this one has caught up.
+            HistoryReflow& reflow = *m_historyReflow;
+            reflow.rewrapper = LineRewrapper(newCols, StyleTable::DEFAULT_STYLE);
+            reflow.nextLine = reflow.lineStart;
+            reflow.mixedWidths = reflow.mixedWidths || (widthChanged && reflow.history.TotalLines() != 0);
+        }
+        // Under the alternate screen the main one's cursor is the one 1049 saved, restored on the way out
+        if (m_isAlternateScreenActive) {
+            ReflowScreen(main, newRows, newCols, m_hiddenSavedCursor.y, m_hiddenSavedCursor.x);
+        }
+        else {
+            ReflowScreen(main, newRows, newCols, m_cursorY, m_cursorX);
+        }
+        if (!alternate.Empty()) {
+            alternate.Resize(newRows, newCols, BlankStyle());
         }
 
-        m_screenBuffer = std::move(newBuffer);
+        ++m_screenId;
         m_rows = newRows;
         m_cols = newCols;
+        m_scrollTop = 0;
+        m_scrollBottom = m_rows - 1;
+        m_viewportOffset = 0;
+
+        // A wrap pending on the last column stays pending
+        int cursorX = m_cursorX;
+        EnsureCursorInBounds();
+        if (cursorX == m_cols && !m_isAlternateScreenActive) {
+            m_cursorX = m_cols;
+        }
+
+        if (widthChanged && !m_historyReflow) {
+            StartHistoryReflow();
+        }
+    }
+
+    void TerminalBuffer::ReflowScreen(CellGrid& grid, int newRows, int newCols, int& cursorY, int& cursorX) {
+        if (newRows <= 0 || newCols <= 0) {
+            grid.Resize(newRows, newCols, BlankStyle());
+            return;
+        }
+
+        LineRewrapper rewrapper(newCols, BlankStyle());
+        auto addScreen = [&]() {
+            int rows = grid.Rows();
+            for (int r = 0; r < rows; ++r) {
+                // The last row can't continue anywhere
+                bool wrapped = grid.Wrapped(r) && r + 1 < rows;
+                rewrapper.AddRow(grid.TextSpan(r), grid.Spans(r), grid.Clusters(r), wrapped, r == cursorY ? cursorX : -1);
+            }
+            rewrapper.Finish();
+        };
+        addScreen();
+
+        // A screen that comes out with room to spare takes back the newest history lines, like the ones a
+        // narrower width pushed off the top, starting at a logical line so they rewrap with what follows.
+        // So does one whose top row goes on a line from history. They go in ahead of the screen's rows,
+        // and any that still don't fit go back below.
+        int used = rewrapper.CursorRow() + 1;
+        for (int r = static_cast<int>(rewrapper.RowCount()) - 1; r >= used; --r) {
+            if (!rewrapper.IsBlank(r)) {
+                used = r + 1;
+            }
+        }
+        size_t held = m_scrollback.LineCount();
+        size_t limit = std::min(held, m_scrollback.RetractableLines());
+        if (m_historyReflow) {
+            // The lines a history reflow has rewrapped are in its own history already
+            limit = std::min<size_t>(limit, static_cast<size_t>(m_scrollback.TotalLines() - ReflowedUpTo()));
+        }
+        if (limit > 0 && (used < newRows || m_scrollback.IsWrapped(held - 1))) {
+            // Whole logical lines, until they make a row more than is free (one may join the screen's first line)
+            size_t start = held;
+            int rows = 0;
+            while (start > held - limit && rows <= newRows - used) {
+                size_t line = start;
+                size_t cells = m_scrollback.LineLength(--line);
+                while (line > held - limit && line > 0 && m_scrollback.IsWrapped(line - 1)) {
+                    cells += m_scrollback.LineLength(--line);
+                }
+                if (line > 0 && m_scrollback.IsWrapped(line - 1)) {
+                    break;  // Begins before the lines that can be taken back
+                }
+                start = line;
+                rows += static_cast<int>(std::max<size_t>((cells + newCols - 1) / newCols, 1));
+            }
+
+            if (start < held) {
+                rewrapper = LineRewrapper(newCols, BlankStyle());
+                std::vector<char32_t> text;
+                std::vector<StyleSpan> spans;
+                std::vector<std::u32string> clusters;
+                for (size_t line = start; line < held; ++line) {
+                    text.resize(m_scrollback.LineLength(line));
+                    spans.clear();
+                    clusters.clear();
+                    m_scrollback.ReadLine(line, text, spans, m_styles, &clusters);
+                    rewrapper.AddRow(text, spans, clusters, m_scrollback.IsWrapped(line));
+                }
+                m_scrollback.DropNewest(held - start);
+                addScreen();
+            }
+        }
+
+        // Blank rows below the cursor are dropped first, then rows go off the top into history,
+        // but never the cursor's own: rows at the bottom are lost before that
+        int count = static_cast<int>(rewrapper.RowCount());
+        int cursorRow = rewrapper.CursorRow();
+        while (count > newRows && count - 1 > cursorRow && rewrapper.IsBlank(count - 1)) {
+            --count;
+        }
+        int first = std::max(count - newRows, 0);
+        if (cursorRow >= 0) {
+            first = std::min(first, cursorRow);
+        }
+        for (int r = 0; r < first; ++r) {
+            const LineRewrapper::Row& row = rewrapper.GetRow(r);
+            m_scrollback.PushLine(row.text, row.spans, m_styles, row.clusters, row.wrapped);
+        }
+
+        CellGrid reflowed(newRows, newCols, BlankStyle());
+        int last = std::min(count, first + newRows);
+        for (int r = first; r < last; ++r) {
+            const LineRewrapper::Row& row = rewrapper.GetRow(r);
+            reflowed.SetRow(r - first, row.text, row.spans, row.clusters, row.wrapped && r + 1 < last);
+        }
+        grid = std::move(reflowed);
+
+        if (cursorRow >= 0) {
+            cursorY = cursorRow - first;
+            cursorX = rewrapper.CursorCol();
+        }
+    }
+
+    void TerminalBuffer::StartHistoryReflow() {
+        m_historyReflow.reset();
+        if (m_scrollback.LineCount() == 0) return;
+
+        m_historyReflow = std::make_unique<HistoryReflow>(m_cols);
+        m_historyReflow->lineStart = m_scrollback.TotalLines() - m_scrollback.LineCount();
+        m_historyReflow->nextLine = m_historyReflow->lineStart;
+        SetReflowLimits();
+    }
+
+    void TerminalBuffer::SetReflowLimits() {
+        // The rewrapped history gets the room m_scrollback leaves under its limits, which grows as it lets go of
+        // rewrapped lines, plus the newest chunks it hasn't compressed yet. Its spill limit only ever goes up,
+        // lowering it would drop what is stored past the new end.
+        Scrollback& history = m_historyReflow->history;
+        size_t slack = (Scrollback::HOT_CHUNKS + 1) * Scrollback::CHUNK_BYTES;
+        size_t memoryLimit = m_scrollback.MemoryLimit();
+        history.SetMemoryLimit(memoryLimit - std::min(m_scrollback.MemoryUsage(), memoryLimit) + slack);
+        uint64_t spillLimit = m_scrollback.SpillLimit();
+        uint64_t spill = std::min<uint64_t>(spillLimit - std::min(m_scrollback.SpilledBytes(), spillLimit) + slack, spillLimit);
+        if (spill > history.SpillLimit()) {
+            history.SetSpillLimit(spill);
+        }
+    }
+
+    uint64_t TerminalBuffer::ReflowedUpTo() const {
+        // Lines evicted before the reflow got to them are gone from either history
+        return std::max(m_historyReflow->lineStart, m_scrollback.TotalLines() - m_scrollback.LineCount());
+    }
+
+    const Scrollback& TerminalBuffer::HistoryFor(size_t& line) const {
+        if (m_historyReflow) {
+            const Scrollback& history = m_historyReflow->history;
+            if (line < history.LineCount()) {
+                return history;
+            }
+            line = line - history.LineCount() + static_cast<size_t>(ReflowedUpTo() - (m_scrollback.TotalLines() - m_scrollback.LineCount()));
+        }
+        return m_scrollback;
+    }
+
+    size_t TerminalBuffer::HistoryLineCount() const {
+        if (!m_historyReflow) {
+            return m_scrollback.LineCount();
+        }
+        return m_historyReflow->history.LineCount() + static_cast<size_t>(m_scrollback.TotalLines() - ReflowedUpTo());
+    }
+
+    size_t TerminalBuffer::HistoryLineLength(size_t line) const {
+        return HistoryFor(line).LineLength(line);
+    }
+
+    bool TerminalBuffer::IsHistoryWrapped(size_t line) const {
+        return HistoryFor(line).IsWrapped(line);
+    }
+
+    void TerminalBuffer::ReadHistoryLine(size_t line, std::span<char32_t> text, std::vector<StyleSpan>& spans, StyleTable& styles,
+        std::vector<std::u32string>* clusters) const {
+        HistoryFor(line).ReadLine(line, text, spans, styles, clusters);
+    }
+
+    size_t TerminalBuffer::HistoryMemoryUsage() const {
+        return m_scrollback.MemoryUsage() + (m_historyReflow ? m_historyReflow->history.MemoryUsage() : 0);
+    }
+
+    bool TerminalBuffer::ContinueHistoryReflow(size_t lines) {
+        if (!m_historyReflow) return false;
+        HistoryReflow& reflow = *m_historyReflow;
+
+        uint64_t firstLine = m_scrollback.TotalLines() - m_scrollback.LineCount();
+        reflow.nextLine = std::max(reflow.nextLine, firstLine);
+        reflow.lineStart = ReflowedUpTo();
 
-        EnsureCursorInBounds(); // Make sure cursor is still valid
+        auto pushRows = [&reflow]() {
+            for (size_t r = 0; r < reflow.rewrapper.RowCount(); ++r) {
+                const LineRewrapper::Row& row = reflow.rewrapper.GetRow(r);
+                reflow.history.PushLine(row.text, row.spans, reflow.styles, row.clusters, row.wrapped);
+            }
+            reflow.rewrapper.ClearRows();
+        };
+        for (size_t n = 0; n < lines && reflow.nextLine < m_scrollback.TotalLines(); ++n, ++reflow.nextLine) {
+            size_t line = static_cast<size_t>(reflow.nextLine - firstLine);
+            reflow.text.resize(m_scrollback.LineLength(line));
+            reflow.spans.clear();
+            reflow.clusters.clear();
+            m_scrollback.ReadLine(line, reflow.text, reflow.spans, reflow.styles, &reflow.clusters);
+            bool wrapped = m_scrollback.IsWrapped(line);
+            reflow.rewrapper.AddRow(reflow.text, reflow.spans, reflow.clusters, wrapped);
+            if (!wrapped) {
+                pushRows();
+                reflow.lineStart = reflow.nextLine + 1;
+            }
+        }
+        if (reflow.nextLine < m_scrollback.TotalLines()) {
+            // The chunks read to the end are let go, and the room they leave goes to the rewrapped history
+            m_scrollback.DropBefore(reflow.lineStart);
+            SetReflowLimits();
+            m_viewportOffset = static_cast<int>(std::min<size_t>(static_cast<size_t>(m_viewportOffset), HistoryLineCount()));
+            return true;
+        }
+
+        // Caught up. A last line that goes on in the screen is kept as it is.
+        reflow.rewrapper.Finish();
+        pushRows();
+        bool mixedWidths = reflow.mixedWidths;
+        m_scrollback.Swap(reflow.history);
+        m_scrollback.SetMemoryLimit(reflow.history.MemoryLimit());
+        m_scrollback.SetSpillLimit(reflow.history.SpillLimit());
+        m_historyReflow.reset();
+        ++m_historyClears;
+        m_viewportOffset = static_cast<int>(std::min<size_t>(static_cast<size_t>(m_viewportOffset), m_scrollback.LineCount()));
+        if (mixedWidths) {
+            StartHistoryReflow();
+        }
+        return HistoryReflowPending();
     }
 
 
-    void TerminalBuffer::SetChar(int r, int c, wchar_t ch) {
+    void TerminalBuffer::SetChar(int r, int c, char32_t ch) {
         if (r >= 0 && r < m_rows && c >= 0 && c < m_cols) {
-            m_screenBuffer[r][c].character = ch;
+            SplitWideCells(r, c, c);
+            m_screen.Text(r)[c] = ch;
         }
     }
 
     Cell TerminalBuffer::GetCell(int r, int c) const {
         if (r >= 0 && r < m_rows && c >= 0 && c < m_cols) {
-            return m_screenBuffer[r][c];
+            return m_screen.At(r, c);
         }
         // Consider throwing or returning a default 'empty' cell
         // For rendering, it's often better to handle out-of-bounds gracefully
         return Cell{}; // Default character ' '
     }
 
-    const std::vector<std::vector<Cell>>& TerminalBuffer::GetScreenBuffer() const {
-        return m_screenBuffer;
+    void TerminalBuffer::Clear() {
+        m_screen.FillRows(0, m_rows - 1, BlankStyle());
+        m_cursorX = 0;
+        m_cursorY = 0;
     }
 
-    void TerminalBuffer::Clear() {
-        for (int r = 0; r < m_rows; ++r) {
-            for (int c = 0; c < m_cols; ++c) {
-                m_screenBuffer[r][c].character = L' ';
-                m_screenBuffer[r][c].foregroundColor = m_defaultAttributes.foregroundColor;
-                m_screenBuffer[r][c].backgroundColor = m_defaultAttributes.backgroundColor;
-                m_screenBuffer[r][c].attributes = m_defaultAttributes.attributes;
+    void TerminalBuffer::ScrollUp(int count) { // SU, also what a line feed at the bottom margin does
+        if (count <= 0) return;
+
+        // Lines leaving the top of the main screen go to history; the alternate screen and
+        // regions with a top margin discard them like other terminals do
+        if (m_scrollTop == 0 && !m_isAlternateScreenActive) {
+            int lines = std::min(count, m_scrollBottom + 1);
+            for (int r = 0; r < lines; ++r) {
+                m_scrollback.PushLine(m_screen.TextSpan(r), m_screen.Spans(r), m_styles, m_screen.Clusters(r), m_screen.Wrapped(r));
+            }
+            if (m_viewportOffset > 0) {
+                // Keep showing the same history lines while output continues underneath
+                m_viewportOffset = static_cast<int>(std::min<size_t>(static_cast<size_t>(m_viewportOffset) + lines, HistoryLineCount()));
             }
         }
-        m_cursorX = 0;
-        m_cursorY = 0;
+        m_screen.ScrollRows(m_scrollTop, m_scrollBottom, count, BlankStyle());
     }
 
-    void TerminalBuffer::ScrollUp(int linesToScroll) {
-        if (linesToScroll <= 0) return;
-        if (linesToScroll >= m_rows) {
-            Clear(); // Scroll everything off screen
-            return;
+    void TerminalBuffer::ScrollViewport(int lines) {
+        int64_t offset = static_cast<int64_t>(m_viewportOffset) + lines;
+        m_viewportOffset = static_cast<int>(std::clamp<int64_t>(offset, 0, static_cast<int64_t>(HistoryLineCount())));
+    }
+
+    void TerminalBuffer::SetScrollbackLimit(size_t bytes) {
+        m_scrollback.SetMemoryLimit(bytes);
+        if (m_historyReflow) {
+            SetReflowLimits();
         }
+    }
 
-        // Move lines up
-        for (int r = 0; r < m_rows - linesToScroll; ++r) {
-            m_screenBuffer[r] = m_screenBuffer[r + linesToScroll];
+    void TerminalBuffer::SetScrollbackSpillLimit(uint64_t bytes) {
+        m_scrollback.SetSpillLimit(bytes);
+        if (m_historyReflow) {
+            Scrollback& history = m_historyReflow->history;
+            history.SetSpillLimit(std::min(history.SpillLimit(), bytes));
+            SetReflowLimits();
         }
+    }
 
-        Cell defaultCellWithSpace = m_defaultAttributes;
-        defaultCellWithSpace.character = L' ';
+    void TerminalBuffer::CollectSearchBlocks(std::vector<std::shared_ptr<const SearchBlock>>& blocks, uint64_t& firstLine) const {
+        uint64_t nextLine = m_scrollback.TotalLines();
+        if (m_historyReflow) {
+            // The rewrapped lines, then the rest of m_scrollback numbered on from them
+            const Scrollback& history = m_historyReflow->history;
+            history.CollectSearchBlocks(blocks);
+            firstLine = history.TotalLines() - history.LineCount();
+            uint64_t from = ReflowedUpTo();
+            nextLine = history.TotalLines() + (m_scrollback.TotalLines() - from);
+            std::vector<std::shared_ptr<const SearchBlock>> rest;
+            m_scrollback.CollectSearchBlocks(rest);
+            for (const std::shared_ptr<const SearchBlock>& block : rest) {
+                if (std::shared_ptr<const SearchBlock> renumbered = SearchIndex::Renumbered(*block, from, history.TotalLines())) {
+                    blocks.push_back(std::move(renumbered));
+                }
+            }
+        }
+        else {
+            m_scrollback.CollectSearchBlocks(blocks);
+            firstLine = m_scrollback.TotalLines() - m_scrollback.LineCount();
+        }
 
-        // Clear the new lines at the bottom
-        for (int r = m_rows - linesToScroll; r < m_rows; ++r) {
-            for (int c = 0; c < m_cols; ++c) {
-                m_screenBuffer[r][c] = defaultCellWithSpace;
+        // The screen changes all the time, so it is packed for each search rather than kept
+        SearchIndex screen(nextLine);
+        for (int r = 0; r < m_rows; ++r) {
+            std::span<const char32_t> text = m_screen.TextSpan(r);
+            bool wrapped = m_screen.Wrapped(r);
+            size_t length = text.size();
+            while (!wrapped && length > 0 && text[length - 1] == U' ') {
+                --length;
             }
+            screen.AddRow(text.first(length), m_screen.Clusters(r), wrapped);
         }
+        screen.Collect(blocks);
+    }
+
+    bool TerminalBuffer::ContinueSearchIndexing(size_t blocks) {
+        bool pending = m_scrollback.FinishSearchIndex(blocks);
+        if (m_historyReflow) {
+            pending = m_historyReflow->history.FinishSearchIndex(blocks) || pending;
+        }
+        return pending;
+    }
+
+    void TerminalBuffer::ScrollDown(int count) { // SD
+        if (count <= 0) return;
+        m_screen.ScrollRows(m_scrollTop, m_scrollBottom, -count, BlankStyle());
+    }
+
+    void TerminalBuffer::InsertLines(int count) { // IL, only inside the margins
+        if (count <= 0 || m_cursorY < m_scrollTop || m_cursorY > m_scrollBottom) return;
+        m_screen.ScrollRows(m_cursorY, m_scrollBottom, -count, BlankStyle());
+        m_cursorX = 0;
+    }
+
+    void TerminalBuffer::DeleteLines(int count) { // DL, only inside the margins
+        if (count <= 0 || m_cursorY < m_scrollTop || m_cursorY > m_scrollBottom) return;
+        m_screen.ScrollRows(m_cursorY, m_scrollBottom, count, BlankStyle());
+        m_cursorX = 0;
+    }
+
+    void TerminalBuffer::InsertCharacters(int count) { // ICH, cells shifted past the right edge are lost
+        if (count <= 0) return;
+        m_cursorX = std::min(m_cursorX, m_cols - 1); // Also cancels a pending wrap
+        count = std::min(count, m_cols - m_cursorX);
+        // Wide characters split at the cursor or pushed half past the edge are blanked
+        SplitWideCells(m_cursorY, m_cursorX, m_cursorX - 1);
+        SplitWideCells(m_cursorY, m_cols - count, m_cols - count - 1);
+        m_screen.InsertCells(m_cursorY, m_cursorX, count, BlankStyle());
+    }
+
+    void TerminalBuffer::DeleteCharacters(int count) { // DCH, blanks come in from the right edge
+        if (count <= 0) return;
+        m_cursorX = std::min(m_cursorX, m_cols - 1);
+        count = std::min(count, m_cols - m_cursorX);
+        SplitWideCells(m_cursorY, m_cursorX, m_cursorX + count - 1);
+        m_screen.DeleteCells(m_cursorY, m_cursorX, count, BlankStyle());
+    }
+
+    void TerminalBuffer::SetScrollingRegion(int top, int bottom) { // DECSTBM
+        if (top < 1) top = 1;
+        if (bottom < 1 || bottom > m_rows) bottom = m_rows;
+        if (top >= bottom) return; // A region needs at least two lines
+
+        m_scrollTop = top - 1;
+        m_scrollBottom = bottom - 1;
+        CursorPosition(1, 1);
     }
 
     void TerminalBuffer::SetCursorPosition(int r, int c) {
@@ -157,46 +702,165 @@ namespace winrt::win_retro_term::Core
     }
 
 
-    void TerminalBuffer::PrintChar(wchar_t ch) {
+    void TerminalBuffer::PrintChar(char32_t ch) {
+        PrintString(std::span<const char32_t>(&ch, 1));
+    }
+
+    void TerminalBuffer::PrintString(std::span<const char32_t> text) {
+        PrintCells(text);
+    }
+
+    void TerminalBuffer::PrintCells(std::span<const char32_t> text) {
+        // Runs that are one cell per code point go in as they are, anything else one code point at a time
+        size_t i = 0;
+        while (i < text.size()) {
+            CodePointClass next = CodePointClass::Narrow;
+            size_t narrow = NarrowRunLength(text.subspan(i), next);
+            if (narrow != 0) {
+                PrintNarrowCells(text.subspan(i, narrow));
+                i += narrow;
+            }
+            if (i < text.size()) {
+                PrintCodePoint(text[i++], next);
+            }
+        }
+    }
+
+    void TerminalBuffer::PrintNarrowCells(std::span<const char32_t> text) {
+        // Charset lookup is only needed when something other than US-ASCII is invoked into GL
+        bool needsMapping = m_charsets[m_glCharsetIndex] != CHARSET_US_ASCII;
+
+        size_t i = 0;
+        while (i < text.size()) {
+            if (m_cursorY >= m_rows) {
+                m_cursorY = m_rows - 1;
+                ScrollUp();
+            }
+            if (m_cursorX >= m_cols) {
+                if (m_autoWrapMode) {
+                    m_screen.SetWrapped(m_cursorY, true);
+                    CarriageReturn();
+                    LineFeed();
+                }
+                else {
+                    m_cursorX = m_cols - 1;
+                }
+            }
+
+            size_t remaining = text.size() - i;
+            size_t room = static_cast<size_t>(m_cols - m_cursorX);
+            SplitWideCells(m_cursorY, m_cursorX, m_cursorX + static_cast<int>(std::min(remaining, room)) - 1);
+            char32_t* row = m_screen.Text(m_cursorY);
+
+            if (!m_autoWrapMode && remaining > room) {
+                // Without autowrap everything past the margin lands on the last column, so only the final character survives there
+                size_t leading = room - 1;
+                for (size_t k = 0; k < leading; ++k) {
+                    row[m_cursorX + k] = needsMapping ? MapCharacter(text[i + k]) : text[i + k];
+                }
+                row[m_cols - 1] = needsMapping ? MapCharacter(text.back()) : text.back();
+                m_screen.SetStyle(m_cursorY, m_cursorX, static_cast<int>(room), m_currentStyleId);
+                m_cursorX = m_cols - 1;
+                return;
+            }
+
+            size_t count = std::min(remaining, room);
+            if (needsMapping) {
+                for (size_t k = 0; k < count; ++k) {
+                    row[m_cursorX + k] = MapCharacter(text[i + k]);
+                }
+            }
+            else {
+                std::memcpy(row + m_cursorX, text.data() + i, sizeof(char32_t) * count);
+            }
+            m_screen.SetStyle(m_cursorY, m_cursorX, static_cast<int>(count), m_currentStyleId);
+            i += count;
+
+            // Stopping on the last column keeps the pending-wrap position PrintChar uses (cursor == cols)
+            m_cursorX += static_cast<int>(count);
+            if (!m_autoWrapMode && m_cursorX >= m_cols) {
+                m_cursorX = m_cols - 1;
+            }
+        }
+    }
+
+    void TerminalBuffer::PrintCodePoint(char32_t ch, CodePointClass cls) {
+        if (JoinPreviousCell(ch, cls)) return;
+
+        // A mark with nothing to join shows on its own. A wide character needs two columns, a single-column
+        // screen shows U+FFFD in its place so every wide character keeps its spacer through later resizes.
+        int width = std::max(CellWidth(cls), 1);
+        if (width > m_cols) {
+            width = 1;
+            ch = 0xFFFD;
+        }
+
         if (m_cursorY >= m_rows) {
             m_cursorY = m_rows - 1;
             ScrollUp();
         }
-        if (m_cursorX >= m_cols) {
-            if (m_autoWrapMode)
-            {
+        if (m_cursorX + width > m_cols) {
+            // A wide character that doesn't fit in the last column wraps whole, leaving that column as it was
+            if (m_autoWrapMode) {
+                m_screen.SetWrapped(m_cursorY, true);
                 CarriageReturn();
                 LineFeed();
             }
-            else
-            {
-                m_cursorX = m_cols - 1;
+            else {
+                m_cursorX = m_cols - width;
             }
         }
 
-        wchar_t mappedChar = MapCharacter(ch);
+        SplitWideCells(m_cursorY, m_cursorX, m_cursorX + width - 1);
+        char32_t* row = m_screen.Text(m_cursorY);
+        row[m_cursorX] = ch;
+        if (width == 2) {
+            row[m_cursorX + 1] = WIDE_SPACER;
+        }
+        m_screen.SetStyle(m_cursorY, m_cursorX, width, m_currentStyleId);
+
+        m_cursorX += width;
+        if (!m_autoWrapMode && m_cursorX >= m_cols) {
+            m_cursorX = m_cols - 1;
+        }
+    }
 
-        if (m_cursorY < m_rows && m_cursorX < m_cols) {
-            m_screenBuffer[m_cursorY][m_cursorX].character = mappedChar;
-            m_screenBuffer[m_cursorY][m_cursorX].foregroundColor = m_currentAttributes.foregroundColor;
-            m_screenBuffer[m_cursorY][m_cursorX].backgroundColor = m_currentAttributes.backgroundColor;
-            m_screenBuffer[m_cursorY][m_cursorX].attributes = m_currentAttributes.attributes;
-            
-            if (m_cursorX < m_cols - 1) 
-            {
-                m_cursorX++;
-            }
-            else 
-            {
-                if (m_autoWrapMode) 
-                {
-                    m_cursorX++;
-                }
-            }
+    bool TerminalBuffer::JoinPreviousCell(char32_t ch, CodePointClass cls) {
+        if (cls == CodePointClass::Narrow || cls == CodePointClass::Wide) return false;
+
+        // The cell left of the cursor, or the one the cursor is parked after waiting to wrap
+        int col = std::min(m_cursorX, m_cols) - 1;
+        if (col < 0 || m_cursorY >= m_rows) return false;
+        std::span<const char32_t> cells = m_screen.TextSpan(m_cursorY);
+        if (cells[col] == WIDE_SPACER && col > 0) {
+            --col;
+        }
+
+        if (cls == CodePointClass::RegionalIndicator || IsPictographic(cls)) {
+            // Regional indicators pair up into flags; a pictograph only joins one that ends in a ZWJ
+            char32_t previous = cells[col];
+            std::u32string_view cluster = IsClusterCell(previous) ? m_screen.Cluster(m_cursorY, previous) : std::u32string_view(&previous, 1);
+            bool joins = cls == CodePointClass::RegionalIndicator
+                ? cluster.size() == 1 && ClassifyCodePoint(cluster[0]) == CodePointClass::RegionalIndicator
+                : cluster.size() > 1 && cluster.back() == 0x200D;
+            if (!joins) return false;
         }
+        m_screen.AppendToCell(m_cursorY, col, ch);
+        return true;
     }
 
-    wchar_t TerminalBuffer::MapCharacter(wchar_t ch) 
+    void TerminalBuffer::SplitWideCells(int row, int first, int last) {
+        // Whatever overwrites half of a wide character blanks the other half
+        std::span<const char32_t> cells = m_screen.TextSpan(row);
+        if (first > 0 && cells[first] == WIDE_SPACER) {
+            m_screen.Text(row)[first - 1] = U' ';
+        }
+        if (last + 1 < m_cols && cells[last + 1] == WIDE_SPACER) {
+            m_screen.Text(row)[last + 1] = U' ';
+        }
+    }
+
+    char32_t TerminalBuffer::MapCharacter(char32_t ch) 
     {
         if (ch < 0x20 || ch == 0x7F) {
             return ch;
@@ -205,16 +869,13 @@ namespace winrt::win_retro_term::Core
         wchar_t activeCharset = m_charsets[m_glCharsetIndex];
 
         if (activeCharset == CHARSET_DEC_SPECIAL_GRAPHICS) {
-            if (ch == L'_') return L' ';
-
-            auto it = decSpecialGraphicsMap.find(ch);
-            if (it != decSpecialGraphicsMap.end()) {
-                return it->second;
+            if (ch >= DEC_SPECIAL_GRAPHICS_FIRST && ch < 0x7F) {
+                return decSpecialGraphicsTable[ch - DEC_SPECIAL_GRAPHICS_FIRST];
             }
             return ch;
         }
         else if (activeCharset == CHARSET_UK) {
-            if (ch == L'#') return L'\u00A3';
+            if (ch == U'#') return U'\u00A3';
             return ch;
         }
 
@@ -227,7 +888,7 @@ namespace winrt::win_retro_term::Core
 
         m_charsets[targetSet] = charSetType;
 
-        OutputDebugString((L"TerminalBuffer: Designated G" + std::to_wstring(targetSet) + L" as type '" + std::wstring(1, charSetType) + L"'\n").c_str());
+        WRT_TRACE(TraceCategory::Charset, TraceLevel::Verbose, TraceEvent::DesignateCharSet, targetSet, static_cast<int32_t>(charSetType));
     }
 
 
@@ -235,7 +896,7 @@ namespace winrt::win_retro_term::Core
         if (gSetToInvokeIntoGL > 3) return;
 
         m_glCharsetIndex = gSetToInvokeIntoGL;
-        OutputDebugString((L"TerminalBuffer: Invoked G" + std::to_wstring(gSetToInvokeIntoGL) + L" (type '" + std::wstring(1,m_charsets[gSetToInvokeIntoGL]) + L"') into GL\n").c_str());
+        WRT_TRACE(TraceCategory::Charset, TraceLevel::Verbose, TraceEvent::InvokeCharSet, gSetToInvokeIntoGL, static_cast<int32_t>(m_charsets[gSetToInvokeIntoGL]));
     }
 
     void TerminalBuffer::ExecuteControlFunction(wchar_t control) 
@@ -247,15 +908,26 @@ namespace winrt::win_retro_term::Core
             InvokeCharSet(0);
         }
         else {
-            OutputDebugString((L"TerminalBuffer: Unhandled ExecuteControlFunction: 0x" + std::to_wstring(static_cast<int>(control)) + L"\n").c_str());
+            WRT_TRACE(TraceCategory::Control, TraceLevel::Info, TraceEvent::ControlUnhandled, static_cast<int32_t>(control));
         }
     }
 
     void TerminalBuffer::LineFeed() { // LF, \n
-        m_cursorY++;
-        if (m_cursorY >= m_rows) {
-            ScrollUp();
-            m_cursorY = m_rows - 1;
+        // Only the bottom margin scrolls; below the region the cursor just stops at the last row
+        if (m_cursorY == m_scrollBottom) {
+            ScrollUp(1);
+        }
+        else if (m_cursorY < m_rows - 1) {
+            m_cursorY++;
+        }
+    }
+
+    void TerminalBuffer::ReverseIndex() { // RI, ESC M
+        if (m_cursorY == m_scrollTop) {
+            ScrollDown(1);
+        }
+        else if (m_cursorY > 0) {
+            m_cursorY--;
         }
     }
 
@@ -266,11 +938,13 @@ namespace winrt::win_retro_term::Core
     void TerminalBuffer::Backspace() { // BS, \b
         if (m_cursorX > 0) {
             m_cursorX--;
-            m_screenBuffer[m_cursorY][m_cursorX].character = L' ';
+            SplitWideCells(m_cursorY, m_cursorX, m_cursorX);
+            m_screen.Text(m_cursorY)[m_cursorX] = U' ';
         }
         else if (m_cursorY > 0) {
             m_cursorY--;
-            m_screenBuffer[m_cursorY][m_cursorX].character = L' ';
+            SplitWideCells(m_cursorY, m_cursorX, m_cursorX);
+            m_screen.Text(m_cursorY)[m_cursorX] = U' ';
         }
     }
 
@@ -285,21 +959,24 @@ namespace winrt::win_retro_term::Core
     }
 
     void TerminalBuffer::Bell() { // BEL, \a
-        MessageBeep(MB_OK);
+        Platform::Beep();
     }
 
     void TerminalBuffer::CursorUp(int count) {
-        m_cursorY = std::max(0, m_cursorY - count);
+        // Stops at the top margin when starting inside the region
+        int limit = m_cursorY >= m_scrollTop ? m_scrollTop : 0;
+        m_cursorY = std::max(limit, m_cursorY - count);
         EnsureCursorInBounds();
     }
 
     void TerminalBuffer::CursorDown(int count) {
-        m_cursorY = std::min(m_rows - 1, m_cursorY + count);
+        int limit = m_cursorY <= m_scrollBottom ? m_scrollBottom : m_rows - 1;
+        m_cursorY += std::min(count, limit - m_cursorY); // Counts can be as large as INT_MAX
         EnsureCursorInBounds();
     }
 
     void TerminalBuffer::CursorForward(int count) {
-        m_cursorX = std::min(m_cols - 1, m_cursorX + count);
+        m_cursorX += std::min(count, m_cols - 1 - m_cursorX);
         EnsureCursorInBounds();
     }
 
@@ -309,7 +986,10 @@ namespace winrt::win_retro_term::Core
     }
 
     void TerminalBuffer::CursorPosition(int row, int col) {
-        m_cursorY = std::max(0, std::min(row - 1, m_rows - 1));
+        // In origin mode rows count from the top margin and can't leave the region
+        int top = m_originMode ? m_scrollTop : 0;
+        int bottom = m_originMode ? m_scrollBottom : m_rows - 1;
+        m_cursorY = top + std::max(0, std::min(row - 1, bottom - top));
         m_cursorX = std::max(0, std::min(col - 1, m_cols - 1));
     }
 
@@ -318,33 +998,30 @@ namespace winrt::win_retro_term::Core
         // Ps = 0: Erase from cursor to end of screen (inclusive of cursor position).
         // Ps = 1: Erase from beginning of screen to cursor (inclusive).
         // Ps = 2: Erase entire screen (cursor position does not change).
-        // Ps = 3: Erase entire screen + scrollback buffer (DEC specific, Windows Terminal supports). For now, treat as 2.
-
-        Cell defaultCellWithSpace = m_defaultAttributes;
-        defaultCellWithSpace.character = L' ';
+        // Ps = 3: Erase the scrollback (xterm). The screen and cursor are left alone, the view goes back to the bottom.
 
         switch (mode) {
         case 0: // From cursor to end
-            for (int c = m_cursorX; c < m_cols; ++c) m_screenBuffer[m_cursorY][c] = defaultCellWithSpace;
-            for (int r = m_cursorY + 1; r < m_rows; ++r) 
-            {
-                for (int c = 0; c < m_cols; ++c) m_screenBuffer[r][c] = defaultCellWithSpace;
+            EraseCells(m_cursorX, m_cols - 1);
+            if (m_cursorY + 1 < m_rows) {
+                m_screen.FillRows(m_cursorY + 1, m_rows - 1, BlankStyle());
             }
             break;
         case 1: // From beginning to cursor
-            for (int r = 0; r < m_cursorY; ++r) 
-            {
-                for (int c = 0; c < m_cols; ++c) m_screenBuffer[r][c] = defaultCellWithSpace;
+            if (m_cursorY > 0) {
+                m_screen.FillRows(0, m_cursorY - 1, BlankStyle());
             }
-            for (int c = 0; c <= m_cursorX; ++c) m_screenBuffer[m_cursorY][c] = defaultCellWithSpace;
+            EraseCells(0, std::min(m_cursorX, m_cols - 1));
             break;
         case 2: // Erase entire screen
-        case 3: // Erase entire screen + scrollback (treat as 2 for now)
-            for (int r = 0; r < m_rows; ++r) 
-            {
-                for (int c = 0; c < m_cols; ++c) m_screenBuffer[r][c] = defaultCellWithSpace;
-            }
-            // Cursor position does NOT change for ED with Ps=2 or Ps=3
+            m_screen.FillRows(0, m_rows - 1, BlankStyle());
+            // Cursor position does NOT change for ED with Ps=2
+            break;
+        case 3: // Erase scrollback only (xterm), the screen is left alone
+            m_scrollback.Clear();
+            m_historyReflow.reset();
+            ++m_historyClears;
+            m_viewportOffset = 0;
             break;
         default:
             // Unknown mode, ignore
@@ -352,6 +1029,15 @@ namespace winrt::win_retro_term::Core
         }
     }
 
+    void TerminalBuffer::EraseCells(int first, int last) {
+        if (first > last) return;
+        SplitWideCells(m_cursorY, first, last);
+        m_screen.FillCells(m_cursorY, first, last - first + 1, BlankStyle());
+        if (last == m_cols - 1) {
+            m_screen.SetWrapped(m_cursorY, false);  // Nothing left to continue
+        }
+    }
+
     void TerminalBuffer::EraseInLine(int mode) {
         // EL: CSI Ps K
         // Ps = 0: Erase from cursor to end of line (inclusive).
@@ -359,26 +1045,15 @@ namespace winrt::win_retro_term::Core
         // Ps = 2: Erase entire line (cursor position does not change).
         if (m_cursorY < 0 || m_cursorY >= m_rows) return;
 
-        Cell defaultCellWithSpace = m_defaultAttributes;
-        defaultCellWithSpace.character = L' ';
-
         switch (mode) {
         case 0: // From cursor to end of line
-            for (int c = m_cursorX; c < m_cols; ++c) {
-                m_screenBuffer[m_cursorY][c] = defaultCellWithSpace;
-            }
+            EraseCells(m_cursorX, m_cols - 1);
             break;
         case 1: // From beginning of line to cursor
-            for (int c = 0; c <= m_cursorX; ++c) {
-                if (c < m_cols) { // Boundary check
-                    m_screenBuffer[m_cursorY][c] = defaultCellWithSpace;
-                }
-            }
+            EraseCells(0, std::min(m_cursorX, m_cols - 1));
             break;
         case 2: // Erase entire line
-            for (int c = 0; c < m_cols; ++c) {
-                m_screenBuffer[m_cursorY][c] = defaultCellWithSpace;
-            }
+            m_screen.FillRows(m_cursorY, m_cursorY, BlankStyle());
             break;
         default:
             // Unknown mode, ignore
@@ -386,110 +1061,189 @@ namespace winrt::win_retro_term::Core
         }
     }
 
-    void TerminalBuffer::SetGraphicsRendition(const std::vector<int>& params) {
+    void TerminalBuffer::SetGraphicsRendition(VtParamsView params) {
         if (params.empty()) {
-            m_currentAttributes = m_defaultAttributes;
+            m_currentStyle = TextStyle{};
+            UpdateCurrentStyleId();
             return;
         }
 
+        CellAttributesFlags& attributes = m_currentStyle.attributes;
         for (size_t i = 0; i < params.size(); ++i) {
             int p = params[i];
             if (p == 0) { // Reset / Normal
-                m_currentAttributes = m_defaultAttributes;
+                m_currentStyle = TextStyle{};
             }
             else if (p == 1) { // Bold or increased intensity
-                m_currentAttributes.attributes |= CellAttributesFlags::Bold;
+                attributes |= CellAttributesFlags::Bold;
             }
             else if (p == 2) { // Dim
-                m_currentAttributes.attributes |= CellAttributesFlags::Dim;
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Bold; // Faint typically overrides Bold
+                attributes |= CellAttributesFlags::Dim;
+                attributes = attributes & ~CellAttributesFlags::Bold; // Faint typically overrides Bold
             }
             else if (p == 3) { // Italic
-                m_currentAttributes.attributes |= CellAttributesFlags::Italic;
+                attributes |= CellAttributesFlags::Italic;
             }
-            else if (p == 4) { // Underline
-                m_currentAttributes.attributes |= CellAttributesFlags::Underline;
+            else if (p == 4) { // Underline, 4:n selects the style
+                SetUnderlineStyle(params.HasSubParams(i) ? params.SubParams(i)[0] : 1);
             }
             else if (p == 7) { // Inverse video
-                m_currentAttributes.attributes |= CellAttributesFlags::Inverse;
+                attributes |= CellAttributesFlags::Inverse;
             }
             else if (p == 8) { // Concealed (not visible)
-                m_currentAttributes.attributes |= CellAttributesFlags::Concealed;
+                attributes |= CellAttributesFlags::Concealed;
             }
             else if (p == 9) { // Strikethrough / crossed-out
-                m_currentAttributes.attributes |= CellAttributesFlags::Strikethrough;
+                attributes |= CellAttributesFlags::Strikethrough;
             }
-            else if (p == 21) { // Doubly underlined (treat as single underline for now)
-                m_currentAttributes.attributes |= CellAttributesFlags::Underline;
+            else if (p == 21) { // Doubly underlined
+                SetUnderlineStyle(2);
             }
             else if (p == 22) { // Normal intensity (neither bold nor dim)
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Bold;
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Dim;
+                attributes = attributes & ~CellAttributesFlags::Bold;
+                attributes = attributes & ~CellAttributesFlags::Dim;
             }
             else if (p == 23) { // Not italic
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Italic;
+                attributes = attributes & ~CellAttributesFlags::Italic;
             }
             else if (p == 24) { // Not underlined
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Underline;
+                SetUnderlineStyle(0);
             }
             else if (p == 27) { // Not inverse
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Inverse;
+                attributes = attributes & ~CellAttributesFlags::Inverse;
             }
             else if (p == 28) { // Not concealed
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Concealed;
+                attributes = attributes & ~CellAttributesFlags::Concealed;
             }
             else if (p == 29) { // Not strikethrough
-                m_currentAttributes.attributes = m_currentAttributes.attributes & ~CellAttributesFlags::Strikethrough;
+                attributes = attributes & ~CellAttributesFlags::Strikethrough;
             }
             // Basic 3/4-bit ANSI Colors
             else if (p >= 30 && p <= 37) { // Set foreground color
-                m_currentAttributes.foregroundColor = static_cast<AnsiColor>(p - 30);
+                m_currentStyle.foreground = TextColor::Indexed(static_cast<uint8_t>(p - 30));
             }
             else if (p == 39) { // Default foreground color
-                m_currentAttributes.foregroundColor = m_defaultAttributes.foregroundColor;
+                m_currentStyle.foreground = TextColor::Default();
             }
             else if (p >= 40 && p <= 47) { // Set background color
-                m_currentAttributes.backgroundColor = static_cast<AnsiColor>(p - 40);
+                m_currentStyle.background = TextColor::Indexed(static_cast<uint8_t>(p - 40));
             }
             else if (p == 49) { // Default background color
-                m_currentAttributes.backgroundColor = m_defaultAttributes.backgroundColor;
+                m_currentStyle.background = TextColor::Default();
+            }
+            else if (p == 59) { // Default underline color
+                m_currentStyle.underlineColor = TextColor::Default();
             }
             // Bright 3/4-bit ANSI Colors
             else if (p >= 90 && p <= 97) { // Set bright foreground color
-                m_currentAttributes.foregroundColor = static_cast<AnsiColor>((p - 90) + 8); // Offset by 8 for bright
+                m_currentStyle.foreground = TextColor::Indexed(static_cast<uint8_t>((p - 90) + 8)); // Offset by 8 for bright
             }
             else if (p >= 100 && p <= 107) { // Set bright background color
-                m_currentAttributes.backgroundColor = static_cast<AnsiColor>((p - 100) + 8); // Offset by 8 for bright
-            }
-            // 8-bit (256) colors: 38 ; 5 ; P s or 48 ; 5 ; P s
-            else if (p == 38 || p == 48) {
-                if (i + 2 < params.size()) {
-                    int colorMode = params[i + 1];
-                    int colorValue = params[i + 2];
-                    if (colorMode == 5) { // 256-color palette
-                        if (colorValue >= 0 && colorValue <= 255) {
-                            AnsiColor mappedColor = AnsiColor::White;
-                            if (colorValue < 8) mappedColor = static_cast<AnsiColor>(colorValue);
-                            else if (colorValue < 16) mappedColor = static_cast<AnsiColor>(static_cast<uint8_t>(colorValue - 8) + static_cast<uint8_t>(AnsiColor::BrightBlack));
-
-                            if (p == 38) m_currentAttributes.foregroundColor = mappedColor;
-                            else m_currentAttributes.backgroundColor = mappedColor;
-                        }
-                    }
-                    else if (colorMode == 2) {
-                        if (i + 4 < params.size()) {
-                            // TODO: Store RGB directly in Cell and signal renderer to use it.
-                            i += 2;
-                        }
-                    }
-                    i += 2;
+                m_currentStyle.background = TextColor::Indexed(static_cast<uint8_t>((p - 100) + 8)); // Offset by 8 for bright
+            }
+            // Extended colors: 38:5:n / 38:2::r:g:b, or the legacy 38;5;n / 38;2;r;g;b forms; 58 is the underline color
+            else if (p == 38) {
+                i += SetExtendedColor(params, i, m_currentStyle.foreground);
+            }
+            else if (p == 48) {
+                i += SetExtendedColor(params, i, m_currentStyle.background);
+            }
+            else if (p == 58) {
+                i += SetExtendedColor(params, i, m_currentStyle.underlineColor);
+            }
+        }
+        UpdateCurrentStyleId();
+    }
+
+    size_t TerminalBuffer::SetExtendedColor(VtParamsView params, size_t index, TextColor& color) {
+        // With colons the color is self-contained in the sub-parameters; with semicolons it
+        // swallows the following parameters, so report how many were consumed
+        int colorMode = 0;
+        int values[3] = { -1, -1, -1 }; // Palette index, or r, g, b
+        size_t consumed = 0;
+        if (params.HasSubParams(index)) {
+            std::span<const int32_t> sub = params.SubParams(index);
+            colorMode = sub[0];
+            if (colorMode == 5 && sub.size() >= 2) {
+                values[0] = sub[1];
+            }
+            else if (colorMode == 2 && sub.size() >= 4) {
+                // sub = { 2, colorspace, r, g, b }, the colorspace id may be omitted (38:2:r:g:b)
+                size_t first = sub.size() >= 5 ? 2 : 1;
+                for (size_t k = 0; k < 3; ++k) values[k] = sub[first + k];
+            }
+        }
+        else if (index + 2 < params.size()) {
+            colorMode = params[index + 1];
+            if (colorMode == 5) {
+                values[0] = params[index + 2];
+                consumed = 2;
+            }
+            else if (colorMode == 2) {
+                if (index + 4 < params.size()) {
+                    for (size_t k = 0; k < 3; ++k) values[k] = params[index + 2 + k];
+                    consumed = 4;
                 }
+                else {
+                    consumed = 2;
+                }
+            }
+            else {
+                consumed = 2;
             }
         }
+
+        auto inRange = [](int value) { return value >= 0 && value <= 255; };
+        if (colorMode == 5 && inRange(values[0])) { // 256-color palette
+            color = TextColor::Indexed(static_cast<uint8_t>(values[0]));
+        }
+        else if (colorMode == 2 && inRange(values[0]) && inRange(values[1]) && inRange(values[2])) { // 24-bit
+            color = TextColor::Rgb(static_cast<uint32_t>(values[0]) << 16 | static_cast<uint32_t>(values[1]) << 8 | static_cast<uint32_t>(values[2]));
+        }
+        return consumed;
+    }
+
+    void TerminalBuffer::SetUnderlineStyle(int style) {
+        const CellAttributesFlags underlineFlags = CellAttributesFlags::Underline | CellAttributesFlags::DoubleUnderline | CellAttributesFlags::CurlyUnderline;
+        CellAttributesFlags& attributes = m_currentStyle.attributes;
+        attributes = attributes & ~underlineFlags;
+
+        switch (style) {
+        case 0: break; // 4:0 - No underline
+        case 2: attributes |= CellAttributesFlags::Underline | CellAttributesFlags::DoubleUnderline; break;
+        case 3: attributes |= CellAttributesFlags::Underline | CellAttributesFlags::CurlyUnderline; break;
+        default: attributes |= CellAttributesFlags::Underline; break; // Single, dotted and dashed
+        }
+    }
+
+    void TerminalBuffer::UpdateCurrentStyleId() {
+        TextStyle style = m_currentStyle;
+        style.hyperlink = m_currentHyperlink;
+        m_currentStyleId = m_styles.Intern(style);
+        if (m_styles.Size() >= m_styleCompactThreshold) {
+            CompactStyles();
+        }
+    }
+
+    void TerminalBuffer::CompactStyles() {
+        // History stores styles by value, so only the screens and the current style hold ids
+        std::vector<bool> used(m_styles.Size(), false);
+        m_screen.MarkStyles(used);
+        m_hiddenScreen.MarkStyles(used);
+        used[m_currentStyleId] = true;
+
+        std::vector<uint32_t> remap = m_styles.Compact(used);
+        m_screen.RemapStyles(remap);
+        m_hiddenScreen.RemapStyles(remap);
+        m_currentStyleId = remap[m_currentStyleId];
+        ++m_screenId;
+
+        // A screen full of distinct styles shouldn't make every SGR compact again
+        m_styleCompactThreshold = std::max(STYLE_COMPACT_THRESHOLD, m_styles.Size() * 2);
     }
 
     void TerminalBuffer::SetDecPrivateMode(int mode, bool enabled) {
-        OutputDebugString((L"TerminalBuffer: SetDecPrivateMode - Mode: " + std::to_wstring(mode) + L" Enabled: " + (enabled ? L"true" : L"false") + L"\n").c_str());
+        WRT_TRACE(TraceCategory::Modes, TraceLevel::Verbose, TraceEvent::DecPrivateMode, mode, enabled ? 1 : 0);
 
         switch (mode) {
         case DecPrivateModes::DECCKM_CursorKeys: // Mode 1: Application Cursor Keys
@@ -506,37 +1260,37 @@ namespace winrt::win_retro_term::Core
             break;
         case DecPrivateModes::DECOM_OriginMode: // Mode 6: Origin Mode
             m_originMode = enabled;
+            CursorPosition(1, 1); // Home, relative to the margins when enabled
+            break;
+
+        case DecPrivateModes::XTERM_AlternateScreen: // Mode 47
+            SwitchScreen(enabled);
+            break;
+        case DecPrivateModes::XTERM_AlternateScreenClear: // Mode 1047
+            if (!enabled && m_isAlternateScreenActive) {
+                m_screen.FillRows(0, m_rows - 1, BlankStyle());
+            }
+            SwitchScreen(enabled);
+            break;
+        case DecPrivateModes::XTERM_SaveCursor: // Mode 1048
             if (enabled) {
-                SetCursorPosition(1, 1);
+                SaveCursor();
+            }
+            else {
+                RestoreCursor();
             }
             break;
-
-        case DecPrivateModes::XTERM_AlternateScreenBuffer: // Mode 1049
+        case DecPrivateModes::XTERM_AlternateScreenBuffer: // Mode 1049: 1048 and 1047 together, the alternate screen starts clear
             if (enabled) {
                 if (!m_isAlternateScreenActive) {
-                    // Save current screen, cursor pos, attributes
-                    m_mainScreenBufferBackup = m_screenBuffer;
-                    m_mainScreenCursorXBackup = m_cursorX;
-                    m_mainScreenCursorYBackup = m_cursorY;
-                    m_mainScreenCursorAttributesBackup = m_currentAttributes;
-
+                    SaveCursor();
+                    SwitchScreen(true);
                     Clear();
-                    m_isAlternateScreenActive = true;
                 }
             }
-            else {
-                if (m_isAlternateScreenActive) {
-                    // Restore main screen, cursor pos, attributes
-                    if (!m_mainScreenBufferBackup.empty()) {
-                        m_screenBuffer = m_mainScreenBufferBackup;
-                        m_mainScreenBufferBackup.clear();
-                    }
-                    m_cursorX = m_mainScreenCursorXBackup;
-                    m_cursorY = m_mainScreenCursorYBackup;
-                    m_currentAttributes = m_mainScreenCursorAttributesBackup;
-
-                    m_isAlternateScreenActive = false;
-                }
+            else if (m_isAlternateScreenActive) {
+                SwitchScreen(false);
+                RestoreCursor();
             }
             break;
 
@@ -544,4 +1298,144 @@ namespace winrt::win_retro_term::Core
             break;
         }
     }
-}
\ No newline at end of file
+
+    void TerminalBuffer::SwitchScreen(bool alternate) {
+        if (alternate == m_isAlternateScreenActive) return;
+
+        if (m_hiddenScreen.Rows() != m_rows || m_hiddenScreen.Cols() != m_cols) {
+            m_hiddenScreen = CellGrid(m_rows, m_cols, BlankStyle());
+        }
+        m_screen.Swap(m_hiddenScreen);
+        std::swap(m_savedCursor, m_hiddenSavedCursor);
+        m_isAlternateScreenActive = alternate;
+        ++m_screenId;
+    }
+
+    void TerminalBuffer::SaveCursor() { // DECSC
+        m_savedCursor.x = m_cursorX;
+        m_savedCursor.y = m_cursorY;
+        m_savedCursor.style = m_currentStyle;
+        m_savedCursor.originMode = m_originMode;
+        std::copy(std::begin(m_charsets), std::end(m_charsets), m_savedCursor.charsets);
+        m_savedCursor.glCharsetIndex = m_glCharsetIndex;
+        m_savedCursor.grCharsetIndex = m_grCharsetIndex;
+    }
+
+    void TerminalBuffer::RestoreCursor() { // DECRC, without a save it homes the cursor and resets the rest
+        m_cursorX = m_savedCursor.x;
+        m_cursorY = m_savedCursor.y;
+        m_currentStyle = m_savedCursor.style;
+        UpdateCurrentStyleId();
+        m_originMode = m_savedCursor.originMode;
+        std::copy(std::begin(m_savedCursor.charsets), std::end(m_savedCursor.charsets), m_charsets);
+        m_glCharsetIndex = m_savedCursor.glCharsetIndex;
+        m_grCharsetIndex = m_savedCursor.grCharsetIndex;
+        EnsureCursorInBounds(); // The screen may have shrunk since the cursor was saved
+    }
+
+    void TerminalBuffer::SetWindowTitle(std::string_view title) {
+        // Only the latest title matters, the UI picks it up with the next snapshot
+        m_title.assign(title);
+        ++m_titleGeneration;
+    }
+
+    void TerminalBuffer::SetPaletteColor(int index, uint32_t rgb) {
+        if (index >= 0 && index < 256) {
+            m_palette[index] = rgb;
+            ++m_paletteGeneration;
+        }
+    }
+
+    void TerminalBuffer::SetDefaultColor(bool foreground, uint32_t rgb) {
+        m_palette[foreground ? PALETTE_DEFAULT_FOREGROUND : PALETTE_DEFAULT_BACKGROUND] = rgb;
+        ++m_paletteGeneration;
+    }
+
+    void TerminalBuffer::SetHyperlink(std::string_view id, std::string_view uri) {
+        m_currentHyperlink = InternHyperlink(id, uri);
+        UpdateCurrentStyleId();
+    }
+
+    uint16_t TerminalBuffer::InternHyperlink(std::string_view id, std::string_view uri) {
+        if (uri.empty()) {
+            return 0;
+        }
+
+        std::string key;
+        key.reserve(id.size() + 1 + uri.size());
+        key.append(id).append(1, ';').append(uri);
+        auto existing = m_hyperlinkIds.find(key);
+        if (existing != m_hyperlinkIds.end()) {
+            return existing->second;
+        }
+        if (m_hyperlinkUris.size() >= MAX_HYPERLINKS) {
+            return 0; // Table full, the text is still printed, just not linked
+        }
+        m_hyperlinkUris.emplace_back(uri);
+        uint16_t linkId = static_cast<uint16_t>(m_hyperlinkUris.size());
+        m_hyperlinkIds.emplace(std::move(key), linkId);
+        return linkId;
+    }
+
+    std::string_view TerminalBuffer::GetHyperlinkUri(uint16_t id) const {
+        if (id == 0 || id > m_hyperlinkUris.size()) {
+            return {};
+        }
+        return m_hyperlinkUris[id - 1];
+    }
+
+    void TerminalBuffer::ClipboardWrite(std::string_view selection, std::string_view base64, bool first, bool last) {
+        // The selection (clipboard, primary, ...) is ignored, Windows only has the one clipboard
+        (void)selection;
+        if (first) {
+            m_clipboardPending.clear();
+            m_clipboardBits = 0;
+            m_clipboardBitCount = 0;
+            m_clipboardOverflow = false;
+        }
+
+        // Streaming base64 decode, a quantum may be split across chunks
+        for (char ch : base64) {
+            int value;
+            if (ch >= 'A' && ch <= 'Z') value = ch - 'A';
+            else if (ch >= 'a' && ch <= 'z') value = ch - 'a' + 26;
+            else if (ch >= '0' && ch <= '9') value = ch - '0' + 52;
+            else if (ch == '+') value = 62;
+            else if (ch == '/') value = 63;
+            else continue; // Padding and anything else
+
+            m_clipboardBits = (m_clipboardBits << 6) | static_cast<uint32_t>(value);
+            m_clipboardBitCount += 6;
+            if (m_clipboardBitCount >= 8) {
+                m_clipboardBitCount -= 8;
+                if (m_clipboardPending.size() < MAX_CLIPBOARD_BYTES) {
+                    m_clipboardPending.push_back(static_cast<char>((m_clipboardBits >> m_clipboardBitCount) & 0xFF));
+                }
+                else {
+                    m_clipboardOverflow = true;
+                }
+            }
+        }
+
+        if (last && !m_clipboardOverflow && !m_clipboardPending.empty()) {
+            m_clipboardText.swap(m_clipboardPending);
+            m_clipboardPending.clear();
+            ++m_clipboardGeneration;
+        }
+    }
+
+    void TerminalBuffer::DcsHook(VtParamsView params, std::string_view intermediates, char32_t finalChar) {
+        // No device control strings (DECRQSS, sixel, ...) are implemented yet; the payload is discarded
+        (void)params;
+        WRT_TRACE(TraceCategory::Parser, TraceLevel::Info, TraceEvent::DcsUnhandled, static_cast<int32_t>(finalChar),
+            Trace::PackChars(intermediates.data(), intermediates.size()));
+    }
+
+    void TerminalBuffer::DcsPut(std::string_view data) {
+        (void)data;
+    }
+
+    void TerminalBuffer::DcsUnhook(bool aborted) {
+        (void)aborted;
+    }
+}
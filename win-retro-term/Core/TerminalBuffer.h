@@ -1,44 +1,23 @@
 #pragma once
+#include "Cell.h"
+#include "CellGrid.h"
 #include "ITerminalActions.h"
+#include "LineRewrapper.h"
+#include "ScreenDamage.h"
+#include "Scrollback.h"
+#include "StyleTable.h"
+#include "UnicodeWidth.h"
+#include <array>
+#include <memory>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <cstdint>
 #include <algorithm>
 
 namespace winrt::win_retro_term::Core 
 {
-    enum class AnsiColor : uint8_t {
-        Black = 0, 
-        Red = 1, 
-        Green = 2, 
-        Yellow = 3, 
-        Blue = 4, 
-        Magenta = 5, 
-        Cyan = 6, 
-        White = 7,
-        BrightBlack = 8, 
-        BrightRed = 9, 
-        BrightGreen = 10, 
-        BrightYellow = 11,
-        BrightBlue = 12, 
-        BrightMagenta = 13, 
-        BrightCyan = 14, 
-        BrightWhite = 15,
-        Foreground = 16,
-        Background = 17
-    };
-
-    enum class CellAttributesFlags : uint16_t {
-        None = 0,
-        Bold = 1 << 0,
-        Italic = 1 << 1,
-        Underline = 1 << 2,
-        Inverse = 1 << 3,
-        Concealed = 1 << 4,
-        Strikethrough = 1 << 5,
-        Dim = 1 << 6
-    };
-
     namespace DecPrivateModes {
         const int DECCKM_CursorKeys = 1;                // Application Cursor Keys Mode
         const int DECANM_AnsiVt52Mode = 2;              // ANSI/VT52 mode (VT52 is rare now)
@@ -51,6 +30,9 @@ namespace winrt::win_retro_term::Core
         const int XTERM_SendMouseXYOnClick = 9;         // X10 Mouse Reporting (Press/Release only)
         const int DECTCEM_TextCursorEnable = 25;        // Show/Hide Cursor
         const int DECNKM_KeypadApplication = 66;        // Application Keypad Mode (xterm)
+        const int XTERM_AlternateScreen = 47;           // Switches to the alternate screen as it was left
+        const int XTERM_AlternateScreenClear = 1047;    // Same, the alternate screen is cleared on the way out
+        const int XTERM_SaveCursor = 1048;              // Saves/restores the cursor like DECSC/DECRC
         const int XTERM_AlternateScreenBuffer = 1049;   // Uses alternate screen, saves/restores cursor & screen
         const int XTERM_MouseBtnEvent = 1000;           // Send Mouse X & Y on button press and release.
         const int XTERM_MouseMotionEvent = 1002;        // Send Mouse X & Y on button press, release, and motion.
@@ -59,52 +41,90 @@ namespace winrt::win_retro_term::Core
         const int XTERM_SGRMouseMode = 1006;            // Extended SGR mouse reporting.
     }
 
-    inline CellAttributesFlags operator|(CellAttributesFlags a, CellAttributesFlags b) {
-        return static_cast<CellAttributesFlags>(static_cast<uint16_t>(a) | static_cast<uint16_t>(b));
-    }
-    inline CellAttributesFlags& operator|=(CellAttributesFlags& a, CellAttributesFlags b) {
-        a = a | b;
-        return a;
-    }
-    inline CellAttributesFlags operator&(CellAttributesFlags a, CellAttributesFlags b) {
-        return static_cast<CellAttributesFlags>(static_cast<uint16_t>(a) & static_cast<uint16_t>(b));
-    }
-    inline CellAttributesFlags operator~(CellAttributesFlags a) {
-        return static_cast<CellAttributesFlags>(~static_cast<uint16_t>(a));
-    }
-
-    struct Cell {
-        wchar_t character = L' ';
-        AnsiColor foregroundColor = AnsiColor::Foreground;
-        AnsiColor backgroundColor = AnsiColor::Background;
-        CellAttributesFlags attributes = CellAttributesFlags::None;
-        Cell() = default;
-    };
+    // 0xRRGGBB for the 256 indexed colors, then the default foreground and background
+    using ColorPalette = std::array<uint32_t, 258>;
+    extern const ColorPalette DEFAULT_PALETTE;
+    const size_t PALETTE_DEFAULT_FOREGROUND = 256;
+    const size_t PALETTE_DEFAULT_BACKGROUND = 257;
 
     const wchar_t CHARSET_US_ASCII = L'B';
     const wchar_t CHARSET_DEC_SPECIAL_GRAPHICS = L'0';
     const wchar_t CHARSET_UK = L'A';
 
+    struct ScreenSnapshot;
+    struct SnapshotRow;
+
     class TerminalBuffer : public ITerminalActions {
     public:
         TerminalBuffer(int rows, int cols);
 
-        void SetChar(int r, int c, wchar_t ch);
+        void SetChar(int r, int c, char32_t ch);
         Cell GetCell(int r, int c) const;
-        const std::vector<std::vector<Cell>>& GetScreenBuffer() const;
+        // Text and style runs of visible row 'r', top to bottom regardless of how the rows are stored
+        std::span<const char32_t> GetRowText(int r) const { return m_screen.TextSpan(r); }
+        std::span<const StyleSpan> GetRowSpans(int r) const { return m_screen.Spans(r); }
+        std::span<const std::u32string> GetRowClusters(int r) const { return m_screen.Clusters(r); }
+        bool IsRowWrapped(int r) const { return m_screen.Wrapped(r); }
+
+        // Fills 'snapshot' with the visible screen, cursor and input modes. Rows are shared, immutable
+        // handles that are only rebuilt when they change, so this costs O(changed rows).
+        void CaptureSnapshot(ScreenSnapshot& snapshot);
+
+        const StyleTable& GetStyles() const { return m_styles; }
+
+        // Changes since 'cursor' was last passed in (everything the first time), and moves it up to now
+        void CollectDamage(DamageCursor& cursor, ScreenDamage& damage) const;
+        // The same for a single built-in consumer
+        void ConsumeDamage(ScreenDamage& damage) { CollectDamage(m_damageCursor, damage); }
 
         void Clear();
+
+        // A width change rewraps the main screen's soft-wrapped lines to the new width right away, and rows
+        // that no longer fit go to history. A screen left with room to spare takes the newest history lines
+        // back, so narrowing and widening again gives the same screen. History itself is rewrapped by
+        // ContinueHistoryReflow a batch at a time, so a resize costs O(screen) however long the history is.
+        // The alternate screen is cut to size.
         void Resize(int newRows, int newCols);
-        void ScrollUp(int linesToScroll = 1);
+
+        // Rewraps up to 'lines' history lines after a resize; false once the history shows at the current width.
+        // Until then the lines not reached yet show at the width they were written. A resize meanwhile keeps what
+        // has been rewrapped, and if the width changed those lines get another pass once the rest has caught up.
+        bool ContinueHistoryReflow(size_t lines);
+        bool HistoryReflowPending() const { return m_historyReflow != nullptr; }
         void SetCursorPosition(int r, int c);
 
+        // History view: the offset is how many lines the view is scrolled back from the live screen.
+        // New output keeps a scrolled-back view on the same lines.
+        void ScrollViewport(int lines);     // Positive scrolls back into history
+        void ScrollViewportToBottom() { m_viewportOffset = 0; }
+        int GetViewportOffset() const { return m_viewportOffset; }
+        const Scrollback& GetScrollback() const { return m_scrollback; }
+        void SetScrollbackLimit(size_t bytes);          // RAM for history
+        void SetScrollbackSpillLimit(uint64_t bytes);   // Session file for older history, 0 keeps it all in RAM
+        size_t HistoryMemoryUsage() const;              // Rewrapped lines of a reflow included
+
+        // History as it shows, numbered like Scrollback lines: while a reflow runs, the lines it has rewrapped
+        // followed by the rest of GetScrollback()
+        size_t HistoryLineCount() const;
+        size_t HistoryLineLength(size_t line) const;
+        bool IsHistoryWrapped(size_t line) const;
+        void ReadHistoryLine(size_t line, std::span<char32_t> text, std::vector<StyleSpan>& spans, StyleTable& styles,
+            std::vector<std::u32string>* clusters = nullptr) const;
+
+        // History and the visible screen as SearchBlocks, the screen's rows numbered on from the last history line.
+        // 'firstLine' is the oldest history line still held, the first block may begin before it.
+        void CollectSearchBlocks(std::vector<std::shared_ptr<const SearchBlock>>& blocks, uint64_t& firstLine) const;
+        // Filters and compresses up to 'blocks' search blocks of history; false once there are none left
+        bool ContinueSearchIndexing(size_t blocks);
+
         int GetCursorRow() const { return m_cursorY; }
         int GetCursorCol() const { return m_cursorX; }
         int GetRows() const { return m_rows; }
         int GetCols() const { return m_cols; }
 
         // --- ITerminalActions Implementation ---
-        void PrintChar(wchar_t ch) override;
+        void PrintChar(char32_t ch) override;
+        void PrintString(std::span<const char32_t> text) override;
         void ExecuteControlFunction(wchar_t control) override;
 
         void LineFeed() override;
@@ -118,21 +138,42 @@ namespace winrt::win_retro_term::Core
         void CursorForward(int count) override;
         void CursorBack(int count) override;
         void CursorPosition(int row, int col) override;
+        void ReverseIndex() override;
+        void SaveCursor() override;
+        void RestoreCursor() override;
 
         void EraseInDisplay(int mode) override;
         void EraseInLine(int mode) override;
 
-        void SetGraphicsRendition(const std::vector<int>& params) override;
+        void SetScrollingRegion(int top, int bottom) override;
+        void ScrollUp(int count = 1) override;
+        void ScrollDown(int count) override;
+        void InsertLines(int count) override;
+        void DeleteLines(int count) override;
+        void InsertCharacters(int count) override;
+        void DeleteCharacters(int count) override;
 
-        CellAttributesFlags GetCurrentAttributesFlags() const { return m_currentAttributes.attributes; }
-        AnsiColor GetCurrentForegroundColor() const { return m_currentAttributes.foregroundColor; }
-        AnsiColor GetCurrentBackgroundColor() const { return m_currentAttributes.backgroundColor; }
+        void SetGraphicsRendition(VtParamsView params) override;
+
+        const TextStyle& GetCurrentStyle() const { return m_styles.Get(m_currentStyleId); }
 
         void DesignateCharSet(uint8_t targetSet, wchar_t charSetType) override;
         void InvokeCharSet(uint8_t gSetToInvokeIntoGL) override;
 
         void SetDecPrivateMode(int mode, bool enabled) override;
 
+        void SetWindowTitle(std::string_view title) override;
+        void SetPaletteColor(int index, uint32_t rgb) override;
+        void SetDefaultColor(bool foreground, uint32_t rgb) override;
+        void SetHyperlink(std::string_view id, std::string_view uri) override;
+        void ClipboardWrite(std::string_view selection, std::string_view base64, bool first, bool last) override;
+        void DcsHook(VtParamsView params, std::string_view intermediates, char32_t finalChar) override;
+        void DcsPut(std::string_view data) override;
+        void DcsUnhook(bool aborted) override;
+
+        // Empty for unknown ids
+        std::string_view GetHyperlinkUri(uint16_t id) const;
+
         bool IsApplicationCursorKeysMode() const { return m_applicationCursorKeysMode; }
         bool IsApplicationKeypadMode() const { return m_applicationKeypadMode; }
         bool IsCursorVisible() const { return m_cursorVisible; }
@@ -141,16 +182,76 @@ namespace winrt::win_retro_term::Core
     private:
         void EnsureCursorInBounds();
         void InitBuffer();
+        uint32_t ModeBits() const;
+        void SwitchScreen(bool alternate);
+        void UpdateSnapshotRows();
+        void UpdateHistoryRows(int count, size_t firstLine);
+        // Moves 'cursorY' and 'cursorX' along with the text they point at
+        void ReflowScreen(CellGrid& grid, int newRows, int newCols, int& cursorY, int& cursorX);
+        void StartHistoryReflow();
+        void SetReflowLimits();
+        uint64_t ReflowedUpTo() const;
+        const Scrollback& HistoryFor(size_t& line) const;
+
+        // Style of the blanks that erasing, scrolling and shifting bring in
+        uint32_t BlankStyle() const { return StyleTable::DEFAULT_STYLE; }
 
         int m_rows;
         int m_cols;
-        std::vector<std::vector<Cell>> m_screenBuffer;
+        CellGrid m_screen;
+        int m_scrollTop = 0;        // DECSTBM margins, inclusive and 0-based
+        int m_scrollBottom = 0;
+
+        Scrollback m_scrollback;
+        int m_viewportOffset = 0;
+
+        // History being rewrapped after a resize: the lines so far build up in a second Scrollback that takes
+        // the place of m_scrollback once it has caught up, lines pushed meanwhile included. m_scrollback lets go
+        // of its chunks as they are rewrapped, and the second one only gets the room that leaves (see
+        // SetReflowLimits), so the two don't hold more than one would. Styles are interned into a table of
+        // its own, so compacting m_styles doesn't concern it.
+        struct HistoryReflow {
+            explicit HistoryReflow(int cols) : history(0, 0), rewrapper(cols, StyleTable::DEFAULT_STYLE) {}
+
+            Scrollback history;
+            LineRewrapper rewrapper;
+            StyleTable styles;
+            uint64_t lineStart = 0;         // First line of m_scrollback not in 'history': where the line being collected begins
+            uint64_t nextLine = 0;          // Next line of m_scrollback to read, counted like TotalLines
+            bool mixedWidths = false;       // Some of 'history' was rewrapped at an earlier width
+            std::vector<char32_t> text;
+            std::vector<StyleSpan> spans;
+            std::vector<std::u32string> clusters;
+        };
+        std::unique_ptr<HistoryReflow> m_historyReflow;
         int m_cursorX;
         int m_cursorY;
         const int TAB_WIDTH = 8;
 
-        Cell m_currentAttributes;
-        Cell m_defaultAttributes;
+        // SGR edits m_currentStyle and resolves it to an id once, printed cells just copy the id.
+        // History lines read back for a snapshot intern their styles too, hence mutable.
+        static constexpr size_t STYLE_COMPACT_THRESHOLD = 1 << 16;
+        mutable StyleTable m_styles;
+        TextStyle m_currentStyle;           // Without the hyperlink, which SGR 0 doesn't reset
+        uint32_t m_currentStyleId = StyleTable::DEFAULT_STYLE;
+        size_t m_styleCompactThreshold = STYLE_COMPACT_THRESHOLD;
+
+        // Host-facing state set through OSC strings. Generations let CaptureSnapshot copy them only when changed.
+        static const size_t MAX_HYPERLINKS = 4096;
+        static const size_t MAX_CLIPBOARD_BYTES = 1024 * 1024;
+        std::string m_title;
+        uint64_t m_titleGeneration = 0;
+        ColorPalette m_palette = DEFAULT_PALETTE;
+        uint64_t m_paletteGeneration = 0;
+        std::vector<std::string> m_hyperlinkUris;                   // Indexed by id - 1
+        std::unordered_map<std::string, uint16_t> m_hyperlinkIds;   // "id;uri" -> id, so repeated links share an id
+        uint16_t m_currentHyperlink = 0;
+        std::string m_clipboardPending;                             // Decoded so far for an OSC 52 write in progress
+        uint32_t m_clipboardBits = 0;                               // Base64 bits carried across chunks
+        int m_clipboardBitCount = 0;
+        bool m_clipboardOverflow = false;
+        std::string m_clipboardText;
+        uint64_t m_clipboardGeneration = 0;
 
         wchar_t m_charsets[4];
         uint8_t m_glCharsetIndex;
@@ -163,12 +264,55 @@ namespace winrt::win_retro_term::Core
         bool m_autoWrapMode = true;
         bool m_originMode = false;
 
+        // Changes whenever damage has to be full: resize, screen switch, style compaction
+        uint64_t m_screenId = 1;
+        DamageCursor m_damageCursor;
+
+        // Rows handed out to snapshots: the live screen's, kept up to date through their own damage
+        // cursor, and the history lines the last snapshot showed, with what they were read as
+        struct HistoryRow {
+            uint64_t line;                          // Counted from the last scrollback clear, evicted lines included
+            std::shared_ptr<SnapshotRow> row;
+        };
+        uint64_t m_snapshotEpoch = 0;
+        DamageCursor m_snapshotCursor;
+        ScreenDamage m_snapshotDamage;
+        std::vector<std::shared_ptr<SnapshotRow>> m_snapshotRows;
+        std::vector<HistoryRow> m_historyRows;      // Ascending and contiguous
+        std::vector<HistoryRow> m_historyScratch;
+        uint64_t m_historyRowsId = 0;               // m_screenId and m_historyClears they were read under
+        uint64_t m_historyRowsClears = 0;
+        uint64_t m_historyClears = 0;
+
+        // What DECSC saves and DECRC restores. Each screen has its own, like xterm.
+        struct SavedCursor {
+            int x = 0;
+            int y = 0;
+            TextStyle style;
+            bool originMode = false;
+            wchar_t charsets[4] = { CHARSET_US_ASCII, CHARSET_US_ASCII, CHARSET_US_ASCII, CHARSET_US_ASCII };
+            uint8_t glCharsetIndex = 0;
+            uint8_t grCharsetIndex = 1;
+        };
+        SavedCursor m_savedCursor;
+
+        // The screen not shown, main or alternate, kept allocated so switching only swaps the two.
+        // The alternate one is allocated on first use and never writes to history.
         bool m_isAlternateScreenActive = false;
-        std::vector<std::vector<Cell>> m_mainScreenBufferBackup;
-        Cell m_mainScreenCursorAttributesBackup;
-        int m_mainScreenCursorXBackup = 0;
-        int m_mainScreenCursorYBackup = 0;
+        CellGrid m_hiddenScreen;
+        SavedCursor m_hiddenSavedCursor;
 
-        wchar_t MapCharacter(wchar_t ch);
+        void PrintCells(std::span<const char32_t> text);
+        void PrintNarrowCells(std::span<const char32_t> text);
+        void PrintCodePoint(char32_t ch, CodePointClass cls);
+        bool JoinPreviousCell(char32_t ch, CodePointClass cls);
+        void SplitWideCells(int row, int first, int last);     // Before cells first..last are overwritten
+        void EraseCells(int first, int last);                 // On the cursor row
+        char32_t MapCharacter(char32_t ch);
+        size_t SetExtendedColor(VtParamsView params, size_t index, TextColor& color);
+        void SetUnderlineStyle(int style);
+        void UpdateCurrentStyleId();
+        uint16_t InternHyperlink(std::string_view id, std::string_view uri);
+        void CompactStyles();
     };
 }
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "pch.h"
+#include "TerminalWorker.h"
+#include <algorithm>
+#include <utility>
+
+namespace winrt::win_retro_term::Core
+{
+    TerminalWorker::TerminalWorker(int rows, int cols)
+        : m_terminalBuffer(rows, cols), m_ansiParser(m_terminalBuffer), m_input(INPUT_RING_CAPACITY)
+    {
+    }
+
+    TerminalWorker::~TerminalWorker()
+    {
+        Stop();
+    }
+
+    void TerminalWorker::Start()
+    {
+        if (m_thread.joinable() || m_input.IsClosed()) {
+            return;
+        }
+        ApplyPendingResize();
+        PublishSnapshot(); // The UI has something to draw before the first byte arrives
+        m_thread = std::thread(&TerminalWorker::ThreadFunc, this);
+    }
+
+    void TerminalWorker::Stop()
+    {
+        m_stopping.store(true, std::memory_order_release);
+        m_input.Close(); // Also releases a reader waiting for space
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    bool TerminalWorker::Feed(const char* data, size_t length)
+    {
+        while (length > 0) {
+            if (!m_input.WaitForSpace()) {
+                return false;
+            }
+            size_t written = m_input.Write(data, length);
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    void TerminalWorker::PostResize(int rows, int cols)
+    {
+        // The sequence number keeps a later resize back to the same size from passing for this one. It is
+        // odd, so the word is never 0.
+        uint32_t sequence = m_resizeSequence.fetch_add(2, std::memory_order_relaxed) | 1;
+        uint64_t size = (static_cast<uint64_t>(std::clamp(rows, 0, 0xFFFF)) << 16) | static_cast<uint64_t>(std::clamp(cols, 0, 0xFFFF));
+        m_pendingResizeMark.store(m_input.WritePosition(), std::memory_order_relaxed);
+        m_pendingSize.store((static_cast<uint64_t>(sequence) << 32) | size, std::memory_order_release);
+        m_input.WakeConsumer();
+    }
+
+    void TerminalWorker::PostSearch(std::u32string query, bool matchCase)
+    {
+        {
+            std::lock_guard lock(m_searchMutex);
+            m_pendingQuery = std::move(query);
+            m_pendingMatchCase = matchCase;
+        }
+        m_searchPosted.store(true, std::memory_order_release);
+        m_input.WakeConsumer();
+    }
+
+    void TerminalWorker::PostScrollViewport(int lines)
+    {
+        m_pendingViewportLines.fetch_add(lines, std::memory_order_relaxed);
+        m_input.WakeConsumer();
+    }
+
+    void TerminalWorker::PostScrollToBottom()
+    {
+        m_pendingScrollToBottom.store(true, std::memory_order_relaxed);
+        m_input.WakeConsumer();
+    }
+
+    IngestionMetrics TerminalWorker::GetMetrics() const
+    {
+        IngestionMetrics metrics;
+        metrics.queueDepth = m_input.Size();
+        metrics.queueCapacity = m_input.Capacity();
+        metrics.wakeups = m_wakeups.load(std::memory_order_relaxed);
+        metrics.bytesParsed = m_bytesParsed.load(std::memory_order_relaxed);
+        metrics.lastWakeupBytes = m_lastWakeupBytes.load(std::memory_order_relaxed);
+        metrics.flooding = m_flooding.load(std::memory_order_relaxed);
+        metrics.floodEpisodes = m_floodEpisodes.load(std::memory_order_relaxed);
+        metrics.preResizeBytes = m_preResizeBytes.load(std::memory_order_relaxed);
+        return metrics;
+    }
+
+    bool TerminalWorker::ApplyPendingResize()
+    {
+        uint64_t size = m_pendingSize.load(std::memory_order_acquire);
+        if (size == 0 || BytesBeforeResize() != 0) {
+            return false;
+        }
+        if (!m_pendingSize.compare_exchange_strong(size, 0, std::memory_order_acquire)) {
+            return false;   // A newer one came in, it is applied at its own mark, even if it is the same size
+        }
+
+        int rows = static_cast<int>((size >> 16) & 0xFFFF);
+        int cols = static_cast<int>(size & 0xFFFF);
+        if (rows == m_terminalBuffer.GetRows() && cols == m_terminalBuffer.GetCols()) {
+            return false;
+        }
+        m_terminalBuffer.Resize(rows, cols);
+        return true;
+    }
+
+    size_t TerminalWorker::BytesBeforeResize() const
+    {
+        // Output queued before a pending resize was posted, still to be parsed at the old size
+        if (m_pendingSize.load(std::memory_order_acquire) == 0) {
+            return 0;
+        }
+        uint64_t mark = m_pendingResizeMark.load(std::memory_order_relaxed);
+        uint64_t read = m_input.ReadPosition();
+        return mark > read ? static_cast<size_t>(mark - read) : 0;
+    }
+
+    bool TerminalWorker::ApplyPendingViewport()
+    {
+        int before = m_terminalBuffer.GetViewportOffset();
+        if (m_pendingScrollToBottom.exchange(false, std::memory_order_relaxed)) {
+            m_pendingViewportLines.store(0, std::memory_order_relaxed);
+            m_terminalBuffer.ScrollViewportToBottom();
+        }
+        int lines = m_pendingViewportLines.exchange(0, std::memory_order_relaxed);
+        if (lines != 0) {
+            m_terminalBuffer.ScrollViewport(lines);
+        }
+        return m_terminalBuffer.GetViewportOffset() != before;
+    }
+
+    void TerminalWorker::ApplyPendingSearch()
+    {
+        if (!m_searchPosted.exchange(false, std::memory_order_acquire)) {
+            return;
+        }
+        std::u32string query;
+        bool matchCase;
+        {
+            std::lock_guard lock(m_searchMutex);
+            query = m_pendingQuery;
+            matchCase = m_pendingMatchCase;
+        }
+
+        std::vector<std::shared_ptr<const SearchBlock>> blocks;
+        uint64_t firstLine = 0;
+        if (!query.empty()) {
+            m_terminalBuffer.CollectSearchBlocks(blocks, firstLine);
+        }
+        m_search.Start(std::move(blocks), firstLine, query, matchCase);
+    }
+
+    void TerminalWorker::PublishSnapshot()
+    {
+        ScreenSnapshot& snapshot = m_snapshots.BackBuffer();
+        m_terminalBuffer.CaptureSnapshot(snapshot);
+        snapshot.flooding = m_flooding.load(std::memory_order_relaxed);
+        snapshot.backlogBytes = m_input.Size();
+        snapshot.sequence = ++m_publishedSequence;
+        m_snapshots.Publish();
+        m_lastPublish = std::chrono::steady_clock::now();
+    }
+
+    void TerminalWorker::UpdateFloodState()
+    {
+        size_t backlog = m_input.Size();
+        bool flooding = m_flooding.load(std::memory_order_relaxed);
+        if (!flooding && backlog >= FLOOD_ENTER_BYTES) {
+            m_flooding.store(true, std::memory_order_relaxed);
+            m_floodEpisodes.fetch_add(1, std::memory_order_relaxed);
+            m_input.SetWriteLimit(FLOOD_BACKLOG_LIMIT);
+        }
+        else if (flooding && backlog < FLOOD_EXIT_BYTES) {
+            m_flooding.store(false, std::memory_order_relaxed);
+            m_input.SetWriteLimit(m_input.Capacity());
+        }
+    }
+
+    void TerminalWorker::ThreadFunc()
+    {
+        while (true) {
+            uint32_t epoch = m_input.ConsumerEpoch();
+            if (m_stopping.load(std::memory_order_acquire)) {
+                break;
+            }
+
+            // Drain everything queued since the last wake-up, however many reads it took to arrive
+            bool changed = ApplyPendingResize();
+            changed = ApplyPendingViewport() || changed;
+            ApplyPendingSearch();
+            size_t drained = 0;
+            for (std::span<const char> chunk = m_input.PeekRead(); !chunk.empty(); chunk = m_input.PeekRead()) {
+                // A pending resize is applied right at its mark
+                size_t count = std::min(chunk.size(), PARSE_SLICE_BYTES);
+                size_t beforeResize = BytesBeforeResize();
+                if (beforeResize != 0) {
+                    count = std::min(count, beforeResize);
+                    m_preResizeBytes.fetch_add(count, std::memory_order_relaxed);
+                }
+                m_ansiParser.Parse(chunk.data(), count);
+                m_input.CommitRead(count);
+                drained += count;
+                changed = true;
+                ApplyPendingResize();
+
+                // Mid-drain publishes are paced to the frame rate, so a flood jump-scrolls
+                // instead of copying out screens nobody will ever see, and held while output
+                // for a size the UI has left is parsed
+                UpdateFloodState();
+                if (std::chrono::steady_clock::now() - m_lastPublish >= FRAME_INTERVAL && BytesBeforeResize() == 0) {
+                    ApplyPendingResize();
+                    ApplyPendingViewport();
+                    ApplyPendingSearch();
+                    PublishSnapshot();
+                    changed = false;
+                }
+                if (m_stopping.load(std::memory_order_acquire)) {
+                    return;
+                }
+            }
+            UpdateFloodState();
+
+            if (drained > 0) {
+                m_wakeups.fetch_add(1, std::memory_order_relaxed);
+                m_bytesParsed.fetch_add(drained, std::memory_order_relaxed);
+                m_lastWakeupBytes.store(drained, std::memory_order_relaxed);
+            }
+
+            // Each pass changes what a view scrolled back into history shows, and the last one swaps the
+            // rewrapped history in, which is worth a publish
+            bool reflowing = false;
+            if (m_terminalBuffer.HistoryReflowPending()) {
+                reflowing = m_terminalBuffer.ContinueHistoryReflow(HISTORY_REFLOW_LINES);
+                changed = changed || !reflowing || m_terminalBuffer.GetViewportOffset() != 0;
+            }
+            bool indexing = m_terminalBuffer.ContinueSearchIndexing(SEARCH_INDEX_BLOCKS);
+
+            // The ring is empty here, so the screen has settled and is always worth publishing
+            if (changed) {
+                PublishSnapshot();
+            }
+            else if (!reflowing && !indexing) {
+                m_input.WaitForData(epoch);
+            }
+        }
+    }
+}
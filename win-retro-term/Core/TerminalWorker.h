@@ -0,0 +1,136 @@
+#pragma once
+#include "AnsiParser.h"
+#include "ByteRing.h"
+#include "ScreenSnapshot.h"
+#include "ScrollbackSearch.h"
+#include "TerminalBuffer.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace winrt::win_retro_term::Core
+{
+    struct IngestionMetrics {
+        size_t queueDepth = 0;          // Bytes waiting in the input ring
+        size_t queueCapacity = 0;
+        uint64_t wakeups = 0;           // Times the worker woke up and drained the ring
+        uint64_t bytesParsed = 0;
+        uint64_t lastWakeupBytes = 0;   // Bytes drained by the most recent wake-up
+        bool flooding = false;
+        uint64_t floodEpisodes = 0;
+        uint64_t preResizeBytes = 0;    // Output parsed at the old size while a posted resize waited for it
+
+        uint64_t AverageBytesPerWakeup() const { return wakeups != 0 ? bytesParsed / wakeups : 0; }
+    };
+
+    // Owns the terminal state and parses PTY output on a dedicated thread.
+    // The PTY reader thread fills the input ring in place, the worker drains everything queued
+    // on each wake-up, and the UI thread picks up finished screens through a snapshot exchange
+    // without ever touching TerminalBuffer directly.
+    //
+    // Flood control: once the backlog passes FLOOD_ENTER_BYTES the worker jump-scrolls, publishing
+    // at most one snapshot per frame instead of one per drain, and lowers the ring's write limit so the
+    // reader is held back and the queued output (what still has to scroll past after a Ctrl+C) stays short.
+    // It leaves flood mode once the backlog falls under FLOOD_EXIT_BYTES.
+    //
+    // After a width change the history is rewrapped HISTORY_REFLOW_LINES at a time between drains,
+    // and the worker doesn't sleep until it is done.
+    //
+    // Resizes mark where the PTY was told about them in the input stream and take effect there: output
+    // queued before the mark was written for the old size and is parsed at it, so nothing is lost. The
+    // UI has moved on by then, so no snapshot is published until the resize is applied; ConPTY follows
+    // every resize with a repaint of the whole screen, which is what gets shown.
+    //
+    // Searches take the history's search blocks and a packing of the screen on the worker, between
+    // drains, and then run on the ScrollbackSearch pool while output goes on. Search blocks are
+    // filtered and compressed SEARCH_INDEX_BLOCKS at a time between drains too, while parsing only
+    // when the index runs out of room.
+    class TerminalWorker {
+    public:
+        static constexpr size_t INPUT_RING_CAPACITY = 4 * 1024 * 1024;
+        static constexpr size_t PARSE_SLICE_BYTES = 64 * 1024;          // Ring space is returned and publishing re-checked per slice
+        static constexpr size_t FLOOD_ENTER_BYTES = 512 * 1024;
+        static constexpr size_t FLOOD_EXIT_BYTES = 16 * 1024;
+        static constexpr size_t FLOOD_BACKLOG_LIMIT = 1024 * 1024;      // Ring write limit while flooding
+        static constexpr std::chrono::milliseconds FRAME_INTERVAL{ 16 };
+        static constexpr size_t HISTORY_REFLOW_LINES = 1024;            // History rewrapped per pass after a resize, a few ms of plain text
+        static constexpr size_t SEARCH_INDEX_BLOCKS = 4;                // Search blocks finished per pass, about 50 us each
+
+        TerminalWorker(int rows, int cols);
+        ~TerminalWorker();
+
+        void Start();
+        void Stop(); // Closes the input ring, a stopped worker can't be restarted
+
+        // Producer side for the PTY reader thread, which reads directly into the ring
+        ByteRing& InputRing() { return m_input; }
+
+        // Copies 'data' into the ring, waiting while it is full.
+        // Returns false once the worker is stopping and the data was dropped.
+        bool Feed(const char* data, size_t length);
+
+        // UI thread: the buffer is resized on the worker once the output queued so far is parsed.
+        // Call it right before resizing the PTY, so the mark it takes precedes the PTY's repaint.
+        void PostResize(int rows, int cols);
+
+        // UI thread: moves the view through the scrollback, positive goes back in history.
+        // Requests add up until the worker applies them.
+        void PostScrollViewport(int lines);
+        void PostScrollToBottom();
+
+        // UI thread: latest published screen, see SnapshotExchange::Acquire
+        const ScreenSnapshot& AcquireSnapshot() { return m_snapshots.Acquire(); }
+        const ScreenSnapshot& CurrentSnapshot() const { return m_snapshots.FrontBuffer(); }
+
+        // UI thread: searches history and screen as they are when the worker picks the query up, replacing
+        // the search before. Call it again on every keystroke, typing on narrows the search before. An empty query stops searching.
+        void PostSearch(std::u32string query, bool matchCase);
+
+        // Any thread
+        IngestionMetrics GetMetrics() const;
+        // Matches come in as they are found, newest blocks first but in no particular order
+        size_t TakeSearchMatches(std::vector<SearchMatch>& out) { return m_search.TakeMatches(out); }
+        SearchProgress GetSearchProgress() const { return m_search.Progress(); }
+
+    private:
+        void ThreadFunc();
+        bool ApplyPendingResize();
+        size_t BytesBeforeResize() const;
+        bool ApplyPendingViewport();
+        void ApplyPendingSearch();
+        void PublishSnapshot();
+        void UpdateFloodState();
+
+        TerminalBuffer m_terminalBuffer;
+        AnsiParser m_ansiParser;
+        ByteRing m_input;
+        SnapshotExchange m_snapshots;
+        uint64_t m_publishedSequence = 0;
+        std::chrono::steady_clock::time_point m_lastPublish;
+
+        std::thread m_thread;
+        std::atomic<bool> m_stopping{ false };
+        std::atomic<uint64_t> m_pendingSize{ 0 };   // sequence << 32 | rows << 16 | cols, 0 when there is no pending resize
+        std::atomic<uint64_t> m_pendingResizeMark{ 0 };     // Input position when it was posted, stored before m_pendingSize
+        std::atomic<uint32_t> m_resizeSequence{ 0 };
+        std::atomic<int> m_pendingViewportLines{ 0 };
+        std::atomic<bool> m_pendingScrollToBottom{ false };
+
+        ScrollbackSearch m_search;
+        std::mutex m_searchMutex;
+        std::u32string m_pendingQuery;
+        bool m_pendingMatchCase = false;
+        std::atomic<bool> m_searchPosted{ false };
+
+        std::atomic<uint64_t> m_wakeups{ 0 };
+        std::atomic<uint64_t> m_bytesParsed{ 0 };
+        std::atomic<uint64_t> m_lastWakeupBytes{ 0 };
+        std::atomic<bool> m_flooding{ false };
+        std::atomic<uint64_t> m_floodEpisodes{ 0 };
+        std::atomic<uint64_t> m_preResizeBytes{ 0 };
+    };
+}
@@ -0,0 +1,119 @@
+#include "pch.h"
+#include "Trace.h"
+#include <bit>
+#include <chrono>
+#include <cstdio>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        static_assert((Trace::RING_CAPACITY & (Trace::RING_CAPACITY - 1)) == 0, "Ring capacity must be a power of two");
+
+        // Each slot carries a stamp so readers can tell a finished record from one being overwritten:
+        // 0 while a writer owns the slot, write index + 1 once the record is complete.
+        TraceRecord s_ring[Trace::RING_CAPACITY];
+        std::atomic<uint64_t> s_stamps[Trace::RING_CAPACITY];
+        std::atomic<uint64_t> s_writeIndex{ 0 };
+
+        struct TraceFileHeader {
+            char magic[8];          // "WRTTRACE"
+            uint32_t version;
+            uint32_t recordSize;
+            uint64_t recordCount;
+            uint64_t ticksPerSecond;
+        };
+    }
+
+    std::atomic<uint32_t> Trace::s_enabledState{ 0 };
+
+    void Trace::SetEnabled(uint32_t categoryMask, TraceLevel maxLevel)
+    {
+        uint32_t state = (categoryMask & CATEGORY_BITS) | (static_cast<uint32_t>(maxLevel) << LEVEL_SHIFT);
+        s_enabledState.store(state, std::memory_order_relaxed);
+    }
+
+    void Trace::Write(TraceCategory category, TraceLevel level, TraceEvent event, int32_t arg0, int32_t arg1, int32_t arg2, int32_t arg3)
+    {
+        uint64_t index = s_writeIndex.fetch_add(1, std::memory_order_relaxed);
+        size_t slot = static_cast<size_t>(index & (RING_CAPACITY - 1));
+
+        s_stamps[slot].store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        TraceRecord& record = s_ring[slot];
+        record.timestamp = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        record.sequence = static_cast<uint32_t>(index);
+        record.event = event;
+        record.category = static_cast<uint8_t>(std::countr_zero(static_cast<uint32_t>(category)));
+        record.level = level;
+        record.args[0] = arg0;
+        record.args[1] = arg1;
+        record.args[2] = arg2;
+        record.args[3] = arg3;
+
+        s_stamps[slot].store(index + 1, std::memory_order_release);
+    }
+
+    bool Trace::DumpToFile(const char* path)
+    {
+        FILE* file = std::fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+
+        uint64_t end = s_writeIndex.load(std::memory_order_acquire);
+        uint64_t begin = end > RING_CAPACITY ? end - RING_CAPACITY : 0;
+
+        TraceFileHeader header = { { 'W', 'R', 'T', 'T', 'R', 'A', 'C', 'E' }, 1, sizeof(TraceRecord), 0,
+            static_cast<uint64_t>(std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num) };
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+        uint64_t written = 0;
+        for (uint64_t index = begin; ok && index < end; ++index) {
+            size_t slot = static_cast<size_t>(index & (RING_CAPACITY - 1));
+            if (s_stamps[slot].load(std::memory_order_acquire) != index + 1) {
+                continue; // Still being written, or already overwritten by a newer record
+            }
+            TraceRecord copy = s_ring[slot];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s_stamps[slot].load(std::memory_order_relaxed) != index + 1) {
+                continue;
+            }
+            ok = std::fwrite(&copy, sizeof(copy), 1, file) == 1;
+            ++written;
+        }
+
+        // Patch the record count now that torn slots have been skipped
+        header.recordCount = written;
+        ok = ok && std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+        return std::fclose(file) == 0 && ok;
+    }
+
+    const char* Trace::EventName(TraceEvent event)
+    {
+        switch (event) {
+        case TraceEvent::CsiDispatch: return "CsiDispatch";
+        case TraceEvent::CsiUnhandled: return "CsiUnhandled";
+        case TraceEvent::EscDispatch: return "EscDispatch";
+        case TraceEvent::EscUnhandled: return "EscUnhandled";
+        case TraceEvent::DecPrivateMode: return "DecPrivateMode";
+        case TraceEvent::DesignateCharSet: return "DesignateCharSet";
+        case TraceEvent::InvokeCharSet: return "InvokeCharSet";
+        case TraceEvent::ControlUnhandled: return "ControlUnhandled";
+        case TraceEvent::OscDispatch: return "OscDispatch";
+        case TraceEvent::OscUnhandled: return "OscUnhandled";
+        case TraceEvent::DcsUnhandled: return "DcsUnhandled";
+        }
+        return "Unknown";
+    }
+
+    int32_t Trace::PackChars(const char* chars, size_t count)
+    {
+        uint32_t packed = 0;
+        for (size_t i = 0; i < count && i < 4; ++i) {
+            packed |= static_cast<uint32_t>(static_cast<uint8_t>(chars[i])) << (i * 8);
+        }
+        return static_cast<int32_t>(packed);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Set WRT_TRACE_ENABLED to 0 to compile every trace point out entirely.
+// When compiled in, a disabled trace point costs one relaxed load and a branch.
+#ifndef WRT_TRACE_ENABLED
+#define WRT_TRACE_ENABLED 1
+#endif
+
+namespace winrt::win_retro_term::Core
+{
+    enum class TraceCategory : uint32_t {
+        None = 0,
+        Parser = 1 << 0,    // Escape/CSI dispatch in AnsiParser
+        Modes = 1 << 1,     // DEC private modes
+        Charset = 1 << 2,   // G0-G3 designation and invocation
+        Control = 1 << 3,   // C0 controls without a handler
+        All = 0xFFFFFFFF
+    };
+
+    enum class TraceLevel : uint8_t {
+        Error = 0,
+        Warning = 1,
+        Info = 2,
+        Verbose = 3
+    };
+
+    enum class TraceEvent : uint16_t {
+        CsiDispatch,        // args: final, packed intermediates, param count, first param
+        CsiUnhandled,       // args: final, packed intermediates
+        EscDispatch,        // args: final, packed intermediates
+        EscUnhandled,       // args: final
+        DecPrivateMode,     // args: mode, enabled
+        DesignateCharSet,   // args: target set, charset designator
+        InvokeCharSet,      // args: G set, charset designator
+        ControlUnhandled,   // args: control code
+        OscDispatch,        // args: command, payload length
+        OscUnhandled,       // args: command, payload length
+        DcsUnhandled        // args: final, packed intermediates
+    };
+
+    // Fixed-size binary record, written as-is by Trace::DumpToFile
+    struct TraceRecord {
+        uint64_t timestamp;     // steady_clock ticks
+        uint32_t sequence;      // Low bits of the global write index, used to spot overwritten slots
+        TraceEvent event;
+        uint8_t category;       // Bit index of the TraceCategory
+        TraceLevel level;
+        int32_t args[4];
+    };
+    static_assert(sizeof(TraceRecord) == 32, "Trace records are dumped as fixed 32-byte entries");
+
+    class Trace {
+    public:
+        static constexpr size_t RING_CAPACITY = 8192; // Power of two
+
+        // Enables the given categories up to and including 'maxLevel'. A zero mask disables tracing.
+        static void SetEnabled(uint32_t categoryMask, TraceLevel maxLevel);
+
+        static bool IsEnabled(TraceCategory category, TraceLevel level) {
+            uint32_t state = s_enabledState.load(std::memory_order_relaxed);
+            return (state & static_cast<uint32_t>(category) & CATEGORY_BITS) != 0 &&
+                static_cast<uint32_t>(level) <= (state >> LEVEL_SHIFT);
+        }
+
+        // Appends a record to the lock-free ring, overwriting the oldest one when full. Safe from any thread.
+        static void Write(TraceCategory category, TraceLevel level, TraceEvent event,
+            int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0, int32_t arg3 = 0);
+
+        // Writes the records currently in the ring, oldest first, behind a small header. Returns false on I/O failure.
+        static bool DumpToFile(const char* path);
+
+        static const char* EventName(TraceEvent event);
+
+        // Packs up to four ASCII characters (e.g. CSI intermediates) into one argument
+        static int32_t PackChars(const char* chars, size_t count);
+
+    private:
+        // The level lives in the top bits so IsEnabled needs a single atomic load
+        static constexpr uint32_t LEVEL_SHIFT = 28;
+        static constexpr uint32_t CATEGORY_BITS = (1u << LEVEL_SHIFT) - 1;
+
+        static std::atomic<uint32_t> s_enabledState;
+    };
+}
+
+#if WRT_TRACE_ENABLED
+// Usage: WRT_TRACE(TraceCategory::Parser, TraceLevel::Verbose, TraceEvent::CsiDispatch, arg0, ...)
+// Arguments are only evaluated when the category and level are enabled.
+#define WRT_TRACE(category, level, ...)                                                 \
+    do {                                                                                \
+        if (::winrt::win_retro_term::Core::Trace::IsEnabled(category, level)) {         \
+            ::winrt::win_retro_term::Core::Trace::Write(category, level, __VA_ARGS__);  \
+        }                                                                               \
+    } while (0)
+#else
+#define WRT_TRACE(category, level, ...) do { } while (0)
+#endif
@@ -0,0 +1,286 @@
+#include "pch.h"
+#include "UnicodeWidth.h"
+#include <array>
+#include <cstddef>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        struct CodePointRange {
+            char32_t first;
+            char32_t last;      // Inclusive
+            CodePointClass cls;
+        };
+
+        constexpr CodePointClass W = CodePointClass::Wide;
+        constexpr CodePointClass E = CodePointClass::Extend;
+        constexpr CodePointClass J = CodePointClass::ZeroWidthJoiner;
+        constexpr CodePointClass R = CodePointClass::RegionalIndicator;
+        constexpr CodePointClass PN = CodePointClass::PictographicNarrow;
+        constexpr CodePointClass PW = CodePointClass::PictographicWide;
+
+        // Every code point that isn't Narrow, sorted and not overlapping (Unicode 14.0).
+        // Extend is Grapheme_Extend plus the invisible format characters, Hangul medial and final jamo and
+        // the emoji modifiers; Wide is East Asian Width W and F, plus the unassigned parts of the ideograph planes.
+        constexpr CodePointRange RANGES[] = {
+        { 0x0300, 0x036F, E }, { 0x0483, 0x0489, E }, { 0x0591, 0x05BD, E }, { 0x05BF, 0x05BF, E }, { 0x05C1, 0x05C2, E },
+        { 0x05C4, 0x05C5, E }, { 0x05C7, 0x05C7, E }, { 0x0610, 0x061A, E }, { 0x061C, 0x061C, E }, { 0x064B, 0x065F, E },
+        { 0x0670, 0x0670, E }, { 0x06D6, 0x06DC, E }, { 0x06DF, 0x06E4, E }, { 0x06E7, 0x06E8, E }, { 0x06EA, 0x06ED, E },
+        { 0x0711, 0x0711, E }, { 0x0730, 0x074A, E }, { 0x07A6, 0x07B0, E }, { 0x07EB, 0x07F3, E }, { 0x07FD, 0x07FD, E },
+        { 0x0816, 0x0819, E }, { 0x081B, 0x0823, E }, { 0x0825, 0x0827, E }, { 0x0829, 0x082D, E }, { 0x0859, 0x085B, E },
+        { 0x0898, 0x089F, E }, { 0x08CA, 0x08E1, E }, { 0x08E3, 0x0902, E }, { 0x093A, 0x093A, E }, { 0x093C, 0x093C, E },
+        { 0x0941, 0x0948, E }, { 0x094D, 0x094D, E }, { 0x0951, 0x0957, E }, { 0x0962, 0x0963, E }, { 0x0981, 0x0981, E },
+        { 0x09BC, 0x09BC, E }, { 0x09C1, 0x09C4, E }, { 0x09CD, 0x09CD, E }, { 0x09E2, 0x09E3, E }, { 0x09FE, 0x09FE, E },
+        { 0x0A01, 0x0A02, E }, { 0x0A3C, 0x0A3C, E }, { 0x0A41, 0x0A42, E }, { 0x0A47, 0x0A48, E }, { 0x0A4B, 0x0A4D, E },
+        { 0x0A51, 0x0A51, E }, { 0x0A70, 0x0A71, E }, { 0x0A75, 0x0A75, E }, { 0x0A81, 0x0A82, E }, { 0x0ABC, 0x0ABC, E },
+        { 0x0AC1, 0x0AC5, E }, { 0x0AC7, 0x0AC8, E }, { 0x0ACD, 0x0ACD, E }, { 0x0AE2, 0x0AE3, E }, { 0x0AFA, 0x0AFF, E },
+        { 0x0B01, 0x0B01, E }, { 0x0B3C, 0x0B3C, E }, { 0x0B3F, 0x0B3F, E }, { 0x0B41, 0x0B44, E }, { 0x0B4D, 0x0B4D, E },
+        { 0x0B55, 0x0B56, E }, { 0x0B62, 0x0B63, E }, { 0x0B82, 0x0B82, E }, { 0x0BC0, 0x0BC0, E }, { 0x0BCD, 0x0BCD, E },
+        { 0x0C00, 0x0C00, E }, { 0x0C04, 0x0C04, E }, { 0x0C3C, 0x0C3C, E }, { 0x0C3E, 0x0C40, E }, { 0x0C46, 0x0C48, E },
+        { 0x0C4A, 0x0C4D, E }, { 0x0C55, 0x0C56, E }, { 0x0C62, 0x0C63, E }, { 0x0C81, 0x0C81, E }, { 0x0CBC, 0x0CBC, E },
+        { 0x0CBF, 0x0CBF, E }, { 0x0CC6, 0x0CC6, E }, { 0x0CCC, 0x0CCD, E }, { 0x0CE2, 0x0CE3, E }, { 0x0D00, 0x0D01, E },
+        { 0x0D3B, 0x0D3C, E }, { 0x0D41, 0x0D44, E }, { 0x0D4D, 0x0D4D, E }, { 0x0D62, 0x0D63, E }, { 0x0D81, 0x0D81, E },
+        { 0x0DCA, 0x0DCA, E }, { 0x0DD2, 0x0DD4, E }, { 0x0DD6, 0x0DD6, E }, { 0x0E31, 0x0E31, E }, { 0x0E34, 0x0E3A, E },
+        { 0x0E47, 0x0E4E, E }, { 0x0EB1, 0x0EB1, E }, { 0x0EB4, 0x0EBC, E }, { 0x0EC8, 0x0ECD, E }, { 0x0F18, 0x0F19, E },
+        { 0x0F35, 0x0F35, E }, { 0x0F37, 0x0F37, E }, { 0x0F39, 0x0F39, E }, { 0x0F71, 0x0F7E, E }, { 0x0F80, 0x0F84, E },
+        { 0x0F86, 0x0F87, E }, { 0x0F8D, 0x0F97, E }, { 0x0F99, 0x0FBC, E }, { 0x0FC6, 0x0FC6, E }, { 0x102D, 0x1030, E },
+        { 0x1032, 0x1037, E }, { 0x1039, 0x103A, E }, { 0x103D, 0x103E, E }, { 0x1058, 0x1059, E }, { 0x105E, 0x1060, E },
+        { 0x1071, 0x1074, E }, { 0x1082, 0x1082, E }, { 0x1085, 0x1086, E }, { 0x108D, 0x108D, E }, { 0x109D, 0x109D, E },
+        { 0x1100, 0x115F, W }, { 0x1160, 0x11FF, E }, { 0x135D, 0x135F, E }, { 0x1712, 0x1714, E }, { 0x1732, 0x1733, E },
+        { 0x1752, 0x1753, E }, { 0x1772, 0x1773, E }, { 0x17B4, 0x17B5, E }, { 0x17B7, 0x17BD, E }, { 0x17C6, 0x17C6, E },
+        { 0x17C9, 0x17D3, E }, { 0x17DD, 0x17DD, E }, { 0x180B, 0x180F, E }, { 0x1885, 0x1886, E }, { 0x18A9, 0x18A9, E },
+        { 0x1920, 0x1922, E }, { 0x1927, 0x1928, E }, { 0x1932, 0x1932, E }, { 0x1939, 0x193B, E }, { 0x1A17, 0x1A18, E },
+        { 0x1A1B, 0x1A1B, E }, { 0x1A56, 0x1A56, E }, { 0x1A58, 0x1A5E, E }, { 0x1A60, 0x1A60, E }, { 0x1A62, 0x1A62, E },
+        { 0x1A65, 0x1A6C, E }, { 0x1A73, 0x1A7C, E }, { 0x1A7F, 0x1A7F, E }, { 0x1AB0, 0x1ACE, E }, { 0x1B00, 0x1B03, E },
+        { 0x1B34, 0x1B34, E }, { 0x1B36, 0x1B3A, E }, { 0x1B3C, 0x1B3C, E }, { 0x1B42, 0x1B42, E }, { 0x1B6B, 0x1B73, E },
+        { 0x1B80, 0x1B81, E }, { 0x1BA2, 0x1BA5, E }, { 0x1BA8, 0x1BA9, E }, { 0x1BAB, 0x1BAD, E }, { 0x1BE6, 0x1BE6, E },
+        { 0x1BE8, 0x1BE9, E }, { 0x1BED, 0x1BED, E }, { 0x1BEF, 0x1BF1, E }, { 0x1C2C, 0x1C33, E }, { 0x1C36, 0x1C37, E },
+        { 0x1CD0, 0x1CD2, E }, { 0x1CD4, 0x1CE0, E }, { 0x1CE2, 0x1CE8, E }, { 0x1CED, 0x1CED, E }, { 0x1CF4, 0x1CF4, E },
+        { 0x1CF8, 0x1CF9, E }, { 0x1DC0, 0x1DFF, E }, { 0x200B, 0x200C, E }, { 0x200D, 0x200D, J }, { 0x200E, 0x200F, E },
+        { 0x202A, 0x202E, E }, { 0x203C, 0x203C, PN }, { 0x2049, 0x2049, PN }, { 0x2060, 0x2064, E }, { 0x2066, 0x206F, E },
+        { 0x20D0, 0x20F0, E }, { 0x2122, 0x2122, PN }, { 0x2139, 0x2139, PN }, { 0x2194, 0x2199, PN }, { 0x21A9, 0x21AA, PN },
+        { 0x231A, 0x231B, PW }, { 0x2328, 0x2328, PN }, { 0x2329, 0x232A, W }, { 0x2388, 0x2388, PN }, { 0x23CF, 0x23CF, PN },
+        { 0x23E9, 0x23EC, PW }, { 0x23ED, 0x23EF, PN }, { 0x23F0, 0x23F0, PW }, { 0x23F1, 0x23F2, PN }, { 0x23F3, 0x23F3, PW },
+        { 0x23F8, 0x23FA, PN }, { 0x24C2, 0x24C2, PN }, { 0x25AA, 0x25AB, PN }, { 0x25B6, 0x25B6, PN }, { 0x25C0, 0x25C0, PN },
+        { 0x25FB, 0x25FC, PN }, { 0x25FD, 0x25FE, PW }, { 0x2600, 0x2605, PN }, { 0x2607, 0x2612, PN }, { 0x2614, 0x2615, PW },
+        { 0x2616, 0x2647, PN }, { 0x2648, 0x2653, PW }, { 0x2654, 0x267E, PN }, { 0x267F, 0x267F, PW }, { 0x2680, 0x2685, PN },
+        { 0x2690, 0x2692, PN }, { 0x2693, 0x2693, PW }, { 0x2694, 0x26A0, PN }, { 0x26A1, 0x26A1, PW }, { 0x26A2, 0x26A9, PN },
+        { 0x26AA, 0x26AB, PW }, { 0x26AC, 0x26BC, PN }, { 0x26BD, 0x26BE, PW }, { 0x26BF, 0x26C3, PN }, { 0x26C4, 0x26C5, PW },
+        { 0x26C6, 0x26CD, PN }, { 0x26CE, 0x26CE, PW }, { 0x26CF, 0x26D3, PN }, { 0x26D4, 0x26D4, PW }, { 0x26D5, 0x26E9, PN },
+        { 0x26EA, 0x26EA, PW }, { 0x26EB, 0x26F1, PN }, { 0x26F2, 0x26F3, PW }, { 0x26F4, 0x26F4, PN }, { 0x26F5, 0x26F5, PW },
+        { 0x26F6, 0x26F9, PN }, { 0x26FA, 0x26FA, PW }, { 0x26FB, 0x26FC, PN }, { 0x26FD, 0x26FD, PW }, { 0x26FE, 0x2704, PN },
+        { 0x2705, 0x2705, PW }, { 0x2708, 0x2709, PN }, { 0x270A, 0x270B, PW }, { 0x270C, 0x2712, PN }, { 0x2714, 0x2714, PN },
+        { 0x2716, 0x2716, PN }, { 0x271D, 0x271D, PN }, { 0x2721, 0x2721, PN }, { 0x2728, 0x2728, PW }, { 0x2733, 0x2734, PN },
+        { 0x2744, 0x2744, PN }, { 0x2747, 0x2747, PN }, { 0x274C, 0x274C, PW }, { 0x274E, 0x274E, PW }, { 0x2753, 0x2755, PW },
+        { 0x2757, 0x2757, PW }, { 0x2763, 0x2767, PN }, { 0x2795, 0x2797, PW }, { 0x27A1, 0x27A1, PN }, { 0x27B0, 0x27B0, PW },
+        { 0x27BF, 0x27BF, PW }, { 0x2934, 0x2935, PN }, { 0x2B05, 0x2B07, PN }, { 0x2B1B, 0x2B1C, PW }, { 0x2B50, 0x2B50, PW },
+        { 0x2B55, 0x2B55, PW }, { 0x2CEF, 0x2CF1, E }, { 0x2D7F, 0x2D7F, E }, { 0x2DE0, 0x2DFF, E }, { 0x2E80, 0x2E99, W },
+        { 0x2E9B, 0x2EF3, W }, { 0x2F00, 0x2FD5, W }, { 0x2FF0, 0x2FFB, W }, { 0x3000, 0x3029, W }, { 0x302A, 0x302D, E },
+        { 0x302E, 0x302F, W }, { 0x3030, 0x3030, PW }, { 0x3031, 0x303C, W }, { 0x303D, 0x303D, PW }, { 0x303E, 0x303E, W },
+        { 0x3041, 0x3096, W }, { 0x3099, 0x309A, E }, { 0x309B, 0x30FF, W }, { 0x3105, 0x312F, W }, { 0x3131, 0x318E, W },
+        { 0x3190, 0x31E3, W }, { 0x31F0, 0x321E, W }, { 0x3220, 0x3247, W }, { 0x3250, 0x3296, W }, { 0x3297, 0x3297, PW },
+        { 0x3298, 0x3298, W }, { 0x3299, 0x3299, PW }, { 0x329A, 0x4DBF, W }, { 0x4E00, 0xA48C, W }, { 0xA490, 0xA4C6, W },
+        { 0xA66F, 0xA672, E }, { 0xA674, 0xA67D, E }, { 0xA69E, 0xA69F, E }, { 0xA6F0, 0xA6F1, E }, { 0xA802, 0xA802, E },
+        { 0xA806, 0xA806, E }, { 0xA80B, 0xA80B, E }, { 0xA825, 0xA826, E }, { 0xA82C, 0xA82C, E }, { 0xA8C4, 0xA8C5, E },
+        { 0xA8E0, 0xA8F1, E }, { 0xA8FF, 0xA8FF, E }, { 0xA926, 0xA92D, E }, { 0xA947, 0xA951, E }, { 0xA960, 0xA97C, W },
+        { 0xA980, 0xA982, E }, { 0xA9B3, 0xA9B3, E }, { 0xA9B6, 0xA9B9, E }, { 0xA9BC, 0xA9BD, E }, { 0xA9E5, 0xA9E5, E },
+        { 0xAA29, 0xAA2E, E }, { 0xAA31, 0xAA32, E }, { 0xAA35, 0xAA36, E }, { 0xAA43, 0xAA43, E }, { 0xAA4C, 0xAA4C, E },
+        { 0xAA7C, 0xAA7C, E }, { 0xAAB0, 0xAAB0, E }, { 0xAAB2, 0xAAB4, E }, { 0xAAB7, 0xAAB8, E }, { 0xAABE, 0xAABF, E },
+        { 0xAAC1, 0xAAC1, E }, { 0xAAEC, 0xAAED, E }, { 0xAAF6, 0xAAF6, E }, { 0xABE5, 0xABE5, E }, { 0xABE8, 0xABE8, E },
+        { 0xABED, 0xABED, E }, { 0xAC00, 0xD7A3, W }, { 0xD7B0, 0xD7FF, E }, { 0xF900, 0xFAFF, W }, { 0xFB1E, 0xFB1E, E },
+        { 0xFE00, 0xFE0F, E }, { 0xFE10, 0xFE19, W }, { 0xFE20, 0xFE2F, E }, { 0xFE30, 0xFE52, W }, { 0xFE54, 0xFE66, W },
+        { 0xFE68, 0xFE6B, W }, { 0xFEFF, 0xFEFF, E }, { 0xFF01, 0xFF60, W }, { 0xFFE0, 0xFFE6, W }, { 0xFFF9, 0xFFFB, E },
+        { 0x101FD, 0x101FD, E }, { 0x102E0, 0x102E0, E }, { 0x10376, 0x1037A, E }, { 0x10A01, 0x10A03, E }, { 0x10A05, 0x10A06, E },
+        { 0x10A0C, 0x10A0F, E }, { 0x10A38, 0x10A3A, E }, { 0x10A3F, 0x10A3F, E }, { 0x10AE5, 0x10AE6, E }, { 0x10D24, 0x10D27, E },
+        { 0x10EAB, 0x10EAC, E }, { 0x10F46, 0x10F50, E }, { 0x10F82, 0x10F85, E }, { 0x11001, 0x11001, E }, { 0x11038, 0x11046, E },
+        { 0x11070, 0x11070, E }, { 0x11073, 0x11074, E }, { 0x1107F, 0x11081, E }, { 0x110B3, 0x110B6, E }, { 0x110B9, 0x110BA, E },
+        { 0x110C2, 0x110C2, E }, { 0x11100, 0x11102, E }, { 0x11127, 0x1112B, E }, { 0x1112D, 0x11134, E }, { 0x11173, 0x11173, E },
+        { 0x11180, 0x11181, E }, { 0x111B6, 0x111BE, E }, { 0x111C9, 0x111CC, E }, { 0x111CF, 0x111CF, E }, { 0x1122F, 0x11231, E },
+        { 0x11234, 0x11234, E }, { 0x11236, 0x11237, E }, { 0x1123E, 0x1123E, E }, { 0x112DF, 0x112DF, E }, { 0x112E3, 0x112EA, E },
+        { 0x11300, 0x11301, E }, { 0x1133B, 0x1133C, E }, { 0x11340, 0x11340, E }, { 0x11366, 0x1136C, E }, { 0x11370, 0x11374, E },
+        { 0x11438, 0x1143F, E }, { 0x11442, 0x11444, E }, { 0x11446, 0x11446, E }, { 0x1145E, 0x1145E, E }, { 0x114B3, 0x114B8, E },
+        { 0x114BA, 0x114BA, E }, { 0x114BF, 0x114C0, E }, { 0x114C2, 0x114C3, E }, { 0x115B2, 0x115B5, E }, { 0x115BC, 0x115BD, E },
+        { 0x115BF, 0x115C0, E }, { 0x115DC, 0x115DD, E }, { 0x11633, 0x1163A, E }, { 0x1163D, 0x1163D, E }, { 0x1163F, 0x11640, E },
+        { 0x116AB, 0x116AB, E }, { 0x116AD, 0x116AD, E }, { 0x116B0, 0x116B5, E }, { 0x116B7, 0x116B7, E }, { 0x1171D, 0x1171F, E },
+        { 0x11722, 0x11725, E }, { 0x11727, 0x1172B, E }, { 0x1182F, 0x11837, E }, { 0x11839, 0x1183A, E }, { 0x1193B, 0x1193C, E },
+        { 0x1193E, 0x1193E, E }, { 0x11943, 0x11943, E }, { 0x119D4, 0x119D7, E }, { 0x119DA, 0x119DB, E }, { 0x119E0, 0x119E0, E },
+        { 0x11A01, 0x11A0A, E }, { 0x11A33, 0x11A38, E }, { 0x11A3B, 0x11A3E, E }, { 0x11A47, 0x11A47, E }, { 0x11A51, 0x11A56, E },
+        { 0x11A59, 0x11A5B, E }, { 0x11A8A, 0x11A96, E }, { 0x11A98, 0x11A99, E }, { 0x11C30, 0x11C36, E }, { 0x11C38, 0x11C3D, E },
+        { 0x11C3F, 0x11C3F, E }, { 0x11C92, 0x11CA7, E }, { 0x11CAA, 0x11CB0, E }, { 0x11CB2, 0x11CB3, E }, { 0x11CB5, 0x11CB6, E },
+        { 0x11D31, 0x11D36, E }, { 0x11D3A, 0x11D3A, E }, { 0x11D3C, 0x11D3D, E }, { 0x11D3F, 0x11D45, E }, { 0x11D47, 0x11D47, E },
+        { 0x11D90, 0x11D91, E }, { 0x11D95, 0x11D95, E }, { 0x11D97, 0x11D97, E }, { 0x11EF3, 0x11EF4, E }, { 0x13430, 0x13438, E },
+        { 0x16AF0, 0x16AF4, E }, { 0x16B30, 0x16B36, E }, { 0x16F4F, 0x16F4F, E }, { 0x16F8F, 0x16F92, E }, { 0x16FE0, 0x16FE3, W },
+        { 0x16FE4, 0x16FE4, E }, { 0x16FF0, 0x16FF1, W }, { 0x17000, 0x187F7, W }, { 0x18800, 0x18CD5, W }, { 0x18D00, 0x18D08, W },
+        { 0x1AFF0, 0x1AFF3, W }, { 0x1AFF5, 0x1AFFB, W }, { 0x1AFFD, 0x1AFFE, W }, { 0x1B000, 0x1B122, W }, { 0x1B150, 0x1B152, W },
+        { 0x1B164, 0x1B167, W }, { 0x1B170, 0x1B2FB, W }, { 0x1BC9D, 0x1BC9E, E }, { 0x1BCA0, 0x1BCA3, E }, { 0x1CF00, 0x1CF2D, E },
+        { 0x1CF30, 0x1CF46, E }, { 0x1D167, 0x1D169, E }, { 0x1D173, 0x1D182, E }, { 0x1D185, 0x1D18B, E }, { 0x1D1AA, 0x1D1AD, E },
+        { 0x1D242, 0x1D244, E }, { 0x1DA00, 0x1DA36, E }, { 0x1DA3B, 0x1DA6C, E }, { 0x1DA75, 0x1DA75, E }, { 0x1DA84, 0x1DA84, E },
+        { 0x1DA9B, 0x1DA9F, E }, { 0x1DAA1, 0x1DAAF, E }, { 0x1E000, 0x1E006, E }, { 0x1E008, 0x1E018, E }, { 0x1E01B, 0x1E021, E },
+        { 0x1E023, 0x1E024, E }, { 0x1E026, 0x1E02A, E }, { 0x1E130, 0x1E136, E }, { 0x1E2AE, 0x1E2AE, E }, { 0x1E2EC, 0x1E2EF, E },
+        { 0x1E8D0, 0x1E8D6, E }, { 0x1E944, 0x1E94A, E }, { 0x1F000, 0x1F003, PN }, { 0x1F004, 0x1F004, PW }, { 0x1F005, 0x1F0CE, PN },
+        { 0x1F0CF, 0x1F0CF, PW }, { 0x1F0D0, 0x1F0FF, PN }, { 0x1F10D, 0x1F10F, PN }, { 0x1F12F, 0x1F12F, PN }, { 0x1F16C, 0x1F171, PN },
+        { 0x1F17E, 0x1F17F, PN }, { 0x1F18E, 0x1F18E, PW }, { 0x1F191, 0x1F19A, PW }, { 0x1F1AD, 0x1F1E5, PN }, { 0x1F1E6, 0x1F1FF, R },
+        { 0x1F200, 0x1F200, W }, { 0x1F201, 0x1F202, PW }, { 0x1F203, 0x1F20F, PN }, { 0x1F210, 0x1F219, W }, { 0x1F21A, 0x1F21A, PW },
+        { 0x1F21B, 0x1F22E, W }, { 0x1F22F, 0x1F22F, PW }, { 0x1F230, 0x1F231, W }, { 0x1F232, 0x1F23A, PW }, { 0x1F23B, 0x1F23B, W },
+        { 0x1F23C, 0x1F23F, PN }, { 0x1F240, 0x1F248, W }, { 0x1F249, 0x1F24F, PN }, { 0x1F250, 0x1F251, PW }, { 0x1F252, 0x1F25F, PN },
+        { 0x1F260, 0x1F265, PW }, { 0x1F266, 0x1F2FF, PN }, { 0x1F300, 0x1F320, PW }, { 0x1F321, 0x1F32C, PN }, { 0x1F32D, 0x1F335, PW },
+        { 0x1F336, 0x1F336, PN }, { 0x1F337, 0x1F37C, PW }, { 0x1F37D, 0x1F37D, PN }, { 0x1F37E, 0x1F393, PW }, { 0x1F394, 0x1F39F, PN },
+        { 0x1F3A0, 0x1F3CA, PW }, { 0x1F3CB, 0x1F3CE, PN }, { 0x1F3CF, 0x1F3D3, PW }, { 0x1F3D4, 0x1F3DF, PN }, { 0x1F3E0, 0x1F3F0, PW },
+        { 0x1F3F1, 0x1F3F3, PN }, { 0x1F3F4, 0x1F3F4, PW }, { 0x1F3F5, 0x1F3F7, PN }, { 0x1F3F8, 0x1F3FA, PW }, { 0x1F3FB, 0x1F3FF, E },
+        { 0x1F400, 0x1F43E, PW }, { 0x1F43F, 0x1F43F, PN }, { 0x1F440, 0x1F440, PW }, { 0x1F441, 0x1F441, PN }, { 0x1F442, 0x1F4FC, PW },
+        { 0x1F4FD, 0x1F4FE, PN }, { 0x1F4FF, 0x1F53D, PW }, { 0x1F546, 0x1F54A, PN }, { 0x1F54B, 0x1F54E, PW }, { 0x1F54F, 0x1F54F, PN },
+        { 0x1F550, 0x1F567, PW }, { 0x1F568, 0x1F579, PN }, { 0x1F57A, 0x1F57A, PW }, { 0x1F57B, 0x1F594, PN }, { 0x1F595, 0x1F596, PW },
+        { 0x1F597, 0x1F5A3, PN }, { 0x1F5A4, 0x1F5A4, PW }, { 0x1F5A5, 0x1F5FA, PN }, { 0x1F5FB, 0x1F64F, PW }, { 0x1F680, 0x1F6C5, PW },
+        { 0x1F6C6, 0x1F6CB, PN }, { 0x1F6CC, 0x1F6CC, PW }, { 0x1F6CD, 0x1F6CF, PN }, { 0x1F6D0, 0x1F6D2, PW }, { 0x1F6D3, 0x1F6D4, PN },
+        { 0x1F6D5, 0x1F6D7, PW }, { 0x1F6D8, 0x1F6DC, PN }, { 0x1F6DD, 0x1F6DF, PW }, { 0x1F6E0, 0x1F6EA, PN }, { 0x1F6EB, 0x1F6EC, PW },
+        { 0x1F6ED, 0x1F6F3, PN }, { 0x1F6F4, 0x1F6FC, PW }, { 0x1F6FD, 0x1F6FF, PN }, { 0x1F774, 0x1F77F, PN }, { 0x1F7D5, 0x1F7DF, PN },
+        { 0x1F7E0, 0x1F7EB, PW }, { 0x1F7EC, 0x1F7EF, PN }, { 0x1F7F0, 0x1F7F0, PW }, { 0x1F7F1, 0x1F7FF, PN }, { 0x1F80C, 0x1F80F, PN },
+        { 0x1F848, 0x1F84F, PN }, { 0x1F85A, 0x1F85F, PN }, { 0x1F888, 0x1F88F, PN }, { 0x1F8AE, 0x1F8FF, PN }, { 0x1F90C, 0x1F93A, PW },
+        { 0x1F93C, 0x1F945, PW }, { 0x1F947, 0x1F9FF, PW }, { 0x1FA00, 0x1FA6F, PN }, { 0x1FA70, 0x1FA74, PW }, { 0x1FA75, 0x1FA77, PN },
+        { 0x1FA78, 0x1FA7C, PW }, { 0x1FA7D, 0x1FA7F, PN }, { 0x1FA80, 0x1FA86, PW }, { 0x1FA87, 0x1FA8F, PN }, { 0x1FA90, 0x1FAAC, PW },
+        { 0x1FAAD, 0x1FAAF, PN }, { 0x1FAB0, 0x1FABA, PW }, { 0x1FABB, 0x1FABF, PN }, { 0x1FAC0, 0x1FAC5, PW }, { 0x1FAC6, 0x1FACF, PN },
+        { 0x1FAD0, 0x1FAD9, PW }, { 0x1FADA, 0x1FADF, PN }, { 0x1FAE0, 0x1FAE7, PW }, { 0x1FAE8, 0x1FAEF, PN }, { 0x1FAF0, 0x1FAF6, PW },
+        { 0x1FAF7, 0x1FAFF, PN }, { 0x1FC00, 0x1FFFD, PN }, { 0x20000, 0x2FFFD, W }, { 0x30000, 0x3FFFD, W }, { 0xE0001, 0xE0001, E },
+        { 0xE0020, 0xE007F, E }, { 0xE0100, 0xE01EF, E },
+        };
+
+        // The lookup goes code point >> 12 -> block of 64 leaf ids -> leaf of 64 classes packed two per byte.
+        // Blocks and leaves that hold a single class are shared, so only the mixed ones take space.
+        constexpr int LEAF_BITS = 6;
+        constexpr int BLOCK_BITS = 12;
+        constexpr size_t LEAF_SIZE = size_t{ 1 } << LEAF_BITS;
+        constexpr size_t LEAVES_PER_BLOCK = size_t{ 1 } << (BLOCK_BITS - LEAF_BITS);
+        constexpr size_t BLOCK_COUNT = 0x110000 >> BLOCK_BITS;
+        constexpr size_t CLASS_COUNT = static_cast<size_t>(CodePointClass::PictographicWide) + 1;
+        constexpr int MIXED = -1;
+
+        // The class covering all of first..last, or MIXED. 'next' is the first range that can still
+        // matter and only moves forward, so the callers go through the code points in order.
+        constexpr int Coverage(char32_t first, char32_t last, size_t& next)
+        {
+            while (next < std::size(RANGES) && RANGES[next].last < first) {
+                ++next;
+            }
+            if (next == std::size(RANGES) || RANGES[next].first > last) {
+                return static_cast<int>(CodePointClass::Narrow);
+            }
+            if (RANGES[next].first <= first && RANGES[next].last >= last) {
+                return static_cast<int>(RANGES[next].cls);
+            }
+            return MIXED;
+        }
+
+        struct TableSizes {
+            size_t blocks;      // The uniform ones first, one per class
+            size_t leaves;
+        };
+
+        constexpr TableSizes CountTables()
+        {
+            TableSizes sizes{ CLASS_COUNT, CLASS_COUNT };
+            size_t next = 0;
+            for (size_t block = 0; block < BLOCK_COUNT; ++block) {
+                char32_t base = static_cast<char32_t>(block << BLOCK_BITS);
+                if (Coverage(base, base + (1 << BLOCK_BITS) - 1, next) != MIXED) {
+                    continue;
+                }
+                ++sizes.blocks;
+                for (size_t leaf = 0; leaf < LEAVES_PER_BLOCK; ++leaf) {
+                    char32_t first = base + static_cast<char32_t>(leaf << LEAF_BITS);
+                    if (Coverage(first, first + LEAF_SIZE - 1, next) == MIXED) {
+                        ++sizes.leaves;
+                    }
+                }
+            }
+            return sizes;
+        }
+
+        constexpr TableSizes SIZES = CountTables();
+
+        struct Tables {
+            std::array<uint8_t, BLOCK_COUNT> blocks;
+            std::array<std::array<uint16_t, LEAVES_PER_BLOCK>, SIZES.blocks> leafIds;
+            std::array<std::array<uint8_t, LEAF_SIZE / 2>, SIZES.leaves> leaves;
+        };
+        static_assert(SIZES.blocks <= 0x100, "Block ids are bytes");
+        static_assert(sizeof(Tables) <= 16 * 1024, "The width table is meant to stay a few KB");
+
+        constexpr Tables BuildTables()
+        {
+            Tables tables{};
+            for (size_t cls = 0; cls < CLASS_COUNT; ++cls) {
+                for (uint16_t& id : tables.leafIds[cls]) {
+                    id = static_cast<uint16_t>(cls);
+                }
+                for (uint8_t& pair : tables.leaves[cls]) {
+                    pair = static_cast<uint8_t>(cls | (cls << 4));
+                }
+            }
+
+            size_t blocks = CLASS_COUNT;
+            size_t leaves = CLASS_COUNT;
+            size_t next = 0;
+            for (size_t block = 0; block < BLOCK_COUNT; ++block) {
+                char32_t base = static_cast<char32_t>(block << BLOCK_BITS);
+                int cls = Coverage(base, base + (1 << BLOCK_BITS) - 1, next);
+                if (cls != MIXED) {
+                    tables.blocks[block] = static_cast<uint8_t>(cls);
+                    continue;
+                }
+                tables.blocks[block] = static_cast<uint8_t>(blocks);
+                std::array<uint16_t, LEAVES_PER_BLOCK>& leafIds = tables.leafIds[blocks++];
+                for (size_t leaf = 0; leaf < LEAVES_PER_BLOCK; ++leaf) {
+                    char32_t first = base + static_cast<char32_t>(leaf << LEAF_BITS);
+                    char32_t last = first + LEAF_SIZE - 1;
+                    cls = Coverage(first, last, next);
+                    if (cls != MIXED) {
+                        leafIds[leaf] = static_cast<uint16_t>(cls);
+                        continue;
+                    }
+                    leafIds[leaf] = static_cast<uint16_t>(leaves);
+                    std::array<uint8_t, LEAF_SIZE / 2>& packed = tables.leaves[leaves++];
+                    for (size_t r = next; r < std::size(RANGES) && RANGES[r].first <= last; ++r) {
+                        char32_t from = RANGES[r].first < first ? first : RANGES[r].first;
+                        char32_t to = RANGES[r].last > last ? last : RANGES[r].last;
+                        for (char32_t ch = from; ch <= to; ++ch) {
+                            size_t index = ch - first;
+                            packed[index / 2] |= static_cast<uint8_t>(static_cast<uint8_t>(RANGES[r].cls) << (index % 2 * 4));
+                        }
+                    }
+                }
+            }
+            return tables;
+        }
+
+        constexpr Tables TABLES = BuildTables();
+
+        constexpr CodePointClass Lookup(char32_t ch)
+        {
+            if (ch >= 0x110000) {
+                return CodePointClass::Narrow;
+            }
+            size_t block = TABLES.blocks[ch >> BLOCK_BITS];
+            size_t leaf = TABLES.leafIds[block][(ch >> LEAF_BITS) & (LEAVES_PER_BLOCK - 1)];
+            size_t index = ch & (LEAF_SIZE - 1);
+            return static_cast<CodePointClass>((TABLES.leaves[leaf][index / 2] >> (index % 2 * 4)) & 0xF);
+        }
+
+        static_assert(Lookup(U'A') == CodePointClass::Narrow);
+        static_assert(Lookup(0x0301) == CodePointClass::Extend);
+        static_assert(Lookup(0x200D) == CodePointClass::ZeroWidthJoiner);
+        static_assert(Lookup(0x4E2D) == CodePointClass::Wide);
+        static_assert(Lookup(0xFF21) == CodePointClass::Wide);
+        static_assert(Lookup(0x1F1FA) == CodePointClass::RegionalIndicator);
+        static_assert(Lookup(0x1F600) == CodePointClass::PictographicWide);
+        static_assert(Lookup(0x2764) == CodePointClass::PictographicNarrow);
+        static_assert(Lookup(0xFE0F) == CodePointClass::Extend);
+        static_assert(Lookup(0x2FFFD) == CodePointClass::Wide);
+        static_assert(Lookup(0xE0001) == CodePointClass::Extend);
+    }
+
+    CodePointClass ClassifyCodePoint(char32_t ch)
+    {
+        return Lookup(ch);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+
+namespace winrt::win_retro_term::Core
+{
+    // How a code point takes up cells and whether it joins the grapheme cluster before it.
+    // Widths follow East Asian Width (Wide and Fullwidth take two cells, Ambiguous takes one),
+    // joining follows the extended grapheme cluster rules a terminal can apply one code point at a time.
+    enum class CodePointClass : uint8_t {
+        Narrow,                 // One cell
+        Wide,                   // Two cells
+        Extend,                 // No cell of its own: combining marks, variation selectors, emoji modifiers, format characters
+        ZeroWidthJoiner,        // U+200D, joins like Extend and lets a following pictograph join as well
+        RegionalIndicator,      // Two cells, two in a row make one flag
+        PictographicNarrow,     // Extended_Pictographic, joins after a ZWJ
+        PictographicWide,
+    };
+
+    // Code points below this are all Narrow, so runs of them never need a lookup
+    constexpr char32_t FIRST_NON_NARROW = 0x300;
+
+    // O(1): three table reads. Unassigned code points are Narrow, except in the CJK ideograph blocks.
+    CodePointClass ClassifyCodePoint(char32_t ch);
+
+    constexpr int CellWidth(CodePointClass cls) {
+        switch (cls) {
+        case CodePointClass::Wide:
+        case CodePointClass::RegionalIndicator:
+        case CodePointClass::PictographicWide:
+            return 2;
+        case CodePointClass::Extend:
+        case CodePointClass::ZeroWidthJoiner:
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    constexpr bool IsPictographic(CodePointClass cls) {
+        return cls == CodePointClass::PictographicNarrow || cls == CodePointClass::PictographicWide;
+    }
+}
@@ -0,0 +1,122 @@
+#include "pch.h"
+#include "Utf8Decoder.h"
+#include "Simd.h"
+#include <algorithm>
+
+namespace winrt::win_retro_term::Core
+{
+    namespace
+    {
+        // Widens a block of bytes known to be ASCII. Returns how many were copied,
+        // stopping at the first byte with the high bit set.
+        size_t CopyAsciiRun(const uint8_t* input, size_t length, char32_t* output)
+        {
+            size_t i = 0;
+#if defined(WRT_SIMD_SSE2)
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 16 <= length; i += 16) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+                if (_mm_movemask_epi8(bytes) != 0) {
+                    break;
+                }
+                __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+                __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+                __m128i* out = reinterpret_cast<__m128i*>(output + i);
+                _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, zero));
+            }
+#elif defined(WRT_SIMD_NEON)
+            for (; i + 16 <= length; i += 16) {
+                uint8x16_t bytes = vld1q_u8(input + i);
+                if (vmaxvq_u8(bytes) >= 0x80) {
+                    break;
+                }
+                uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+                uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+                uint32_t* out = reinterpret_cast<uint32_t*>(output + i);
+                vst1q_u32(out + 0, vmovl_u16(vget_low_u16(lo)));
+                vst1q_u32(out + 4, vmovl_u16(vget_high_u16(lo)));
+                vst1q_u32(out + 8, vmovl_u16(vget_low_u16(hi)));
+                vst1q_u32(out + 12, vmovl_u16(vget_high_u16(hi)));
+            }
+#endif
+            while (i < length && input[i] < 0x80) {
+                output[i] = input[i];
+                ++i;
+            }
+            return i;
+        }
+    }
+
+    void Utf8Decoder::Reset()
+    {
+        m_codePoint = 0;
+        m_bytesNeeded = 0;
+        m_lowerBoundary = 0x80;
+        m_upperBoundary = 0xBF;
+    }
+
+    Utf8Decoder::Result Utf8Decoder::Decode(const char* data, size_t length, char32_t* output, size_t capacity)
+    {
+        const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+        size_t in = 0;
+        size_t out = 0;
+
+        while (in < length && out < capacity) {
+            if (m_bytesNeeded == 0) {
+                // Fast path: most terminal output is plain ASCII
+                size_t ascii = CopyAsciiRun(input + in, std::min(length - in, capacity - out), output + out);
+                in += ascii;
+                out += ascii;
+                if (in == length || out == capacity) {
+                    break;
+                }
+
+                uint8_t lead = input[in++];
+                if (lead >= 0xC2 && lead <= 0xDF) {
+                    m_bytesNeeded = 1;
+                    m_codePoint = lead & 0x1F;
+                }
+                else if (lead >= 0xE0 && lead <= 0xEF) {
+                    if (lead == 0xE0) m_lowerBoundary = 0xA0; // Overlong
+                    if (lead == 0xED) m_upperBoundary = 0x9F; // Surrogates
+                    m_bytesNeeded = 2;
+                    m_codePoint = lead & 0x0F;
+                }
+                else if (lead >= 0xF0 && lead <= 0xF4) {
+                    if (lead == 0xF0) m_lowerBoundary = 0x90; // Overlong
+                    if (lead == 0xF4) m_upperBoundary = 0x8F; // Above U+10FFFF
+                    m_bytesNeeded = 3;
+                    m_codePoint = lead & 0x07;
+                }
+                else {
+                    // Stray continuation byte or a lead byte that can never start a valid sequence
+                    output[out++] = REPLACEMENT_CHARACTER;
+                }
+                continue;
+            }
+
+            uint8_t byte = input[in];
+            if (byte < m_lowerBoundary || byte > m_upperBoundary) {
+                // The sequence so far is a maximal subpart: replace it once and
+                // reprocess this byte as the start of something new
+                Reset();
+                output[out++] = REPLACEMENT_CHARACTER;
+                continue;
+            }
+
+            ++in;
+            m_lowerBoundary = 0x80;
+            m_upperBoundary = 0xBF;
+            m_codePoint = (m_codePoint << 6) | (byte & 0x3F);
+            if (--m_bytesNeeded == 0) {
+                output[out++] = m_codePoint;
+                m_codePoint = 0;
+            }
+        }
+
+        return { in, out };
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace winrt::win_retro_term::Core
+{
+    // Incremental UTF-8 to code point decoder for PTY output.
+    // A sequence split across reads is carried over in the decoder state (at most 3 bytes worth),
+    // malformed input is replaced by U+FFFD per maximal subpart instead of being dropped.
+    class Utf8Decoder {
+    public:
+        static constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+        struct Result {
+            size_t bytesConsumed;
+            size_t codePointsWritten;
+        };
+
+        // Decodes from 'data' into 'output' until either the input is exhausted or the output is full.
+        // Bytes of a trailing incomplete sequence are consumed and kept in the decoder state.
+        Result Decode(const char* data, size_t length, char32_t* output, size_t capacity);
+
+        // Drops any partial sequence, e.g. when the PTY is restarted.
+        void Reset();
+
+        bool HasPendingSequence() const { return m_bytesNeeded != 0; }
+
+    private:
+        char32_t m_codePoint = 0;   // Bits accumulated so far for the pending sequence
+        uint8_t m_bytesNeeded = 0;  // Continuation bytes still expected
+        uint8_t m_lowerBoundary = 0x80;
+        uint8_t m_upperBoundary = 0xBF;
+    };
+}
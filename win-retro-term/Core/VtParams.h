@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+namespace winrt::win_retro_term::Core
+{
+    // Read-only view over the parameters of one control sequence.
+    // Points into the parser's inline storage, so it is only valid for the duration of the dispatch.
+    class VtParamsView {
+    public:
+        VtParamsView() = default;
+        VtParamsView(const int32_t* values, const uint8_t* paramStarts, size_t count)
+            : m_values(values), m_paramStarts(paramStarts), m_count(count) {}
+
+        size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+
+        // Main value of parameter 'index' (the part before any ':'). Omitted parameters read as 0.
+        int32_t operator[](size_t index) const { return m_values[m_paramStarts[index]]; }
+
+        // Value of parameter 'index', or 'defaultValue' when it is missing or 0
+        int32_t At(size_t index, int32_t defaultValue) const {
+            if (index >= m_count) return defaultValue;
+            int32_t value = (*this)[index];
+            return (value == 0 && defaultValue != 0) ? defaultValue : value;
+        }
+
+        // Colon-separated sub-parameters following the main value, e.g. {2, 0, r, g, b} for "38:2::r:g:b"
+        std::span<const int32_t> SubParams(size_t index) const {
+            size_t first = m_paramStarts[index] + 1u;
+            return { m_values + first, m_values + m_paramStarts[index + 1] };
+        }
+        bool HasSubParams(size_t index) const { return m_paramStarts[index + 1] - m_paramStarts[index] > 1; }
+
+    private:
+        const int32_t* m_values = nullptr;
+        const uint8_t* m_paramStarts = nullptr;
+        size_t m_count = 0;
+    };
+
+    // Fixed-capacity storage for CSI/DCS parameters and sub-parameters; nothing here touches the heap.
+    // All values are kept flat in one array, m_paramStarts[i] is where parameter i begins and
+    // m_paramStarts[count] is the end sentinel, so sub-parameters are the values in between.
+    class VtParams {
+    public:
+        static constexpr size_t MAX_PARAMS = 32;
+        static constexpr size_t MAX_VALUES = 64;
+
+        void Clear() {
+            m_paramCount = 0;
+            m_valueCount = 0;
+            m_paramStarts[0] = 0;
+            m_overflow = false;
+        }
+
+        void AddDigit(int digit) {
+            if (m_paramCount == 0) {
+                StartParam();
+            }
+            if (m_overflow) return;
+
+            int64_t value = static_cast<int64_t>(m_values[m_valueCount - 1]) * 10 + digit;
+            // Clamp to avoid overflow, typical terminal int range
+            if (value > std::numeric_limits<int32_t>::max()) {
+                value = std::numeric_limits<int32_t>::max();
+            }
+            m_values[m_valueCount - 1] = static_cast<int32_t>(value);
+        }
+
+        // ';' ends the current parameter and starts the next one
+        void NextParam() {
+            if (m_paramCount == 0) {
+                StartParam();
+            }
+            StartParam();
+        }
+
+        // ':' starts a sub-parameter of the current parameter
+        void NextSubParam() {
+            if (m_paramCount == 0) {
+                StartParam();
+            }
+            if (m_overflow || m_valueCount == MAX_VALUES) {
+                m_overflow = true;
+                return;
+            }
+            m_values[m_valueCount++] = 0;
+            m_paramStarts[m_paramCount] = static_cast<uint8_t>(m_valueCount);
+        }
+
+        VtParamsView View() const { return VtParamsView(m_values, m_paramStarts, m_paramCount); }
+        size_t size() const { return m_paramCount; }
+
+    private:
+        void StartParam() {
+            if (m_overflow || m_paramCount == MAX_PARAMS || m_valueCount == MAX_VALUES) {
+                // Further parameters are dropped, like any terminal with a fixed parameter limit
+                m_overflow = true;
+                return;
+            }
+            m_paramStarts[m_paramCount++] = static_cast<uint8_t>(m_valueCount);
+            m_values[m_valueCount++] = 0;
+            m_paramStarts[m_paramCount] = static_cast<uint8_t>(m_valueCount);
+        }
+
+        int32_t m_values[MAX_VALUES] = {};
+        uint8_t m_paramStarts[MAX_PARAMS + 1] = {};
+        uint8_t m_paramCount = 0;
+        uint8_t m_valueCount = 0;
+        bool m_overflow = false;
+    };
+}
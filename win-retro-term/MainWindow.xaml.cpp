@@ -16,5 +16,10 @@ namespace winrt::win_retro_term::implementation
     MainWindow::MainWindow()
     {
         InitializeComponent();
+
+        Terminal().TitleChanged([this](win_retro_term::TerminalControl const& sender, winrt::Windows::Foundation::IInspectable const&) {
+            hstring title = sender.Title();
+            Title(title.empty() ? L"win-retro-term" : title);
+        });
     }
 }
@@ -123,9 +123,8 @@ void D3D11Renderer::CreateDeviceIndependentResources() {
     }
 }
 
-void D3D11Renderer::Initialize(winrt::Microsoft::UI::Xaml::Controls::SwapChainPanel const& panel, winrt::win_retro_term::Core::TerminalBuffer* buffer) {
+void D3D11Renderer::Initialize(winrt::Microsoft::UI::Xaml::Controls::SwapChainPanel const& panel) {
     m_swapChainPanel = panel;
-    m_terminalBufferPtr = buffer;
     CreateDeviceResources();
     CreateWindowSizeDependentResources();
     UpdateFontMetrics();
@@ -329,63 +328,65 @@ float D3D11Renderer::GetFontCharHeight() const {
     return m_lineHeight > 0 ? m_lineHeight : 16.0f;
 }
 
-D2D1_COLOR_F D3D11Renderer::GetD2DColor(winrt::win_retro_term::Core::AnsiColor color, bool isForeground) 
+D2D1_COLOR_F D3D11Renderer::GetD2DColor(uint32_t rgb)
 {
-    static const D2D1_COLOR_F ansiPalette[] = {
-        D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f),        // Black
-        D2D1::ColorF(0.66f, 0.0f, 0.0f, 1.0f),       // Red (darker)
-        D2D1::ColorF(0.0f, 0.66f, 0.0f, 1.0f),       // Green (darker)
-        D2D1::ColorF(0.66f, 0.66f, 0.0f, 1.0f),      // Yellow (darker, often brown)
-        D2D1::ColorF(0.0f, 0.0f, 0.66f, 1.0f),       // Blue (darker)
-        D2D1::ColorF(0.66f, 0.0f, 0.66f, 1.0f),      // Magenta (darker)
-        D2D1::ColorF(0.0f, 0.66f, 0.66f, 1.0f),      // Cyan (darker)
-        D2D1::ColorF(0.82f, 0.82f, 0.82f, 1.0f),     // White (light gray)
-
-        D2D1::ColorF(0.33f, 0.33f, 0.33f, 1.0f),     // Bright Black (dark gray)
-        D2D1::ColorF(1.0f, 0.2f, 0.2f, 1.0f),        // Bright Red
-        D2D1::ColorF(0.2f, 1.0f, 0.2f, 1.0f),        // Bright Green
-        D2D1::ColorF(1.0f, 1.0f, 0.2f, 1.0f),        // Bright Yellow
-        D2D1::ColorF(0.2f, 0.2f, 1.0f, 1.0f),        // Bright Blue
-        D2D1::ColorF(1.0f, 0.2f, 1.0f, 1.0f),        // Bright Magenta
-        D2D1::ColorF(0.2f, 1.0f, 1.0f, 1.0f),        // Bright Cyan
-        D2D1::ColorF(1.0f, 1.0f, 1.0f, 1.0f),        // Bright White
-    };
-    static const D2D1_COLOR_F defaultTermFg = D2D1::ColorF(0.82f, 0.82f, 0.82f, 1.0f); // Light Gray
-    static const D2D1_COLOR_F defaultTermBg = D2D1::ColorF(0.02f, 0.02f, 0.08f, 1.0f); // Dark Blue (matches current clear)
+    return D2D1::ColorF(((rgb >> 16) & 0xFF) / 255.0f, ((rgb >> 8) & 0xFF) / 255.0f, (rgb & 0xFF) / 255.0f, 1.0f);
+}
 
-    if (color == winrt::win_retro_term::Core::AnsiColor::Foreground) return defaultTermFg;
-    if (color == winrt::win_retro_term::Core::AnsiColor::Background) return defaultTermBg;
+uint32_t D3D11Renderer::ResolveColor(winrt::win_retro_term::Core::TextColor color, size_t defaultIndex) const
+{
+    if (color.IsRgb()) return color.RgbValue();
+    if (color.IsIndexed()) return m_palette[color.Index()];
+    return m_palette[defaultIndex];
+}
 
-    uint8_t index = static_cast<uint8_t>(color);
-    if (index < ARRAYSIZE(ansiPalette)) {
-        return ansiPalette[index];
+ID2D1SolidColorBrush* D3D11Renderer::GetBrush(winrt::win_retro_term::Core::TextColor color, size_t defaultIndex, ID2D1SolidColorBrush* scratch)
+{
+    if (color.IsDefault()) {
+        return defaultIndex == winrt::win_retro_term::Core::PALETTE_DEFAULT_FOREGROUND ? m_defaultFgBrush.Get() : m_defaultBgBrush.Get();
+    }
+    if (color.IsIndexed() && color.Index() < m_colorBrushes.size()) {
+        return m_colorBrushes[color.Index()].Get();
     }
-    return isForeground ? defaultTermFg : defaultTermBg;
+    // Draw calls take the brush color when they are issued, so one brush serves every such run
+    scratch->SetColor(GetD2DColor(ResolveColor(color, defaultIndex)));
+    return scratch;
 }
 
 void D3D11Renderer::CreateColorPaletteBrushes() {
     if (!m_d2dContext) return;
     m_colorBrushes.clear();
-    m_colorBrushes.resize(18);
+    m_colorBrushes.resize(16);
 
-    for (uint8_t i = 0; i < 16; ++i) {
-        ThrowIfFailed(m_d2dContext->CreateSolidColorBrush(
-            GetD2DColor(static_cast<winrt::win_retro_term::Core::AnsiColor>(i), true),
-            &m_colorBrushes[i]
-        ));
+    for (size_t i = 0; i < m_colorBrushes.size(); ++i) {
+        ThrowIfFailed(m_d2dContext->CreateSolidColorBrush(GetD2DColor(m_palette[i]), &m_colorBrushes[i]));
     }
 
     ThrowIfFailed(m_d2dContext->CreateSolidColorBrush(
-        GetD2DColor(winrt::win_retro_term::Core::AnsiColor::Foreground, true),
+        GetD2DColor(m_palette[winrt::win_retro_term::Core::PALETTE_DEFAULT_FOREGROUND]),
         &m_defaultFgBrush
     ));
-    m_colorBrushes[static_cast<uint8_t>(winrt::win_retro_term::Core::AnsiColor::Foreground)] = m_defaultFgBrush;
-
     ThrowIfFailed(m_d2dContext->CreateSolidColorBrush(
-        GetD2DColor(winrt::win_retro_term::Core::AnsiColor::Background, false),
+        GetD2DColor(m_palette[winrt::win_retro_term::Core::PALETTE_DEFAULT_BACKGROUND]),
         &m_defaultBgBrush
     ));
-    m_colorBrushes[static_cast<uint8_t>(winrt::win_retro_term::Core::AnsiColor::Background)] = m_defaultBgBrush;
+    ThrowIfFailed(m_d2dContext->CreateSolidColorBrush(GetD2DColor(0), &m_scratchFgBrush));
+    ThrowIfFailed(m_d2dContext->CreateSolidColorBrush(GetD2DColor(0), &m_scratchBgBrush));
+}
+
+void D3D11Renderer::UpdatePalette(const winrt::win_retro_term::Core::ScreenSnapshot& snapshot) {
+    if (snapshot.paletteGeneration == m_paletteGeneration) return;
+    m_palette = snapshot.palette;
+    m_paletteGeneration = snapshot.paletteGeneration;
+
+    // Recolor in place
+    for (size_t i = 0; i < m_colorBrushes.size(); ++i) {
+        if (m_colorBrushes[i]) {
+            m_colorBrushes[i]->SetColor(GetD2DColor(m_palette[i]));
+        }
+    }
+    if (m_defaultFgBrush) m_defaultFgBrush->SetColor(GetD2DColor(m_palette[winrt::win_retro_term::Core::PALETTE_DEFAULT_FOREGROUND]));
+    if (m_defaultBgBrush) m_defaultBgBrush->SetColor(GetD2DColor(m_palette[winrt::win_retro_term::Core::PALETTE_DEFAULT_BACKGROUND]));
 }
 
 void D3D11Renderer::CreateTextFormats() {
@@ -405,6 +406,7 @@ void D3D11Renderer::CreateTextFormats() {
         fontSize, L"en-US", &m_textFormatNormal));
     m_textFormatNormal->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
     m_textFormatNormal->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_NEAR);
+    m_textFormatNormal->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP); // A glyph wider than its cells overhangs them
 
     // Bold
     ThrowIfFailed(m_dwriteFactory->CreateTextFormat(
@@ -412,6 +414,7 @@ void D3D11Renderer::CreateTextFormats() {
         fontSize, L"en-US", &m_textFormatBold));
     m_textFormatBold->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
     m_textFormatBold->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_NEAR);
+    m_textFormatBold->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
 
     m_textFormat = m_textFormatNormal;
     UpdateFontMetrics();
@@ -474,126 +477,173 @@ void D3D11Renderer::ValidateDevice() {
     }
 }
 
-void D3D11Renderer::Render() {
-    if (!m_isInitialized || m_deviceLost || !m_terminalBufferPtr) return;
+void D3D11Renderer::Render(const winrt::win_retro_term::Core::ScreenSnapshot& snapshot) {
+    if (!m_isInitialized || m_deviceLost || snapshot.sequence == 0) return;
     if (!m_renderTargetView || !m_d2dContext || !m_d2dTargetBitmap || m_colorBrushes.empty()) return;
 
-    D2D1_COLOR_F color = GetD2DColor(winrt::win_retro_term::Core::AnsiColor::Background, false);
+    UpdatePalette(snapshot);
+
+    D2D1_COLOR_F color = GetD2DColor(m_palette[winrt::win_retro_term::Core::PALETTE_DEFAULT_BACKGROUND]);
     const float clearColor[4] = { color.r, color.g, color.b, color.a };
     m_d3dContext->ClearRenderTargetView(m_renderTargetView.Get(), clearColor);
 
     m_d2dContext->BeginDraw();
     m_d2dContext->SetTransform(D2D1::Matrix3x2F::Identity());
 
-    const auto& screenData = m_terminalBufferPtr->GetScreenBuffer();
-    int rows = m_terminalBufferPtr->GetRows();
-    int cols = m_terminalBufferPtr->GetCols();
+    int rows = snapshot.rows;
+    int cols = snapshot.cols;
 
-    float yPos = 5.0f; // Starting Y offset (DIPs)
+    const float yOffsetTop = 5.0f;
+    float yPos = yOffsetTop; // Starting Y offset (DIPs)
     float xOffset = 5.0f; // Starting X offset (DIPs)
     float charWidth = GetFontCharWidth();  // From cached metrics
     float lineHeight = GetFontCharHeight(); // From cached metrics
 
     for (int r = 0; r < rows; ++r) {
-        if (r >= screenData.size()) continue; // Should not happen
+        const char32_t* row = snapshot.Text(r);
 
-        // Render runs of characters with the same attributes
+        // Each style span of the row is drawn as one run
         int currentRunStartCol = 0;
-        winrt::win_retro_term::Core::Cell firstCellInRun = screenData[r][0];
-
-        for (int c = 0; c <= cols; ++c) { // Iterate one past last col to draw final run
-            bool endOfLine = (c == cols);
-            bool attributesChanged = false;
-            winrt::win_retro_term::Core::Cell currentCell;
-
-            if (!endOfLine) {
-                currentCell = screenData[r][c];
-                if (currentCell.foregroundColor != firstCellInRun.foregroundColor ||
-                    currentCell.backgroundColor != firstCellInRun.backgroundColor ||
-                    currentCell.attributes != firstCellInRun.attributes) {
-                    attributesChanged = true;
-                }
+        for (const winrt::win_retro_term::Core::StyleSpan& span : snapshot.Spans(r)) {
+            int runLength = static_cast<int>(span.length);
+            int c = currentRunStartCol + runLength;
+
+            // Determine attributes for this run
+            const winrt::win_retro_term::Core::TextStyle& style = snapshot.Style(span);
+            winrt::win_retro_term::Core::TextColor fg = style.foreground;
+            winrt::win_retro_term::Core::TextColor bg = style.background;
+            size_t fgDefault = winrt::win_retro_term::Core::PALETTE_DEFAULT_FOREGROUND;
+            size_t bgDefault = winrt::win_retro_term::Core::PALETTE_DEFAULT_BACKGROUND;
+            winrt::win_retro_term::Core::CellAttributesFlags cellAttrs = style.attributes;
+
+            if ((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Inverse) != winrt::win_retro_term::Core::CellAttributesFlags::None) {
+                std::swap(fg, bg);
+                std::swap(fgDefault, bgDefault);
             }
 
-            if (endOfLine || attributesChanged) {
-                // Draw the run from currentRunStartCol to c-1
-                int runLength = c - currentRunStartCol;
-                if (runLength > 0) {
-                    std::wstring runText;
-                    runText.reserve(runLength);
-                    for (int i = 0; i < runLength; ++i) {
-                        runText += screenData[r][currentRunStartCol + i].character;
+            // Background fill for the run
+            ID2D1SolidColorBrush* bgBrush = GetBrush(bg, bgDefault, m_scratchBgBrush.Get());
+            D2D1_RECT_F bgRect = D2D1::RectF(
+                xOffset + currentRunStartCol * charWidth,
+                yPos,
+                xOffset + c * charWidth, // Up to the end of the run
+                yPos + lineHeight);
+            m_d2dContext->FillRectangle(&bgRect, bgBrush);
+
+            // Select TextFormat (Normal/Bold)
+            IDWriteTextFormat* currentTextFormat = m_textFormatNormal.Get();
+            if ((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Bold) != winrt::win_retro_term::Core::CellAttributesFlags::None) {
+                currentTextFormat = m_textFormatBold.Get();
+                // If Faint is also set, some terminals might prefer faint or normal
+                if ((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Dim) != winrt::win_retro_term::Core::CellAttributesFlags::None) {
+                    // currentTextFormat = m_textFormatNormal.Get(); // Example: Faint overrides Bold
+                }
+            }
+            // TODO: Add Italic, BoldItalic if supported
+
+            // Foreground text brush
+            ID2D1SolidColorBrush* fgBrush = GetBrush(fg, fgDefault, m_scratchFgBrush.Get());
+
+            // Narrow characters go down a stretch at a time. A wide character or a cluster is drawn on its own,
+            // in a layout as wide as its cells, since the font that has it (often a fallback) doesn't advance
+            // by whole cells and everything after it in the same string would drift off the grid.
+            std::wstring runText;
+            int textStartCol = currentRunStartCol;
+            auto appendCodePoint = [&runText](char32_t ch) {
+                if (ch >= 0x10000) {
+                    // Outside the BMP: UTF-16 surrogate pair
+                    ch -= 0x10000;
+                    runText += static_cast<wchar_t>(0xD800 + (ch >> 10));
+                    runText += static_cast<wchar_t>(0xDC00 + (ch & 0x3FF));
+                }
+                else {
+                    runText += static_cast<wchar_t>(ch);
+                }
+            };
+            auto drawText = [&](int endCol, float extra) { // 'extra' gives a bit of room past the last char
+                if (runText.empty()) return;
+                D2D1_RECT_F textLayoutRect = D2D1::RectF(
+                    xOffset + textStartCol * charWidth,
+                    yPos,
+                    xOffset + endCol * charWidth + extra,
+                    yPos + lineHeight);
+                m_d2dContext->DrawText(
+                    runText.c_str(), (UINT32)runText.length(),
+                    currentTextFormat, &textLayoutRect, fgBrush,
+                    D2D1_DRAW_TEXT_OPTIONS_NONE // Or D2D1_DRAW_TEXT_OPTIONS_ENABLE_COLOR_FONT if using color fonts
+                );
+                runText.clear();
+            };
+
+            if (fgBrush && currentTextFormat &&
+                !((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Concealed) != winrt::win_retro_term::Core::CellAttributesFlags::None)) { // Don't draw concealed
+                for (int col = currentRunStartCol; col < c; ++col) {
+                    char32_t ch = row[col];
+                    if (ch == winrt::win_retro_term::Core::WIDE_SPACER) {
+                        continue; // Covered by the wide character before it
                     }
-
-                    // Determine attributes for this run (from firstCellInRun)
-                    winrt::win_retro_term::Core::AnsiColor fg = firstCellInRun.foregroundColor;
-                    winrt::win_retro_term::Core::AnsiColor bg = firstCellInRun.backgroundColor;
-                    winrt::win_retro_term::Core::CellAttributesFlags cellAttrs = firstCellInRun.attributes;
-
-                    if ((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Inverse) != winrt::win_retro_term::Core::CellAttributesFlags::None) {
-                        std::swap(fg, bg);
+                    bool wide = col + 1 < cols && row[col + 1] == winrt::win_retro_term::Core::WIDE_SPACER;
+                    bool cluster = winrt::win_retro_term::Core::IsClusterCell(ch);
+                    if (!wide && !cluster) {
+                        if (runText.empty()) {
+                            textStartCol = col;
+                        }
+                        appendCodePoint(ch);
+                        continue;
                     }
 
-                    // Background fill for the run
-                    ID2D1SolidColorBrush* bgBrush = m_colorBrushes[static_cast<uint8_t>(bg)].Get();
-                    D2D1_RECT_F bgRect = D2D1::RectF(
-                        xOffset + currentRunStartCol * charWidth,
-                        yPos,
-                        xOffset + c * charWidth, // Up to current column 'c'
-                        yPos + lineHeight);
-                    m_d2dContext->FillRectangle(&bgRect, bgBrush);
-
-                    // Select TextFormat (Normal/Bold)
-                    IDWriteTextFormat* currentTextFormat = m_textFormatNormal.Get();
-                    if ((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Bold) != winrt::win_retro_term::Core::CellAttributesFlags::None) {
-                        currentTextFormat = m_textFormatBold.Get();
-                        // If Faint is also set, some terminals might prefer faint or normal
-                        if ((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Dim) != winrt::win_retro_term::Core::CellAttributesFlags::None) {
-                            // currentTextFormat = m_textFormatNormal.Get(); // Example: Faint overrides Bold
+                    drawText(col, charWidth);
+                    textStartCol = col;
+                    if (cluster) {
+                        for (char32_t part : snapshot.Cluster(r, ch)) {
+                            appendCodePoint(part);
                         }
                     }
-                    // TODO: Add Italic, BoldItalic if supported
-
-                    // Foreground text brush
-                    ID2D1SolidColorBrush* fgBrush = m_colorBrushes[static_cast<uint8_t>(fg)].Get();
-
-                    // Text layout rect for the run
-                    D2D1_RECT_F textLayoutRect = D2D1::RectF(
-                        xOffset + currentRunStartCol * charWidth,
-                        yPos,
-                        xOffset + (currentRunStartCol + runLength) * charWidth + charWidth, // Give a bit extra for last char
-                        yPos + lineHeight);
-
-                    if (!runText.empty() && fgBrush && currentTextFormat &&
-                        !((cellAttrs & winrt::win_retro_term::Core::CellAttributesFlags::Concealed) != winrt::win_retro_term::Core::CellAttributesFlags::None)) { // Don't draw concealed
-                        m_d2dContext->DrawText(
-                            runText.c_str(), (UINT32)runText.length(),
-                            currentTextFormat, &textLayoutRect, fgBrush,
-                            D2D1_DRAW_TEXT_OPTIONS_NONE // Or D2D1_DRAW_TEXT_OPTIONS_ENABLE_COLOR_FONT if using color fonts
-                        );
+                    else {
+                        appendCodePoint(ch);
                     }
-                    // TODO: Draw underline, strikethrough as separate lines/rects if needed
-                }
-
-                // Start new run
-                if (!endOfLine) {
-                    currentRunStartCol = c;
-                    firstCellInRun = currentCell;
+                    drawText(col + (wide ? 2 : 1), 0.0f);
                 }
+                drawText(c, charWidth);
             }
+            // TODO: Draw underline, strikethrough as separate lines/rects if needed
+
+            currentRunStartCol = c;
         }
         yPos += lineHeight;
     }
 
     // Render cursor
-    int cursorR = m_terminalBufferPtr->GetCursorRow();
-    int cursorC = m_terminalBufferPtr->GetCursorCol();
+    int cursorR = snapshot.cursorRow;
+    int cursorC = snapshot.cursorCol;
     float cursor_x_pos = 5.0f + cursorC * m_avgCharWidth;
     float cursor_y_pos = 5.0f + cursorR * m_lineHeight;
 
-    // Draw a rectangle or block for the cursor
-    D2D1_RECT_F cursorRect = D2D1::RectF(cursor_x_pos, cursor_y_pos, cursor_x_pos + m_avgCharWidth, cursor_y_pos + m_lineHeight);
-    m_d2dContext->FillRectangle(&cursorRect, m_defaultFgBrush.Get());
+    // Draw a rectangle or block for the cursor, unless hidden with DECTCEM
+    if (snapshot.cursorVisible) {
+        D2D1_RECT_F cursorRect = D2D1::RectF(cursor_x_pos, cursor_y_pos, cursor_x_pos + m_avgCharWidth, cursor_y_pos + m_lineHeight);
+        m_d2dContext->FillRectangle(&cursorRect, m_defaultFgBrush.Get());
+    }
+
+    // Backlog indicator while the worker is jump-scrolling through an output flood,
+    // otherwise the position in history while the view is scrolled back
+    wchar_t indicator[48];
+    int indicatorLength = 0;
+    if (snapshot.flooding) {
+        indicatorLength = swprintf_s(indicator, L" +%zu KiB ", snapshot.backlogBytes / 1024);
+    }
+    else if (snapshot.viewportOffset > 0) {
+        indicatorLength = swprintf_s(indicator, L" -%d/%zu ", snapshot.viewportOffset, snapshot.scrollbackLines);
+    }
+    {
+        if (indicatorLength > 0) {
+            float indicatorWidth = indicatorLength * m_avgCharWidth;
+            float indicatorRight = xOffset + cols * m_avgCharWidth;
+            D2D1_RECT_F indicatorRect = D2D1::RectF(indicatorRight - indicatorWidth, yOffsetTop, indicatorRight, yOffsetTop + m_lineHeight);
+            m_d2dContext->FillRectangle(&indicatorRect, m_defaultFgBrush.Get());
+            m_d2dContext->DrawText(indicator, static_cast<UINT32>(indicatorLength), m_textFormatNormal.Get(), &indicatorRect, m_defaultBgBrush.Get());
+        }
+    }
 
     HRESULT hr = m_d2dContext->EndDraw();
     if (hr == D2DERR_RECREATE_TARGET) {
@@ -656,6 +706,8 @@ void D3D11Renderer::ReleaseDeviceDependentResources() {
     m_colorBrushes.clear();
     m_defaultFgBrush = nullptr;
     m_defaultBgBrush = nullptr;
+    m_scratchFgBrush = nullptr;
+    m_scratchBgBrush = nullptr;
 
     m_textFormatNormal = nullptr;
     m_textFormatBold = nullptr;
@@ -7,7 +7,7 @@
 #include <d2d1_3.h>
 #include <dwrite_3.h>
 
-#include "Core/TerminalBuffer.h"
+#include "Core/ScreenSnapshot.h"
 
 namespace winrt::Microsoft::UI::Xaml::Controls {
     struct SwapChainPanel;
@@ -20,12 +20,12 @@ public:
     D3D11Renderer();
     ~D3D11Renderer();
 
-    void Initialize(winrt::Microsoft::UI::Xaml::Controls::SwapChainPanel const& panel, winrt::win_retro_term::Core::TerminalBuffer* buffer);
+    void Initialize(winrt::Microsoft::UI::Xaml::Controls::SwapChainPanel const& panel);
     void SetLogicalSize(winrt::Windows::Foundation::Size logicalSize);
     void SetCompositionScale(float compositionScaleX, float compositionScaleY);
     void ValidateDevice();
 
-    void Render();
+    void Render(const winrt::win_retro_term::Core::ScreenSnapshot& snapshot);
     void Present();
 
     void Suspend();
@@ -71,24 +71,32 @@ private:
     bool m_isInitialized = false;
     bool m_deviceLost = false;
 
-    // Font metrics and terminal buffer
-    winrt::win_retro_term::Core::TerminalBuffer* m_terminalBufferPtr = nullptr;
-
+    // Font metrics
     float m_avgCharWidth = 8.0f;
     float m_lineHeight = 16.0f;
 
     void UpdateFontMetrics();
 
-    // Brushes for different ANSI colors (or a map/vector of brushes)
+    // Brushes for the 16 base colors and the defaults; 256-color and truecolor runs recolor a scratch brush instead
     std::vector<Microsoft::WRL::ComPtr<ID2D1SolidColorBrush>> m_colorBrushes;
     Microsoft::WRL::ComPtr<ID2D1SolidColorBrush>  m_defaultFgBrush;
     Microsoft::WRL::ComPtr<ID2D1SolidColorBrush>  m_defaultBgBrush;
+    Microsoft::WRL::ComPtr<ID2D1SolidColorBrush>  m_scratchFgBrush;
+    Microsoft::WRL::ComPtr<ID2D1SolidColorBrush>  m_scratchBgBrush;
+
+    // Colors the brushes were made from; follows the snapshot palette when OSC 4/10/11 change it
+    winrt::win_retro_term::Core::ColorPalette m_palette = winrt::win_retro_term::Core::DEFAULT_PALETTE;
+    uint64_t m_paletteGeneration = 0;
 
     // Text Formats for different styles (bold, italic)
     Microsoft::WRL::ComPtr<IDWriteTextFormat>     m_textFormatNormal;
     Microsoft::WRL::ComPtr<IDWriteTextFormat>     m_textFormatBold;
 
     void CreateColorPaletteBrushes();
+    void UpdatePalette(const winrt::win_retro_term::Core::ScreenSnapshot& snapshot);
     void CreateTextFormats();
-    D2D1_COLOR_F GetD2DColor(winrt::win_retro_term::Core::AnsiColor color, bool isForeground);
+    static D2D1_COLOR_F GetD2DColor(uint32_t rgb);
+    // 'defaultIndex' is PALETTE_DEFAULT_FOREGROUND or PALETTE_DEFAULT_BACKGROUND, for a default color
+    uint32_t ResolveColor(winrt::win_retro_term::Core::TextColor color, size_t defaultIndex) const;
+    ID2D1SolidColorBrush* GetBrush(winrt::win_retro_term::Core::TextColor color, size_t defaultIndex, ID2D1SolidColorBrush* scratch);
 };
\ No newline at end of file
@@ -6,8 +6,10 @@
 
 #include <winrt/Microsoft.UI.Input.h>
 #include <winrt/Microsoft.UI.Xaml.Input.h>
+#include <winrt/Windows.ApplicationModel.DataTransfer.h>
 #include <winrt/Windows.UI.Core.h>
 
+#include <optional>
 #include <string>
 
 using namespace winrt;
@@ -18,15 +20,22 @@ using namespace winrt::Microsoft::UI::Xaml::Input;
 
 namespace winrt::win_retro_term::implementation
 {
+    namespace
+    {
+        const int WHEEL_LINES_PER_NOTCH = 3;
+    }
+
     TerminalControl::TerminalControl()
     {
         InitializeComponent();
         RootGrid().IsTabStop(true);
 
-        m_dispatcherQueue = winrt::Microsoft::UI::Dispatching::DispatcherQueue::GetForCurrentThread();
+#if defined(_DEBUG)
+        // Unhandled sequences and controls are recorded in the trace ring and dumped when the control unloads
+        Core::Trace::SetEnabled(static_cast<uint32_t>(Core::TraceCategory::All), Core::TraceLevel::Info);
+#endif
 
-        m_terminalBuffer = std::make_unique<Core::TerminalBuffer>(25, 80);
-        m_ansiParser = std::make_unique<Core::AnsiParser>(*m_terminalBuffer.get());
+        m_terminalWorker = std::make_unique<Core::TerminalWorker>(m_rows, m_cols);
         m_renderer = std::make_unique<D3D11Renderer>();
         m_ptyProcess = std::make_unique<ConPtyProcess>();
 
@@ -38,17 +47,29 @@ namespace winrt::win_retro_term::implementation
     {
     }
 
+    winrt::event_token TerminalControl::TitleChanged(winrt::Windows::Foundation::TypedEventHandler<win_retro_term::TerminalControl, winrt::Windows::Foundation::IInspectable> const& handler)
+    {
+        return m_titleChangedEvent.add(handler);
+    }
+
+    void TerminalControl::TitleChanged(winrt::event_token const& token) noexcept
+    {
+        m_titleChangedEvent.remove(token);
+    }
+
     void TerminalControl::InitializePtyAndBuffer() {
-        // Get initial terminal dimensions
-        UpdateTerminalSize();
+        // The first size goes in right away, before the PTY exists
+        Core::GridSize size;
+        if (ComputeTerminalSize(size)) {
+            ApplyTerminalSize(size);
+        }
 
-        auto ptyCallback = [this](const char* buffer, size_t length) {
-            this->PtyDataReceived(buffer, length);
-            };
+        m_terminalWorker->Start();
 
-        COORD ptyInitialSize = { static_cast<SHORT>(m_terminalBuffer->GetCols()), static_cast<SHORT>(m_terminalBuffer->GetRows()) };
+        COORD ptyInitialSize = { static_cast<SHORT>(m_cols), static_cast<SHORT>(m_rows) };
 
-        if (m_ptyProcess->Start(L"cmd.exe", ptyInitialSize, ptyCallback)) {
+        // The reader thread fills the worker's input ring in place, no per-read callback or copy
+        if (m_ptyProcess->Start(L"cmd.exe", ptyInitialSize, m_terminalWorker->InputRing())) {
             OutputDebugStringA("TerminalControl: ConPTY started successfully.\n");
         }
         else {
@@ -58,7 +79,7 @@ namespace winrt::win_retro_term::implementation
 
     void TerminalControl::OnLoaded(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::RoutedEventArgs const& args)
     {
-        m_renderer->Initialize(dxSwapChainPanel(), m_terminalBuffer.get());
+        m_renderer->Initialize(dxSwapChainPanel());
 
         m_renderer->SetLogicalSize({ (float)dxSwapChainPanel().ActualWidth(), (float)dxSwapChainPanel().ActualHeight() });
         m_renderer->SetCompositionScale(dxSwapChainPanel().CompositionScaleX(), dxSwapChainPanel().CompositionScaleY());
@@ -85,57 +106,70 @@ namespace winrt::win_retro_term::implementation
             winrt::Microsoft::UI::Xaml::Media::CompositionTarget::Rendering(m_renderingEventToken);
             m_renderingEventToken = {};
         }
+        // Stop the worker first: it releases the reader thread if it is waiting for ring space
+        if (m_terminalWorker) {
+            m_terminalWorker->Stop();
+        }
         if (m_ptyProcess) {
             m_ptyProcess->Stop();
             m_ptyProcess.reset();
         }
         m_renderer.reset();
-        m_terminalBuffer.reset();
-        m_ansiParser.reset();
-    }
+        m_terminalWorker.reset();
 
-    void TerminalControl::PtyDataReceived(const char* buffer, size_t length) {
-        std::vector<char> dataCopy(buffer, buffer + length);
-
-        m_dispatcherQueue.TryEnqueue([this, data = std::move(dataCopy)]() {
-            if (m_ansiParser) {
-                m_ansiParser->Parse(data.data(), data.size());
-            }
-            });
+#if defined(_DEBUG)
+        char tempPath[MAX_PATH] = {};
+        if (GetTempPathA(MAX_PATH, tempPath) > 0) {
+            Core::Trace::DumpToFile((std::string(tempPath) + "win-retro-term.trace").c_str());
+        }
+#endif
     }
 
-    void TerminalControl::UpdateTerminalSize() {
-        if (!m_renderer || !m_renderer->IsInitialized() || !m_terminalBuffer || !m_ptyProcess) {
-            return;
+    bool TerminalControl::ComputeTerminalSize(Core::GridSize& size) const {
+        if (!m_renderer || !m_renderer->IsInitialized() || !m_terminalWorker || !m_ptyProcess) {
+            return false;
         }
 
         float panelWidth = static_cast<float>(dxSwapChainPanel().ActualWidth());
         float panelHeight = static_cast<float>(dxSwapChainPanel().ActualHeight());
 
-        if (panelWidth <= 0 || panelHeight <= 0 || m_charWidthApprox <= 0 || m_charHeightApprox <= 0) return;
+        if (panelWidth <= 0 || panelHeight <= 0 || m_charWidthApprox <= 0 || m_charHeightApprox <= 0) return false;
 
-        int newCols = static_cast<int>(panelWidth / m_charWidthApprox);
-        int newRows = static_cast<int>(panelHeight / m_charHeightApprox);
+        size.cols = std::max(1, static_cast<int>(panelWidth / m_charWidthApprox));
+        size.rows = std::max(1, static_cast<int>(panelHeight / m_charHeightApprox));
+        return true;
+    }
 
-        newCols = std::max(1, newCols);
-        newRows = std::max(1, newRows);
+    void TerminalControl::RequestTerminalSize() {
+        Core::GridSize size;
+        if (ComputeTerminalSize(size)) {
+            m_resizeCoordinator.Request(size, Core::ResizeCoordinator::Clock::now());
+        }
+    }
 
-        if (newCols != m_terminalBuffer->GetCols() || newRows != m_terminalBuffer->GetRows()) {
-            OutputDebugStringA(("TerminalControl Resizing to R: " + std::to_string(newRows) + " C: " + std::to_string(newCols) + "\n").c_str());
-            m_terminalBuffer->Resize(newRows, newCols);
-            if (m_ptyProcess->IsRunning()) {
-                m_ptyProcess->Resize({ static_cast<SHORT>(newCols), static_cast<SHORT>(newRows) });
-            }
+    void TerminalControl::ApplyTerminalSize(Core::GridSize size) {
+        m_resizeCoordinator.Commit(size);
+        if (size.cols == m_cols && size.rows == m_rows) {
+            return;
+        }
+        OutputDebugStringA(("TerminalControl Resizing to R: " + std::to_string(size.rows) + " C: " + std::to_string(size.cols) + "\n").c_str());
+        m_rows = size.rows;
+        m_cols = size.cols;
+        // The worker marks the input stream first, so it can tell output for the old size from the PTY's repaint
+        m_terminalWorker->PostResize(size.rows, size.cols);
+        if (m_ptyProcess->IsRunning()) {
+            m_ptyProcess->Resize({ static_cast<SHORT>(size.cols), static_cast<SHORT>(size.rows) });
         }
     }
 
     void TerminalControl::OnSizeChanged(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::SizeChangedEventArgs const& args)
     {
+        // The swap chain follows at once and shows the current grid, the grid and PTY follow once the size settles
         if (m_renderer)
         {
             m_renderer->SetLogicalSize(args.NewSize());
         }
-        UpdateTerminalSize();
+        RequestTerminalSize();
     }
 
     void TerminalControl::OnCompositionScaleChanged(winrt::Microsoft::UI::Xaml::Controls::SwapChainPanel const& sender, winrt::Windows::Foundation::IInspectable const& args)
@@ -146,21 +180,52 @@ namespace winrt::win_retro_term::implementation
             m_charWidthApprox = m_renderer->GetFontCharWidth();
             m_charHeightApprox = m_renderer->GetFontCharHeight();
         }
-        UpdateTerminalSize();
+        RequestTerminalSize();
     }
 
     void TerminalControl::OnRendering(winrt::Windows::Foundation::IInspectable const& sender, winrt::Windows::Foundation::IInspectable const& args)
     {
-        if (m_renderer && m_renderer->IsInitialized())
+        if (m_renderer && m_renderer->IsInitialized() && m_terminalWorker)
         {
-            m_renderer->Render();
+            if (std::optional<Core::GridSize> size = m_resizeCoordinator.Poll(Core::ResizeCoordinator::Clock::now())) {
+                ApplyTerminalSize(*size);
+            }
+
+            const Core::ScreenSnapshot& snapshot = m_terminalWorker->AcquireSnapshot();
+            ApplyHostState(snapshot);
+            m_renderer->Render(snapshot);
             m_renderer->Present();
         }
     }
 
+    // Title and clipboard changes ride along with the snapshot, so they are applied at most once per frame
+    void TerminalControl::ApplyHostState(const Core::ScreenSnapshot& snapshot)
+    {
+        if (snapshot.titleGeneration != m_titleGeneration) {
+            m_titleGeneration = snapshot.titleGeneration;
+            m_title = winrt::to_hstring(snapshot.title);
+            m_titleChangedEvent(*this, nullptr);
+        }
+        if (snapshot.clipboardGeneration != m_clipboardGeneration) {
+            m_clipboardGeneration = snapshot.clipboardGeneration;
+            try {
+                winrt::Windows::ApplicationModel::DataTransfer::DataPackage package;
+                package.SetText(winrt::to_hstring(snapshot.clipboardText));
+                winrt::Windows::ApplicationModel::DataTransfer::Clipboard::SetContent(package);
+            }
+            catch (winrt::hresult_error const&) {
+                // Clipboard is busy in another process; the write is dropped like on other terminals
+                OutputDebugStringA("TerminalControl: Failed to set clipboard content.\n");
+            }
+        }
+    }
+
     void TerminalControl::SendInputToPty(const std::string& utf8Input) {
         if (m_ptyProcess && m_ptyProcess->IsRunning() && !utf8Input.empty()) {
             m_ptyProcess->WriteInput(utf8Input);
+            if (m_terminalWorker) {
+                m_terminalWorker->PostScrollToBottom(); // Typing brings the view back to the live screen
+            }
         }
     }
 
@@ -181,6 +246,19 @@ namespace winrt::win_retro_term::implementation
         args.Handled(true);
     }
 
+    void TerminalControl::RootGrid_OnPointerWheelChanged(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::Input::PointerRoutedEventArgs const& args) {
+        if (!m_terminalWorker) {
+            return;
+        }
+        // One notch (120) scrolls three lines, wheel up goes back in history
+        int delta = args.GetCurrentPoint(RootGrid()).Properties().MouseWheelDelta();
+        int lines = delta * WHEEL_LINES_PER_NOTCH / WHEEL_DELTA;
+        if (lines != 0) {
+            m_terminalWorker->PostScrollViewport(lines);
+        }
+        args.Handled(true);
+    }
+
     void TerminalControl::RootGrid_OnKeyDown(winrt::Windows::Foundation::IInspectable const& sender, Microsoft::UI::Xaml::Input::KeyRoutedEventArgs const& args)
     {
         if (!m_isFocused) {
@@ -197,8 +275,9 @@ namespace winrt::win_retro_term::implementation
         bool shiftDown = (winrt::Microsoft::UI::Input::InputKeyboardSource::GetKeyStateForCurrentThread(VirtualKey::Shift) &
             winrt::Windows::UI::Core::CoreVirtualKeyStates::Down) == winrt::Windows::UI::Core::CoreVirtualKeyStates::Down;
 
-        bool appCursorMode = m_terminalBuffer ? m_terminalBuffer->IsApplicationCursorKeysMode() : false;
-        bool appKeypadMode = m_terminalBuffer ? m_terminalBuffer->IsApplicationKeypadMode() : false;
+        // Modes as of the last rendered frame; the buffer itself belongs to the worker thread
+        bool appCursorMode = m_terminalWorker ? m_terminalWorker->CurrentSnapshot().applicationCursorKeysMode : false;
+        bool appKeypadMode = m_terminalWorker ? m_terminalWorker->CurrentSnapshot().applicationKeypadMode : false;
 
         if (ctrlDown) {
             winrt::Windows::System::VirtualKey key = args.Key();
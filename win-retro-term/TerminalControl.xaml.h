@@ -4,8 +4,9 @@
 
 #include "Renderer/D3D11Renderer.h"
 #include "Core/ConPtyProcess.h"
-#include "Core/TerminalBuffer.h"
-#include "Core/AnsiParser.h"
+#include "Core/ResizeCoordinator.h"
+#include "Core/TerminalWorker.h"
+#include "Core/Trace.h"
 
 #include <winrt/Microsoft.UI.Xaml.Media.h>
 #include <winrt/Microsoft.UI.Dispatching.h>
@@ -17,6 +18,10 @@ namespace winrt::win_retro_term::implementation
         TerminalControl();
         ~TerminalControl();
 
+        winrt::hstring Title() const { return m_title; }
+        winrt::event_token TitleChanged(winrt::Windows::Foundation::TypedEventHandler<win_retro_term::TerminalControl, winrt::Windows::Foundation::IInspectable> const& handler);
+        void TitleChanged(winrt::event_token const& token) noexcept;
+
         void OnLoaded(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::RoutedEventArgs const& args);
         void OnUnloaded(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::RoutedEventArgs const& args);
         void OnSizeChanged(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::SizeChangedEventArgs const& args);
@@ -26,28 +31,41 @@ namespace winrt::win_retro_term::implementation
         void RootGrid_OnGotFocus(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::RoutedEventArgs const& args);
         void RootGrid_OnLostFocus(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::RoutedEventArgs const& args);
         void RootGrid_OnPointerPressed(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::Input::PointerRoutedEventArgs const& args);
+        void RootGrid_OnPointerWheelChanged(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::Input::PointerRoutedEventArgs const& args);
 
         void RootGrid_OnKeyDown(winrt::Windows::Foundation::IInspectable const& sender, Microsoft::UI::Xaml::Input::KeyRoutedEventArgs const& e);
         void RootGrid_OnCharacterReceived(winrt::Windows::Foundation::IInspectable const& sender, winrt::Microsoft::UI::Xaml::Input::CharacterReceivedRoutedEventArgs const& args);
 
     private:
         void InitializePtyAndBuffer();
-        void PtyDataReceived(const char* buffer, size_t length);
-        void UpdateTerminalSize();
+        bool ComputeTerminalSize(Core::GridSize& size) const;
+        void RequestTerminalSize();
+        void ApplyTerminalSize(Core::GridSize size);
         void SendInputToPty(const std::string& utf8Input);
+        void ApplyHostState(const Core::ScreenSnapshot& snapshot);
 
         std::unique_ptr<D3D11Renderer> m_renderer;
         std::unique_ptr<ConPtyProcess> m_ptyProcess;
-        std::unique_ptr<Core::TerminalBuffer> m_terminalBuffer;
-        std::unique_ptr<Core::AnsiParser> m_ansiParser;
+        std::unique_ptr<Core::TerminalWorker> m_terminalWorker;
 
         winrt::event_token m_renderingEventToken{};
-        winrt::Microsoft::UI::Dispatching::DispatcherQueue m_dispatcherQueue{ nullptr };
+
+        // Size last requested from the worker and the PTY. Sizes from layout go through the
+        // coordinator, which holds them back while a window edge is being dragged.
+        int m_rows = 25;
+        int m_cols = 80;
+        Core::ResizeCoordinator m_resizeCoordinator{ { 25, 80 } };
 
         float m_charWidthApprox = 8.0f;
         float m_charHeightApprox = 16.0f;
 
         bool m_isFocused = false; // For cursor rendering later
+
+        // Last title and clipboard write taken from a snapshot
+        winrt::hstring m_title;
+        uint64_t m_titleGeneration = 0;
+        uint64_t m_clipboardGeneration = 0;
+        winrt::event<winrt::Windows::Foundation::TypedEventHandler<win_retro_term::TerminalControl, winrt::Windows::Foundation::IInspectable>> m_titleChangedEvent;
     };
 }
 